@@ -3,6 +3,8 @@
 # Any other node types should be derived from this class
 
 import time
+import json
+import hashlib
 import logging
 from exceptions import NodeStateError
 from message import MessageCommand
@@ -11,6 +13,9 @@ def now():
     return time.clock_gettime(time.CLOCK_MONOTONIC)
 
 class BaseNode:
+    # Retransmissions of the probe after a warm restart before the node is connected again
+    PROBE_RETRANSMISSIONS = 2
+
     def __init__(self, config, master, name):
         self._config = config
         self._master = master
@@ -29,12 +34,19 @@ class BaseNode:
                         "CHECK" : False,
                         "RT" : False,
                         "ROUTES" : False,
+                        "CHANNELS" : False,
                         "INITDONE" : False,
                         "REBUILD_SCH" : False}
 
         # Number of retransmisions
         self._rt_count = 0
 
+        # Set while the resume of the last session is pending
+        self._resuming = False
+
+        # Saved state of the last run after a warm restart, used if the probe of the node is ack'ed
+        self._probe_state = None
+
         # This is either None (no pendng message)
         # or a tuple (k, v, cb) which defines the change in the status field when the current message is ack'ed
         # cb is a callback that is called on ack
@@ -75,11 +87,27 @@ class BaseNode:
             return tmp
 
         if not self._status['CON']:
+            if self._probe_state is not None:
+                # Warm restart, check if the master is still connected to the node
+                self.log.info('probing node')
+                self._status_on_ack = ("CON", True, BaseNode.__on_probed)
+                return MessageCommand(self, "authping")
+
+            timeout = int(self._config['hop_timeout']) * self.route_length()
+
+            ticket = self._master.get_session(self)
+            if ticket is not None:
+                # Continue the session from the last run, a configured node keeps its configuration
+                self.log.info('resuming session')
+                self._resuming = True
+                self._status_on_ack = ("CON", True, BaseNode.__on_resumed)
+                return MessageCommand(self, "resume", ticket, timeout)
+
             self.log.info('connecting to node')
             # Not connected, need to connect first
             self._status_on_ack = ("CON", True, BaseNode.__on_connected)
             gw = self._gateway._node_id if self._gateway is not None else 0
-            return MessageCommand(self, "connect", gw, int(self._config['hop_timeout']) * self.route_length())
+            return MessageCommand(self, "connect", gw, timeout)
 
 
         if not self._status['ROUTES']:
@@ -87,6 +115,15 @@ class BaseNode:
             self._status_on_ack = ("ROUTES", True, None)
             return self.__make_route_msg()
 
+        if not self._status['CHANNELS']:
+            # Tell the node the channels of its next hops
+            hop_channels = self.__make_hop_channels()
+            if not hop_channels:
+                self._status['CHANNELS'] = True
+            else:
+                self._status_on_ack = ("CHANNELS", True, None)
+                return MessageCommand(self, "set_hop_channels", hop_channels)
+
         if self._status['CHECK'] or self._last_ack + self._check_interval < now():
             # Do a ping check
             self.log.debug('checking node still connected')
@@ -101,6 +138,19 @@ class BaseNode:
         return self._next_message()
 
 
+    def next_timer(self):
+        """
+        Time (now()) when next_message may have something new to send without any other event
+        (end of the reconnect delay or the next check), None if there is no timer.
+        """
+        if self._wait_until > now():
+            return self._wait_until
+
+        if self._status['CON']:
+            return self._last_ack + self._check_interval
+
+        return None
+
     def on_ack(self, code):
         if self._status_on_ack is None:
             raise NodeStateError("Got ACK but has no outstanding message!")
@@ -120,6 +170,19 @@ class BaseNode:
         self._last_ack = now()
 
     def on_timeout(self):
+        if self._probe_state is not None and self._rt_count >= self.PROBE_RETRANSMISSIONS:
+            self.__probe_failed()
+            return
+
+        if self._resuming:
+            # The node can't be resumed (e.g. it has been restarted), connect normally
+            self.log.info('session resumption failed')
+            self._resuming = False
+            self._master.drop_session(self)
+            self._status_on_ack = None
+            self._rt_count = 0
+            return
+
         if self._rt_count > self._max_rt:
             # node timeouted
             if not self._status['CON']:
@@ -139,6 +202,9 @@ class BaseNode:
         else:
             self._status['RT'] = True
 
+    def command_pending(self):
+        return self._status_on_ack is not None
+
     def is_available(self):
         if self._gateway is not None and not self._gateway.is_available():
             return False
@@ -149,13 +215,29 @@ class BaseNode:
         self._status['CHECK'] = True
         if check_path and self._gateway is not None:
             self._gateway.check_con()
+        self._master.wakeup()
 
     def node_id(self):
         return self._node_id
 
+    def channel(self):
+        """
+        The channel this node receives on or None if it uses the default frequency.
+        """
+        try:
+            return int(self._config.config['channel'])
+        except KeyError:
+            return None
+
     def name(self):
         return self._name
 
+    def gateway(self):
+        """
+        The next hop towards the master, None if the node is connected directly to the master
+        """
+        return self._gateway
+
     def route_length(self):
         if self._gateway is not None:
             return self._gateway.route_length() + 1
@@ -219,6 +301,26 @@ class BaseNode:
 
         return MessageCommand(self, "reset_routes", routestr)
 
+    def __route_hops(self):
+        """
+        All next hops this node uses, including the gateway
+        """
+        hops = []
+        if self._gateway is not None:
+            hops.append(self._gateway)
+
+        for _, hop in self._config['routes']:
+            if not hop.startswith('#'):
+                h = self._master.resolve_node(hop)
+                if h is not None and h not in hops:
+                    hops.append(h)
+        return hops
+
+    def __make_hop_channels(self):
+        channels = ["{}:{}".format(h.node_id(), h.channel())
+                    for h in self.__route_hops() if h.channel() is not None]
+        return ','.join(channels)
+
     def __on_connected(self, code):
         if self._status["INITDONE"] and code == 3:
             self.log.info('reconnected to still configured node')
@@ -227,18 +329,140 @@ class BaseNode:
             self.log.info('connected')
             self._status["REBUILD_SCH"] = False
             self._status["ROUTES"] = False
+            self._status["CHANNELS"] = False
             self._status["INITDONE"] = False
 
         self._on_connected(code)
 
+    def __on_resumed(self, code):
+        self._resuming = False
+
+        # Bit 0: routes set, bit 1: sensors active
+        if (code & 3) == 3:
+            # The status channel is either resumed as well or the node rebuilds it by itself
+            self.log.info('resumed session of still configured node')
+            self._status["ROUTES"] = True
+            self._status["CHANNELS"] = True
+            self._status["INITDONE"] = True
+            self._status["REBUILD_SCH"] = False
+            self._on_resumed()
+            self._on_connected(code)
+        else:
+            self.__on_connected(code)
+
+    def __on_probed(self, code):
+        state = self._probe_state
+        self._probe_state = None
+        self.log.info('node still connected after warm restart')
+
+        # Only what differs from the current configuration is sent again
+        self._status["ROUTES"] = state['routes'] == self.__make_route_msg().cmd
+        self._status["CHANNELS"] = state['hop_channels'] == self.__make_hop_channels()
+        self._status["INITDONE"] = state['initdone']
+        # The status updates during the restart are lost, let the node send its status again
+        self._status["REBUILD_SCH"] = state['initdone']
+        self._restore_state(state)
+        self._on_connected(code)
+
+    def __probe_failed(self):
+        # e.g. the master has been reset in the meantime, connect as usual
+        self.log.info('probe failed, connecting')
+        self._probe_state = None
+        self._status_on_ack = None
+        self._status['RT'] = False
+        self._rt_count = 0
+
+    def attach(self, state):
+        """
+        Warm restart, state is the saved view of the node from the last run or None.
+        The state is used if the node answers a probe.
+        """
+        if state is None or state['id'] != self._node_id or state['type'] != type(self).__name__:
+            return
+        self._probe_state = state
+
+    def save_state(self):
+        """
+        View of the node for a warm restart, None if it is not connected
+        """
+        if not self._status['CON']:
+            # Keep the view while it is probed, e.g. if the controller is restarted again right away
+            return self._probe_state
+
+        state = {'id': self._node_id,
+                 'type': type(self).__name__,
+                 'routes': self.__make_route_msg().cmd if self._status['ROUTES'] else None,
+                 'hop_channels': self.__make_hop_channels() if self._status['CHANNELS'] else None,
+                 'initdone': self._status['INITDONE'],
+                 'last_status': self.last_status()}
+        state.update(self._save_state())
+        return state
+
+    def check_config(self, config):
+        """
+        Raises an exception if the configuration is invalid or can't be applied by reload_config
+        """
+        int(config['max_retransmissions'])
+        int(config['check_interval'])
+
+        if config['type'] != self._config['type'] or int(config['id']) != self._node_id:
+            raise ValueError("Type or id of node {} changed, restart required".format(self._name))
+        if config['gateway'] != self._config['gateway']:
+            raise ValueError("Gateway of node {} changed, restart required".format(self._name))
+
+    def network_config(self):
+        """
+        Routes and hop channels of the current configuration, compared by config_changed
+        """
+        return (self.__make_route_msg().cmd, self.__make_hop_channels())
+
+    def reload_config(self, config):
+        """
+        Replaces the configuration, check_config must have accepted it.
+        config_changed must be called once all nodes have their new configuration.
+        """
+        self._config = config
+        self._max_rt = int(config['max_retransmissions'])
+        self._check_interval = int(config['check_interval'])
+        self._reload_config()
+
+    def config_changed(self, network_config):
+        """
+        Only the changed parts are sent to the node again, network_config is from before the reload
+        """
+        routes, hop_channels = self.network_config()
+        if routes != network_config[0]:
+            self.log.info('routes changed')
+            self._status['ROUTES'] = False
+        if hop_channels != network_config[1]:
+            self.log.info('hop channels changed')
+            self._status['CHANNELS'] = False
+        self._master.wakeup()
+
+    def last_status(self):
+        return self._status.get('LAST_STATUS')
+
+    def config_hash(self):
+        """
+        Hash over the configuration of this node, a session is only resumed with the same configuration
+        """
+        config = json.dumps(self._config.config, sort_keys=True, default=str)
+        return hashlib.sha1(config.encode('utf-8')).hexdigest()
+
     def can_inject_command(self):
         return self._status['CON'] and self._status_on_ack is None
 
     def inject_command(self, cmd, args):
         if self.can_inject_command():
             self._injected_command = MessageCommand(self, cmd, args)
+            self._master.wakeup()
 
     def command_aborted(self):
+        if self._probe_state is not None:
+            # The master is not connected to the node
+            self.__probe_failed()
+            return
+
         if self._status_on_ack != (None, None, None):
             self.log.error("Aborting non-void command, status: '{}'".format(self._status_on_ack))
             raise NodeStateError("PANIC! Non void commands should never be aborted!")
@@ -254,11 +478,35 @@ class BaseNode:
     def _on_connected(self, code):
         pass
 
+    def _on_resumed(self):
+        pass
+
     def _next_message(self):
         return None
 
     def _on_connection_failed(self):
         pass
 
+    def _reload_config(self):
+        pass
+
+    def _save_state(self):
+        return {}
+
+    def _restore_state(self, state):
+        pass
+
+    def status_sources(self):
+        """
+        Names of the other nodes whose status changes this node needs (see on_node_status_changed)
+        """
+        return []
+
     def on_node_status_changed(self, node, status):
         pass
+
+    def on_node_status_restored(self, node, status):
+        """
+        Status of the node from the last run after a warm restart, nothing is sent to the uplink
+        """
+        pass
@@ -35,6 +35,7 @@ class DebugInterface:
             'check': self.check,
             'dumpstate': self.dumpstate,
             'restart': self.restart,
+            'reload': self.reload,
             'storage_ctl': self.storagectl,
             'retry': self.reset_timeouts
         }
@@ -173,6 +174,9 @@ Restart the master now unless you are ABSOLUTELY SURE that the current state mat
         self.send_text("MASTER RESTART")
         self.master.request_restart()
 
+    def reload(self, line, reader, writer):
+        writer.write(self.master.reload_config().encode())
+
     def storagectl(self, line, reader, writer):
         parts = shlex.split(line)
         command = ' '.join(line.split()[1:])
@@ -2,6 +2,8 @@
 import asyncio
 import time
 import os
+import signal
+import sys
 import logging
 from pathlib import Path
 
@@ -11,11 +13,12 @@ from waschnode import WaschNode
 from manhattannode import ManhattanNode
 from uplink import WaschUplink
 from debuginterface import DebugInterface
+import metrics
 
 from configuration import Configuration
 
 
-async def statuswriter(master):
+async def statuswriter(master, uplink):
     while True:
         await asyncio.sleep(1)
 
@@ -25,6 +28,7 @@ async def statuswriter(master):
         state = "*************************************************\n"
         state += "Update time: {}\n".format(time.asctime())
         state += master.debug_state()
+        state += uplink.debug_state()
 
         with open("/tmp/wasch.state", 'w+') as statefile:
             statefile.write(state)
@@ -51,6 +55,18 @@ def load_nodes(config, master, uplink):
             raise KeyError("Unknown node type", t)
 
 
+def config_loader(configprefix):
+    """
+    Returns a function that reads the configuration again, for the reload of the master
+    """
+    def load():
+        config = Configuration(configfile='config.conf', pathprefix=configprefix)
+        nc = config.subconfig('network')
+        node_configs = {n: nc.subconfig(n) for n in config['network'] if n != 'MASTER'}
+        return nc.subconfig('MASTER'), node_configs
+    return load
+
+
 def main(configprefix):
     logformat = '%(asctime)s | %(name)s | %(levelname)5s | %(message)s'
     logging.basicConfig(format=logformat, filename='/var/log/wasch/activity.log', level=logging.DEBUG)
@@ -70,9 +86,26 @@ def main(configprefix):
 
     load_nodes(config, master, uplink)
 
+    # Reload the configuration on SIGHUP (systemctl reload)
+    master.config_loader = config_loader(configprefix)
+    loop.add_signal_handler(signal.SIGHUP, master.reload_config)
+
     di = DebugInterface(master)
 
-    state_task = asyncio.ensure_future(statuswriter(master))
+    metrics.register_uplink(uplink)
+    try:
+        metrics_port = int(config['metrics_port'])
+    except KeyError:
+        metrics_port = None
+
+    if metrics_port is not None:
+        try:
+            metrics_address = config['metrics_address']
+        except KeyError:
+            metrics_address = '127.0.0.1'
+        loop.run_until_complete(metrics.start_server(metrics_address, metrics_port))
+
+    state_task = asyncio.ensure_future(statuswriter(master, uplink))
 
     #pluginpath = Path(__file__).resolve().parent / "plugins"
 
@@ -84,4 +117,5 @@ def main(configprefix):
     loop.run_until_complete(master.run())
 
 if __name__ == "__main__":
-    main("conf")
+    # Another config directory can be given, e.g. one written by "test.py genconf"
+    main(sys.argv[1] if len(sys.argv) > 1 else "conf")
@@ -19,6 +19,11 @@ class ManhattanNode(BaseNode):
         # Insert the state entries for this typeof node
         self._uplink = uplink
 
+        self.check_config(config)
+
+    def check_config(self, config):
+        super().check_config(config)
+
         configtest = [
             config['color_opened'],
             config['color_closed'],
@@ -27,6 +32,10 @@ class ManhattanNode(BaseNode):
             config['uplink_key'],
             ]
 
+    def _reload_config(self):
+        # The LED colors are set again with the restored status
+        self._expected_led_state = [0, 0]
+
     def _initialize(self):
         self._status["CH_INIT"] = 0
         self._status["CSSI"] = False
@@ -41,12 +50,19 @@ class ManhattanNode(BaseNode):
             # This node does not care about other nodes at all
             return
 
+        url = '{}?key={}&status={}'.format(self._config['uplink'], self._config['uplink_key'], status)
+        self._uplink.raw_request(url, key=self.name())
+
+        self.__update_expected_state(status)
+
+    def on_node_status_restored(self, node, status):
+        if node is self:
+            self.__update_expected_state(status)
+
+    def __update_expected_state(self, status):
         # Not actually needed, I just do this so it shows up in the state dump
         self._status["LAST_STATUS"] = status
 
-        url = '{}?key={}&status={}'.format(self._config['uplink'], self._config['uplink_key'], status)
-        self._uplink.raw_request(url)
-
         r = self._config['color_closed']
         g = self._config['color_opened']
 
@@ -64,6 +80,22 @@ class ManhattanNode(BaseNode):
             self._status["CSSI"] = False
             self._status["LED_STATE"] = None
 
+    def _on_resumed(self):
+        # The node still has the configuration from the last run
+        self._status["CH_INIT"] = manhattan_sensor_channels
+        self._status["CSSI"] = True
+
+    def _save_state(self):
+        return {'ch_init': self._status["CH_INIT"],
+                'cssi': self.__make_cssi_message().cmd if self._status["CSSI"] else None,
+                'led_state': self._status["LED_STATE"]}
+
+    def _restore_state(self, state):
+        self._status["CH_INIT"] = state['ch_init']
+        # The indicator colors may have been changed
+        self._status["CSSI"] = state['cssi'] == self.__make_cssi_message().cmd
+        self._status["LED_STATE"] = state['led_state']
+
     def _next_message(self):
         if self._status["CH_INIT"] < manhattan_sensor_channels:
             # init a channel
@@ -4,6 +4,8 @@ nodes - not knowing anything about sensors!
 """
 
 import time
+import os
+import json
 import asyncio
 import serial
 import serial_asyncio
@@ -12,6 +14,31 @@ import logging
 
 from exceptions import MasterCommandError
 from message import MessageCommand, MessageResponse
+import serialframe
+import metrics
+import tracing
+import timeseries
+
+# Longest command line the master accepts (CLI_CMD_BUFFER_LENGTH minus the newline and a tag)
+MAX_COMMAND_LENGTH = 190
+
+
+def split_command(command, items):
+    """
+    Splits a command with a comma separated list into commands that fit into the command buffer of the master,
+    only for commands that add the items to what is already set
+    """
+    commands = []
+    current = []
+    for item in items:
+        if current and len(command) + 1 + len(','.join(current + [item])) > MAX_COMMAND_LENGTH:
+            commands.append(command + ' ' + ','.join(current))
+            current = []
+        current.append(item)
+    if current:
+        commands.append(command + ' ' + ','.join(current))
+    return commands
+
 
 class Master:
     """
@@ -22,6 +49,9 @@ class Master:
         self.loop = loop
         self.nodes = {}
         self.id_to_node = {}
+
+        # Maps the name of a node to the nodes that need its status (itself and the nodes displaying it)
+        self.status_subscribers = {}
         self.config = config
         self.uplink = uplink
         self.injected_command = None
@@ -29,6 +59,11 @@ class Master:
         self.restart_requested = False
         self.debug_interface = None
 
+        # Returns the master and the node configurations for reload_config
+        self.config_loader = None
+        # Commands for the master itself, e.g. changed routes after a reload
+        self.master_commands = []
+
         self.alive = False
         self.last_cmd = None
         self.initialized = False
@@ -36,17 +71,114 @@ class Master:
         self.new_con_evt = None
         self.last_node_commands = {}
 
-        # Set when received a PEND signal
-        # Cleared when received ACK or TIMEOUT signal
-        self.message_pending = False
+        # Nodes with a command in flight, maps the node name to the tag of the last command sent to it.
+        # Every node has at most one command in flight, the commands of different nodes run in parallel.
+        # An entry is removed with the ACK or TIMEOUT of the node, with an ERR for its tag
+        # or with the prompt if the command did not send a message to the node (no PEND).
+        self.inflight = {}
+
+        # Time (time.monotonic) when the in flight command of a node is given up if neither ACK nor TIMEOUT arrived,
+        # e.g. because the notification has been lost. The command is then handled like a TIMEOUT.
+        self.inflight_deadlines = {}
+
+        # Tags of the in flight commands that have been confirmed by a PEND
+        self.pending_tags = set()
+
+        self.next_tag = 1
+
+        # Command and send time of the last command of each node, for the round-trip time.
+        # A retransmission belongs to the command it repeats.
+        self.command_started = {}
+
+        # Index of the node that is asked for a message first, the nodes are served round robin
+        self.next_node = 0
+
+        # Set by everything that can create work for the main loop
+        self.wakeup_event = asyncio.Event()
+
+        self.startup_time = 0
+        self.last_alive_signal = 0
+        self.last_wdt_feed = 0
 
         # Set to the name of the node when a command is sent
         # Cleared to None when the command prompt is read and the master node is ready for the next command
         self.wait_for_prompt = None
 
+        # Tag of the command the prompt is waited for, None for commands of the master itself
+        self.prompt_tag = None
+
+        self.__read_limits()
+
         self._reader, self._writer = (None, None)
         self.log = logging.getLogger('master')
 
+        # The binary protocol is switched on after every reboot of the master if configured
+        try:
+            self.binary_protocol = config['serial_protocol'] == 'binary'
+        except KeyError:
+            self.binary_protocol = False
+        self.framed = False
+
+        # Session tickets of the nodes, these are kept across restarts to resume the connections
+        try:
+            self.session_file = config['session_file']
+        except KeyError:
+            self.session_file = None
+        self.sessions = self.__load_sessions()
+
+        # View of the nodes for a warm restart: the controller re-attaches to the running master
+        # and only probes the nodes instead of rebooting the master and reinitializing all nodes
+        try:
+            self.state_file = config['state_file']
+        except KeyError:
+            self.state_file = None
+
+        # A saved state older than this is not used, the master has most likely been reset by its watchdog
+        try:
+            self.warm_restart_max_age = int(config['warm_restart_max_age'])
+        except KeyError:
+            self.warm_restart_max_age = 300
+
+        self.state_dirty = False
+        self.last_state_save = 0
+
+        self.tracer = tracing.LatencyTracker()
+
+        # Local store of the status changes, raw data and round-trip times, disabled without a directory
+        self.timeseries = None
+        try:
+            timeseries_dir = config['timeseries_dir']
+        except KeyError:
+            timeseries_dir = None
+
+        if timeseries_dir is not None:
+            try:
+                retention = float(config['timeseries_retention']) * 86400
+            except KeyError:
+                retention = None
+            self.timeseries = timeseries.Collector(timeseries.TimeSeriesStore(timeseries_dir, retention=retention))
+
+        metrics.NODE_AVAILABLE.set_function(self.node_availability)
+        metrics.COMMANDS_IN_FLIGHT.set_function(lambda: len(self.inflight))
+
+    def __read_limits(self):
+        # Limits for the commands in flight, in total and through a single relay node
+        try:
+            self.max_inflight = int(self.config['max_inflight'])
+        except KeyError:
+            self.max_inflight = 16
+
+        try:
+            self.max_inflight_per_relay = int(self.config['max_inflight_per_relay'])
+        except KeyError:
+            self.max_inflight_per_relay = 4
+
+        # Time in seconds after which a command in flight is considered lost
+        try:
+            self.inflight_timeout = float(self.config['inflight_timeout'])
+        except KeyError:
+            self.inflight_timeout = 120
+
     def add_node(self, node):
         self.nodes[node.name()] = node
         self.id_to_node[node.node_id()] = node
@@ -59,99 +191,59 @@ class Master:
         Main run method, should be started as the main task from outside
         """
 
-        last_alive_signal = 0
-        last_wdt_feed = 0
+        self.last_alive_signal = 0
+        self.last_wdt_feed = 0
 
         if self.debug_interface is not None:
             await self.debug_interface.start()
 
+        self.update_status_index()
+        self.save_node_names()
+
+        # Only the first start can be a warm restart, later restarts reboot the master
+        warm_state = self.__load_state()
+
         while True:
             for n in self.nodes.values():
                 n.initialize()
             self.injected_command = None
+            self.master_commands = []
             self.raw_mode = False
-            self.message_pending = False
-            self.wait_for_prompt = None
+            self.clear_inflight()
+            self.framed = False
+
+            if warm_state is not None:
+                self.restore_state(warm_state)
+            self.state_dirty = True
 
             self.initialized = True
 
-            await self.connect()
+            await self.connect(reset=warm_state is None)
 
 
             try:
-                # reboot the master node to kill any old connections, if this script is restarted
-                await self.send("reboot")
-                await asyncio.sleep(2)
+                if warm_state is not None:
+                    warm_state = None
+                    await self.attach()
+                else:
+                    # reboot the master node to kill any old connections, if this script is restarted
+                    await self.send_reboot()
+                    await asyncio.sleep(2)
+                    if self.binary_protocol:
+                        await self.send("binary")
+                        self.framed = True
                 await self.init_routes()
                 await asyncio.sleep(1)
 
-                self.message_pending = False
-                self.wait_for_prompt = None
-
-                startup_time = time.monotonic()
-
-                while True:
-                    # Receive serial packet
-                    try:
-                        line = await asyncio.wait_for(self._reader.readline(), 1)
-                        if not line:
-                            print("Received empty data!")
-                            break
-
-                        print("RECV '{}'".format(line.decode("ascii").strip()))
-                        self.log.debug("RECV '{}'".format(line.decode("ascii").strip()))
-                        if self.debug_interface is not None:
-                            self.debug_interface.send_text(line.decode("ascii"), True)
+                self.clear_inflight()
 
-                        self.parse_packet(line)
-                    except asyncio.TimeoutError:
-                        pass
+                self.startup_time = time.monotonic()
 
-                    if self.restart_requested:
-                        self.restart_requested = False
-                        # just break, the outer loop will do the restart
-                        break
-
-                    if self.injected_command is not None:
-                        await self.send(self.injected_command)
-                        self.injected_command = None
-
-                    now = time.monotonic()
-
-                    if now < startup_time + 1:
-                        # Wait for 1 sec at start to discard any messsaages from the initialization
-                        # before beginning to send messages to the nodes
-                        continue
-
-                    if last_wdt_feed + self.config['gateway_watchdog_interval'] < now:
-                        self.log.debug("Feeding gateway watchdog")
-                        await self.send("wdt_feed")
-                        last_wdt_feed = now
-
-                    if not self.raw_mode and (self.wait_for_prompt is not None or self.message_pending):
-                        # Waiting for the last message to be processed or for the timeout / ack for the last command
-                        continue
-
-                    #print(self.debug_state())
-                    self.alive = False
-                    for node in self.nodes.values():
-                        if node.is_available():
-                            self.alive = True
-
-                        if not self.raw_mode:
-                            next = node.next_message()
-                            if next is not None:
-                                self.last_node_commands[node.name()] = next.to_command()
-                                await self.send(next)
-                                break
-
-                    if last_alive_signal + self.config['alive_signal_interval'] < now:
-                        if self.alive:
-                            self.uplink.send_alive_signal()
-                            last_alive_signal = now
-
-
-                    await asyncio.sleep(0.001)
+                reader = asyncio.ensure_future(self.read_loop())
+                try:
+                    await self.process_events(reader)
+                finally:
+                    reader.cancel()
 
             except ConnectionResetError:
                 print("Connection reset")
@@ -169,6 +261,118 @@ class Master:
                 self.loop.stop()
                 raise
 
+    async def process_events(self, reader):
+        """
+        Does the work whenever something happened: a received line / frame, a due timer
+        or a change from the debug interface. Returns when the master needs to be restarted.
+        """
+        self.wakeup()
+        while True:
+            timeout = self.next_timer() - time.monotonic()
+            try:
+                await asyncio.wait_for(self.wakeup_event.wait(), max(timeout, 0))
+            except asyncio.TimeoutError:
+                pass
+            self.wakeup_event.clear()
+
+            if reader.done():
+                # Raises the exception of the reader, if any
+                reader.result()
+                print("Received empty data!")
+                return
+
+            if self.restart_requested:
+                self.restart_requested = False
+                # just return, the outer loop will do the restart
+                return
+
+            if self.state_dirty and self.last_state_save + 1 <= time.monotonic():
+                # At most once per second
+                self.__save_state()
+
+            if not self.raw_mode and self.wait_for_prompt is not None:
+                # The master processes one command at a time, wait until the last one is done.
+                # The ACKs are not waited for, other nodes can get their commands in the meantime.
+                continue
+
+            if self.injected_command is not None:
+                await self.send(self.injected_command)
+                self.injected_command = None
+                continue
+
+            if self.master_commands and not self.raw_mode:
+                await self.send(self.master_commands.pop(0))
+                continue
+
+            now = time.monotonic()
+
+            if now < self.startup_time + 1:
+                # Wait for 1 sec at start to discard any messsaages from the initialization
+                # before beginning to send messages to the nodes
+                continue
+
+            if self.last_wdt_feed + self.config['gateway_watchdog_interval'] < now:
+                self.log.debug("Feeding gateway watchdog")
+                await self.send("wdt_feed")
+                self.last_wdt_feed = now
+                continue
+
+            self.expire_inflight(now)
+
+            #print(self.debug_state())
+            self.alive = any(node.is_available() for node in self.nodes.values())
+
+            if not self.raw_mode:
+                await self.send_next_node_message()
+
+            if self.alive and self.last_alive_signal + self.config['alive_signal_interval'] < now:
+                self.uplink.send_alive_signal()
+                self.last_alive_signal = now
+
+    def next_timer(self):
+        """
+        Time (time.monotonic) of the next timer of the master or of a node.
+        Timers that are already due are waiting for something else (e.g. the prompt or an ACK),
+        the event for this wakes up the loop.
+        """
+        now = time.monotonic()
+        timers = [self.startup_time + 1,
+                  self.last_wdt_feed + self.config['gateway_watchdog_interval']]
+
+        if self.alive:
+            timers.append(self.last_alive_signal + self.config['alive_signal_interval'])
+
+        if self.state_dirty:
+            timers.append(self.last_state_save + 1)
+
+        timers.extend(self.inflight_deadlines.values())
+
+        for node in self.nodes.values():
+            timers.append(node.next_timer())
+
+        timers = [t for t in timers if t is not None and t > now]
+        if not timers:
+            # Nothing planned, wait for the next event
+            return now + 3600
+        return min(timers)
+
+    def wakeup(self):
+        """
+        Something changed, let the main loop check for work
+        """
+        self.wakeup_event.set()
+
+    async def read_loop(self):
+        """
+        Processes the received lines / frames and wakes the main loop after each one.
+        Returns when the connection has been closed.
+        """
+        try:
+            while await self.receive():
+                self.wakeup()
+        finally:
+            self.wakeup()
+
     async def handle_tcp_con(self, rd, wr):
         if self.new_con_evt.is_set():
             # Don't want to accept a new connection
@@ -181,10 +385,13 @@ class Master:
         self._writer = wr
         self.new_con_evt.set()
 
-    async def connect(self):
+    async def connect(self, reset=True):
         """
-        connect to the serial device or wait for a socket connection
+        connect to the serial device or wait for a socket connection,
+        with reset=False the MCU behind a socket connection is not reset
         """
+        metrics.MASTER_CONNECTS.inc()
+        self.tracer.reset_clock()
 
         if self._writer:
             self._writer.close()
@@ -212,9 +419,10 @@ class Master:
             self.log.info("Got connection from {}".format(self._writer.get_extra_info('peername')))
 
             # reset the MCU and start forwarding
-            self._writer.write(b'reset\n')
-            await self._writer.drain()
-            await asyncio.sleep(1)
+            if reset:
+                self._writer.write(b'reset\n')
+                await self._writer.drain()
+                await asyncio.sleep(1)
             self._writer.write(b'forward\n')
             await self._writer.drain()
 
@@ -228,11 +436,17 @@ class Master:
         """
 
 
+        tag = None
         if isinstance(msg, MessageCommand):
             self.wait_for_prompt = msg.node
+            tag = msg.tag
+            cmd = msg.cmd
             msg = msg.to_command()
         else:
             self.wait_for_prompt = "MASTER"
+            cmd = msg
+
+        self.prompt_tag = tag
 
         if msg[-1] != "\n":
             msg += "\n"
@@ -244,67 +458,469 @@ class Master:
             self.debug_interface.send_text("  -->" + msg, True)
 
         self.last_cmd = msg[:-1]
-        self._writer.write(msg.encode('ascii'))
+        if self.timeseries is not None:
+            self.timeseries.command_sent(cmd)
+
+        if self.framed:
+            data = serialframe.encode_command(cmd, tag)
+        else:
+            data = msg.encode('ascii')
+
+        metrics.SERIAL_TX_COMMANDS.inc()
+        metrics.SERIAL_TX_BYTES.inc(len(data))
+        self._writer.write(data)
         await self._writer.drain()
 
+    async def send_next_node_message(self):
+        """
+        Sends the next command of a node that has no command in flight.
+        The nodes are served round robin, so every node gets its turn while the others wait for their ACKs.
+        """
+        if len(self.inflight) >= self.max_inflight:
+            return
+
+        load = self.relay_load()
+        names = list(self.nodes)
+        for i in range(len(names)):
+            index = (self.next_node + i) % len(names)
+            node = self.nodes[names[index]]
+
+            if node.name() in self.inflight or not self.relays_free(node, load):
+                continue
+
+            msg = node.next_message()
+            if msg is None:
+                continue
+
+            self.next_node = index + 1
+
+            msg.set_tag(self.allocate_tag())
+            self.inflight[node.name()] = msg.tag
+            self.inflight_deadlines[node.name()] = time.monotonic() + self.inflight_timeout
+            self.last_node_commands[node.name()] = msg.cmd
+            self.command_sent(node, msg)
+            await self.send(msg)
+            return
+
+    def command_sent(self, node, msg):
+        command = msg.cmd.split()[0]
+        if command == 'retransmit':
+            metrics.RETRANSMISSIONS.inc(node=node.name())
+            if node.name() in self.command_started:
+                return
+        elif command in ('connect', 'resume'):
+            metrics.NODE_CONNECTS.inc(node=node.name(), command=command)
+
+        self.command_started[node.name()] = (command, time.monotonic())
+
+    def node_availability(self):
+        if not self.initialized:
+            return {}
+        return {(name,): int(node.is_available()) for name, node in self.nodes.items()}
+
+    def allocate_tag(self):
+        tag = self.next_tag
+        self.next_tag = tag % 0xFFFF + 1
+        return tag
+
+    def relay_load(self):
+        """
+        Number of in flight commands that are forwarded by each relay node
+        """
+        load = {}
+        for name in self.inflight:
+            relay = self.nodes[name].gateway()
+            while relay is not None:
+                load[relay.name()] = load.get(relay.name(), 0) + 1
+                relay = relay.gateway()
+        return load
+
+    def relays_free(self, node, load):
+        """
+        Checks if all relays on the route to the node can take another command
+        """
+        relay = node.gateway()
+        while relay is not None:
+            if load.get(relay.name(), 0) >= self.max_inflight_per_relay:
+                return False
+            relay = relay.gateway()
+        return True
+
+    def node_for_tag(self, tag):
+        for name, inflight_tag in self.inflight.items():
+            if inflight_tag == tag:
+                return name
+        return None
+
+    def command_done(self, name):
+        """
+        The in flight command of the node is done
+        """
+        tag = self.inflight.pop(name, None)
+        self.inflight_deadlines.pop(name, None)
+        self.pending_tags.discard(tag)
+
+    def expire_inflight(self, now):
+        """
+        Gives up the commands in flight whose ACK or TIMEOUT did not arrive in time
+        """
+        for name, deadline in list(self.inflight_deadlines.items()):
+            if deadline > now:
+                continue
+
+            self.log.warning("No ACK or TIMEOUT for command {} of node {}, giving up".format(
+                self.inflight.get(name), name))
+            metrics.INFLIGHT_EXPIRED.inc(node=name)
+
+            node = self.nodes[name]
+            if node.command_pending():
+                self.command_timeout(node)
+            else:
+                self.command_done(name)
+
+    def command_timeout(self, node):
+        """
+        The in flight command of the node timed out
+        """
+        if node.name() in self.last_node_commands:
+            self.uplink.on_serial_status(node.name(), "TIMEOUT - " + self.last_node_commands[node.name()])
+        self.command_done(node.name())
+        command, started = self.command_started.get(node.name(), ("unknown", None))
+        metrics.TIMEOUTS.inc(node=node.name(), command=command)
+        if self.timeseries is not None and started is not None:
+            self.timeseries.timeout(node.node_id(), time.monotonic() - started)
+        node.on_timeout()
+
+    def clear_inflight(self):
+        self.inflight = {}
+        self.inflight_deadlines = {}
+        self.pending_tags = set()
+        self.wait_for_prompt = None
+        self.prompt_tag = None
+
+    def on_prompt(self):
+        """
+        The master is ready for the next command
+        """
+        tag = self.prompt_tag
+        name = self.node_for_tag(tag) if tag is not None else None
+        if name is not None and tag not in self.pending_tags:
+            # The command did not send a message to the node, so there is nothing to wait for
+            self.command_done(name)
+
+        self.wait_for_prompt = None
+        self.prompt_tag = None
+
+    async def send_reboot(self):
+        """
+        Reboots the master, with the binary protocol the master may still be in binary mode.
+        The reboot frame is terminated by a newline, so it is a single invalid command for the text protocol.
+        """
+        if self.binary_protocol:
+            self._writer.write(serialframe.encode_command("reboot") + b"\n")
+        await self.send("reboot")
+
+    async def attach(self):
+        """
+        Re-attaches to the running master for a warm restart, it keeps its connections to the nodes.
+        A partial command of the last run is terminated first.
+        """
+        self.log.info("Warm restart, re-attaching to the running master")
+        if self.binary_protocol:
+            # The master is in binary mode unless it has been reset in the meantime:
+            # In binary mode the frame switches (again) to binary and the text line is an invalid frame.
+            # In text mode the frame is an invalid command and the text line switches to binary.
+            self._writer.write(b"\0" + serialframe.encode_command("binary") + b"\nbinary\n\0")
+            self.framed = True
+        else:
+            self._writer.write(b"\n")
+        await self._writer.drain()
+        await asyncio.sleep(0.5)
+
+    async def receive(self):
+        """
+        Receive and process one line or frame, returns False if the connection has been closed
+        """
+        if not self.framed:
+            line = await self._reader.readline()
+            if not line:
+                return False
+
+            metrics.SERIAL_RX_MESSAGES.inc()
+            metrics.SERIAL_RX_BYTES.inc(len(line))
+
+            text = line.decode("ascii", "replace")
+            self.log_received(text)
+            if self.timeseries is not None:
+                self.timeseries.line(text)
+            self.parse_packet(text)
+            return True
+
+        try:
+            data = await self._reader.readuntil(serialframe.DELIMITER)
+        except asyncio.IncompleteReadError:
+            return False
+
+        metrics.SERIAL_RX_BYTES.inc(len(data))
+        if len(data) <= 1:
+            return True
+        metrics.SERIAL_RX_MESSAGES.inc()
+
+        try:
+            ftype, payload = serialframe.decode_frame(data[:-1])
+        except serialframe.FrameError as error:
+            # e.g. text output from before the switch to the binary protocol
+            self.log.debug("Dropped serial frame: {}".format(error))
+            return True
+
+        self.log_received(serialframe.describe(ftype, payload))
+        self.parse_frame(ftype, payload)
+        return True
+
+    def log_received(self, text):
+        print("RECV '{}'".format(text.strip()))
+        self.log.debug("RECV '{}'".format(text.strip()))
+        if self.debug_interface is not None:
+            self.debug_interface.send_text(text.rstrip("\n") + "\n", True)
+
+    def parse_frame(self, ftype, payload):
+        """
+        Process a frame of the binary protocol
+        """
+        if ftype == serialframe.PROMPT:
+            self.on_prompt()
+            return
+
+        if self.timeseries is not None:
+            if ftype == serialframe.LOG:
+                self.timeseries.line(serialframe.describe(ftype, payload))
+            elif ftype == serialframe.RAW and payload:
+                self.timeseries.raw_frame(payload[0], serialframe.raw_values(payload))
+
+        try:
+            msg = serialframe.to_response(ftype, payload)
+        except serialframe.FrameError as error:
+            self.log.error("Got invalid frame: {}".format(error))
+            return
+
+        if msg is not None:
+            self.handle_response(msg)
+
     def parse_packet(self, packet):
         """
         Prepare the message line for the message parser, removing any possible
         offsets and unnecessary whitespaces
         """
 
-        packet = packet.decode('ascii').strip()
+        packet = packet.strip()
 
         if packet.find("MASTER>") >= 0:
-            self.wait_for_prompt = None
+            self.on_prompt()
             return
 
         cmdoffset = packet.find("###")
         if cmdoffset >= 0:
-            packet = packet[cmdoffset:]
-            msg = MessageResponse(packet)
+            self.handle_response(MessageResponse(packet[cmdoffset:]))
 
-            if msg.is_error and not self.raw_mode:
-                if self.wait_for_prompt is None:
-                    self.log.error("Got error response '{}'".format(packet))
-                    raise MasterCommandError("PANIC! We got an out-of-order ERR response")
-                nd = self.resolve_node(self.wait_for_prompt)
-                if nd is not None:
-                    nd.command_aborted()
+        #else:
+        #    await self.pluginmanager.call("on_nocommand", packet=packet)
+
+    def handle_response(self, msg):
+        """
+        Process a notification of the master
+        """
+        packet = msg.raw
+
+        if msg.is_error and not self.raw_mode:
+            if self.wait_for_prompt is None:
+                self.log.error("Got error response '{}'".format(packet))
+                raise MasterCommandError("PANIC! We got an out-of-order ERR response")
 
+            name = self.wait_for_prompt
+            if msg.tag is not None:
+                name = self.node_for_tag(msg.tag)
+                if name is None:
+                    self.log.warning("Got error response for unknown tag {}".format(msg.tag))
+                    return
+
+            nd = self.resolve_node(name)
+            if nd is not None:
+                self.command_done(nd.name())
+                nd.command_aborted()
+
+            return
+
+        if msg.node in self.id_to_node:
+            node = self.id_to_node[msg.node]
+
+            if msg.msgtype in ('ack', 'timeout', 'status'):
+                self.state_dirty = True
+
+            if msg.msgtype in ('ack', 'timeout') and not self.raw_mode and not node.command_pending():
+                # e.g. a command of the last run before a warm restart
+                self.log.warning("Ignoring '{}', node {} has no command pending".format(packet, node.name()))
                 return
 
-            if msg.node in self.id_to_node:
-                node = self.id_to_node[msg.node]
-
-                if msg.msgtype == 'ack':
-                    if not self.raw_mode:
-                        if node.name() in self.last_node_commands:
-                            self.uplink.on_serial_status(node.name(), "ACK - " + self.last_node_commands[node.name()])
-                        node.on_ack(int(msg.result))
-                        self.message_pending = False
-                elif msg.msgtype == 'timeout':
-                    if not self.raw_mode:
-                        if node.name() in self.last_node_commands:
-                            self.uplink.on_serial_status(node.name(), "TIMEOUT - " + self.last_node_commands[node.name()])
-                        node.on_timeout()
-                        self.message_pending = False
-                elif msg.msgtype == 'status':
+            if msg.msgtype == 'ack':
+                if not self.raw_mode:
                     if node.name() in self.last_node_commands:
-                        self.uplink.on_serial_status(node.name(), packet)
-                    self.status_for_node(node, int(msg.result))
-                elif msg.msgtype == 'pend':
-                    # once we get a PEND event, we block the execution until we get a timeout or a ack
-                    if self.wait_for_prompt is None:
-                        self.log.warning("Received unexpected pending signal")
-
-                    self.message_pending = True
-                else:
-                    self.log.err("Got unknown response '{}'".format(packet))
-                    raise MasterCommandError("PANIC! We got an UNKNOWN response")
+                        self.uplink.on_serial_status(node.name(), "ACK - " + self.last_node_commands[node.name()])
+                    self.command_done(node.name())
+                    if node.name() in self.command_started:
+                        command, started = self.command_started.pop(node.name())
+                        metrics.COMMAND_RTT.observe(time.monotonic() - started, node=node.name(), command=command)
+                        if self.timeseries is not None:
+                            self.timeseries.rtt(node.node_id(), time.monotonic() - started)
+                    node.on_ack(int(msg.result))
+            elif msg.msgtype == 'timeout':
+                if not self.raw_mode:
+                    self.command_timeout(node)
+            elif msg.msgtype == 'status':
+                if node.name() in self.last_node_commands:
+                    self.uplink.on_serial_status(node.name(), packet)
+                metrics.STATUS_CHANGES.inc(node=node.name())
+                if self.timeseries is not None:
+                    self.timeseries.status(node.node_id(), int(msg.result))
+
+                trace = None
+                if msg.trace is not None:
+                    trace = tracing.StatusTrace(node.name(), node.route_length(), int(msg.result), *msg.trace)
+                    self.tracer.start(trace)
+
+                self.status_for_node(node, int(msg.result))
+
+                if trace is not None:
+                    # The trace ends when the status has been sent to the status site
+                    if not self.uplink.notify_when_sent(node.name(), lambda sent, t=trace: self.tracer.uplink_done(t, sent)):
+                        self.tracer.finish(trace)
+            elif msg.msgtype == 'session':
+                self.store_session(node, msg.result)
+            elif msg.msgtype == 'pend':
+                # once we get a PEND event, the node gets no further commands until we get a timeout or a ack
+                if self.wait_for_prompt is None:
+                    self.log.warning("Received unexpected pending signal")
+
+                if msg.tag is not None:
+                    self.pending_tags.add(msg.tag)
+                elif self.prompt_tag is not None:
+                    # Untagged PEND, belongs to the command that is currently processed
+                    self.pending_tags.add(self.prompt_tag)
+            else:
+                self.log.err("Got unknown response '{}'".format(packet))
+                raise MasterCommandError("PANIC! We got an UNKNOWN response")
+
+    def __load_sessions(self):
+        if self.session_file is None:
+            return {}
+
+        try:
+            with open(self.session_file) as sessionfile:
+                return json.load(sessionfile)
+        except FileNotFoundError:
+            return {}
+        except (OSError, ValueError) as error:
+            self.log.warning("Failed to load the session tickets: {}".format(error))
+            return {}
+
+    def __save_sessions(self):
+        if self.session_file is None:
+            return
 
-        #else:
-        #    await self.pluginmanager.call("on_nocommand", packet=packet)
+        # Write a new file and replace the old one, so a crash can't leave a broken file
+        tmpname = self.session_file + ".tmp"
+        try:
+            with open(tmpname, 'w') as sessionfile:
+                json.dump(self.sessions, sessionfile)
+            os.replace(tmpname, self.session_file)
+        except OSError as error:
+            self.log.warning("Failed to save the session tickets: {}".format(error))
+
+    def __load_state(self):
+        """
+        Loads the state of the last run for a warm restart, None if there is no usable state
+        """
+        if self.state_file is None:
+            return None
+
+        try:
+            with open(self.state_file) as statefile:
+                state = json.load(statefile)
+        except FileNotFoundError:
+            return None
+        except (OSError, ValueError) as error:
+            self.log.warning("Failed to load the state of the last run: {}".format(error))
+            return None
+
+        age = time.time() - state.get('time', 0)
+        if age > self.warm_restart_max_age:
+            self.log.info("State of the last run is {:.0f} seconds old, cold start".format(age))
+            return None
+
+        if state.get('framed', False) and not self.binary_protocol:
+            # The master can only leave the binary mode with a reboot
+            self.log.info("Master is in binary mode, cold start")
+            return None
+
+        return state
+
+    def __save_state(self):
+        if self.state_file is None:
+            self.state_dirty = False
+            return
+
+        state = {'time': time.time(),
+                 'framed': self.framed,
+                 'next_tag': self.next_tag,
+                 'nodes': {name: node.save_state() for name, node in self.nodes.items()}}
+
+        tmpname = self.state_file + ".tmp"
+        try:
+            with open(tmpname, 'w') as statefile:
+                json.dump(state, statefile)
+            os.replace(tmpname, self.state_file)
+        except OSError as error:
+            self.log.warning("Failed to save the state: {}".format(error))
+
+        self.state_dirty = False
+        self.last_state_save = time.monotonic()
+
+    def restore_state(self, state):
+        """
+        Hands the saved view to the nodes, they probe the node before they use it.
+        The statuses are restored, so the LEDs are not updated with the initial state.
+        """
+        # Continue with the tags, late responses of the last run can't be taken for new commands
+        self.next_tag = state.get('next_tag', self.next_tag)
+
+        saved_nodes = state.get('nodes', {})
+        for name, node in self.nodes.items():
+            node.attach(saved_nodes.get(name))
+
+        for name, node_state in saved_nodes.items():
+            if name not in self.nodes or not node_state or node_state.get('last_status') is None:
+                continue
+            self.restore_status(self.nodes[name], node_state['last_status'])
+
+    def get_session(self, node):
+        """
+        Session ticket to resume the connection to the node, None if the node needs to be connected.
+        The session is only resumed if the node has been set up with the same configuration.
+        """
+        session = self.sessions.get(node.name())
+        if session is None or session['id'] != node.node_id() or session['config'] != node.config_hash():
+            return None
+
+        return session['ticket']
+
+    def store_session(self, node, ticket):
+        self.sessions[node.name()] = {'id': node.node_id(),
+                                      'ticket': ticket,
+                                      'config': node.config_hash()}
+        self.__save_sessions()
+
+    def drop_session(self, node):
+        if self.sessions.pop(node.name(), None) is not None:
+            self.__save_sessions()
 
     def resolve_node(self, name):
         if name in self.nodes:
@@ -313,48 +929,159 @@ class Master:
             return None
         raise KeyError("No such node!", name)
 
-    async def init_routes(self):
+    def route_commands(self):
+        """
+        Commands to set the routes of the master and the channels of its next hops,
+        the routes are split into several commands for large networks
+        """
         routes = []
         for dst, hop in self.config['routes']:
             d = self.resolve_node(dst).node_id()
             h = self.resolve_node(hop).node_id()
             routes += ["{}:{}".format(d, h)]
 
-        routestr = 'routes ' + ','.join(routes)
-        await self.send(routestr)
+        commands = split_command('routes', routes)
+
+        # Channels of the master's next hops, only needed if some parts of the network use other frequencies.
+        hop_channels = []
+        for _, hop in self.config['routes']:
+            h = self.resolve_node(hop)
+            if h.channel() is not None:
+                hop_channels += ["{}:{}".format(h.node_id(), h.channel())]
+
+        return commands + split_command('hop_channels', hop_channels)
+
+    async def init_routes(self):
+        commands = self.route_commands()
+        await self.send(commands[0])
+
+        for cmd in commands[1:]:
+            await asyncio.sleep(0.5)
+            await self.send(cmd)
+
+    def reload_config(self):
+        """
+        Reads the configuration again and applies it to the running network.
+        Only the changed parts (channel configs, routes, LEDs) are sent to the nodes.
+        Changes of the network structure (nodes, ids, types, gateways) need a restart.
+        Returns a text that describes the result.
+        """
+        if self.config_loader is None:
+            return "Reload not supported"
+
+        try:
+            master_config, node_configs = self.config_loader()
+            if set(node_configs) != set(self.nodes):
+                raise ValueError("Nodes added or removed, restart required")
+            for name, node in self.nodes.items():
+                node.check_config(node_configs[name])
+                for dst, hop in node_configs[name]['routes']:
+                    for route_node in (dst, hop):
+                        if not route_node.startswith('#'):
+                            self.resolve_node(route_node)
+            # Also checks the master routes
+            for dst, hop in master_config['routes']:
+                self.resolve_node(dst)
+                self.resolve_node(hop)
+        except Exception as error:
+            # Anything can be wrong with the file, the running configuration is kept
+            self.log.error("Configuration not reloaded: {}".format(error))
+            return "Configuration not reloaded: {}\n".format(error)
+
+        old_hashes = {name: node.config_hash() for name, node in self.nodes.items()}
+        network_configs = {name: node.network_config() for name, node in self.nodes.items()}
+        master_routes = self.route_commands()
+
+        # All nodes get the new configuration first, the routes and channels depend on the other nodes
+        self.config = master_config
+        self.__read_limits()
+        for name, node in self.nodes.items():
+            node.reload_config(node_configs[name])
+
+        for name, node in self.nodes.items():
+            node.config_changed(network_configs[name])
+
+        # The LED maps may have changed
+        self.update_status_index()
+        self.save_node_names()
+
+        # The expected LED states are built again from the statuses
+        for node in self.nodes.values():
+            status = node.last_status()
+            if status is not None:
+                self.restore_status(node, status)
+
+        new_routes = self.route_commands()
+        if new_routes != master_routes and self.initialized:
+            self.master_commands += [cmd for cmd in new_routes if cmd not in master_routes]
+
+        changed = [name for name, node in self.nodes.items() if node.config_hash() != old_hashes[name]]
+        self.log.info("Configuration reloaded, changed nodes: {}".format(", ".join(changed) or "None"))
+        self.state_dirty = True
+        self.wakeup()
+        return "Configuration reloaded, changed nodes: {}\n".format(", ".join(changed) or "None")
+
+    def update_status_index(self):
+        """
+        Builds the index of the nodes that need the status of a node, must be called when the nodes
+        or their configuration changed
+        """
+        self.status_subscribers = {name: [node] for name, node in self.nodes.items()}
+        for node in self.nodes.values():
+            for source in node.status_sources():
+                subscribers = self.status_subscribers.get(source)
+                if subscribers is not None and node not in subscribers:
+                    subscribers.append(node)
+
+    def save_node_names(self):
+        if self.timeseries is not None:
+            self.timeseries.store.set_node_names({name: node.node_id() for name, node in self.nodes.items()})
 
     def status_for_node(self, node, status):
         self.log.info("Status for node \"{}\" is now {}".format(node.name(), status))
 
-        # Call the status change on ALL nodes, not just on the changed!
-        for n in self.nodes.values():
+        # Call the status change on the changed node and on all nodes that display its status
+        for n in self.status_subscribers.get(node.name(), ()):
             n.on_node_status_changed(node, status)
 
+    def restore_status(self, node, status):
+        for n in self.status_subscribers.get(node.name(), ()):
+            n.on_node_status_restored(node, status)
+
     def debug_state(self):
         state = """alive:       {}
 raw:         {}
 last_cmd:    {}
-msg_pending: {}
+in_flight:   {}
 wait_prompt: {}
 
-""".format(self.alive, self.raw_mode, self.last_cmd, self.message_pending, self.wait_for_prompt)
+""".format(self.alive, self.raw_mode, self.last_cmd,
+           ", ".join("{}@{}".format(n, t) for n, t in self.inflight.items()) or "None",
+           self.wait_for_prompt)
         for node in self.nodes.values():
             state += node.debug_state() + "\n"
+        state += self.tracer.debug_state()
+        if self.timeseries is not None:
+            state += self.timeseries.store.debug_state()
         return state
 
 
     def inject_command(self, cmd):
         self.injected_command = cmd
+        self.wakeup()
 
     def set_raw_mode(self, raw):
         self.raw_mode = raw
+        self.wakeup()
 
     def is_raw_mode(self):
         return self.raw_mode
 
     def request_restart(self):
         self.restart_requested = True
+        self.wakeup()
 
     def reset_timeouts(self):
         for n in self.nodes.values():
             n.reset_timeout()
+        self.wakeup()
@@ -14,6 +14,10 @@ class MessageResponse:
         self.node = None
         self.is_error = False
         self.is_pend = False
+        # Latency trace of a status update (adc cycle, age in ms, attempt, master uptime in ms) or None
+        self.trace = None
+        # Tag of the command this message belongs to, None if the command was untagged
+        self.tag = None
         self.raw = response
 
         if response:
@@ -23,10 +27,13 @@ class MessageResponse:
 
         if "###ERR" in response:
             self.is_error = True
+            match = re.search(r"###ERR@(?P<tag>\d+)", response)
+            if match:
+                self.tag = int(match.group("tag"))
             return
 
-        match = re.search(r"###(?P<type>ACK|STATUS|TIMEOUT|PEND)[ -]?(?P<node>\d+)"
-                          r"(?:[ -](?P<result>\d+))?", response)
+        match = re.search(r"###(?P<type>ACK|STATUS|TIMEOUT|PEND|SESSION)[ -]?(?P<node>\d+)"
+                          r"(?:[ -](?P<result>[0-9a-fA-F]+))?(?:@(?P<tag>\d+))?", response)
 
         if not match:
             self.is_error = True
@@ -34,13 +41,21 @@ class MessageResponse:
 
         self.msgtype = match.group("type").lower()
 
-        if self.msgtype in ["ack", "status"]:
+        if self.msgtype in ["ack", "status", "session"]:
             self.result = match.group("result")
         elif self.msgtype == "pend":
             self.is_pend = True
 
         self.node = int(match.group("node"))
 
+        if match.group("tag") is not None:
+            self.tag = int(match.group("tag"))
+
+        if self.msgtype == "status":
+            trace = re.search(r" T(\d+),(\d+),(\d+),(\d+)", response)
+            if trace:
+                self.trace = tuple(int(v) for v in trace.groups())
+
 class MessageCommand:
     """
     A message going to the serial connection
@@ -48,17 +63,26 @@ class MessageCommand:
     def __init__(self, node, command, *args, seperator=" "):
         self.nodeid = node.node_id()
         self.node = node.name()
+        self.tag = None
         if args:
             strargs = seperator.join([str(arg) for arg in args])
         else:
             strargs = ""
         self.cmd = "{} {} {}\n".format(command, self.nodeid, strargs).strip()
 
+    def set_tag(self, tag):
+        """
+        Tags the command, the master adds the tag to the PEND, ACK, TIMEOUT and ERR messages of the command.
+        """
+        self.tag = tag
+
     def __str__(self):
-        return self.cmd
+        return self.to_command()
 
     def to_command(self):
         """
         Convert to a interpretable command
         """
+        if self.tag is not None:
+            return "@{} {}".format(self.tag, self.cmd)
         return self.cmd
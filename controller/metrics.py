@@ -0,0 +1,207 @@
+"""
+Metrics of the controller in the Prometheus text format
+
+The metrics are defined here and updated by the other modules,
+start_server() makes them available on http://<address>:<port>/metrics
+"""
+
+import logging
+from aiohttp import web
+
+log = logging.getLogger('metrics')
+
+
+def _escape(value):
+    return str(value).replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def _format_labels(names, values, extra=()):
+    pairs = ['{}="{}"'.format(n, _escape(v)) for n, v in zip(names, values)]
+    pairs += ['{}="{}"'.format(n, v) for n, v in extra]
+    if not pairs:
+        return ""
+    return "{" + ",".join(pairs) + "}"
+
+
+def _format_value(value):
+    if value == float('inf'):
+        return "+Inf"
+    if isinstance(value, float) and value.is_integer():
+        return str(int(value))
+    return str(value)
+
+
+class Metric:
+    def __init__(self, name, description, labels=()):
+        self.name = name
+        self.description = description
+        self.labelnames = tuple(labels)
+        self.values = {}
+        self.function = None
+
+    def _key(self, labels):
+        if set(labels) != set(self.labelnames):
+            raise ValueError("Labels of {} must be {}".format(self.name, self.labelnames))
+        return tuple(labels[n] for n in self.labelnames)
+
+    def set_function(self, function):
+        """
+        The value is read from the function when the metrics are requested.
+        Without labels the function returns the value,
+        with labels a dict that maps the tuples of the label values to the values.
+        """
+        self.function = function
+
+    def samples(self):
+        """
+        List of (name suffix, label values, extra labels, value)
+        """
+        values = self.values
+        if self.function is not None:
+            values = self.function()
+            if not self.labelnames:
+                values = {(): values}
+        return [("", key, (), value) for key, value in sorted(values.items())]
+
+    def render(self):
+        lines = ["# HELP {} {}".format(self.name, self.description),
+                 "# TYPE {} {}".format(self.name, self.metric_type)]
+        for suffix, key, extra, value in self.samples():
+            lines.append("{}{}{} {}".format(self.name, suffix, _format_labels(self.labelnames, key, extra),
+                                            _format_value(value)))
+        return "\n".join(lines) + "\n"
+
+
+class Counter(Metric):
+    metric_type = "counter"
+
+    def inc(self, amount=1, **labels):
+        key = self._key(labels)
+        self.values[key] = self.values.get(key, 0) + amount
+
+
+class Gauge(Metric):
+    metric_type = "gauge"
+
+    def set(self, value, **labels):
+        self.values[self._key(labels)] = value
+
+
+class Histogram(Metric):
+    metric_type = "histogram"
+
+    def __init__(self, name, description, buckets, labels=()):
+        super().__init__(name, description, labels)
+        self.buckets = tuple(sorted(buckets)) + (float('inf'),)
+
+    def observe(self, value, **labels):
+        key = self._key(labels)
+        if key not in self.values:
+            self.values[key] = ([0] * len(self.buckets), [0])
+
+        counts, total = self.values[key]
+        for i, bound in enumerate(self.buckets):
+            if value <= bound:
+                counts[i] += 1
+        total[0] += value
+
+    def samples(self):
+        samples = []
+        for key, (counts, total) in sorted(self.values.items()):
+            for bound, count in zip(self.buckets, counts):
+                samples.append(("_bucket", key, (("le", _format_value(float(bound))),), count))
+            samples.append(("_sum", key, (), total[0]))
+            samples.append(("_count", key, (), counts[-1]))
+        return samples
+
+
+REGISTRY = []
+
+
+def _register(metric):
+    REGISTRY.append(metric)
+    return metric
+
+
+RTT_BUCKETS = (0.1, 0.25, 0.5, 1, 2, 5, 10, 20, 30, 60)
+
+# Nodes
+COMMAND_RTT = _register(Histogram(
+    "wasch_command_rtt_seconds", "Time from sending a node command to its ACK, including retransmissions",
+    RTT_BUCKETS, ("node", "command")))
+RETRANSMISSIONS = _register(Counter(
+    "wasch_retransmissions_total", "Retransmissions sent to a node", ("node",)))
+TIMEOUTS = _register(Counter(
+    "wasch_timeouts_total", "Timeouts of node commands", ("node", "command")))
+INFLIGHT_EXPIRED = _register(Counter(
+    "wasch_inflight_expired_total", "Node commands given up without an ACK or TIMEOUT from the master", ("node",)))
+NODE_CONNECTS = _register(Counter(
+    "wasch_node_connects_total", "Connection attempts to a node (connect or resume)", ("node", "command")))
+STATUS_CHANGES = _register(Counter(
+    "wasch_status_changes_total", "Status updates received from a node", ("node",)))
+NODE_AVAILABLE = _register(Gauge(
+    "wasch_node_available", "1 if the node is connected and configured", ("node",)))
+COMMANDS_IN_FLIGHT = _register(Gauge(
+    "wasch_commands_in_flight", "Node commands waiting for their ACK or TIMEOUT"))
+
+STATUS_LATENCY = _register(Histogram(
+    "wasch_status_latency_seconds", "Latency of the status updates per segment (see tracing.py)",
+    (0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 30, 60, 300), ("segment", "hops")))
+STATUS_ATTEMPTS = _register(Histogram(
+    "wasch_status_attempts", "Transmission attempts of the status updates", (1, 2, 3, 4, 6, 8, 12), ("hops",)))
+STATUS_UPLINK_FAILED = _register(Counter(
+    "wasch_status_uplink_failed_total", "Traced status updates the status site rejected", ("hops",)))
+STATUS_LATENCY_QUANTILES = _register(Gauge(
+    "wasch_status_latency_quantile_seconds", "Latency quantiles of the last status updates of a node",
+    ("node", "segment", "quantile")))
+
+# Serial connection to the master
+MASTER_CONNECTS = _register(Counter(
+    "wasch_master_connects_total", "(Re)connections to the master"))
+SERIAL_RX_MESSAGES = _register(Counter(
+    "wasch_serial_received_messages_total", "Lines or frames received from the master"))
+SERIAL_RX_BYTES = _register(Counter(
+    "wasch_serial_received_bytes_total", "Bytes received from the master"))
+SERIAL_TX_COMMANDS = _register(Counter(
+    "wasch_serial_sent_commands_total", "Commands sent to the master"))
+SERIAL_TX_BYTES = _register(Counter(
+    "wasch_serial_sent_bytes_total", "Bytes sent to the master"))
+
+# Uplink
+UPLINK_QUEUE_DEPTH = _register(Gauge(
+    "wasch_uplink_queue_depth", "Requests waiting to be sent to the status site"))
+UPLINK_LATENCY = _register(Histogram(
+    "wasch_uplink_latency_seconds", "Time from queueing a request to its acceptance by the status site",
+    (0.1, 0.5, 1, 2, 5, 10, 30, 60, 300, 900)))
+UPLINK_SENT = _register(Counter(
+    "wasch_uplink_sent_total", "Requests accepted by the status site"))
+UPLINK_DROPPED = _register(Counter(
+    "wasch_uplink_dropped_total", "Requests dropped because the queue was full or the site rejected them"))
+UPLINK_FAILED = _register(Counter(
+    "wasch_uplink_failed_batches_total", "Batches that failed and were retried"))
+
+
+def register_uplink(uplink):
+    UPLINK_QUEUE_DEPTH.set_function(uplink.queue_depth)
+    UPLINK_SENT.set_function(lambda: uplink.sent)
+    UPLINK_DROPPED.set_function(lambda: uplink.dropped)
+    UPLINK_FAILED.set_function(lambda: uplink.failed)
+    uplink.latency_observer = UPLINK_LATENCY.observe
+
+
+def render():
+    return "".join(metric.render() for metric in REGISTRY)
+
+
+async def handle_metrics(request):
+    return web.Response(body=render().encode('utf-8'),
+                        headers={"Content-Type": "text/plain; version=0.0.4; charset=utf-8"})
+
+
+async def start_server(address, port):
+    app = web.Application()
+    app.router.add_get('/metrics', handle_metrics)
+    runner = web.AppRunner(app)
+    await runner.setup()
+    await web.TCPSite(runner, address, port).start()
+    log.info("Metrics available on http://{}:{}/metrics".format(address, port))
@@ -3,3 +3,7 @@
 #socat -d PTY,link=/tmp/waschfreiheit_pts,echo=0 "EXEC:python3 test.py normal ...,pty,raw",echo=0
 #socat -d PTY,link=/tmp/waschfreiheit_pts,echo=0 "EXEC:python3 test.py one_dead ...,pty,raw",echo=0
 socat -d PTY,link=/tmp/waschfreiheit_pts,echo=0 "EXEC:python3 test.py irresponsive ...,pty,raw",echo=0
+
+# Emulated network of 100 nodes, the config is written by: python3 test.py genconf /tmp/waschemu --nodes 100
+# and the controller is started with: python3 main.py /tmp/waschemu
+#socat -d PTY,link=/tmp/waschfreiheit_pts,echo=0 "EXEC:python3 test.py emulate --nodes 100 --report-interval 60,pty,raw",echo=0
@@ -0,0 +1,239 @@
+"""
+Codec for the binary serial protocol of the master node (see Serial.md)
+
+A frame is <TYPE> <PAYLOAD> <CRC16>, COBS encoded and terminated by a zero byte.
+"""
+
+import struct
+
+from message import MessageResponse
+
+# Controller -> master
+CMD = 0x01
+
+# Master -> controller
+LOG = 0x10
+PROMPT = 0x11
+PEND = 0x12
+ACK = 0x13
+TIMEOUT = 0x14
+STATUS = 0x15
+SESSION = 0x16
+ERR = 0x17
+RAW = 0x18
+
+DELIMITER = b'\0'
+
+# Max size of type + payload, longer frames are dropped by the master
+MAX_FRAME_SIZE = 224
+
+# Status with latency trace: node, status, adc cycle, age, attempt, master uptime
+STATUS_TRACE_FORMAT = "<BHHHBI"
+STATUS_TRACE_SIZE = struct.calcsize(STATUS_TRACE_FORMAT)
+
+
+class FrameError(Exception):
+    """
+    A received frame is invalid
+    """
+
+
+def crc16(data):
+    """
+    CRC-16/CCITT-FALSE
+    """
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray()
+    start = 0
+    while True:
+        end = start
+        while end < len(data) and data[end] != 0 and end - start < 254:
+            end += 1
+
+        out.append(end - start + 1)
+        out += data[start:end]
+
+        if end == len(data):
+            break
+
+        # A full block has no zero after it
+        start = end if end - start == 254 else end + 1
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        code = data[pos]
+        pos += 1
+        if code == 0 or pos + code - 1 > len(data):
+            raise FrameError("Invalid COBS data")
+
+        out += data[pos:pos + code - 1]
+        pos += code - 1
+
+        if code != 0xFF and pos < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(ftype, payload=b""):
+    """
+    Encode a frame including the delimiter
+    """
+    data = bytes([ftype]) + bytes(payload)
+    if len(data) > MAX_FRAME_SIZE:
+        raise ValueError("Frame too long")
+    data += struct.pack("<H", crc16(data))
+    return cobs_encode(data) + DELIMITER
+
+
+def decode_frame(data):
+    """
+    Decode a frame without the delimiter, returns (type, payload)
+    """
+    data = cobs_decode(data)
+    if len(data) < 3:
+        raise FrameError("Frame too short")
+
+    if crc16(data[:-2]) != struct.unpack("<H", data[-2:])[0]:
+        raise FrameError("CRC mismatch")
+
+    return data[0], data[1:-2]
+
+
+def encode_command(command, tag=None):
+    """
+    Encode a CLI command, the tag is reported with the PEND, ACK, TIMEOUT and ERR frames of the command
+    """
+    payload = struct.pack("<H", tag or 0) + command.strip().encode('ascii')
+    return encode_frame(CMD, payload)
+
+
+class FrameDecoder:
+    """
+    Splits a byte stream into frames, invalid frames are counted and dropped
+    """
+    def __init__(self):
+        self.buffer = bytearray()
+        self.errors = 0
+
+    def feed(self, data):
+        """
+        Returns a list of the (type, payload) tuples completed by the data
+        """
+        self.buffer += data
+        frames = []
+        while True:
+            end = self.buffer.find(DELIMITER)
+            if end < 0:
+                break
+
+            raw = bytes(self.buffer[:end])
+            del self.buffer[:end + 1]
+            if not raw:
+                continue
+
+            try:
+                frames.append(decode_frame(raw))
+            except FrameError:
+                self.errors += 1
+        return frames
+
+
+def _tag_text(tag):
+    return "@{}".format(tag) if tag else ""
+
+
+def raw_values(payload):
+    """
+    Frame values of a RAW frame (node id followed by the 16 bit values)
+    """
+    return struct.unpack("<{}H".format((len(payload) - 1) // 2), payload[1:(len(payload) - 1) // 2 * 2 + 1])
+
+
+def describe(ftype, payload):
+    """
+    Text form of a frame, the notifications look like in the text protocol
+    """
+    try:
+        if ftype == LOG:
+            return payload.decode('ascii', 'replace')
+        if ftype == PROMPT:
+            return "MASTER>" + _tag_text(struct.unpack("<H", payload)[0])
+        if ftype in (PEND, TIMEOUT):
+            node, tag = struct.unpack("<BH", payload)
+            return "###{}{}{}".format("PEND" if ftype == PEND else "TIMEOUT", node, _tag_text(tag))
+        if ftype == ACK:
+            node, code, tag = struct.unpack("<BBH", payload)
+            return "###ACK{}-{}{}".format(node, code, _tag_text(tag))
+        if ftype == STATUS:
+            if len(payload) == STATUS_TRACE_SIZE:
+                return "###STATUS{}-{} T{},{},{},{}".format(*struct.unpack(STATUS_TRACE_FORMAT, payload))
+            return "###STATUS{}-{}".format(*struct.unpack("<BH", payload))
+        if ftype == SESSION:
+            return "###SESSION{}-{:016x}".format(*struct.unpack("<BQ", payload))
+        if ftype == ERR:
+            return "###ERR" + _tag_text(struct.unpack("<H", payload)[0])
+        if ftype == RAW:
+            values = raw_values(payload)
+            return "RAW{}-{} {}".format(payload[0], len(values), " ".join(str(v) for v in values))
+    except struct.error:
+        pass
+    return "<frame {:02x}: {}>".format(ftype, payload.hex())
+
+
+def to_response(ftype, payload):
+    """
+    Converts a notification frame into a MessageResponse, returns None for other frames
+    """
+    if ftype not in (PEND, ACK, TIMEOUT, STATUS, SESSION, ERR):
+        return None
+
+    msg = MessageResponse(None)
+    msg.raw = describe(ftype, payload)
+
+    try:
+        if ftype == ERR:
+            msg.is_error = True
+            tag, = struct.unpack("<H", payload)
+        elif ftype == ACK:
+            msg.node, code, tag = struct.unpack("<BBH", payload)
+            msg.result = str(code)
+        elif ftype == STATUS:
+            if len(payload) == STATUS_TRACE_SIZE:
+                msg.node, status, *trace = struct.unpack(STATUS_TRACE_FORMAT, payload)
+                msg.trace = tuple(trace)
+            else:
+                msg.node, status = struct.unpack("<BH", payload)
+            msg.result = str(status)
+            tag = 0
+        elif ftype == SESSION:
+            msg.node, ticket = struct.unpack("<BQ", payload)
+            msg.result = "{:016x}".format(ticket)
+            tag = 0
+        else:
+            msg.node, tag = struct.unpack("<BH", payload)
+            msg.is_pend = ftype == PEND
+    except struct.error:
+        raise FrameError("Invalid payload for frame type {:02x}".format(ftype))
+
+    if ftype != ERR:
+        msg.msgtype = {PEND: "pend", ACK: "ack", TIMEOUT: "timeout",
+                       STATUS: "status", SESSION: "session"}[ftype]
+
+    if tag:
+        msg.tag = tag
+    return msg
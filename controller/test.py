@@ -1,12 +1,23 @@
+import argparse
 import asyncio
+import collections
+import contextlib
+import math
 import os
 import re
+import shutil
+import struct
 import sys
 import random
+import tempfile
+import time
 import logging
 
 from asyncio.streams import StreamWriter, FlowControlMixin
 
+import serialframe
+import tracing
+
 # Setup the log
 logformat = '%(asctime)s | %(name)s | %(levelname)s | %(message)s'
 logging.basicConfig(format=logformat)
@@ -48,26 +59,44 @@ async def node_irresponsive(stdin, stdout, loop=None):
 
 nodes = {}
 async def setup(stdin, stdout, loop=None, dead_nodes=[], random_dead_nodes=[]):
+    global nodes
     async for line in stdin:
         line = line.decode('ascii')
         log.info("I: %s", line.strip())
 
+        # The controller tags the node commands (@<TAG> <COMMAND>), the tag is repeated in the replies
+        tag = ""
+        tagmatch = re.match(r'@(\d+) (.*)', line)
+        if tagmatch:
+            tag = "@" + tagmatch.group(1)
+            line = tagmatch.group(2)
+
         if line[0:7] == 'routes ':
+            await command(stdout, "MASTER>")
             continue
 
 
         match = re.findall(r'(\d+)', line)
         if match:
+            await command(stdout, "###PEND{}{}".format(match[0], tag))
+            await command(stdout, "MASTER>")
             if match[0] in dead_nodes:
-                await command(stdout, "###TIMEOUT{}".format(match[0]))
+                await command(stdout, "###TIMEOUT{}{}".format(match[0], tag))
             elif match[0] in random_dead_nodes and random.random() < 0.7:
-                await command(stdout, "###TIMEOUT{}".format(match[0]))
+                await command(stdout, "###TIMEOUT{}{}".format(match[0], tag))
+            elif line.startswith('connect ') or line.startswith('resume '):
+                # The session ticket is only used to resume the node, the emulator makes up a new one
+                await command(stdout, "###SESSION{}-{:016x}".format(match[0], random.getrandbits(64)))
+                # A resumed node is still configured (routes and sensors)
+                code = 3 if line.startswith('resume ') else 0
+                await command(stdout, "###ACK{}-{}{}".format(match[0], code, tag))
+                nodes[int(match[0])] = True
             else:
                 # Now in match[0] we have the node to ACK:
-                await command(stdout, "###ACK{}-0".format(match[0]))
-                global nodes
+                await command(stdout, "###ACK{}-0{}".format(match[0], tag))
                 nodes[int(match[0])] = True
         else:
+            await command(stdout, "MASTER>")
             print("Unknown line", line, file=sys.stderr)
 
         if line.strip() == "authping 4":
@@ -101,6 +130,999 @@ async def send(command):
         command += '\n'
     await stdout.write(command.encode('ascii'))
 
+# Emulator of the master and the mesh network for load and soak tests.
+#
+# The emulated master behaves like the real one (see master_node.c): a command is answered with
+# PEND and the prompt, the ACK or TIMEOUT follows when the node answered or the retransmission
+# timeout (estimated from the round-trip times, doubled with every retransmission) expired.
+# The notifications after a retransmit carry the tag of the original command, like on the master.
+# Each node has a hop depth, every hop delays a message (log-normal) and loses it with a fixed
+# probability. The machines on the nodes are switched on and off following a daily usage profile.
+
+# Limits of the retransmission timeout of the master (see rtt_estimator.h)
+RTT_MIN_TIMEOUT = 0.3
+RTT_MAX_TIMEOUT = 120
+# Size of the command buffer of the master (see main.c)
+CLI_CMD_BUFFER_LENGTH = 200
+
+# Relative usage of the machines per hour of the day, the evenings are busy
+USAGE_PROFILE = (0.3, 0.2, 0.1, 0.1, 0.1, 0.1, 0.2, 0.4, 0.6, 0.8, 1.0, 1.1,
+                 1.1, 1.1, 1.1, 1.2, 1.3, 1.5, 1.7, 1.9, 1.9, 1.6, 1.1, 0.6)
+
+# Commands that are answered by the master itself
+MASTER_COMMANDS = ('routes', 'hop_channels', 'wdt_feed', 'help')
+# Commands that are sent to a node
+NODE_COMMANDS = ('connect', 'resume', 'retransmit', 'reset_routes', 'set_routes', 'cfg_sensor', 'cfg_freq_chn',
+                 'enable_sensor', 'raw_frames', 'raw_status', 'authping', 'ping', 'led', 'led_update',
+                 'set_hop_channels', 'rebuild_status_channel', 'cfg_status_change_indicator', 'storage_ctl')
+
+NOTIFICATION_NAMES = {serialframe.PEND: "PEND", serialframe.ACK: "ACK", serialframe.TIMEOUT: "TIMEOUT",
+                      serialframe.STATUS: "STATUS", serialframe.SESSION: "SESSION", serialframe.ERR: "ERR"}
+
+emulog = logging.getLogger('emulator')
+
+
+class LatencyStats:
+    def __init__(self, window=100000):
+        self.values = collections.deque(maxlen=window)
+        self.count = 0
+
+    def add(self, value):
+        self.values.append(value)
+        self.count += 1
+
+    def summary(self):
+        if not self.values:
+            return "-"
+        values = sorted(self.values)
+        return "{:.3f} / {:.3f} / {:.3f} / {:.3f}s ({} samples)".format(
+            tracing.percentile(values, 50), tracing.percentile(values, 90),
+            tracing.percentile(values, 99), values[-1], self.count)
+
+
+class EmulatorStats:
+    def __init__(self):
+        self.started = time.monotonic()
+        self.commands = collections.Counter()
+        self.notifications = collections.Counter()
+        self.bytes_out = 0
+        self.max_inflight = 0
+        # Commands cut off at the end of the command buffer
+        self.too_long = 0
+        self.setup_done = None
+        self.last_prompt = None
+
+        # Prompt to the next command, only if the controller sent it within a second
+        self.turnaround = LatencyStats()
+        # First transmission of a command to its ACK
+        self.ack_rtt = LatencyStats()
+        # Status change on the node to the STATUS notification of the master
+        self.status_age = LatencyStats()
+        # STATUS notification to the first LED command for the node
+        self.led_latency = LatencyStats()
+        # STATUS notification to the status site (bench only)
+        self.uplink_latency = LatencyStats()
+
+    def report(self, emulator, baudrate):
+        elapsed = max(time.monotonic() - self.started, 0.001)
+        live = [n for n in emulator.nodes.values() if not n.dead]
+        up = sum(1 for n in live if n.sensors_active and n.node_id in emulator.cons)
+        commands = sum(self.commands.values())
+
+        text = "Emulator after {:.0f}s (usage at {:.1f}x):\n".format(elapsed, emulator.usage.speedup)
+        text += "    nodes:          {} ({} dead), {} up, setup {}\n".format(
+            len(emulator.nodes), len(emulator.nodes) - len(live), up,
+            "done after {:.1f}s".format(self.setup_done) if self.setup_done is not None else "not done")
+        text += "    commands:       {} ({:.1f}/s), max in flight {}\n".format(
+            commands, commands / elapsed, self.max_inflight)
+        text += "                    {}\n".format(", ".join(
+            "{} {}".format(c, n) for c, n in self.commands.most_common()))
+        if self.too_long:
+            text += "                    {} too long for the command buffer\n".format(self.too_long)
+        text += "    notifications:  {}\n".format(", ".join(
+            "{} {}".format(c, n) for c, n in sorted(self.notifications.items())))
+        text += "    status updates: {:.2f}/s\n".format(self.notifications['STATUS'] / elapsed)
+        if baudrate:
+            text += "    serial out:     {:.0f} bytes/s ({:.0f}% of {} baud)\n".format(
+                self.bytes_out / elapsed, self.bytes_out * 10 / elapsed / baudrate * 100, baudrate)
+        text += "    latency (p50 / p90 / p99 / max):\n"
+        text += "      prompt -> next command  {}\n".format(self.turnaround.summary())
+        text += "      command -> ACK          {}\n".format(self.ack_rtt.summary())
+        text += "      status change -> STATUS {}\n".format(self.status_age.summary())
+        text += "      STATUS -> LED command   {}\n".format(self.led_latency.summary())
+        if self.uplink_latency.count:
+            text += "      STATUS -> uplink        {}\n".format(self.uplink_latency.summary())
+        return text
+
+
+class Network:
+    """
+    Delay and loss of the radio links
+    """
+    def __init__(self, args, rng):
+        self.rng = rng
+        self.latency = args.latency / 1000
+        self.jitter = args.jitter
+        self.loss = args.loss
+        self.node_delay = args.node_delay / 1000
+
+    def transmit(self, hops):
+        """
+        Delay of a message over the hops, None if it is lost
+        """
+        delay = 0
+        for _ in range(hops):
+            if self.rng.random() < self.loss:
+                return None
+            delay += self.rng.lognormvariate(math.log(self.latency), self.jitter)
+        return delay
+
+
+class UsageModel:
+    """
+    Times between the status changes of a machine
+    """
+    def __init__(self, args, rng):
+        self.rng = rng
+        self.speedup = args.speedup
+        self.cycle = args.cycle * 60
+        self.uses = args.uses_per_day
+        # Fixed rate of status changes per machine (per second), overrides the usage profile
+        self.rate = args.status_rate
+        self.started = time.monotonic()
+        self.clock = time.time()
+
+    def hour(self):
+        emulated = self.clock + (time.monotonic() - self.started) * self.speedup
+        return time.localtime(emulated).tm_hour
+
+    def busy_share(self):
+        return min(self.uses * self.cycle / 86400, 0.9)
+
+    def next_change(self, running):
+        if self.rate:
+            return self.rng.expovariate(self.rate)
+
+        if running:
+            duration = max(self.rng.gauss(self.cycle, self.cycle * 0.2), 600)
+        else:
+            mean_idle = max(86400 / self.uses - self.cycle, 60)
+            factor = USAGE_PROFILE[self.hour()] / (sum(USAGE_PROFILE) / len(USAGE_PROFILE))
+            duration = self.rng.expovariate(factor / mean_idle)
+        return duration / self.speedup
+
+
+class EmulatedNode:
+    """
+    The node itself, the master's view of it is in Connection
+    """
+    def __init__(self, node_id, hops, dead=False):
+        self.node_id = node_id
+        self.hops = hops
+        self.dead = dead
+
+        self.session = None
+        self.routes_set = False
+        self.sensors_active = False
+
+        # Machines: running flag and the timer of the next change
+        self.running = {}
+        self.machine_timers = {}
+        self.status = 0
+
+        # Status update on its way to the master
+        self.adc_cycle = 0
+        self.status_changed = 0
+        self.status_attempt = 0
+        self.status_timer = None
+
+    def flags(self):
+        # Bit 0: routes set, bit 1: sensors active (see the ACK codes of connect / resume)
+        return int(self.routes_set) | (int(self.sensors_active) << 1)
+
+    def stop_sensors(self):
+        for timer in self.machine_timers.values():
+            timer.cancel()
+        self.machine_timers = {}
+        self.running = {}
+        self.sensors_active = False
+
+
+class Message:
+    def __init__(self, tag, argv):
+        self.tag = tag
+        self.argv = argv
+        self.cmd = argv[0]
+        self.first_sent = time.monotonic()
+        self.sent_at = self.first_sent
+        self.retransmitted = False
+        self.acked = False
+        # New session ticket of a connect / resume
+        self.ticket = None
+
+
+class Connection:
+    """
+    Connection of the master to a node with its retransmission timeout
+    """
+    def __init__(self, node_id, timeout):
+        self.node_id = node_id
+        self.rto = min(max(timeout, RTT_MIN_TIMEOUT), RTT_MAX_TIMEOUT)
+        self.srtt = None
+        self.rttvar = 0
+        self.messages = []
+        self.timed_out = False
+        self.retransmissions = 0
+        self.timer = None
+        # Last status reported to the controller
+        self.status = None
+
+    def timeout(self):
+        return min(max(self.rto * 2 ** self.retransmissions, RTT_MIN_TIMEOUT), RTT_MAX_TIMEOUT)
+
+    def update_rtt(self, rtt):
+        if self.srtt is None:
+            self.srtt = rtt
+            self.rttvar = rtt / 2
+        else:
+            self.rttvar = 0.75 * self.rttvar + 0.25 * abs(self.srtt - rtt)
+            self.srtt = 0.875 * self.srtt + 0.125 * rtt
+        self.rto = min(max(self.srtt + 4 * self.rttvar, RTT_MIN_TIMEOUT), RTT_MAX_TIMEOUT)
+
+    def unacked(self):
+        return [m for m in self.messages if not m.acked]
+
+
+class MasterEmulator:
+    def __init__(self, nodes, args, rng, loop):
+        self.nodes = {n.node_id: n for n in nodes}
+        self.loop = loop
+        self.rng = rng
+        self.network = Network(args, rng)
+        self.usage = UsageModel(args, rng)
+        self.stats = EmulatorStats()
+        self.status_retry = args.status_retry
+        self.cmd_delay = args.cmd_delay / 1000
+        self.baudrate = args.baud
+
+        self.cons = {}
+        self.framed = False
+        self.boot_time = time.monotonic()
+
+        # Time of the STATUS notification per node until the LED command for it
+        self.led_pending = {}
+        # Time of the STATUS notification per node and status until it reached the status site (bench)
+        self.status_notified = {}
+
+        self.writer = None
+        self.out_queue = asyncio.Queue()
+        self.serve_task = None
+        self.write_task = None
+
+    def attach(self, reader, writer):
+        """
+        Serves a new connection of the controller
+        """
+        for task in (self.serve_task, self.write_task):
+            if task is not None:
+                task.cancel()
+        self.writer = writer
+        self.out_queue = asyncio.Queue()
+        self.serve_task = asyncio.ensure_future(self.serve(reader))
+        self.write_task = asyncio.ensure_future(self.write_loop())
+        return self.serve_task
+
+    # -- Serial connection --
+
+    async def write_loop(self):
+        while True:
+            data, is_prompt = await self.out_queue.get()
+            self.writer.write(data)
+            await self.writer.drain()
+            if self.baudrate:
+                # 8N1, 10 bits per byte
+                await asyncio.sleep(len(data) * 10 / self.baudrate)
+            if is_prompt:
+                self.stats.last_prompt = time.monotonic()
+
+    def write(self, data, is_prompt=False):
+        self.stats.bytes_out += len(data)
+        self.out_queue.put_nowait((data, is_prompt))
+
+    def output(self, text):
+        emulog.debug("O: %s", text)
+        if self.framed:
+            self.write(serialframe.encode_frame(serialframe.LOG, text.encode('ascii')))
+        else:
+            self.write((text + "\n").encode('ascii'))
+
+    def notify(self, ftype, payload, text):
+        self.stats.notifications[NOTIFICATION_NAMES[ftype]] += 1
+        emulog.debug("O: %s", text)
+        if self.framed:
+            self.write(serialframe.encode_frame(ftype, payload))
+        else:
+            self.write((text + "\n").encode('ascii'))
+
+    def prompt(self, tag):
+        if self.framed:
+            self.write(serialframe.encode_frame(serialframe.PROMPT, struct.pack("<H", tag)), True)
+        else:
+            self.write(b"MASTER>\n", True)
+
+    @staticmethod
+    def tag_text(tag):
+        return "@{}".format(tag) if tag else ""
+
+    def notify_pend(self, node, tag):
+        self.notify(serialframe.PEND, struct.pack("<BH", node, tag), "###PEND{}{}".format(node, self.tag_text(tag)))
+
+    def notify_ack(self, node, code, tag):
+        self.notify(serialframe.ACK, struct.pack("<BBH", node, code, tag),
+                    "###ACK{}-{}{}".format(node, code, self.tag_text(tag)))
+
+    def notify_timeout(self, node, tag):
+        self.notify(serialframe.TIMEOUT, struct.pack("<BH", node, tag),
+                    "###TIMEOUT{}{}".format(node, self.tag_text(tag)))
+
+    def notify_session(self, node, ticket):
+        self.notify(serialframe.SESSION, struct.pack("<BQ", node, ticket), "###SESSION{}-{:016x}".format(node, ticket))
+
+    def notify_err(self, tag):
+        self.notify(serialframe.ERR, struct.pack("<H", tag), "###ERR{}".format(self.tag_text(tag)))
+
+    def notify_status(self, node, status, adc_cycle, age, attempt):
+        uptime = int((time.monotonic() - self.boot_time) * 1000) & 0xFFFFFFFF
+        age = min(int(age * 1000), 0xFFFF)
+        payload = struct.pack(serialframe.STATUS_TRACE_FORMAT, node, status, adc_cycle & 0xFFFF, age, min(attempt, 255), uptime)
+        self.notify(serialframe.STATUS, payload, "###STATUS{}-{} T{},{},{},{}".format(
+            node, status, adc_cycle & 0xFFFF, age, attempt, uptime))
+
+    async def serve(self, reader):
+        """
+        Reads the commands, text lines or frames after the binary command
+        """
+        buffer = bytearray()
+        while True:
+            delimiter = serialframe.DELIMITER if self.framed else b"\n"
+            end = buffer.find(delimiter)
+            if end < 0:
+                data = await reader.read(4096)
+                if not data:
+                    emulog.info("Controller disconnected")
+                    return
+                buffer += data
+                continue
+
+            raw = bytes(buffer[:end])
+            del buffer[:end + 1]
+
+            if self.framed:
+                if not raw:
+                    continue
+                try:
+                    ftype, payload = serialframe.decode_frame(raw)
+                except serialframe.FrameError:
+                    continue
+                if ftype != serialframe.CMD or len(payload) < 2:
+                    continue
+                tag, = struct.unpack_from("<H", payload)
+                command = payload[2:].decode('ascii', 'replace')
+                # The master copies the command with its tag into the command buffer and cuts off the rest
+                space = CLI_CMD_BUFFER_LENGTH - 1 - len("@{} ".format(tag))
+                if len(command) > space:
+                    self.command_too_long(command)
+                    command = command[:space]
+                await self.execute(tag, command)
+            else:
+                # The master evaluates a full command buffer, the rest of the line is the next command
+                raw = raw.replace(b'\r', b'')
+                if len(raw) >= CLI_CMD_BUFFER_LENGTH:
+                    self.command_too_long(raw.decode('ascii', 'replace'))
+                for start in range(0, max(len(raw), 1), CLI_CMD_BUFFER_LENGTH - 1):
+                    await self.execute_line(raw[start:start + CLI_CMD_BUFFER_LENGTH - 1])
+
+    async def execute_line(self, raw):
+        line = raw.decode('ascii', 'replace').replace('\0', '').strip()
+        if not line:
+            return
+        tag = 0
+        tagmatch = re.match(r'@(\d+) (.*)', line)
+        if tagmatch:
+            tag = int(tagmatch.group(1))
+            line = tagmatch.group(2)
+        await self.execute(tag, line)
+
+    def command_too_long(self, command):
+        self.stats.too_long += 1
+        emulog.warning("Command longer than the command buffer of the master: %s...", command[:40])
+
+    # -- Commands --
+
+    async def execute(self, tag, line):
+        now = time.monotonic()
+        emulog.debug("I: %s", line)
+        argv = line.split()
+        if not argv:
+            self.prompt(tag)
+            return
+
+        cmd = argv[0]
+        known = cmd in MASTER_COMMANDS or cmd in NODE_COMMANDS or cmd in ('reboot', 'reset', 'forward', 'binary')
+        self.stats.commands[cmd if known else 'unknown'] += 1
+        if self.stats.last_prompt is not None and now - self.stats.last_prompt < 1:
+            self.stats.turnaround.add(now - self.stats.last_prompt)
+        self.stats.last_prompt = None
+
+        if self.cmd_delay:
+            await asyncio.sleep(self.cmd_delay)
+
+        if cmd in ('reboot', 'reset'):
+            self.reboot()
+        elif cmd == 'forward':
+            # Start of the forwarding by the TCP gateway
+            return
+        elif cmd == 'binary':
+            self.framed = True
+        elif cmd in MASTER_COMMANDS:
+            pass
+        elif cmd in NODE_COMMANDS:
+            self.node_command(tag, argv)
+        else:
+            self.output("Unknown command \"{}\"".format(cmd))
+
+        self.prompt(tag)
+
+    def reboot(self):
+        """
+        The connections of the master are lost, the nodes keep running with their sessions
+        """
+        for con in self.cons.values():
+            if con.timer is not None:
+                con.timer.cancel()
+        self.cons = {}
+        self.framed = False
+        self.boot_time = time.monotonic()
+        self.led_pending = {}
+        self.output("Master booted")
+
+    def node_command(self, tag, argv):
+        cmd = argv[0]
+        try:
+            node_id = int(argv[1])
+        except (IndexError, ValueError):
+            self.output("USAGE: {} <NODE> ...".format(cmd))
+            self.notify_err(tag)
+            return
+
+        if cmd in ('led', 'led_update') and node_id in self.led_pending:
+            self.stats.led_latency.add(time.monotonic() - self.led_pending.pop(node_id))
+
+        if cmd in ('connect', 'resume'):
+            try:
+                timeout = int(argv[3])
+            except (IndexError, ValueError):
+                self.output("USAGE: {} <NODE> <HOP/TICKET> <TIMEOUT>".format(cmd))
+                self.notify_err(tag)
+                return
+            self.close_connection(node_id)
+            self.cons[node_id] = Connection(node_id, timeout)
+
+        con = self.cons.get(node_id)
+        if con is None:
+            self.output("Not connected!")
+            self.notify_err(tag)
+            return
+
+        if cmd == 'retransmit':
+            self.retransmit(con, tag)
+            return
+
+        msg = Message(tag, argv)
+        if cmd in ('connect', 'resume'):
+            msg.ticket = self.rng.getrandbits(64)
+
+        if not con.unacked():
+            # Nothing outstanding, start with a new timeout
+            con.timed_out = False
+            con.retransmissions = 0
+        con.messages.append(msg)
+        self.stats.max_inflight = max(self.stats.max_inflight, sum(1 for c in self.cons.values() if c.unacked()))
+
+        self.notify_pend(node_id, tag)
+        self.transmit(con, msg)
+        self.update_timer(con)
+
+    def close_connection(self, node_id):
+        con = self.cons.pop(node_id, None)
+        if con is not None and con.timer is not None:
+            con.timer.cancel()
+
+    def retransmit(self, con, tag):
+        unacked = con.unacked()
+        if not unacked or not con.timed_out:
+            self.output("Illegal call to sensor_connection_retransmit!")
+            self.notify_err(tag)
+            return
+
+        self.notify_pend(con.node_id, tag)
+        con.retransmissions += 1
+        now = time.monotonic()
+        for msg in unacked:
+            msg.retransmitted = True
+            msg.sent_at = now
+            self.transmit(con, msg)
+        con.timed_out = False
+        self.update_timer(con)
+
+    # -- Radio network --
+
+    def transmit(self, con, msg):
+        node = self.nodes.get(con.node_id)
+        if node is None or node.dead:
+            return
+        delay = self.network.transmit(node.hops)
+        if delay is not None:
+            self.loop.call_later(delay, self.deliver, con, msg, node)
+
+    def deliver(self, con, msg, node):
+        """
+        The message reached the node
+        """
+        code = self.node_receive(node, msg)
+        if code is None:
+            return
+        delay = self.network.transmit(node.hops)
+        if delay is not None:
+            self.loop.call_later(delay + self.network.node_delay, self.on_node_ack, con, msg, code)
+
+    def on_node_ack(self, con, msg, code):
+        if self.cons.get(con.node_id) is not con or msg.acked:
+            # Old connection or an ACK of another transmission
+            return
+
+        now = time.monotonic()
+        msg.acked = True
+        if msg.retransmitted:
+            # Can't tell which transmission has been ack'ed, keep the backoff
+            con.rto = con.timeout()
+        else:
+            con.update_rtt(now - msg.sent_at)
+        self.stats.ack_rtt.add(now - msg.first_sent)
+
+        if msg.ticket is not None:
+            self.notify_session(con.node_id, msg.ticket)
+        self.notify_ack(con.node_id, code, msg.tag)
+
+        con.messages = con.unacked()
+        if not con.messages and con.timer is not None:
+            con.timer.cancel()
+            con.timer = None
+
+    def update_timer(self, con):
+        unacked = con.unacked()
+        if con.timer is not None:
+            con.timer.cancel()
+            con.timer = None
+        if not unacked or con.timed_out:
+            return
+        con.timer = self.loop.call_at(self.loop.time() + max(unacked[0].sent_at + con.timeout() - time.monotonic(), 0),
+                                      self.check_timeout, con)
+
+    def check_timeout(self, con):
+        con.timer = None
+        unacked = con.unacked()
+        if con.timed_out or not unacked or self.cons.get(con.node_id) is not con:
+            return
+
+        if time.monotonic() - unacked[0].sent_at < con.timeout():
+            self.update_timer(con)
+            return
+
+        # The oldest message that has not been ack'ed times out first
+        con.timed_out = True
+        self.notify_timeout(con.node_id, unacked[0].tag)
+
+    # -- Nodes --
+
+    def node_receive(self, node, msg):
+        """
+        Processes a message on the node, returns the ACK code or None if the node drops it
+        """
+        if msg.cmd == 'connect':
+            node.session = msg.ticket
+            return node.flags()
+
+        if msg.cmd == 'resume':
+            if node.session is None or "{:016x}".format(node.session) != msg.argv[2].lower():
+                # Unknown session (e.g. the node has been restarted)
+                return None
+            node.session = msg.ticket
+            return node.flags()
+
+        if msg.cmd == 'reset_routes':
+            node.routes_set = True
+            node.stop_sensors()
+        elif msg.cmd == 'set_routes':
+            node.routes_set = True
+        elif msg.cmd == 'enable_sensor':
+            try:
+                mask = int(msg.argv[2])
+            except (IndexError, ValueError):
+                return 1
+            self.enable_sensors(node, mask)
+        return 0
+
+    def enable_sensors(self, node, mask):
+        channels = [i for i in range(16) if mask & (1 << i)]
+        for channel in list(node.machine_timers):
+            if channel not in channels:
+                node.machine_timers.pop(channel).cancel()
+                node.running.pop(channel, None)
+
+        for channel in channels:
+            if channel in node.machine_timers:
+                continue
+            running = self.rng.random() < self.usage.busy_share()
+            node.running[channel] = running
+            # Somewhere within the current phase
+            delay = self.usage.next_change(running) * self.rng.random()
+            node.machine_timers[channel] = self.loop.call_later(delay, self.machine_changed, node, channel)
+
+        node.sensors_active = mask != 0
+        node.status = sum(1 << ch for ch, running in node.running.items() if running)
+        self.check_setup()
+
+    def check_setup(self):
+        if self.stats.setup_done is not None:
+            return
+        if all(n.dead or (n.sensors_active and n.node_id in self.cons) for n in self.nodes.values()):
+            self.stats.setup_done = time.monotonic() - self.stats.started
+            emulog.info("All nodes are up after %.1fs", self.stats.setup_done)
+
+    def machine_changed(self, node, channel):
+        running = not node.running[channel]
+        node.running[channel] = running
+        node.machine_timers[channel] = self.loop.call_later(self.usage.next_change(running),
+                                                            self.machine_changed, node, channel)
+        node.status ^= 1 << channel
+
+        # The node sends the latest status until the master ack'ed it
+        node.adc_cycle += 1
+        node.status_changed = time.monotonic()
+        node.status_attempt = 0
+        if node.status_timer is None:
+            self.send_status(node)
+
+    def send_status(self, node):
+        node.status_timer = None
+        node.status_attempt += 1
+        delay = self.network.transmit(node.hops)
+        if delay is not None:
+            self.loop.call_later(delay, self.status_received, node, node.status, node.adc_cycle,
+                                 node.status_changed, time.monotonic(), node.status_attempt)
+            if self.network.transmit(node.hops) is not None:
+                # The ACK of the master reached the node
+                return
+        node.status_timer = self.loop.call_later(self.status_retry * min(node.status_attempt, 4), self.send_status, node)
+
+    def status_received(self, node, status, adc_cycle, changed, sent, attempt):
+        con = self.cons.get(node.node_id)
+        if con is None or con.status == status:
+            # No status channel or a repeated update
+            return
+        con.status = status
+        now = time.monotonic()
+        self.stats.status_age.add(now - changed)
+        # The trace has the age at the transmission that reached the master (see msg_status_trace_t)
+        self.notify_status(node.node_id, status, adc_cycle, sent - changed, attempt)
+        self.led_pending.setdefault(node.node_id, now)
+        self.status_notified[(node.node_id, status)] = now
+
+
+def make_topology(args, rng):
+    """
+    List of (node id, gateway id, hops), the gateway of a node is a random node one level closer to the master
+    """
+    levels = [[] for _ in range(args.depth)]
+    for i in range(args.nodes):
+        levels[i * args.depth // args.nodes].append(i + 1)
+
+    topology = []
+    for depth, level in enumerate(levels):
+        for node_id in level:
+            gateway = rng.choice(levels[depth - 1]) if depth > 0 else 0
+            topology.append((node_id, gateway, depth + 1))
+    return topology
+
+
+def make_nodes(args):
+    rng = random.Random(args.seed)
+    topology = make_topology(args, rng)
+    dead = set(rng.sample([node_id for node_id, _, _ in topology], int(len(topology) * args.dead)))
+    return [EmulatedNode(node_id, hops, node_id in dead) for node_id, _, hops in topology]
+
+
+def node_name(node_id):
+    return "N{:03d}".format(node_id) if node_id else "MASTER"
+
+
+def generate_config(args, directory):
+    """
+    Writes the controller configuration of the emulated network (same seed, same network)
+    """
+    topology = make_topology(args, random.Random(args.seed))
+    gateways = {node_id: gateway for node_id, gateway, _ in topology}
+
+    def path(node_id):
+        # Nodes from the master to the node
+        result = []
+        while node_id:
+            result.insert(0, node_id)
+            node_id = gateways[node_id]
+        return result
+
+    # Routes of every relay to the nodes behind it: (destination, next hop)
+    routes = collections.defaultdict(list)
+    for node_id, _, _ in topology:
+        nodes = [0] + path(node_id)
+        for i, relay in enumerate(nodes[:-1]):
+            routes[relay].append((node_id, nodes[i + 1]))
+
+    def route_list(relay):
+        return ", ".join('("{}", "{}")'.format(node_name(dst), node_name(hop)) for dst, hop in routes[relay])
+
+    conf = """# Generated by test.py genconf: {nodes} nodes, depth {depth}, seed {seed}
+connection = "{connection}";
+serial: {{
+	baudrate: 115200;
+	device: "/tmp/waschfreiheit_pts";
+}}
+
+tcp: {{
+	port: {port};
+}}
+
+max_retransmissions = 7;
+reconnect_delay = 300;
+hop_timeout = 3;
+check_interval = 600;
+
+gateway_watchdog_interval = 60;
+""".format(nodes=args.nodes, depth=args.depth, seed=args.seed, connection=args.connection, port=args.port)
+
+    if args.max_inflight is not None:
+        conf += "max_inflight = {};\n".format(args.max_inflight)
+    if args.max_inflight_per_relay is not None:
+        conf += "max_inflight_per_relay = {};\n".format(args.max_inflight_per_relay)
+    if args.binary:
+        conf += 'serial_protocol = "binary";\n'
+
+    conf += """
+network : {{
+	MASTER: {{id: 0; type: "MASTER",
+		routes: ({});
+		alive_signal_interval = 60;
+	}}
+""".format(route_list(0))
+
+    for node_id, gateway, _ in topology:
+        conf += """	{name}: {{id: {id}; type: "wasch", gateway: "{gateway}",
+		routes: ({routes});
+		samplerate = 500;
+		channel_mask = 3;
+		ledmap: {{
+			{name}: {{index: 0; colors: {{s0: 1; s1: 2; s2: 2; s3: 3}}}}
+		}}
+		channels: ({{
+			index = 0;
+			@include "sensor_normal.conf"
+		}}, {{
+			index = 1;
+			@include "sensor_normal.conf"
+		}});
+	}}
+""".format(name=node_name(node_id), id=node_id, gateway=node_name(gateway), routes=route_list(node_id))
+    conf += "}\n"
+
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+    with open(os.path.join(directory, "config.conf"), 'w') as conffile:
+        conffile.write(conf)
+    with open(os.path.join(directory, "uplink.conf"), 'w') as conffile:
+        conffile.write('base_url = "http://localhost:8080";\nkey = "test";\n')
+    shutil.copy(os.path.join(os.path.dirname(os.path.abspath(__file__)), "conf", "sensor_normal.conf"), directory)
+
+
+class PipeWriter:
+    """
+    Writer end of an in-process connection, feeds the reader of the other side
+    """
+    def __init__(self, reader):
+        self.reader = reader
+
+    def write(self, data):
+        self.reader.feed_data(data)
+
+    async def drain(self):
+        pass
+
+    def close(self):
+        self.reader.feed_eof()
+
+
+class BenchUplink:
+    """
+    Stand-in for the uplink, measures the time from the STATUS notification to the status site
+    """
+    def __init__(self, emulator):
+        self.emulator = emulator
+        self.master = None
+
+    def on_status_change(self, node, state):
+        node_id = self.master.nodes[node].node_id()
+        notified = self.emulator.status_notified.pop((node_id, int(state)), None)
+        if notified is not None:
+            self.emulator.stats.uplink_latency.add(time.monotonic() - notified)
+
+    def notify_when_sent(self, node, callback):
+        return False
+
+    def __getattr__(self, name):
+        # The other requests are not measured
+        return lambda *args, **kwargs: None
+
+
+async def report_loop(emulator, interval, duration=None):
+    started = time.monotonic()
+    while duration is None or time.monotonic() - started < duration:
+        await asyncio.sleep(interval if duration is None else min(interval, duration - (time.monotonic() - started)))
+        print(emulator.stats.report(emulator, emulator.baudrate), file=sys.stderr)
+
+
+async def emulate(args, loop):
+    emulator = MasterEmulator(make_nodes(args), args, random.Random(args.seed + 1), loop)
+    if args.tcp:
+        # Connect to the controller like the TCP gateway of the master
+        host, port = args.tcp.rsplit(':', 1)
+        reader, writer = await asyncio.open_connection(host, int(port))
+    else:
+        reader, writer = await setup_stdio(loop)
+
+    emulator.attach(reader, writer)
+    reporter = asyncio.ensure_future(report_loop(emulator, args.report_interval, args.duration))
+    await asyncio.wait([emulator.serve_task, reporter], return_when=asyncio.FIRST_COMPLETED)
+    print(emulator.stats.report(emulator, emulator.baudrate), file=sys.stderr)
+
+
+async def bench(args, loop):
+    """
+    Runs the controller in this process against the emulator
+    """
+    # Imported here, the other modes do not need the dependencies of the controller
+    from configuration import Configuration
+    from master import Master
+    import main as controller
+
+    directory = tempfile.mkdtemp(prefix="waschbench")
+    generate_config(args, directory)
+    config = Configuration(configfile='config.conf', pathprefix=directory)
+
+    emulator = MasterEmulator(make_nodes(args), args, random.Random(args.seed + 1), loop)
+    uplink = BenchUplink(emulator)
+
+    class BenchMaster(Master):
+        async def connect(self, reset=True):
+            self._reader = asyncio.StreamReader()
+            emulator_reader = asyncio.StreamReader()
+            self._writer = PipeWriter(emulator_reader)
+            emulator.attach(emulator_reader, PipeWriter(self._reader))
+
+        async def run(self):
+            try:
+                await super().run()
+            except Exception:
+                # Master.run() stops the loop, the exception would be lost
+                emulog.exception("Controller failed")
+                raise
+
+    master = BenchMaster(loop, config.subconfig('network').subconfig('MASTER'), uplink)
+    uplink.master = master
+    controller.load_nodes(config, master, uplink)
+
+    cpu = time.process_time()
+    task = asyncio.ensure_future(master.run())
+    await report_loop(emulator, args.report_interval, args.duration)
+    task.cancel()
+
+    elapsed = time.monotonic() - emulator.stats.started
+    print("CPU time of the controller and the emulator: {:.1f}s ({:.0f}% of one core)".format(
+        time.process_time() - cpu, (time.process_time() - cpu) / elapsed * 100), file=sys.stderr)
+    shutil.rmtree(directory)
+
+
+def emulator_main(argv):
+    parser = argparse.ArgumentParser(prog="test.py", description="Emulator of the master and the mesh network.")
+    sub = parser.add_subparsers(dest="mode")
+    modes = {
+        "emulate": "Emulate the master on stdin / stdout (socat, see run_tests.sh) or over TCP",
+        "bench": "Run the controller in this process against the emulator",
+        "genconf": "Write the controller configuration of the emulated network",
+    }
+    for mode, text in modes.items():
+        p = sub.add_parser(mode, help=text)
+        net = p.add_argument_group("network")
+        net.add_argument("--nodes", type=int, default=50, help="Number of nodes (1 - 254, default 50)")
+        net.add_argument("--depth", type=int, default=3, help="Max hop count, the nodes are spread evenly (default 3)")
+        net.add_argument("--seed", type=int, default=1, help="Seed of the topology and the random events")
+        net.add_argument("--binary", action="store_true", help="Controller uses the binary protocol")
+        net.add_argument("--max-inflight", type=int, help="max_inflight of the controller")
+        net.add_argument("--max-inflight-per-relay", type=int, help="max_inflight_per_relay of the controller")
+
+        if mode == "genconf":
+            p.add_argument("directory", help="Output directory, start the controller with it as config prefix")
+            p.add_argument("--connection", choices=("serial", "tcp"), default="serial")
+            p.add_argument("--port", type=int, default=12345, help="TCP port of the controller")
+            continue
+
+        radio = p.add_argument_group("radio")
+        radio.add_argument("--latency", type=float, default=40, help="Median delay per hop in ms (default 40)")
+        radio.add_argument("--jitter", type=float, default=0.5, help="Sigma of the log-normal hop delay (default 0.5)")
+        radio.add_argument("--loss", type=float, default=0.02, help="Loss probability per hop (default 0.02)")
+        radio.add_argument("--dead", type=float, default=0, help="Share of the nodes that never answer")
+        radio.add_argument("--node-delay", type=float, default=5, help="Processing time on the node in ms")
+        radio.add_argument("--status-retry", type=float, default=1, help="Retry interval of the status updates (s)")
+
+        master = p.add_argument_group("master")
+        master.add_argument("--cmd-delay", type=float, default=2, help="Processing time of a command in ms")
+        master.add_argument("--baud", type=int, default=115200, help="Baud rate of the serial output, 0: unlimited")
+
+        usage = p.add_argument_group("usage")
+        usage.add_argument("--uses-per-day", type=float, default=6, help="Uses per machine and day (default 6)")
+        usage.add_argument("--cycle", type=float, default=75, help="Mean duration of a machine cycle in min")
+        usage.add_argument("--speedup", type=float, default=1, help="Time lapse factor of the usage profile")
+        usage.add_argument("--status-rate", type=float, default=0,
+                           help="Fixed rate of status changes per machine (1/s) instead of the usage profile")
+
+        p.add_argument("--duration", type=float, help="Stop after this number of seconds")
+        p.add_argument("--report-interval", type=float, default=10, help="Seconds between the reports")
+        p.add_argument("-v", "--verbose", action="store_true", help="Log every line")
+        if mode == "emulate":
+            p.add_argument("--tcp", metavar="HOST:PORT", help="Connect to the controller instead of stdin / stdout")
+        else:
+            p.add_argument("--port", type=int, default=12345)
+            p.set_defaults(connection="serial")
+
+    args = parser.parse_args(argv)
+    if args.mode is None:
+        parser.print_help()
+        return
+    if not 1 <= args.nodes <= 254:
+        parser.error("--nodes must be 1 - 254")
+    args.depth = max(1, min(args.depth, args.nodes))
+
+    if args.mode == "genconf":
+        generate_config(args, args.directory)
+        return
+
+    emulog.setLevel(logging.DEBUG if args.verbose else logging.INFO)
+    log.setLevel(logging.WARNING)
+    loop = asyncio.get_event_loop()
+    if args.mode == "emulate":
+        loop.run_until_complete(emulate(args, loop))
+    else:
+        if not args.verbose:
+            # The controller logs every retransmission
+            logging.getLogger().setLevel(logging.ERROR)
+        # The master prints every line
+        with open(os.devnull, 'w') as devnull, contextlib.redirect_stdout(devnull):
+            try:
+                loop.run_until_complete(bench(args, loop))
+            except RuntimeError:
+                sys.exit(1)
+
+
+
 def test(mode):
     loop = asyncio.get_event_loop()
     stdin, stdout = loop.run_until_complete(setup_stdio(loop=loop))
@@ -118,4 +1140,7 @@ def test(mode):
         raise KeyError("Invalid Mode")
 
 if __name__== "__main__":
-    test(sys.argv[1])
+    if len(sys.argv) > 1 and sys.argv[1] in ("emulate", "bench", "genconf"):
+        emulator_main(sys.argv[1:])
+    else:
+        test(sys.argv[1])
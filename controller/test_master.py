@@ -0,0 +1,151 @@
+"""
+Checks of the master scheduling that do not need a master or an emulated network
+
+python3 test_master.py
+"""
+
+import asyncio
+import logging
+import sys
+import time
+
+from master import Master, split_command, MAX_COMMAND_LENGTH
+
+logformat = '%(asctime)s | %(name)s | %(levelname)s | %(message)s'
+logging.basicConfig(format=logformat)
+
+
+class FakeUplink:
+    def __init__(self):
+        self.serial_status = []
+
+    def on_serial_status(self, node, status):
+        self.serial_status.append((node, status))
+
+
+class FakeNode:
+    def __init__(self, name):
+        self._name = name
+        self.pending = True
+        self.timeouts = 0
+
+    def name(self):
+        return self._name
+
+    def node_id(self):
+        return 1
+
+    def command_pending(self):
+        return self.pending
+
+    def on_timeout(self):
+        self.timeouts += 1
+        self.pending = False
+
+    def next_timer(self):
+        return None
+
+
+def make_master(config=None):
+    conf = {'inflight_timeout': 10, 'gateway_watchdog_interval': 60, 'alive_signal_interval': 60}
+    conf.update(config or {})
+    return Master(asyncio.new_event_loop(), conf, FakeUplink())
+
+
+def test_inflight_deadline():
+    """
+    A command without ACK or TIMEOUT is handled like a TIMEOUT after inflight_timeout
+    """
+    master = make_master()
+    node = FakeNode("HSH1")
+    master.nodes[node.name()] = node
+
+    now = time.monotonic()
+    master.inflight[node.name()] = 7
+    master.inflight_deadlines[node.name()] = now + 10
+    master.last_node_commands[node.name()] = "status 1"
+
+    if master.next_timer() > now + 10:
+        return "the deadline is not a timer of the main loop"
+
+    master.expire_inflight(now + 5)
+    if node.name() not in master.inflight or node.timeouts:
+        return "the command expired before its deadline"
+
+    master.expire_inflight(now + 10)
+    if node.name() in master.inflight or node.name() in master.inflight_deadlines:
+        return "the expired command is still in flight"
+    if node.timeouts != 1:
+        return "the expired command has not been handled like a TIMEOUT"
+    if master.uplink.serial_status != [(node.name(), "TIMEOUT - status 1")]:
+        return "the TIMEOUT has not been reported to the uplink"
+
+    # A command that is not pending (e.g. no PEND) is just removed
+    master.inflight[node.name()] = 8
+    master.inflight_deadlines[node.name()] = now
+    master.expire_inflight(now)
+    if node.name() in master.inflight or node.timeouts != 1:
+        return "the command without PEND has not been removed"
+
+    return None
+
+
+def test_split_command():
+    """
+    Long route lists are split into commands that fit into the command buffer of the master
+    """
+    if split_command('routes', []) != []:
+        return "an empty list gives a command"
+
+    if split_command('routes', ["1:2", "3:2"]) != ["routes 1:2,3:2"]:
+        return "a short list has been split"
+
+    # Routes of a network with 250 nodes
+    routes = ["{}:{}".format(d, d % 7 + 1) for d in range(2, 252)]
+    commands = split_command('routes', routes)
+    if len(commands) < 2:
+        return "a long list has not been split"
+
+    items = []
+    for cmd in commands:
+        if len(cmd) > MAX_COMMAND_LENGTH:
+            return "command of {} chars is too long".format(len(cmd))
+        # The master's buffer also has to hold the longest tag and the terminating 0
+        if len("@65535 " + cmd) > 200 - 1:
+            return "tagged command of {} chars does not fit".format(len(cmd))
+        name, _, args = cmd.partition(' ')
+        if name != 'routes':
+            return "wrong command '{}'".format(name)
+        items += args.split(',')
+
+    if items != routes:
+        return "the items changed while splitting"
+
+    # The commands are filled up, only the last one may be short
+    for cmd in commands[:-1]:
+        if len(cmd) + len(',252:1') <= MAX_COMMAND_LENGTH:
+            return "a command has been split too early"
+
+    return None
+
+
+TESTS = [test_inflight_deadline, test_split_command]
+
+
+def main():
+    failed = 0
+    for test in TESTS:
+        error = test()
+        if error is not None:
+            print("FAILED {}: {}".format(test.__name__, error))
+            failed += 1
+
+    if failed:
+        return 1
+
+    print("OK")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
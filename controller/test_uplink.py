@@ -0,0 +1,194 @@
+"""
+Stand-in for the status site to test the uplink
+
+python3 test_uplink.py server [port]
+    Logs all requests, set base_url = "http://localhost:<port>" in uplink.conf.
+    Send "down" / "up" / "slow" on stdin to simulate an outage or a slow site.
+
+python3 test_uplink.py outage
+    Sends status changes through the uplink while the site is down for some time,
+    then checks that the latest state of every machine arrived and that every
+    notify_when_sent() callback has been called.
+
+python3 test_uplink.py rejected
+    Sends requests the site rejects between valid ones, then checks that only the
+    accepted requests are counted as sent and the rejected ones as dropped, and that
+    the callbacks report the rejection.
+"""
+
+import asyncio
+import logging
+import random
+import sys
+
+from aiohttp import web
+
+from uplink import WaschUplink
+
+logformat = '%(asctime)s | %(name)s | %(levelname)s | %(message)s'
+logging.basicConfig(format=logformat)
+log = logging.getLogger('site')
+log.setLevel(logging.INFO)
+
+
+class StandInSite:
+    def __init__(self):
+        self.down = False
+        self.delay = 0
+        # Requests for these machines are rejected with 404
+        self.unknown = set()
+        self.requests = []
+        # Latest state of every machine
+        self.machines = {}
+
+    async def handle(self, request):
+        if self.down:
+            return web.Response(status=503)
+
+        if self.delay:
+            await asyncio.sleep(self.delay)
+
+        path = request.path
+        self.requests.append(path)
+        log.info("GET %s", request.path_qs)
+
+        parts = path.strip('/').split('/')
+        if parts[0] == 'machine' and parts[1] in self.unknown:
+            return web.Response(status=404)
+        if parts[0] == 'machine' and len(parts) == 4:
+            self.machines[parts[1]] = parts[2]
+        return web.Response(text="OK")
+
+    async def start(self, port):
+        app = web.Application()
+        app.router.add_get('/{tail:.*}', self.handle)
+        runner = web.AppRunner(app)
+        await runner.setup()
+        await web.TCPSite(runner, 'localhost', port).start()
+
+
+async def read_commands(site, loop):
+    reader = asyncio.StreamReader()
+    await loop.connect_read_pipe(lambda: asyncio.StreamReaderProtocol(reader), sys.stdin)
+    async for line in reader:
+        cmd = line.decode('ascii').strip()
+        if cmd == 'down':
+            site.down = True
+        elif cmd == 'up':
+            site.down = False
+            site.delay = 0
+        elif cmd == 'slow':
+            site.delay = 2
+        log.info("Site is now %s", "down" if site.down else "slow" if site.delay else "up")
+
+
+async def outage_test(port):
+    site = StandInSite()
+    await site.start(port)
+
+    uplink = WaschUplink({'base_url': 'http://localhost:{}'.format(port), 'key': 'test',
+                          'batch_window': 0.1, 'retry_min': 0.1, 'retry_max': 1,
+                          'max_extralog': 50})
+
+    expected = {}
+    notified = []
+    site.down = True
+    for i in range(2000):
+        machine = "HSH{}".format(random.randint(1, 20))
+        status = random.randint(0, 3)
+        expected[machine] = str(status)
+        uplink.on_status_change(machine, status)
+        uplink.notify_when_sent(machine, lambda sent, i=i: notified.append(i))
+        uplink.on_serial_status(machine, "ACK - status {}".format(i))
+        if i % 100 == 0:
+            await asyncio.sleep(0.1)
+
+    log.info("Queued %d requests while the site is down", uplink.queue_depth())
+    await asyncio.sleep(1)
+    site.down = False
+
+    while uplink.queue_depth():
+        await asyncio.sleep(0.1)
+    await asyncio.sleep(0.5)
+
+    uplink.task.cancel()
+    try:
+        await uplink.task
+    except asyncio.CancelledError:
+        pass
+
+    print(uplink.debug_state())
+    print("{} requests received".format(len(site.requests)))
+    if site.machines != expected:
+        print("FAILED: the site has not got the latest states")
+        return 1
+    if sorted(notified) != list(range(2000)):
+        print("FAILED: {} of 2000 sent callbacks called".format(len(set(notified))))
+        return 1
+
+    print("OK")
+    return 0
+
+
+async def rejected_test(port):
+    site = StandInSite()
+    site.unknown = {"HSH{}".format(i) for i in range(10, 20)}
+    await site.start(port)
+
+    uplink = WaschUplink({'base_url': 'http://localhost:{}'.format(port), 'key': 'test',
+                          'batch_window': 0.1, 'retry_min': 0.1, 'retry_max': 1})
+    latencies = []
+    uplink.latency_observer = latencies.append
+
+    results = {}
+    for i in range(20):
+        machine = "HSH{}".format(i)
+        uplink.on_status_change(machine, 1)
+        uplink.notify_when_sent(machine, lambda sent, m=machine: results.__setitem__(m, sent))
+
+    while uplink.queue_depth():
+        await asyncio.sleep(0.1)
+    await asyncio.sleep(0.5)
+
+    uplink.task.cancel()
+    try:
+        await uplink.task
+    except asyncio.CancelledError:
+        pass
+
+    print(uplink.debug_state())
+    if uplink.sent != 10 or len(latencies) != 10:
+        print("FAILED: rejected requests are counted as sent")
+        return 1
+    if uplink.rejected != 10 or uplink.dropped != 10 or uplink.failed:
+        print("FAILED: rejected requests are not counted as dropped")
+        return 1
+    if len(site.machines) != 10:
+        print("FAILED: the accepted requests did not arrive")
+        return 1
+    if results != {m: m not in site.unknown for m in ("HSH{}".format(i) for i in range(20))}:
+        print("FAILED: the callbacks did not report the rejected requests")
+        return 1
+
+    print("OK")
+    return 0
+
+
+def main():
+    loop = asyncio.get_event_loop()
+    mode = sys.argv[1] if len(sys.argv) > 1 else 'server'
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 8080
+
+    if mode == 'server':
+        site = StandInSite()
+        loop.run_until_complete(site.start(port))
+        loop.run_until_complete(read_commands(site, loop))
+    elif mode == 'outage':
+        sys.exit(loop.run_until_complete(outage_test(port)))
+    elif mode == 'rejected':
+        sys.exit(loop.run_until_complete(rejected_test(port)))
+    else:
+        raise KeyError("Invalid Mode")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,585 @@
+"""
+Local time series store of the controller
+
+Everything the controller learns about the network (status changes, raw frames, raw status
+snapshots, round-trip times) is appended to segment files with fixed-size binary records, so it
+can be queried without the status site, e.g. all transitions of a node in the last week or the
+raw frames of a channel for tuning the state estimation.
+
+<directory>/<start>.seg  records of a segment, <start> is the unix time of its first record
+<directory>/<start>.idx  index of the segment, one entry per block of BLOCK_RECORDS records
+<directory>/nodes.json   node names -> node ids
+
+The times in a segment never decrease, so the start of a range is found with a binary search.
+An index entry holds the time of the first record of its block and the kinds and nodes of the
+records in the block, a scan skips the blocks without the requested records.
+The segment file is authoritative, the index only covers the complete blocks and is rebuilt if
+it is missing or short.
+
+python3 timeseries.py <directory> transitions <node> [days]
+python3 timeseries.py <directory> dump [--kind KIND] [--node NODE] [--from TIME] [--to TIME]
+    Query the store, the times are unix times or days ago (e.g. -7).
+"""
+
+import argparse
+import collections
+import json
+import logging
+import mmap
+import os
+import re
+import struct
+import time
+
+# time (unix time), kind, node id, field, value
+RECORD_FORMAT = "<dBBHI"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+# time of the first record, kinds bitmask, nodes bitmask (256 bits)
+INDEX_FORMAT = "<dI32s"
+INDEX_SIZE = struct.calcsize(INDEX_FORMAT)
+BLOCK_RECORDS = 1024
+
+# Record kinds and their fields
+STATUS = 1      # status update of a node, value: status
+RTT = 2         # ACK of a command, value: round-trip time in ms (including retransmissions)
+TIMEOUT = 3     # TIMEOUT of a command, value: time until the timeout in ms
+RAW_FRAME = 4   # raw frame value, field: channel (NO_CHANNEL if unknown), value: frame value
+RAW_STATUS = 5  # value of a raw status snapshot, field: see RAW_STATUS_FIELDS / raw_status_field()
+
+KIND_NAMES = {STATUS: "status", RTT: "rtt", TIMEOUT: "timeout", RAW_FRAME: "raw", RAW_STATUS: "raw_status"}
+
+NO_CHANNEL = 0xFFFF
+
+# Values of the raw status output of the master (see handle_raw_status), True for hex values
+RAW_STATUS_FIELDS = collections.OrderedDict([
+    ("Node status", (0, True)),
+    ("Channel status", (1, True)),
+    ("Status at master", (2, True)),
+    ("Channel enabled", (3, True)),
+    ("Retransmissions", (4, False)),
+    ("Uptime", (5, False)),
+    ("ADC loop delay", (6, False)),
+    ("RT delay", (7, False)),
+])
+
+# Values of a channel, the field is 0x100 * (channel + 1) + the number of the value
+RAW_STATUS_CHANNEL_FIELDS = ("Input", "Filtered", "Status", "Raw", "Neg")
+
+Record = collections.namedtuple("Record", ("time", "kind", "node", "field", "value"))
+
+
+def raw_status_field(channel, name):
+    return 0x100 * (channel + 1) + RAW_STATUS_CHANNEL_FIELDS.index(name)
+
+
+def raw_status_field_name(field):
+    if field < 0x100:
+        for name, (number, _) in RAW_STATUS_FIELDS.items():
+            if number == field:
+                return name
+        return str(field)
+
+    channel = (field >> 8) - 1
+    value = field & 0xFF
+    if value < len(RAW_STATUS_CHANNEL_FIELDS):
+        return "Channel {} {}".format(channel, RAW_STATUS_CHANNEL_FIELDS[value])
+    return "Channel {} {}".format(channel, value)
+
+
+class Segment:
+    """
+    Read-only view of a segment file
+    """
+    def __init__(self, path):
+        self.path = path
+        self.file = open(path, 'rb')
+        size = os.fstat(self.file.fileno()).st_size
+        # A partial record at the end is from a crash while writing
+        self.count = size // RECORD_SIZE
+        self.map = None
+        if self.count:
+            self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        self.index = read_index(os.path.splitext(path)[0] + ".idx", self.count // BLOCK_RECORDS)
+
+    def close(self):
+        if self.map is not None:
+            self.map.close()
+        self.file.close()
+
+    def time_at(self, pos):
+        return struct.unpack_from("<d", self.map, pos * RECORD_SIZE)[0]
+
+    def find(self, timestamp):
+        """
+        Position of the first record at or after the time
+        """
+        lo, hi = 0, self.count
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if self.time_at(mid) < timestamp:
+                lo = mid + 1
+            else:
+                hi = mid
+        return lo
+
+    def records(self, start=None, end=None, kind_mask=None, node_mask=None):
+        if not self.count:
+            return
+
+        pos = 0 if start is None else self.find(start)
+        while pos < self.count:
+            block = pos // BLOCK_RECORDS
+            block_end = min((block + 1) * BLOCK_RECORDS, self.count)
+            if block < len(self.index):
+                first, kinds, nodes = self.index[block]
+                if end is not None and first > end:
+                    return
+                if (kind_mask is not None and not kinds & kind_mask) or \
+                   (node_mask is not None and not nodes & node_mask):
+                    pos = block_end
+                    continue
+
+            data = self.map[pos * RECORD_SIZE:block_end * RECORD_SIZE]
+            for rec in struct.iter_unpack(RECORD_FORMAT, data):
+                if end is not None and rec[0] > end:
+                    return
+                if kind_mask is not None and not kind_mask & (1 << rec[1]):
+                    continue
+                if node_mask is not None and not node_mask & (1 << rec[2]):
+                    continue
+                yield Record(*rec)
+            pos = block_end
+
+
+def read_index(path, blocks):
+    """
+    Index entries (time, kinds mask, nodes mask) of the first complete blocks
+    """
+    try:
+        with open(path, 'rb') as indexfile:
+            data = indexfile.read(blocks * INDEX_SIZE)
+    except FileNotFoundError:
+        return []
+
+    return [(first, kinds, int.from_bytes(nodes, 'little'))
+            for first, kinds, nodes in struct.iter_unpack(INDEX_FORMAT, data[:len(data) // INDEX_SIZE * INDEX_SIZE])]
+
+
+def block_summary(data):
+    first = None
+    kinds = 0
+    nodes = 0
+    for rec in struct.iter_unpack(RECORD_FORMAT, data):
+        if first is None:
+            first = rec[0]
+        kinds |= 1 << rec[1]
+        nodes |= 1 << rec[2]
+    return first, kinds, nodes
+
+
+def pack_index(first, kinds, nodes):
+    return struct.pack(INDEX_FORMAT, first, kinds, nodes.to_bytes(32, 'little'))
+
+
+class TimeSeriesStore:
+    """
+    Append-only store, there is one writer (the controller), readers (readonly=True) only map the segments
+    """
+    def __init__(self, directory, segment_duration=86400, retention=None, readonly=False):
+        self.directory = directory
+        self.segment_duration = segment_duration
+        # Age in seconds after which the segments are deleted, None to keep them
+        self.retention = retention
+        self.log = logging.getLogger('timeseries')
+
+        self.file = None
+        self.segment_start = None
+        self.count = 0
+        self.last_time = 0
+        # Summary of the current block for the index
+        self.block_first = None
+        self.block_kinds = 0
+        self.block_nodes = 0
+
+        self.written = 0
+
+        if readonly:
+            return
+
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+
+        self.__open_last_segment()
+
+    def segments(self):
+        """
+        Sorted list of (start time, path) of the segments
+        """
+        result = []
+        for name in os.listdir(self.directory):
+            match = re.fullmatch(r"(\d+)\.seg", name)
+            if match:
+                result.append((int(match.group(1)), os.path.join(self.directory, name)))
+        return sorted(result)
+
+    def __open_last_segment(self):
+        segments = self.segments()
+        if not segments:
+            return
+
+        start, path = segments[-1]
+        with open(path, 'r+b') as segfile:
+            size = os.fstat(segfile.fileno()).st_size
+            if size % RECORD_SIZE:
+                self.log.warning("Dropping a partial record at the end of {}".format(path))
+                segfile.truncate(size - size % RECORD_SIZE)
+            data = segfile.read()
+
+        count = len(data) // RECORD_SIZE
+        if count:
+            self.last_time = struct.unpack_from("<d", data, (count - 1) * RECORD_SIZE)[0]
+
+        if start + self.segment_duration <= time.time():
+            # Too old, the next record starts a new segment
+            return
+
+        # Rebuild the index if the last entries are missing
+        blocks = count // BLOCK_RECORDS
+        indexpath = os.path.splitext(path)[0] + ".idx"
+        index = read_index(indexpath, blocks)
+        if len(index) < blocks:
+            self.log.info("Rebuilding the index of {}".format(path))
+            with open(indexpath, 'wb') as indexfile:
+                for block in range(blocks):
+                    summary = block_summary(data[block * BLOCK_RECORDS * RECORD_SIZE:
+                                                 (block + 1) * BLOCK_RECORDS * RECORD_SIZE])
+                    indexfile.write(pack_index(*summary))
+        elif blocks:
+            # Entries of blocks that were not written completely
+            with open(indexpath, 'r+b') as indexfile:
+                indexfile.truncate(blocks * INDEX_SIZE)
+
+        self.block_first, self.block_kinds, self.block_nodes = \
+            block_summary(data[blocks * BLOCK_RECORDS * RECORD_SIZE:])
+        self.segment_start = start
+        self.count = count
+        self.file = open(path, 'ab', buffering=0)
+
+    def __new_segment(self, timestamp):
+        self.close()
+
+        self.segment_start = int(timestamp)
+        while os.path.exists(self.__path(self.segment_start)):
+            # Only after a clock jump
+            self.segment_start += 1
+        self.count = 0
+        self.block_first = None
+        self.block_kinds = 0
+        self.block_nodes = 0
+        self.file = open(self.__path(self.segment_start), 'ab', buffering=0)
+        self.expire()
+
+    def __path(self, start, ext=".seg"):
+        return os.path.join(self.directory, "{:010d}{}".format(start, ext))
+
+    def expire(self):
+        """
+        Deletes the segments that only contain records older than the retention time
+        """
+        if self.retention is None:
+            return
+
+        limit = time.time() - self.retention
+        segments = self.segments()
+        # A segment ends where the next one starts
+        for (start, path), (next_start, _) in zip(segments, segments[1:]):
+            if next_start > limit:
+                break
+            self.log.info("Deleting segment {}".format(path))
+            os.remove(path)
+            try:
+                os.remove(os.path.splitext(path)[0] + ".idx")
+            except FileNotFoundError:
+                pass
+
+    def append(self, kind, node, field, value, timestamp=None):
+        self.append_records([(kind, node, field, value)], timestamp)
+
+    def append_records(self, records, timestamp=None):
+        """
+        Appends (kind, node id, field, value) records with the same time
+        """
+        if timestamp is None:
+            timestamp = time.time()
+        # The times never decrease, also not if the clock is set back
+        timestamp = max(timestamp, self.last_time)
+        self.last_time = timestamp
+
+        if self.file is None or self.segment_start + self.segment_duration <= timestamp:
+            self.__new_segment(timestamp)
+
+        data = bytearray()
+        index = bytearray()
+        for kind, node, field, value in records:
+            data += struct.pack(RECORD_FORMAT, timestamp, kind, node, field & 0xFFFF, value & 0xFFFFFFFF)
+
+            if self.block_first is None:
+                self.block_first = timestamp
+            self.block_kinds |= 1 << kind
+            self.block_nodes |= 1 << node
+            self.count += 1
+
+            if self.count % BLOCK_RECORDS == 0:
+                index += pack_index(self.block_first, self.block_kinds, self.block_nodes)
+                self.block_first = None
+                self.block_kinds = 0
+                self.block_nodes = 0
+
+        try:
+            self.file.write(data)
+            if index:
+                with open(self.__path(self.segment_start, ".idx"), 'ab') as indexfile:
+                    indexfile.write(index)
+        except OSError as error:
+            self.log.warning("Failed to write to the time series store: {}".format(error))
+            return
+        self.written += len(records)
+
+    def set_node_names(self, names):
+        """
+        Saves the names of the node ids for the queries
+        """
+        path = os.path.join(self.directory, "nodes.json")
+        try:
+            with open(path + ".tmp", 'w') as namefile:
+                json.dump(names, namefile)
+            os.replace(path + ".tmp", path)
+        except OSError as error:
+            self.log.warning("Failed to save the node names: {}".format(error))
+
+    def node_names(self):
+        try:
+            with open(os.path.join(self.directory, "nodes.json")) as namefile:
+                return json.load(namefile)
+        except (OSError, ValueError):
+            return {}
+
+    def scan(self, start=None, end=None, kinds=None, nodes=None):
+        """
+        Records in the time range (unix times, None for no limit), optionally only of some kinds and node ids
+        """
+        kind_mask = None if kinds is None else sum(1 << k for k in set(kinds))
+        node_mask = None if nodes is None else sum(1 << n for n in set(nodes))
+
+        segments = self.segments()
+        for i, (seg_start, path) in enumerate(segments):
+            if end is not None and seg_start > end:
+                break
+            if start is not None and i + 1 < len(segments) and segments[i + 1][0] + 1 < start:
+                # All records are before the next segment starts (at most the time of its first record)
+                continue
+
+            segment = Segment(path)
+            try:
+                yield from segment.records(start, end, kind_mask, node_mask)
+            finally:
+                segment.close()
+
+    def close(self):
+        if self.file is not None:
+            self.file.close()
+            self.file = None
+
+    def debug_state(self):
+        return "Time series: {} records written, segment {} with {} records\n".format(
+            self.written, self.segment_start, self.count)
+
+
+def transitions(records):
+    """
+    The status records that changed the status of their node, as (time, node, old status, new status)
+    """
+    last = {}
+    for rec in records:
+        if rec.kind != STATUS:
+            continue
+        old = last.get(rec.node)
+        if old != rec.value:
+            yield (rec.time, rec.node, old, rec.value)
+            last[rec.node] = rec.value
+
+
+class Collector:
+    """
+    Feeds the information of the master into the store.
+    The raw frames and raw status snapshots are parsed from the output of the master.
+    """
+    RAW_BLOCK_RE = re.compile(r"^(?:###)?RAW(\d+)-(\d+)(?: (.*))?$")
+    RAW_STATUS_BEGIN_RE = re.compile(r"^Raw status data for node (\d+)$")
+    RAW_STATUS_VALUE_RE = re.compile(r"^([A-Za-z ]+):\s*([0-9A-Fa-f]+)$")
+    RAW_STATUS_CHANNEL_RE = re.compile(r"^Channel (\d+) \((WASCH|FREQ)\)$")
+    RAW_FRAMES_CMD_RE = re.compile(r"^raw_frames (\d+) (\d+)")
+
+    def __init__(self, store):
+        self.store = store
+
+        # Current raw frame block: node, expected number of values, values
+        self.raw_block = None
+        # Current raw status snapshot: node, time, channel, records
+        self.raw_status = None
+        # Channel of the last raw_frames command of each node
+        self.raw_channels = {}
+
+    def status(self, node_id, status):
+        self.store.append(STATUS, node_id, 0, status)
+
+    def rtt(self, node_id, seconds):
+        self.store.append(RTT, node_id, 0, int(seconds * 1000))
+
+    def timeout(self, node_id, seconds):
+        self.store.append(TIMEOUT, node_id, 0, int(seconds * 1000))
+
+    def command_sent(self, cmd):
+        match = self.RAW_FRAMES_CMD_RE.match(cmd)
+        if match:
+            self.raw_channels[int(match.group(1))] = int(match.group(2))
+
+    def raw_frame(self, node_id, values):
+        channel = self.raw_channels.get(node_id, NO_CHANNEL)
+        self.store.append_records([(RAW_FRAME, node_id, channel, v) for v in values])
+
+    def line(self, text):
+        """
+        A line of the text output of the master (or a LOG frame of the binary protocol)
+        """
+        text = text.strip()
+        if self.raw_block is not None:
+            if text.startswith("*") and text[1:].isdigit():
+                self.raw_block[2].append(int(text[1:]))
+                if len(self.raw_block[2]) >= self.raw_block[1]:
+                    self.__finish_raw_block()
+                return
+            self.__finish_raw_block()
+
+        if self.raw_status is not None and self.__raw_status_line(text):
+            return
+        self.__finish_raw_status()
+
+        match = self.RAW_BLOCK_RE.match(text)
+        if match:
+            node_id, count = int(match.group(1)), int(match.group(2))
+            if match.group(3):
+                # Block in one line, as written by serialframe.describe()
+                self.raw_frame(node_id, [int(v) for v in match.group(3).split()])
+            elif count:
+                self.raw_block = (node_id, count, [])
+            return
+
+        match = self.RAW_STATUS_BEGIN_RE.match(text)
+        if match:
+            self.raw_status = [int(match.group(1)), time.time(), None, []]
+
+    def __finish_raw_block(self):
+        node_id, _, values = self.raw_block
+        self.raw_block = None
+        if values:
+            self.raw_frame(node_id, values)
+
+    def __raw_status_line(self, text):
+        match = self.RAW_STATUS_CHANNEL_RE.match(text)
+        if match:
+            self.raw_status[2] = int(match.group(1))
+            return True
+
+        match = self.RAW_STATUS_VALUE_RE.match(text)
+        if not match:
+            return False
+
+        node_id, _, channel, records = self.raw_status
+        name, value = match.group(1), match.group(2)
+        if name in RAW_STATUS_FIELDS:
+            field, is_hex = RAW_STATUS_FIELDS[name]
+        elif channel is not None and name in RAW_STATUS_CHANNEL_FIELDS:
+            field, is_hex = raw_status_field(channel, name), False
+        else:
+            return False
+
+        try:
+            records.append((RAW_STATUS, node_id, field, int(value, 16 if is_hex else 10)))
+        except ValueError:
+            return False
+        return True
+
+    def __finish_raw_status(self):
+        if self.raw_status is None:
+            return
+        _, timestamp, _, records = self.raw_status
+        self.raw_status = None
+        if records:
+            self.store.append_records(records, timestamp)
+
+
+def parse_time(text):
+    value = float(text)
+    if value <= 0:
+        # Days ago
+        return time.time() + value * 86400
+    return value
+
+
+def format_time(timestamp):
+    return time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(timestamp)) + ".{:03d}".format(
+        int(timestamp * 1000) % 1000)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Query the time series store of the controller.")
+    parser.add_argument("directory", help="Directory of the store (timeseries_dir)")
+    sub = parser.add_subparsers(dest="mode")
+
+    trans = sub.add_parser("transitions", help="Status changes of a node")
+    trans.add_argument("node", help="Name or id of the node")
+    trans.add_argument("days", type=float, nargs="?", default=7, help="Number of days back (default 7)")
+
+    dump = sub.add_parser("dump", help="Print the records")
+    dump.add_argument("--kind", choices=sorted(KIND_NAMES.values()), action="append")
+    dump.add_argument("--node", action="append", help="Name or id of a node")
+    dump.add_argument("--from", dest="start", type=parse_time, help="Unix time or days ago (e.g. -7)")
+    dump.add_argument("--to", dest="end", type=parse_time, help="Unix time or days ago (e.g. -1)")
+
+    args = parser.parse_args()
+
+    store = TimeSeriesStore(args.directory, readonly=True)
+    names = store.node_names()
+    ids = {v: k for k, v in names.items()}
+
+    def node_id(text):
+        if text in names:
+            return names[text]
+        return int(text)
+
+    if args.mode == "transitions":
+        node = node_id(args.node)
+        records = store.scan(time.time() - args.days * 86400, None, [STATUS], [node])
+        for timestamp, _, old, new in transitions(records):
+            print("{}  {} -> {}".format(format_time(timestamp), "?" if old is None else old, new))
+    elif args.mode == "dump":
+        kinds = None
+        if args.kind:
+            kinds = [k for k, name in KIND_NAMES.items() if name in args.kind]
+        nodes = None if args.node is None else [node_id(n) for n in args.node]
+        for rec in store.scan(args.start, args.end, kinds, nodes):
+            field = rec.field
+            if rec.kind == RAW_STATUS:
+                field = raw_status_field_name(rec.field)
+            elif rec.kind == RAW_FRAME and rec.field == NO_CHANNEL:
+                field = "-"
+            print("{}  {:10} {:10} {:20} {}".format(format_time(rec.time), KIND_NAMES.get(rec.kind, rec.kind),
+                                                    ids.get(rec.node, rec.node), field, rec.value))
+    else:
+        parser.print_help()
+
+
+if __name__ == "__main__":
+    main()
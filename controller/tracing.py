@@ -0,0 +1,149 @@
+"""
+Latency tracing of the status updates
+
+A status update of a node carries a trace (see msg_status_trace_t), the master adds
+the time it received the update. Together with the times in the controller, the
+latency of an update is split into:
+
+node:   detection of the status change on the node to the transmission that reached the master
+        (includes the retransmissions)
+serial: reception on the master to the parsing in the controller
+uplink: parsing in the controller to the completion of the request to the status site
+        (if the site rejected the request, the trace is counted as failed, its latency is still recorded)
+
+The radio transmission itself is not included, there is no common clock with the node.
+"""
+
+import collections
+import logging
+import math
+import time
+
+import metrics
+
+SEGMENTS = ("node", "serial", "uplink", "total")
+
+
+class StatusTrace:
+    def __init__(self, node, hops, status, adc_cycle, age_ms, attempt, received_ms):
+        self.node = node
+        self.hops = hops
+        self.status = status
+        self.adc_cycle = adc_cycle
+        self.attempt = attempt
+        self.received_ms = received_ms
+        self.parsed = time.monotonic()
+        # Set if the status site rejected the update
+        self.uplink_failed = False
+
+        self.delays = {"node": age_ms / 1000}
+
+    def total(self):
+        return sum(self.delays[s] for s in SEGMENTS[:-1] if s in self.delays)
+
+
+def percentile(values, p):
+    """
+    Nearest rank percentile of a sorted list
+    """
+    index = max(math.ceil(p / 100 * len(values)) - 1, 0)
+    return values[index]
+
+
+class LatencyTracker:
+    """
+    Keeps the latencies of the last traces per node and per hop count
+    """
+    QUANTILES = (50, 90, 99)
+
+    def __init__(self, window=500):
+        self.window = window
+        self.log = logging.getLogger('tracing')
+
+        # (group, key) -> segment -> deque of delays, group is 'node' or 'hops'
+        self.samples = collections.defaultdict(
+            lambda: {s: collections.deque(maxlen=self.window) for s in SEGMENTS})
+        self.attempts = collections.defaultdict(lambda: collections.deque(maxlen=self.window))
+
+        self.min_clock_offset = None
+
+        metrics.STATUS_LATENCY_QUANTILES.set_function(self.quantile_metrics)
+
+    def reset_clock(self):
+        """
+        The master has been restarted, its uptime starts again
+        """
+        self.min_clock_offset = None
+
+    def serial_delay(self, trace):
+        """
+        Estimates the delay between the master and the controller.
+        The offset between the uptime of the master and the controller's clock is taken from the
+        fastest update seen so far, so this is the delay compared to the fastest update.
+        """
+        offset = trace.parsed - trace.received_ms / 1000
+        if self.min_clock_offset is None or offset < self.min_clock_offset or offset - self.min_clock_offset > 3600:
+            # New minimum, or the uptime of the master wrapped around
+            self.min_clock_offset = offset
+        return offset - self.min_clock_offset
+
+    def start(self, trace):
+        trace.delays["serial"] = self.serial_delay(trace)
+
+    def uplink_done(self, trace, sent=True):
+        trace.delays["uplink"] = time.monotonic() - trace.parsed
+        trace.uplink_failed = not sent
+        self.finish(trace)
+
+    def finish(self, trace):
+        trace.delays["total"] = trace.total()
+
+        self.log.debug("Status {} of {}: cycle {}, attempt {}, {}{}".format(
+            trace.status, trace.node, trace.adc_cycle, trace.attempt,
+            ", ".join("{} {:.3f}s".format(s, d) for s, d in trace.delays.items()),
+            " (uplink failed)" if trace.uplink_failed else ""))
+
+        for key in (("node", trace.node), ("hops", trace.hops)):
+            for segment, delay in trace.delays.items():
+                self.samples[key][segment].append(delay)
+            self.attempts[key].append(trace.attempt)
+
+        for segment, delay in trace.delays.items():
+            metrics.STATUS_LATENCY.observe(delay, segment=segment, hops=trace.hops)
+        metrics.STATUS_ATTEMPTS.observe(trace.attempt, hops=trace.hops)
+        if trace.uplink_failed:
+            metrics.STATUS_UPLINK_FAILED.inc(hops=trace.hops)
+
+    def quantiles(self, key, segment):
+        values = sorted(self.samples[key][segment])
+        if not values:
+            return None
+        return [percentile(values, q) for q in self.QUANTILES]
+
+    def quantile_metrics(self):
+        result = {}
+        for (group, name), segments in list(self.samples.items()):
+            if group != "node":
+                continue
+            for segment in segments:
+                values = self.quantiles((group, name), segment)
+                if values is None:
+                    continue
+                for q, value in zip(self.QUANTILES, values):
+                    result[(name, segment, str(q / 100))] = value
+        return result
+
+    def debug_state(self):
+        state = "Status latency (p50 / p90 / p99 in seconds, mean attempts):\n"
+        for key in sorted(self.samples, key=lambda k: (k[0], str(k[1]))):
+            group, name = key
+            text = []
+            for segment in SEGMENTS:
+                values = self.quantiles(key, segment)
+                if values is not None:
+                    text.append("{} {}".format(segment, "/".join("{:.2f}".format(v) for v in values)))
+            attempts = self.attempts[key]
+            label = "{} hops".format(name) if group == "hops" else name
+            state += "    {:15}  {}, attempts {:.2f} ({} updates)\n".format(
+                label, ", ".join(text), sum(attempts) / len(attempts), len(attempts))
+        return state
@@ -1,61 +1,257 @@
 """
 Implementation of the uplink to the status site
+
+The requests are collected and sent in batches over one persistent connection.
+State updates (machine status, node alive, alive signal) are coalesced, only the
+latest state of every machine / node is sent. They are kept until they have
+been sent, so an outage of the site only delays them.
+The extralog requests are only for debugging, if the site can't keep up the
+oldest ones are dropped.
+Requests the site rejects (4xx, invalid URL) are dropped as well, a retry would not help.
 """
 
 import asyncio
+import collections
+import time
+import logging
 import aiohttp
 import urllib.parse
 
 
-async def worker(queue):
-    async with aiohttp.ClientSession() as session:
-        while True:
-            request = await queue.get()
-            print("########## UPLINK REQUEST: ", request)
-            try:
-                async with session.get(request) as resp:
-                    await resp.text()
-            except (aiohttp.InvalidURL, aiohttp.ClientConnectorError) as exp:
-                print(exp)
+# Results of sending a request
+SENT = 'sent'
+RETRY = 'retry'
+REJECTED = 'rejected'
+
+
+class UplinkRequest:
+    def __init__(self, url):
+        self.url = url
+        self.created = time.monotonic()
+        # Called with True when the request has been sent, with False if the site rejected it
+        self.callbacks = []
 
 
 class WaschUplink:
     def __init__(self, config):
         self.config = config
-        self.queue = asyncio.Queue()
+        self.log = logging.getLogger('uplink')
 
         self.url = config['base_url']
         self.key = config['key']
 
-        self.task = asyncio.ensure_future(worker(self.queue))
+        # Time to collect further requests before a batch is sent
+        self.batch_window = self.__get_config('batch_window', 0.5)
+        # Max number of queued extralog requests
+        self.max_extralog = int(self.__get_config('max_extralog', 1000))
+        # Delay after a failed batch, doubled with every further failure
+        self.retry_min = self.__get_config('retry_min', 1)
+        self.retry_max = self.__get_config('retry_max', 60)
+        self.request_timeout = self.__get_config('request_timeout', 10)
+
+        # Latest state update for every key, in the order of the first update
+        self.states = collections.OrderedDict()
+        self.extralog = collections.deque()
+
+        self.new_request = asyncio.Event()
+
+        # Statistics
+        self.sent = 0
+        self.failed = 0
+        self.dropped = 0
+        self.rejected = 0
+        self.coalesced = 0
+        self.retry_delay = 0
+        self.last_latency = 0
+        self.max_latency = 0
+        self.latency_sum = 0
+
+        # Called with the latency in seconds for every request accepted by the site
+        self.latency_observer = None
+
+        self.task = asyncio.ensure_future(self.worker())
+
+    def __get_config(self, key, default):
+        try:
+            return float(self.config[key])
+        except KeyError:
+            return default
+
+    def queue_depth(self):
+        return len(self.states) + len(self.extralog)
+
+    def __put_state(self, key, request):
+        if key in self.states:
+            # Latest state wins, the position in the queue stays the same
+            self.states[key].url = request
+            self.coalesced += 1
+        else:
+            self.states[key] = UplinkRequest(request)
+        self.new_request.set()
+
+    def __put_extralog(self, request):
+        if len(self.extralog) >= self.max_extralog:
+            self.extralog.popleft()
+            self.dropped += 1
+        self.extralog.append(UplinkRequest(request))
+        self.new_request.set()
+
+    def __take_batch(self):
+        batch = list(self.states.items()) + [(None, req) for req in self.extralog]
+        self.states = collections.OrderedDict()
+        self.extralog.clear()
+        return batch
+
+    def __requeue(self, batch):
+        """
+        Puts the unsent requests of a batch back in front of the queue
+        """
+        states = collections.OrderedDict()
+        extralog = []
+        for key, req in batch:
+            if key is None:
+                extralog.append(req)
+            elif key not in self.states:
+                # Keep it only if there is no newer state
+                states[key] = req
+            else:
+                # The callbacks wait for the newer state now
+                self.states[key].callbacks = req.callbacks + self.states[key].callbacks
+
+        states.update(self.states)
+        self.states = states
+
+        # Newer extralog requests are more interesting than the unsent old ones
+        space = max(self.max_extralog - len(self.extralog), 0)
+        keep = extralog[len(extralog) - space:] if space < len(extralog) else extralog
+        self.dropped += len(extralog) - len(keep)
+        self.extralog.extendleft(reversed(keep))
+
+    async def __send(self, session, req):
+        """
+        Returns SENT, RETRY if the request should be retried or REJECTED if a retry would not help
+        """
+        try:
+            async with session.get(req.url) as resp:
+                await resp.read()
+                if resp.status >= 500:
+                    self.log.warning("Uplink request failed with status {}".format(resp.status))
+                    return RETRY
+                if resp.status >= 400:
+                    self.log.error("Uplink request '{}' rejected with status {}".format(req.url, resp.status))
+                    return self.__rejected(req)
+        except aiohttp.InvalidURL as exp:
+            self.log.error("Invalid uplink request '{}': {}".format(req.url, exp))
+            return self.__rejected(req)
+        except (aiohttp.ClientError, asyncio.TimeoutError) as exp:
+            self.log.warning("Uplink request failed: {}".format(exp))
+            return RETRY
+
+        latency = time.monotonic() - req.created
+        self.sent += 1
+        self.last_latency = latency
+        self.max_latency = max(self.max_latency, latency)
+        self.latency_sum += latency
+        if self.latency_observer is not None:
+            self.latency_observer(latency)
+        for callback in req.callbacks:
+            callback(True)
+        return SENT
+
+    def __rejected(self, req):
+        for callback in req.callbacks:
+            callback(False)
+        return REJECTED
+
+    async def worker(self):
+        timeout = aiohttp.ClientTimeout(total=self.request_timeout)
+        # Only one connection, it is kept open between the requests
+        connector = aiohttp.TCPConnector(limit=1)
+        async with aiohttp.ClientSession(timeout=timeout, connector=connector) as session:
+            while True:
+                if self.queue_depth() == 0:
+                    self.new_request.clear()
+                    await self.new_request.wait()
+
+                # Give the state changes some time to settle
+                await asyncio.sleep(self.batch_window)
+
+                batch = self.__take_batch()
+                for i, (_, req) in enumerate(batch):
+                    result = await self.__send(session, req)
+                    if result == REJECTED:
+                        self.rejected += 1
+                        self.dropped += 1
+                    elif result == RETRY:
+                        self.failed += 1
+                        self.__requeue(batch[i:])
+                        break
+                else:
+                    self.retry_delay = 0
+                    continue
+
+                self.retry_delay = min(max(self.retry_delay * 2, self.retry_min), self.retry_max)
+                self.log.info("Uplink unavailable, retry in {} seconds".format(self.retry_delay))
+                await asyncio.sleep(self.retry_delay)
+
+    def debug_state(self):
+        return """Uplink:
+    queued:          {} states, {} extralog
+    sent:            {}
+    failed batches:  {}
+    dropped:         {} ({} rejected)
+    coalesced:       {}
+    retry delay:     {}s
+    latency:         last {:.2f}s, max {:.2f}s
+""".format(len(self.states), len(self.extralog), self.sent, self.failed, self.dropped,
+           self.rejected, self.coalesced, self.retry_delay, self.last_latency, self.max_latency)
+
+    def notify_when_sent(self, node, callback):
+        """
+        Calls callback(True) when the queued state of the node (machine status or keyed raw request) has been sent,
+        callback(False) if the site rejected it.
+        If a newer state replaces it, the callback is called when the newer state has been sent.
+        Returns False if there is no queued state for the node.
+        """
+        for key in (('machine', node), ('raw', node)):
+            if key in self.states:
+                self.states[key].callbacks.append(callback)
+                return True
+        return False
 
-    def raw_request(self, request):
-        self.queue.put_nowait(request)
+    def raw_request(self, request, key=None):
+        """
+        Sends the URL as it is, with a key only the latest request for the key is sent
+        """
+        if key is None:
+            self.__put_extralog(request)
+        else:
+            self.__put_state(('raw', key), request)
 
     def on_serial_rx(self, data):
         data = urllib.parse.quote(data)
         request = "{}/extralog/RAW_RX/{}/{}".format(self.url, data, self.key)
-        self.queue.put_nowait(request)
+        self.__put_extralog(request)
 
     def on_serial_tx(self, data):
         data = urllib.parse.quote(data)
         request = "{}/extralog/RAW_TX/{}/{}".format(self.url, data, self.key)
-        self.queue.put_nowait(request)
+        self.__put_extralog(request)
 
 
     def on_serial_status(self, node, data):
         data = urllib.parse.quote(data)
         request = "{}/extralog/{}/{}/{}".format(self.url, node, data, self.key)
-        self.queue.put_nowait(request)
+        self.__put_extralog(request)
 
     def send_alive_signal(self):
         request = "{}/lebt/{}".format(self.url, self.key)
-        self.queue.put_nowait(request)
+        self.__put_state(('lebt',), request)
 
     def on_status_change(self, node, state):
         request = "{}/machine/{}/{}/{}".format(self.url, node, state, self.key)
-        self.queue.put_nowait(request)
+        self.__put_state(('machine', node), request)
 
     def on_node_alive_changed(self, node, state):
         request = "{}/node_alive/{}/{}/{}".format(self.url, node, state, self.key)
-        self.queue.put_nowait(request)
+        self.__put_state(('node_alive', node), request)
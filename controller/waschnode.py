@@ -16,16 +16,19 @@ class WaschNode(BaseNode):
     def __init__(self, config, master, name, uplink):
         super().__init__(config, master, name)
 
-        self._expected_led_state = []
-
         self._uplink = uplink
 
+        self.check_config(config)
+        self.__read_config()
+
+    def __read_config(self):
         self._ledmap = None
         try:
-            self._ledmap = config['ledmap']
+            self._ledmap = self._config['ledmap']
         except KeyError:
             pass
 
+        self._expected_led_state = []
         if self._ledmap is not None:
             # init the state for all leds to 0
             for n in self._ledmap:
@@ -37,13 +40,24 @@ class WaschNode(BaseNode):
         self._channels = []
 
         try:
-            self._channels = config['channels']
+            self._channels = self._config['channels']
         except KeyError:
             pass
 
+        # Channel config commands of the configuration, built once as they are compared in every loop
+        self._channel_cmds = [(ch_cfg, self.__make_calib_message(ch_cfg).cmd) for ch_cfg in self._channels]
+
+    def check_config(self, config):
+        super().check_config(config)
+
+        try:
+            channels = config['channels']
+        except KeyError:
+            channels = []
+
         # Ensure early fail, if the config is invalid
         configtest = []
-        for c in self._channels:
+        for c in channels:
             configtest = c['index']
             if c['type'] == 'wasch':
                 configtest = [int(c['input_filter']['mid_adjustment_speed']),
@@ -61,19 +75,46 @@ class WaschNode(BaseNode):
                 raise Exception("Unknown sensor type: {}".format(c['type']))
         del configtest
 
+    def _reload_config(self):
+        # The changed channels are configured again, they are compared with the node's configuration
+        self.__read_config()
+
     def _initialize(self):
         # Insert the state entries for this typeof node
         self._status["CH_INIT"] = 0
         self._status["LED_STATE"] = None
 
+        # Configuration the node has: the channel config command per channel index and the enable command
+        self._node_channels = {}
+        self._node_sensors = None
+        self._pending_config = None
+
         self._expected_led_state = [0] * len(self._expected_led_state)
 
+    def status_sources(self):
+        # The nodes on the LED map
+        if self._ledmap is None:
+            return []
+        return list(self._ledmap)
+
     def on_node_status_changed(self, node, status):
 
         if node == self:
             # Only send updates if the status update was for this node
             self._uplink.on_status_change(node._name, status)
 
+            if self._ledmap is not None:
+                # The node may have set a status change indicator on its own (color and blinking),
+                # the controller does not know these LEDs, so the next update is a full led message
+                self._status["LED_STATE"] = None
+
+        self.__update_expected_state(node, status)
+
+    def on_node_status_restored(self, node, status):
+        self.__update_expected_state(node, status)
+
+    def __update_expected_state(self, node, status):
+        if node == self:
             # Not actually needed, I just do this so it shows up in the state dump
             self._status["LAST_STATUS"] = status
 
@@ -94,19 +135,43 @@ class WaschNode(BaseNode):
         self._uplink.on_node_alive_changed(self.name(), "1")
         if not self._status["INITDONE"]:
             # not or no longer initialized -> reset
+            self._node_channels = {}
+            self._node_sensors = None
             self._status["CH_INIT"] = 0
             self._status["LED_STATE"] = None
 
-    def _next_message(self):
-        if self._status["CH_INIT"] < len(self._channels):
-            # init a channel
-            self._status_on_ack = ("CH_INIT", self._status["CH_INIT"] + 1, None)
-            return self.__make_calib_message(self._status["CH_INIT"])
+    def _on_resumed(self):
+        # The node still has the configuration from the last run
+        self._node_channels = {ch_cfg['index']: cmd for ch_cfg, cmd in self._channel_cmds}
+        self._node_sensors = self.__make_enable_sensor_message().cmd
+        self._status["CH_INIT"] = len(self._node_channels)
 
-        if not self._status["INITDONE"]:
+    def _save_state(self):
+        return {'channels': self._node_channels,
+                'sensors': self._node_sensors,
+                'led_state': self._status["LED_STATE"]}
+
+    def _restore_state(self, state):
+        # The JSON keys are strings
+        self._node_channels = {int(index): cmd for index, cmd in state['channels'].items()}
+        self._node_sensors = state['sensors']
+        self._status["CH_INIT"] = len(self._node_channels)
+        self._status["LED_STATE"] = state['led_state']
+
+    def _next_message(self):
+        for ch_cfg, cmd in self._channel_cmds:
+            if self._node_channels.get(ch_cfg['index']) != cmd:
+                # (re)configure a channel
+                self._pending_config = (ch_cfg['index'], cmd)
+                self._status_on_ack = (None, None, WaschNode.__on_channel_configured)
+                return self.__make_calib_message(ch_cfg)
+
+        msg = self.__make_enable_sensor_message()
+        if not self._status["INITDONE"] or self._node_sensors != msg.cmd:
             # The last step of the initialization is to activate the configured sensor channels
-            self._status_on_ack = ("INITDONE", True, None)
-            return self.__make_enable_sensor_message()
+            self._pending_config = msg.cmd
+            self._status_on_ack = ("INITDONE", True, WaschNode.__on_sensors_enabled)
+            return msg
 
         if self._expected_led_state != self._status["LED_STATE"]:
             # Need to update the LEDs
@@ -115,12 +180,19 @@ class WaschNode(BaseNode):
 
         return None
 
+    def __on_channel_configured(self, code):
+        index, cmd = self._pending_config
+        self._node_channels[index] = cmd
+        self._status["CH_INIT"] = len(self._node_channels)
+
+    def __on_sensors_enabled(self, code):
+        self._node_sensors = self._pending_config
+
 
     def _on_connection_failed(self):
         self._uplink.on_node_alive_changed(self.name(), "0")
 
-    def __make_calib_message(self, channel):
-        ch_cfg = self._channels[channel]
+    def __make_calib_message(self, ch_cfg):
         if ch_cfg['type'] == 'wasch':
             return self.__make_calib_message_wasch(ch_cfg)
         return self.__make_calib_message_freq(ch_cfg)
@@ -172,7 +244,12 @@ class WaschNode(BaseNode):
 
     def __make_led_message(self):
         """
-        Enable all configured sensors on the node
+        Sets the changed LEDs, all LEDs if the state of the node is not known
         """
-        ledstring = ' '.join([str(l) for l in self._expected_led_state])
-        return MessageCommand(self, "led", ledstring)
+        current = self._status["LED_STATE"]
+        if current is None or len(current) != len(self._expected_led_state):
+            ledstring = ' '.join([str(l) for l in self._expected_led_state])
+            return MessageCommand(self, "led", ledstring)
+
+        changed = ["{}:{}".format(i, l) for i, (l, c) in enumerate(zip(self._expected_led_state, current)) if l != c]
+        return MessageCommand(self, "led_update", ','.join(changed))
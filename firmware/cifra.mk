@@ -5,3 +5,7 @@ TGT_CFLAGS += -Icifra/src/ext
 TGT_CFLAGS += -Dtypeof=__typeof__
 
 OBJS += hmac.o sha256.o blockwise.o chash.o
+
+ifeq ($(AUTH_MAC),AES_CMAC)
+OBJS += aes.o cmac.o modes.o gf128.o
+endif
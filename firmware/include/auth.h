@@ -18,10 +18,32 @@
 #pragma once
 
 #include <stdint.h>
+#include "auth_mac.h"
 
 // 128 bit key
 #define AUTH_KEY_LEN 16
 
+/*
+ * Number of messages that may be signed before the first of them has been ack'ed.
+ * The slave accepts the messages of the window in any order and remembers the received ones in a bitmap
+ * so that none of them can be replayed (like the IPsec anti-replay window).
+ */
+#define AUTH_WINDOW_SIZE 4
+
+/*
+ * The tag only contains the lowest 4 bits of the nonce and the nonce is incremented by 2 per message,
+ * so 8 consecutive messages can be told apart. Half of them are the window, the other half are old messages
+ * which are re-ack'ed.
+ */
+#define AUTH_NONCE_SLOTS 8
+_Static_assert(AUTH_WINDOW_SIZE < AUTH_NONCE_SLOTS, "Window too large for the nonce code in the tag");
+
+/*
+ * A resumed channel continues this far ahead of the session ticket (see auth_master_make_resume()).
+ * The ticket can be used as long as less than 2^31 messages have been sent after it.
+ */
+#define AUTH_RESUME_STEP (1ULL << 32)
+
 // Wrong state to call this function
 #define AUTH_WRONG_STATE     1
 
@@ -34,15 +56,37 @@
 // Message has wrong size
 #define AUTH_WRONG_SIZE      4
 
-// Received message has old nonce (that of the previous packet)
+// Received message has old nonce (that of an already received packet)
 // Should be re-acked
 // The message must not be processed again!
 #define AUTH_OLD_NONCE       5
 
+// AUTH_WINDOW_SIZE messages are outstanding, need an ack before the next message can be signed
+#define AUTH_WINDOW_FULL     6
+
 typedef struct
 {
-	uint8_t key[AUTH_KEY_LEN];
+	// Key prepared by the MAC backend (see auth_mac.h)
+	auth_mac_key_t key;
+
+	/*
+	 * Master: Nonce of the oldest message that has not been ack'ed yet
+	 * Slave:  Nonce of the newest message that has been received in order
+	 */
 	uint64_t nonce;
+
+	/*
+	 * Master: Bit n is set if the message with nonce + 2 * n has been ack'ed
+	 * Slave:  Bit n is set if the message with nonce + 2 * (n + 1) has been received
+	 */
+	uint8_t window;
+
+	/*
+	 * Master: Number of signed messages starting at nonce
+	 * Slave:  Position of the last received message relative to nonce (in messages), this message is ack'ed
+	 */
+	int8_t position;
+
 	uint8_t status;
 } auth_context_t;
 
@@ -70,26 +114,58 @@ int auth_master_make_handshake(auth_context_t *ctx, void *data, uint32_t offset,
 int auth_master_process_handshake(auth_context_t *ctx, const void *data, uint32_t offset, uint32_t len);
 
 /*
- * Signs a message, only the master can sign
+ * Signs a message with the next nonce, only the master can sign
  * <data> is the message to sign, <len> is the message length.
  * The result is appended to the message, <result_len> is initially the size of the data buffer, after return <result_len>
  * is the size of the signed message.
  * add_data is additional data that is included in the tag.
- * returns nonzero on error
+ * The nonce of the message is written to <nonce> (may be NULL), this identifies the message in auth_master_is_acked().
+ * A signed message must be retransmitted as it is, it can't be signed again.
+ * returns nonzero on error, AUTH_WINDOW_FULL if AUTH_WINDOW_SIZE messages are not yet ack'ed.
  */
-int auth_master_sign(auth_context_t *ctx, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen);
+int auth_master_sign(auth_context_t *ctx, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen, uint64_t *nonce);
 
 /*
- * Checks the ack packet and increments the nonce on success
+ * Checks the ack packet and slides the window on success
  * data is the received ack packet, len the length, offset the start of the message data
+ * The nonce of the message this ack was made for is written to <acked_nonce> (may be NULL).
+ * An ack can also confirm some messages before this message (see auth_slave_make_ack()),
+ * auth_master_is_acked() tells which messages are confirmed.
  */
-int auth_master_check_ack(auth_context_t *ctx, const void *data, uint32_t offset, uint32_t len);
+int auth_master_check_ack(auth_context_t *ctx, const void *data, uint32_t offset, uint32_t len, uint64_t *acked_nonce);
+
+/*
+ * Checks if the message with the specified nonce has been ack'ed
+ */
+uint8_t auth_master_is_acked(const auth_context_t *ctx, uint64_t nonce);
+
+/*
+ * Gets the session ticket of the channel, this is the nonce up to which the slave has received all messages.
+ * The ticket is not secret, it can be stored outside of the node and used to resume the channel
+ * without a handshake after the master context has been lost (see auth_master_make_resume()).
+ */
+uint64_t auth_master_get_ticket(const auth_context_t *ctx);
+
+/*
+ * Resumes a channel without a handshake, ctx must be initialized with auth_master_init() (the challenge is not used).
+ * The resume message is signed with the nonce <ticket> + AUTH_RESUME_STEP, which is sent along with the message.
+ * <data>, <len>, <result_len>, <add_data> and <nonce> are used like in auth_master_sign().
+ * The resume message is the first message of the window, the slave acks it like any other message.
+ */
+int auth_master_make_resume(auth_context_t *ctx, uint64_t ticket, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen, uint64_t *nonce);
 
 /*
  * Initializes the auth context in slave (data receiving) mode.
  */
 void auth_slave_init(auth_context_t *ctx, const uint8_t *key, uint64_t nonce);
 
+/*
+ * Initializes the auth context in slave mode for a channel that already exists on the master side.
+ * <ticket> is the ticket of the master context (auth_master_get_ticket()),
+ * it must come from an authenticated source, otherwise old messages could be replayed.
+ */
+void auth_slave_init_resumed(auth_context_t *ctx, const uint8_t *key, uint64_t ticket);
+
 /*
  * Processes the handshake message from the master and creates the handshake reply message.
  * inmsg is the handshake from the master (inlen its length)
@@ -104,13 +180,35 @@ int auth_slave_handshake(auth_context_t *ctx, const void *inmsg, uint32_t inofs,
  * data is the message, on call len is the message length (including auth tag), after return this is the
  * message length without the tag.
  * add_data is additonal data that is included in the auth tag.
- * The caller must check if the return value is AUTH_OLD_NONCE in this case the received packet was the last and the ACK should be sent again.
+ * Messages within the window are accepted in any order, but every message only once.
+ * The caller must check if the return value is AUTH_OLD_NONCE in this case the received packet has already been received
+ * and the ACK should be sent again.
  */
 int auth_slave_verify(auth_context_t *ctx, const void *data, uint32_t *len, const void *add_data, uint32_t add_datalen);
 
 /*
- * Creates an ACK message for the current nonce
+ * Checks a resume message (see auth_master_make_resume()), <data>, <len> and <add_data> are used like in auth_slave_verify().
+ * A channel can only be resumed if it has been built with a handshake before.
+ * The nonce of the resume message must be ahead of all messages of the current channel and its ticket must not be
+ * ahead of the current nonce, so an old resume message can't be replayed (also not in a later channel). On success the channel continues with the nonce of the resume message, which must be ack'ed.
+ * If the message is a retransmission of the resume message of the current channel, AUTH_OLD_NONCE is returned
+ * and the ack should be sent again.
+ */
+int auth_slave_resume(auth_context_t *ctx, const void *data, uint32_t *len, const void *add_data, uint32_t add_datalen);
+
+/*
+ * Creates an ACK message for the last verified message (also if it had an old nonce)
  * data is the target buffer, on call rsult is the buffer length, on return result_len is the length of the ack packet
  * offset is the length of the packet header
+ * <ack_before> is the number of messages directly before the ack'ed message that are confirmed by this ack as well
+ * (cumulative ack). The caller can limit this, e.g. to messages with the same result. Only received messages are confirmed.
+ */
+int auth_slave_make_ack(auth_context_t *ctx, void *data, uint32_t offset, uint32_t *result_len, uint8_t ack_before);
+
+/*
+ * Gets the slot (0 to AUTH_NONCE_SLOTS - 1) of the last verified message.
+ * The slot is the same for a retransmission of a message,
+ * it can be used to store per message data (e.g. the ack result) for the re-ack.
+ * Slot - n is the message n messages before.
  */
-int auth_slave_make_ack(auth_context_t *ctx, void *data, uint32_t offset, uint32_t *result_len);
+uint8_t auth_slave_last_slot(const auth_context_t *ctx);
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+/*
+ * MAC backends for the auth module.
+ *
+ * The backend is selected at build time with AUTH_MAC in the Makefile,
+ * all nodes and the master must use the same backend:
+ * AUTH_MAC_HMAC_SHA256  HMAC-SHA256 (default)
+ * AUTH_MAC_AES_CMAC     AES-128-CMAC
+ * AUTH_MAC_SIPHASH      SipHash-2-4
+ *
+ * All backends use a 128 bit key and produce a 64 bit tag, the auth module uses 60 bits of it.
+ * The auth module may use the same nonce for different messages (e.g. hs2 for a repeated hs1,
+ * re-ack with different result code), so the MAC must not rely on unique nonces.
+ * This rules out one-time MACs like Poly1305.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Length of the tag in bytes
+#define AUTH_MAC_TAG_LEN 8
+
+#if defined(AUTH_MAC_AES_CMAC)
+
+typedef struct
+{
+	// The AES key schedule is too large to keep it for every connection, so it is expanded for every tag.
+	uint8_t key[16];
+} auth_mac_key_t;
+
+#elif defined(AUTH_MAC_SIPHASH)
+
+typedef struct
+{
+	uint64_t k0;
+	uint64_t k1;
+} auth_mac_key_t;
+
+#else
+
+#ifndef AUTH_MAC_HMAC_SHA256
+#define AUTH_MAC_HMAC_SHA256
+#endif
+
+typedef struct
+{
+	/*
+	 * HMAC-SHA256 hash states after the first block (key ^ ipad / key ^ opad).
+	 * These only depend on the key, so they are computed once in the init and every tag starts from them.
+	 */
+	uint32_t inner[8];
+	uint32_t outer[8];
+} auth_mac_key_t;
+
+#endif
+
+// Name of the selected backend
+extern const char auth_mac_name[];
+
+/*
+ * Prepares the key for the MAC calculation.
+ * <key> has AUTH_KEY_LEN (16) bytes.
+ */
+void auth_mac_init(auth_mac_key_t *mac_key, const uint8_t *key);
+
+/*
+ * Calculates the tag over data1, data2 and the nonce (in this order).
+ * len1 / len2 may be 0.
+ */
+void auth_mac_tag(const auth_mac_key_t *mac_key, const void *data1, uint32_t len1, const void *data2, uint32_t len2,
+                  uint64_t nonce, uint8_t tag[AUTH_MAC_TAG_LEN]);
@@ -4,7 +4,10 @@
  * in the LICENSE file.
  */
 
+#include <stdbool.h>
+
 typedef void (*cli_callback_t)(int, char **);
+typedef bool (*cli_tag_callback_t)(const char *);
 
 #define CLI_ARGC_MAX 16
 
@@ -21,6 +24,15 @@ typedef struct _cli_command
  */
 void cli_set_commandlist(const cli_command_t *list);
 
+/*
+ * Sets the handler for command tags.
+ * A command can be prefixed with a tag (@<TAG> <COMMAND> <ARGS>), the handler is called with the tag
+ * (without the @) before every command, or with NULL if the command has no tag.
+ * If the handler returns false, the command is not executed.
+ * Without a handler, tagged commands are not accepted.
+ */
+void cli_set_tag_handler(cli_tag_callback_t cb);
+
 /*
  * Evaluates a command.
  */
@@ -8,5 +8,6 @@
 
 #include "messagetypes.h"
 void cmd_routes(int argc, char **argv);
+void cmd_hop_channels(int argc, char **argv);
 void cmd_ping(int argc, char **argv);
 void cmd_reboot(int argc, char **argv);
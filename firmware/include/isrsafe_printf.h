@@ -8,7 +8,8 @@
 /*
  * This offers a wrapper for printf that disables the interrupts before calling printf
  * and re-enbales them afterwards.
- * Obvoíously, this should only be used for short prints.
+ * The output is only copied into the serial buffer (see serial_tx_dma.h), so the interrupts are
+ * not disabled while the chars are sent, still, this should only be used for short prints.
  */
 
 #include <libopencm3/cm3/cortex.h>
@@ -19,14 +19,17 @@ int master_node_init(void);
 // Commands
 
 void master_node_cmd_connect(int argc, char **argv);
+void master_node_cmd_resume(int argc, char **argv);
 void master_node_cmd_retransmit(int argc, char **argv);
 void master_node_cmd_node_routes(int argc, char **argv);
+void master_node_cmd_hop_channels(int argc, char **argv);
 void master_node_cmd_configure_sensor(int argc, char **argv);
 void master_node_cmd_enable_sensor(int argc, char **argv);
 void master_node_cmd_raw_frames(int argc, char **argv);
 void master_node_cmd_raw_status(int argc, char **argv);
 void master_node_cmd_authping(int argc, char **argv);
 void master_node_cmd_led(int argc, char **argv);
+void master_node_cmd_led_update(int argc, char **argv);
 void master_node_cmd_rebuild_status_channel(int argc, char **argv);
 void master_node_cmd_configure_status_change_indicator(int argc, char **argv);
 void master_node_cmd_configure_freq_sensor(int argc, char **argv);
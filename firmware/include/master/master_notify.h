@@ -0,0 +1,35 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+/*
+ * Machine readable notifications for the interface (controller).
+ * Depending on the serial protocol, these are printed as ### lines or sent as typed frames (see serial_frame.h).
+ * A tag of 0 means the command was untagged.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "messagetypes.h"
+
+void master_notify_pend(uint8_t node, uint16_t tag);
+void master_notify_ack(uint8_t node, uint8_t code, uint16_t tag);
+void master_notify_timeout(uint8_t node, uint16_t tag);
+void master_notify_status(uint8_t node, uint16_t status);
+
+/*
+ * Status update with the latency trace of the node, <received_ms> is the uptime of the master
+ * when the update has been received. <trace> may be unaligned.
+ */
+void master_notify_status_traced(uint8_t node, uint16_t status, const msg_status_trace_t *trace, uint32_t received_ms);
+void master_notify_session(uint8_t node, uint64_t ticket);
+void master_notify_err(uint16_t tag);
+
+/*
+ * Raw sensor values, <values> may be unaligned.
+ */
+void master_notify_raw(uint8_t node, const uint16_t *values, uint8_t count);
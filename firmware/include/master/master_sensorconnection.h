@@ -8,13 +8,79 @@
 /*
  * This is an interface for managing a single master <-> sensor connection.
  *
- * The connection can only have one outstanding packet.
- * This is a limitation by the auth protocol because it can only verify the single next packet.
+ * Up to SENSOR_CONNECTION_WINDOW config messages can be outstanding (sent but not yet ack'ed).
+ * The ACK notifications are always printed in the order the messages have been sent.
+ * A message can have a tag (set with sensor_connection_set_tag() before the command), which is added to its
+ * PEND, ACK and TIMEOUT notifications. This way the interface can match the notifications to its commands,
+ * even if commands to many nodes are outstanding.
  */
 
+#include <FreeRTOS.h>
+#include <task.h>
 #include "auth.h"
 #include "meshnw.h"
+#include "rtt_estimator.h"
+#include "timer_wheel.h"
 
+// Number of config messages that can be sent to a node without waiting for the ack
+#ifdef WASCHV1
+// Not enough RAM for more retransmission buffers
+#define SENSOR_CONNECTION_WINDOW 2
+#else
+#define SENSOR_CONNECTION_WINDOW AUTH_WINDOW_SIZE
+#endif
+
+_Static_assert(SENSOR_CONNECTION_WINDOW <= AUTH_WINDOW_SIZE, "More outstanding messages than the auth window");
+
+/*
+ * Number of retransmission buffers shared by all connections.
+ * A buffer is only used while a message is outstanding, so this only limits how many messages
+ * can be outstanding at the same time in the whole network.
+ * If all buffers are in use, new commands are rejected until an ack frees a buffer.
+ */
+#ifdef WASCHV1
+#define SENSOR_CONNECTION_MSG_POOL_SIZE 8
+#else
+#define SENSOR_CONNECTION_MSG_POOL_SIZE 32
+#endif
+
+_Static_assert(SENSOR_CONNECTION_MSG_POOL_SIZE >= SENSOR_CONNECTION_WINDOW, "Message pool smaller than the window");
+_Static_assert(SENSOR_CONNECTION_MSG_POOL_SIZE < 0xff, "Message pool too large for the buffer index");
+
+// Size of a retransmission buffer
+#define SENSOR_CONNECTION_MSG_SIZE MESHNW_MAX_PACKET_SIZE
+
+typedef struct
+{
+	// Contents of the message, kept for the retransmission
+	uint8_t data[SENSOR_CONNECTION_MSG_SIZE];
+
+	// Nonce of the message, used to find the ack
+	uint64_t nonce;
+
+	// Time when the message has been sent the last time
+	TickType_t sent_at;
+
+	// Length of the message
+	uint8_t len;
+
+	// Set to nonzero if the message has been retransmitted, the round trip time can't be measured then.
+	uint8_t retransmitted;
+
+	// Set to nonzero when the ack has been received, the ACK is printed when all messages before are ack'ed.
+	uint8_t acked;
+
+	// Result code of the ack
+	uint8_t ack_code;
+
+	// Tag of the command that sent this message, 0 if untagged
+	uint16_t tag;
+} sensor_connection_msg_t;
+
+/*
+ * The fields are ordered by their size to avoid padding, the master keeps one of these for every node.
+ * A zero initialized structure is a valid (unused) connection.
+ */
 typedef struct
 {
 	// auth context for receiving status information
@@ -23,30 +89,43 @@ typedef struct
 	// auth context for sending config commands
 	auth_context_t auth_config;
 
+	// Round trip time of the config channel, the TIMEOUT notification is sent based on this
+	rtt_estimator_t rtt;
+
+	// Expires when the oldest message that has not been ack'ed times out
+	timer_wheel_timer_t timer;
+
 	// The current status of the node's sensors
 	uint16_t current_status;
 
-	// Timeout in seconds before a TIMEOUT notification is sent.
+	// Tag for the notifications of the next command
+	uint16_t tag;
+
+	// Initial timeout in seconds, used until the round trip time has been measured.
 	uint8_t timeout;
 
 	/*
-	 * Counter for the timeout.
-	 * If an ACK is outstanding, this is incremented in every update.
-	 * When this reaches <timeout> the timeout notification is sent and the retransmit is allowed.
+	 * Set to nonzero when the TIMEOUT notification has been sent.
+	 * The retransmit is only allowed after this.
 	 */
-	uint8_t timeout_counter;
+	uint8_t timed_out;
 
-	// Contents of the last sent message
-	uint8_t last_sent_message[MESHNW_MAX_PACKET_SIZE];
-
-	// Length of the last sent message
-	uint8_t last_sent_message_len;
+	// Number of retransmissions since the last ack, the timeout is doubled for every retransmission.
+	uint8_t retransmissions;
 
 	/*
-	 * Set to nonzero, if a packet has been sent that has not yet been ack'ed.
-	 * If this is nonzero, no new packets (except for connect (init) and retransmissions) can be sent.
+	 * Outstanding messages, this is a ring buffer starting at first_msg.
+	 * The entries are indices into the shared message pool (+1, 0 means no buffer).
+	 * If this is full, no new packets (except for connect (init) and retransmissions) can be sent.
+	 * The hs1 (or resume) is treated like a message, the hs2 (resume ack) is its ack.
 	 */
-	uint8_t ack_outstanding;
+	uint8_t msgs[SENSOR_CONNECTION_WINDOW];
+
+	// Index of the oldest outstanding message
+	uint8_t first_msg;
+
+	// Number of outstanding messages
+	uint8_t num_msgs;
 
 	// The "add data" as used in the config and status channel.
 	nodeid_t auth_add_data_cfg[2];
@@ -60,11 +139,24 @@ typedef struct
 // node_reply_hop is the next hop where the node sends the hs2
 int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t node_reply_hop, nodeid_t master, uint8_t timeout);
 
-// Handles retransmissions, should be called once per second
-void sensor_connection_update(sensor_connection_t *con);
+// Like sensor_connection_init() but the config channel is resumed from the session ticket of an earlier connection,
+// instead of the handshake. The node keeps its configuration, the ACK code contains the node status like after a connect.
+// If the node can't be resumed (e.g. it has been restarted), it does not reply and a normal connect is needed.
+int sensor_connection_resume(sensor_connection_t *con, nodeid_t node, uint64_t ticket, nodeid_t master, uint8_t timeout);
+
+// Initializes the timeouts and the lock of all connections, this must be called before the first connection is initialized.
+// <task> calls sensor_connection_process_timers(), it is notified if a timer expires earlier than expected.
+void sensor_connection_init_timers(TaskHandle_t task);
+
+// Sends the TIMEOUT notifications for all connections that are due.
+// Returns the time (in ticks) until this needs to be called again.
+TickType_t sensor_connection_process_timers(void);
+
+// Sets the tag for the next command (0: untagged).
+void sensor_connection_set_tag(sensor_connection_t *con, uint16_t tag);
 
-// Re-transmits the last packet.
-// Can only be called if the last packet timeouted.
+// Re-transmits all outstanding packets that have not been ack'ed.
+// Can only be called if the oldest packet timeouted.
 int sensor_connection_retransmit(sensor_connection_t *con);
 
 // Processes a packet.
@@ -75,6 +167,10 @@ void sensor_connection_handle_packet(sensor_connection_t *con, uint8_t *data, ui
 // The format is <DST1>:<HOP1>,<DST2>:<HOP2>,...
 int sensor_connection_set_routes(sensor_connection_t *con, uint8_t reset, const char *routes);
 
+// Sets the channels of next hops on the client. <channels> is a null terminated string containing hop/channel pairs.
+// The format is <HOP1>:<CHANNEL1>,<HOP2>:<CHANNEL2>,...
+int sensor_connection_set_hop_channels(sensor_connection_t *con, const char *channels);
+
 /*
  * Configures the sensor channel <channel>
  * The parameter format is as follows:
@@ -101,6 +197,12 @@ int sensor_connection_authping(sensor_connection_t *con);
  */
 int sensor_connection_led(sensor_connection_t *con, int num_leds, char **leds);
 
+/*
+ * Sets single LEDs on a node, the other LEDs keep their color.
+ * The LEDs have the format <LED1>:<COLOR1>,<LED2>:<COLOR2>,...
+ */
+int sensor_connection_led_update(sensor_connection_t *con, const char *leds);
+
 /*
  * Tells the node to rebuild the status channel. This needs to be done if after a connect the node
  * is NOT reset (no reset_routes).
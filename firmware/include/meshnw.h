@@ -28,6 +28,53 @@ typedef uint8_t nodeid_t;
 
 static const nodeid_t MESHNW_INVALID_NODE = MESHNW_MAX_NODEID + 1;
 
+/*
+ * Channels
+ * Every node receives on the frequency from its rf configuration.
+ * Different parts of the network may use different frequencies, in this case the channel
+ * of a next hop must be set with meshnw_set_hop_channel().
+ * The modem switches to this channel for sending packets to the hop and back afterwards.
+ * Channel n (1 - MESHNW_CHANNEL_MAX) is at 433.2 MHz + n * 100 kHz,
+ * MESHNW_CHANNEL_OWN is the own frequency of the node.
+ */
+#define MESHNW_CHANNEL_OWN 0
+#define MESHNW_CHANNEL_MAX 13
+
+/*
+ * Link statistics
+ * The network layer keeps statistics for the last MESHNW_LINK_STATS_ENTRIES neighbours it exchanged packets with.
+ * The layer 3 header does not contain the sender of a packet, so the neighbour a packet was received from
+ * is assumed to be the next hop of the route back to the source (or the source itself if there is no such route).
+ * The counters wrap around.
+ */
+#define MESHNW_LINK_STATS_ENTRIES 8
+
+typedef struct
+{
+	// Address of the neighbour
+	nodeid_t node;
+
+	// Packets received from the neighbour
+	uint16_t rx;
+
+	// Packets sent to the neighbour (own and forwarded ones)
+	uint16_t tx;
+
+	// Packets received from the neighbour that have been forwarded / dropped (no route, forwarding disabled, send failed)
+	uint16_t fwd;
+	uint16_t drop;
+
+	// Failed attempts to send a packet to the neighbour (modem busy or TX queue full)
+	uint16_t tx_fail;
+
+	// Moving average of the RSSI and SNR of the received packets, same units as sx127x_get_last_pkt_stats()
+	uint8_t rssi;
+	int8_t snr;
+
+	// Moving average of the time a packet forwarded to the neighbour was delayed in this node (in ms)
+	uint16_t fwd_delay;
+} meshnw_link_stats_t;
+
 /*
  * Callback for incoming data
  * src        Address of the sender
@@ -65,6 +112,13 @@ bool meshnw_set_route(nodeid_t destination, nodeid_t next_hop);
  */
 void meshnw_clear_routes(void);
 
+/*
+ * Sets the channel the next hop <hop> is receiving on.
+ * The channels are not affected by meshnw_clear_routes().
+ * returns true on success
+ */
+bool meshnw_set_hop_channel(nodeid_t hop, uint8_t channel);
+
 /*
  * Sends a packet to the specified destination.
  * len is the packet length in bytes, this must not exceed MESHNW_MAX_PACKET_SIZE
@@ -78,3 +132,29 @@ bool meshnw_send(nodeid_t dst, void *data, uint8_t len);
  * tranceiver to generate a "good" random number.
  */
 uint64_t meshnw_get_random(void);
+
+/*
+ * Copies the link statistics into <stats>.
+ * max        Maximum number of entries to copy
+ * returns the number of entries
+ */
+uint8_t meshnw_get_link_stats(meshnw_link_stats_t *stats, uint8_t max);
+
+/*
+ * Prints a table of link statistics.
+ */
+void meshnw_print_link_stats(const meshnw_link_stats_t *stats, uint8_t count);
+
+/*
+ * Prints the link statistics of this node.
+ * Add this as the "linkstats" command to the serial console.
+ */
+void meshnw_cmd_linkstats(int argc, char **argv);
+
+#ifdef MESHNW_TDMA
+/*
+ * Prints the state of the time slotted MAC.
+ * Add this as the "tdma" command to the serial console.
+ */
+void meshnw_cmd_tdma(int argc, char **argv);
+#endif
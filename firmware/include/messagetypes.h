@@ -63,6 +63,7 @@ typedef struct
 
 #define MSG_HS_2_STATUS_ROUTES 1 /* [sensor -> master] Routes OK */
 #define MSG_HS_2_STATUS_SENSOR 2 /* [sensor -> master] Sensors active */
+#define MSG_HS_2_STATUS_SCH    4 /* [sensor -> master] Status channel built (only in the resume ack) */
 typedef struct
 {
 	msg_type_t type;
@@ -298,8 +299,80 @@ typedef struct
 } __attribute__((packed)) msg_storage_ctl_t;
 
 
+/*
+ * Sets the channels of next hops (see meshnw.h).
+ * The node switches to the channel of the next hop when sending a packet to it.
+ * This is required if the nodes behind this node use a different frequency.
+ * The number of entries is defined by the message size.
+ */
+#define MSG_TYPE_HOP_CHANNELS               16
+typedef struct
+{
+	msg_type_t type;
+	struct
+	{
+		nodeid_t hop;
+		uint8_t channel;
+	} c[1]; // at least one entry
+} __attribute__((packed)) msg_hop_channels_t;
+
+
+/*
+ * Resumes the config channel without a handshake after the master has been restarted.
+ * master -> slave
+ * The master continues the channel from the session ticket of the node (see auth.h), the auth module
+ * appends the resume nonce to the message. The node keeps its whole configuration.
+ * A node only accepts this if it has routes, otherwise it needs to be connected normally.
+ */
+#define MSG_TYPE_AUTH_RESUME                17
+typedef struct
+{
+	msg_type_t type;
+} __attribute__((packed)) msg_auth_resume_t;
+
+
+/*
+ * Ack for the resume message, this contains the same status information as the hs2.
+ * slave -> master
+ * If the status channel of the node is built (MSG_HS_2_STATUS_SCH), the master continues it from status_ticket,
+ * so it does not need to be rebuilt.
+ */
+#define MSG_TYPE_AUTH_RESUME_ACK            18
+typedef struct
+{
+	msg_type_t type;
+
+	// Node status (MSG_HS_2_STATUS_*)
+	uint8_t status;
+
+	// Sensor channels with a high measurement
+	uint16_t channels;
+
+	// Session ticket of the status channel
+	uint64_t status_ticket;
+} __attribute__((packed)) msg_auth_resume_ack_t;
+
+
+/*
+ * Sets single status LEDs on a node, the other LEDs keep their color.
+ * Only the blinking of the set LEDs is stopped.
+ * The number of entries is defined by the message size.
+ */
+#define MSG_TYPE_LED_UPDATE                 19
+typedef struct
+{
+	msg_type_t type;
+	struct
+	{
+		uint8_t led : 4;
+		uint8_t color : 4;
+	} __attribute__((packed)) data[1]; // at least one entry
+} __attribute__((packed)) msg_led_update_t;
+
+
 /*
  * Status update message sent by the node through the status channel to the master.
+ * The signed message may be followed by an unsigned msg_status_trace_t.
  */
 #define MSG_TYPE_STATUS_UPDATE             64
 typedef struct
@@ -308,6 +381,23 @@ typedef struct
 	uint16_t status;
 } __attribute__((packed)) msg_status_update_t;
 
+/*
+ * Latency trace of a status update, appended after the MAC of the status update message.
+ * This is not authenticated and only used for diagnostics.
+ * It is updated for every transmission, so a retransmission reports its own attempt and age.
+ */
+typedef struct
+{
+	// Index of the adc thread cycle in which the last status change has been detected (lower 16 bits)
+	uint16_t adc_cycle;
+
+	// Time from the detection of the status change to this transmission in ms (saturated)
+	uint16_t age_ms;
+
+	// Transmission attempt of this message, 1 for the first transmission
+	uint8_t attempt;
+} __attribute__((packed)) msg_status_trace_t;
+
 // above 128 -> not signed
 
 /*
@@ -415,13 +505,49 @@ typedef struct
 } __attribute__((packed)) msg_storage_status_t;
 
 
+/*
+ * Packet containing the link statistics of the network layer (see meshnw_link_stats_t).
+ * This is sent after the raw status, the statistics are split into multiple packets if they don't fit into one.
+ * The number of entries in this packet is defined by the packet size.
+ */
+#define MSG_TYPE_LINK_STATS 133
+#define MSG_LINK_STATS_MAX_ENTRIES 4
+typedef struct
+{
+	msg_type_t type;
+
+	// Total number of entries and index of the first entry in this packet
+	uint8_t total;
+	uint8_t first;
+
+	struct
+	{
+		nodeid_t node;
+		uint16_t rx;
+		uint16_t tx;
+		uint16_t fwd;
+		uint16_t drop;
+		uint16_t tx_fail;
+		uint8_t rssi;
+		int8_t snr;
+		uint16_t fwd_delay;
+	} __attribute__((packed)) entries[0];
+} __attribute__((packed)) msg_link_stats_t;
+
+_Static_assert(sizeof(msg_link_stats_t) + MSG_LINK_STATS_MAX_ENTRIES * sizeof(((msg_link_stats_t *)0)->entries[0]) <= MESHNW_MAX_PACKET_SIZE,
+               "Link statistics packet too large");
+
+
 typedef union
 {
 	msg_type_t type;
 	msg_auth_hs_1_t hs1;
 	msg_auth_hs_2_t hs2;
 	msg_auth_ack_t ack;
+	msg_auth_resume_t resume;
+	msg_auth_resume_ack_t resume_ack;
 	msg_route_data_t route;
+	msg_hop_channels_t hch;
 	msg_configure_sensor_t scfg;
 	msg_start_sensor_t ssta;
 	msg_begin_send_raw_frames_t srf;
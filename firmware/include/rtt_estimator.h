@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+/*
+ * Round trip time estimation for acknowledged messages.
+ *
+ * Keeps a smoothed round trip time (SRTT) and its variation (RTTVAR) and derives the
+ * retransmission timeout from them (RFC 6298, using Jacobson's scaled integer arithmetic).
+ * Used for the status channel on the sensor and for the config channel on the master.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// The timeout is never shorter than this, even for very close nodes.
+#define RTT_MIN_TIMEOUT_MS 300
+
+// Upper limit for the timeout, including the backoff.
+#define RTT_MAX_TIMEOUT_MS 120000
+
+typedef struct
+{
+	// Smoothed round trip time in ms, scaled by 8, 0 if there is no measurement yet
+	uint32_t srtt;
+
+	// Round trip time variation in ms, scaled by 4
+	uint32_t rttvar;
+
+	// Current timeout in ms (without backoff)
+	uint32_t rto;
+} rtt_estimator_t;
+
+
+/*
+ * Initializes the estimator.
+ * <initial_timeout_ms> is used until the first round trip time has been measured.
+ */
+void rtt_init(rtt_estimator_t *rtt, uint32_t initial_timeout_ms);
+
+/*
+ * Updates the estimation with the time between sending a message and receiving the ack.
+ * This must only be called for messages that have not been retransmitted,
+ * otherwise the ack can't be assigned to a transmission (Karn's algorithm).
+ */
+void rtt_update(rtt_estimator_t *rtt, uint32_t rtt_ms);
+
+/*
+ * Call this instead of rtt_update() if a retransmitted message has been acknowledged.
+ * The backed off timeout that worked is kept until the next valid measurement.
+ */
+void rtt_keep_backoff(rtt_estimator_t *rtt, uint8_t backoff);
+
+/*
+ * Gets the retransmission timeout in ms.
+ * The timeout is doubled for every step in <backoff>.
+ */
+uint32_t rtt_timeout(const rtt_estimator_t *rtt, uint8_t backoff);
+
+/*
+ * Gets the smoothed round trip time in ms, 0 if nothing has been measured yet.
+ */
+static inline uint32_t rtt_get_srtt(const rtt_estimator_t *rtt)
+{
+	return rtt->srtt >> 3;
+}
+
+/*
+ * Gets the round trip time variation in ms.
+ */
+static inline uint32_t rtt_get_rttvar(const rtt_estimator_t *rtt)
+{
+	return rtt->rttvar >> 2;
+}
@@ -38,14 +38,25 @@ typedef struct
 	uint32_t max_status_retransmissions;
 
 	/*
-	 * Max random delay for status retransmissions.
+	 * Retransmission delay for status messages.
+	 * The timeout is based on the measured round trip time (the base delay is used until the first measurement),
+	 * it is doubled every rt_delay_lin_div retransmissions.
 	 * Actual retransmission delay is
-	 * base delay + random((rt_delay_random * (1 + num_of_retries / rt_delay_lin_div)
+	 * timeout + random(timeout * rt_delay_random / 100)
 	 */
 	uint32_t rt_delay_random;
 	uint32_t rt_delay_lin_div;
 } misc_config_t;
 
+typedef struct
+{
+	/*
+	 * Channel of the next node towards the master (see meshnw.h).
+	 * This is only required if the master (or the relay) uses a different frequency than this node.
+	 */
+	uint8_t upstream_channel;
+} channel_config_t;
+
 /*
  * Gets the current configuration of this node.
  * If the node is not yet configured, NULL is returned.
@@ -71,6 +82,12 @@ const sx127x_rf_config_t *sensor_config_rf_settings(void);
  */
 const misc_config_t *sensor_config_misc_settings(void);
 
+/*
+ * Gets the current channel configuration.
+ * If the channel config is not set, default values are returned,
+ */
+const channel_config_t *sensor_config_channel_settings(void);
+
 /*
  * Command function for an interactive command to set the config.
  * Add this as the "config" command to the serial console.
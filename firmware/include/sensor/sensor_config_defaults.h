@@ -12,6 +12,7 @@
 
 #pragma once
 #include "rgbcolor.h"
+#include "meshnw.h"
 
 /*
  * This is the default color map for the leds.
@@ -49,6 +50,11 @@
 {                                       \
 	.network_timeout            = 1800,	\
 	.max_status_retransmissions =  100, \
-	.rt_delay_random            =   10, \
+	.rt_delay_random            =   25, \
 	.rt_delay_lin_div           =    3  \
 }
+
+#define DefaultChannelSettings                \
+{                                             \
+	.upstream_channel = MESHNW_CHANNEL_OWN    \
+}
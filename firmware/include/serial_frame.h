@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+/*
+ * Binary framed serial protocol.
+ *
+ * The protocol is off after a reset, the `binary` command switches it on until the next reset.
+ * While it is on, all output (including printf) is sent in frames and the input is only accepted as frames.
+ *
+ * A frame is <TYPE> <PAYLOAD> <CRC>, encoded with COBS and terminated by a 0x00 byte.
+ * The CRC is a CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over type and payload, sent little endian.
+ * All numbers in the payloads are little endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Frame types, see Serial.md for the payloads
+// Controller -> master
+#define SERIAL_FRAME_CMD     0x01
+
+// Master -> controller
+#define SERIAL_FRAME_LOG     0x10
+#define SERIAL_FRAME_PROMPT  0x11
+#define SERIAL_FRAME_PEND    0x12
+#define SERIAL_FRAME_ACK     0x13
+#define SERIAL_FRAME_TIMEOUT 0x14
+#define SERIAL_FRAME_STATUS  0x15
+#define SERIAL_FRAME_SESSION 0x16
+#define SERIAL_FRAME_ERR     0x17
+#define SERIAL_FRAME_RAW     0x18
+
+// Max size of type + payload
+#define SERIAL_FRAME_MAX_SIZE 224
+
+// Longer log lines are split into multiple frames
+#define SERIAL_FRAME_LOG_LENGTH 80
+
+/*
+ * Writes an encoded frame (including the delimiter) to the serial port, either completely or not at all.
+ * <important> is false for LOG frames, these should be dropped first if the output is congested.
+ */
+typedef void (*serial_frame_out_t)(const uint8_t *data, uint32_t len, bool important);
+
+typedef struct
+{
+	// Encoded frame, CRC and COBS overhead included
+	uint8_t data[SERIAL_FRAME_MAX_SIZE + 4];
+	uint16_t len;
+
+	// Set if the frame was too long, it is dropped at the next delimiter
+	uint8_t overflow;
+} serial_frame_rx_t;
+
+
+/*
+ * Sets the function that writes the frames to the serial port.
+ */
+void serial_frame_init(serial_frame_out_t out);
+
+/*
+ * Returns true if the framed protocol is on.
+ */
+bool serial_frame_enabled(void);
+
+/*
+ * Switches the framed protocol on.
+ */
+void serial_frame_enable(void);
+
+/*
+ * Sends a frame, this can be called from any thread.
+ * The payload must not be longer than SERIAL_FRAME_MAX_SIZE - 1.
+ */
+void serial_frame_send(uint8_t type, const void *payload, uint32_t len);
+
+/*
+ * Adds a char of the debug output, the output is sent as LOG frame at the end of every line.
+ */
+void serial_frame_log_putc(char c);
+
+/*
+ * Feeds a received byte into the decoder.
+ * If a frame is complete and valid, the length of type + payload is returned and the frame is in rx->data.
+ * Otherwise -1 is returned.
+ */
+int serial_frame_receive(serial_frame_rx_t *rx, uint8_t c);
+
+/*
+ * binary
+ *   Switches to the framed protocol
+ */
+void serial_frame_cmd_binary(int argc, char **argv);
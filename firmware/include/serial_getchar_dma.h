@@ -9,11 +9,14 @@
 
 /*
  * This provides serial_getchar() that reads a char from the USART1 using DMA.
- * The DMA comes with it's own 32-byte buffer. This will buffer any input, even if
+ * The DMA comes with it's own buffer (512 bytes, 128 on V1). This will buffer any input, even if
  * serial getchar is not called.
+ * A task can be notified about new input, so it does not need to poll.
  */
 
 #include <stdint.h>
+#include <FreeRTOS.h>
+#include <task.h>
 
 /*
  * Initialize DMA for getchar
@@ -25,3 +28,10 @@ void serial_getchar_dma_init(void);
  * This function never waits, instead, if there is no next char, INT16_MIN is returned
  */
 int16_t serial_getchar(void);
+
+/*
+ * Sets the task that is notified (xTaskNotifyGive) about new input.
+ * The notification is sent when the line becomes idle after some chars have been received and
+ * when the buffer is half or completely filled, so a long burst can't overrun the buffer.
+ */
+void serial_getchar_set_notify_task(TaskHandle_t task);
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+#pragma once
+
+/*
+ * Asynchronous output to the USART1.
+ * The chars are put into a ring buffer, which is sent by the DMA in the background.
+ * Writing never waits for the USART, if the buffer is full, the output is dropped and counted.
+ * The debug output leaves a part of the buffer free for the important output (the notifications of the master),
+ * so the debug output is dropped first.
+ * Both can be used from any thread or interrupt, the buffer is only locked while chars are added.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Initialize the DMA and the interrupt for the output, the USART must already be set up.
+ */
+void serial_tx_dma_init(void);
+
+/*
+ * Adds a char of the debug output.
+ * Once a char has been dropped, the rest of the line is dropped as well, only the newline is kept.
+ */
+void serial_putchar(char c);
+
+/*
+ * Adds a block of chars to the output, either completely or not at all.
+ * Only important output may use the reserved part of the buffer (use_reserve = true).
+ * Returns false if the block has been dropped.
+ */
+bool serial_tx_dma_write(const void *data, uint32_t len, bool use_reserve);
+
+/*
+ * Waits until the whole buffer has been sent, this also works with disabled interrupts.
+ */
+void serial_tx_dma_flush(void);
+
+/*
+ * Sends the remaining output and stops the DMA, the output is blocking afterwards.
+ * This is used before something else takes over the USART.
+ */
+void serial_tx_dma_stop(void);
+
+/*
+ * txstats
+ *   Print the number of sent and dropped chars.
+ */
+void serial_tx_dma_cmd_stats(int argc, char **argv);
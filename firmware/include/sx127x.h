@@ -8,7 +8,7 @@
  * Current limitations:
  *   - Only polling mode available
  *   - Only LoRa mode (so no FSK or OOK)
- *   - No support for frequency hopping
+ *   - No support for frequency hopping (the frequency can only be changed manually)
  *   - ...
  */
 
@@ -65,6 +65,13 @@ uint8_t sx127x_recv(uint8_t *buffer, uint8_t max);
  */
 bool sx127x_send(const uint8_t *data, uint8_t len);
 
+/*
+ * Changes the carrier frequency.
+ * This fails if the modem is transmitting (TX or FSTX mode), a packet that is currently being received is lost.
+ * The frequency in the configuration is not changed, so a modem reset restores the configured frequency.
+ */
+bool sx127x_set_frequency(uint32_t frequency);
+
 /*
  * Checks if the modem is busy transmitting or receiving.
  */
@@ -77,10 +84,16 @@ uint64_t sx127x_get_random(void);
 
 /*
  * Reads the snr and the rssi value for the last received packet
- * RSSI: <rssi> - 157 dB
+ * RSSI: <rssi> - SX127X_CONFIG_RSSI_OFFSET dBm
  * SNR:  <snr> / 4 dB
  */
 void sx127x_get_last_pkt_stats(uint8_t *rssi, int8_t *snr);
 
+/*
+ * Calculates the time on air (in us) of a packet with <len> bytes
+ * for the current modem configuration.
+ */
+uint32_t sx127x_get_time_on_air_us(uint8_t len);
+
 
 void sx127x_test_cmd(int argc, char **argv);
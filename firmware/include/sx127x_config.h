@@ -69,3 +69,12 @@
 // Freqency limitations to stay within German regulatury limitations
 #define SX127X_CONFIG_LORA_FREQUENCY_MIN 433200000
 #define SX127X_CONFIG_LORA_FREQUENCY_MAX 434600000
+
+// The packet RSSI is reported as <value> - offset dBm, the offset depends on the RF port of the band (datasheet 5.5.5)
+#if SX127X_CONFIG_LORA_FREQUENCY_MAX < 779000000
+// Low frequency port (433 MHz)
+#define SX127X_CONFIG_RSSI_OFFSET        164
+#else
+// High frequency port (868 MHz)
+#define SX127X_CONFIG_RSSI_OFFSET        157
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+/*
+ * Hashed timer wheel.
+ *
+ * A timer is put into the slot of its deadline (deadline / TIMER_WHEEL_SLOT_TIME modulo the number of slots),
+ * so arming and disarming a timer is O(1) and expiring only needs to look at the slots between the last and
+ * the current time. Timers that are more than one round (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOT_TIME) in the future
+ * stay in their slot until their round has come.
+ *
+ * The times are in ticks (ms) and may wrap around, deadlines must not be more than 2^31 ticks in the future.
+ * The wheel is not thread safe, the user has to lock it.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Time covered by one slot (in ticks) as power of two
+#define TIMER_WHEEL_SLOT_SHIFT 4
+#define TIMER_WHEEL_SLOT_TIME (1 << TIMER_WHEEL_SLOT_SHIFT)
+
+// Number of slots, one round is 1024 ms
+#define TIMER_WHEEL_SLOTS 64
+
+typedef struct timer_wheel_timer
+{
+	struct timer_wheel_timer *next;
+	struct timer_wheel_timer *prev;
+
+	uint32_t deadline;
+
+	// Nonzero while the timer is in the wheel
+	uint8_t armed;
+} timer_wheel_timer_t;
+
+typedef struct
+{
+	// Doubly linked lists of the timers in every slot
+	timer_wheel_timer_t *slots[TIMER_WHEEL_SLOTS];
+
+	// All timers before this time have been expired
+	uint32_t now;
+
+	// Number of armed timers
+	uint16_t num_timers;
+} timer_wheel_t;
+
+
+/*
+ * Initializes an empty wheel, <now> is the current time.
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now);
+
+/*
+ * Arms the timer to expire at <deadline>.
+ * If the timer is already armed, it is moved to the new deadline.
+ * A deadline in the past expires with the next call to timer_wheel_expire().
+ */
+void timer_wheel_arm(timer_wheel_t *wheel, timer_wheel_timer_t *timer, uint32_t deadline);
+
+/*
+ * Removes the timer from the wheel, nothing happens if it is not armed.
+ */
+void timer_wheel_disarm(timer_wheel_t *wheel, timer_wheel_timer_t *timer);
+
+/*
+ * Removes and returns one timer with a deadline before or at <now>.
+ * Returns NULL if no more timers are due, call this until it returns NULL.
+ */
+timer_wheel_timer_t *timer_wheel_expire(timer_wheel_t *wheel, uint32_t now);
+
+/*
+ * Gets the time until the next deadline (0 if a timer is already due).
+ * The slots are only searched for one round, if the next deadline is later, the time until the end of the round is returned.
+ * Returns <max> if no timer is armed, the result is never larger than <max>.
+ */
+uint32_t timer_wheel_next(const timer_wheel_t *wheel, uint32_t now, uint32_t max);
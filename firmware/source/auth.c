@@ -8,13 +8,12 @@
 #include <errno.h>
 #include <string.h>
 #include "tinyprintf.h"
-#include "sha2.h"
-#include "hmac.h"
 
 #define AUTH_MASTER         1
 #define AUTH_SLAVE          2
 #define AUTH_HANDSHAKE_CPLT 4
 #define AUTH_HANDSHAKE_PEND 8
+#define AUTH_RESUMED        16
 
 
 /*
@@ -38,11 +37,31 @@
  *       AUTH_TAG
  *
  * Data: A data message contains some user data (or a HS2).
- *       The data is followed by a 64 bit tag consisting of the last 4 bits of the nonce and a 60 bit hash over
- *       The data and a secret key (HMAC)
+ *       The data is followed by a 64 bit tag consisting of the last 4 bits of the nonce and a 60 bit MAC over
+ *       The data and a secret key (see auth_mac.h for the MAC backends)
  *
  *       USERDATA
  *       AUTH_TAG
+ *
+ * ACK:  An ack is a data message with the nonce of the ack'ed message + 1.
+ *       ACK_BEFORE is the number of messages directly before the ack'ed message that are confirmed as well.
+ *
+ *       USERDATA
+ *       ACK_BEFORE
+ *       AUTH_TAG
+ *
+ * RESUME: This is sent from the master to continue a channel without a handshake.
+ *         It is a data message signed with the resume nonce, which is sent in the message.
+ *         The resume nonce is the session ticket (the nonce up to which the slave has received everything)
+ *         + AUTH_RESUME_STEP. The slave only accepts it if the nonce is ahead of its current window
+ *         and the ticket is not ahead of its current nonce.
+ *
+ *         USERDATA
+ *         NONCE
+ *         AUTH_TAG
+ *
+ * Every data message uses a new nonce (incremented by 2), the master can sign up to AUTH_WINDOW_SIZE messages
+ * before it needs an ack.
  */
 
 /*
@@ -70,6 +89,41 @@ static inline uint8_t handshake_pend(auth_context_t *ctx)
 }
 
 
+/*
+ * Gets the 4 bit nonce code from the tag of a message.
+ * The message must be at least as long as the tag.
+ */
+static inline uint8_t get_nonce_code(const void *data, uint32_t len)
+{
+	return ((const uint8_t *)data)[len - sizeof(auth_number_t)] >> 4;
+}
+
+
+/*
+ * Gets the position of the message with the nonce code <code> relative to <nonce> (in messages, 0 to AUTH_NONCE_SLOTS - 1)
+ * Returns -1 if the code can't belong to a message relative to this nonce.
+ */
+static int8_t get_nonce_position(uint64_t nonce, uint8_t code)
+{
+	uint8_t diff = (code - (uint8_t)nonce) & 0x0F;
+	if (diff & 0x01)
+	{
+		return -1;
+	}
+
+	return diff >> 1;
+}
+
+
+/*
+ * Gets the nonce <position> messages after (or before if negative) <nonce>
+ */
+static inline uint64_t nonce_at(uint64_t nonce, int8_t position)
+{
+	return nonce + 2 * (int64_t)position;
+}
+
+
 /*
  * Compares memory in constant time.
  */
@@ -89,24 +143,11 @@ static uint8_t timesafe_memeq(const void *a, const void *b, uint32_t length)
 
 static auth_number_t generate_tag(const auth_context_t *ctx, uint64_t nonce, const void *data1, uint32_t len1, const void *data2, uint32_t len2)
 {
-	cf_hmac_ctx hash_ctx;
-	uint8_t digest[CF_SHA256_HASHSZ];
-
-	cf_hmac_init(&hash_ctx, &cf_sha256, ctx->key, AUTH_KEY_LEN);
-
-	if (len1 != 0)
-	{
-		cf_hmac_update(&hash_ctx, data1, len1);
-	}
-
-	if (len2 != 0)
-	{
-		cf_hmac_update(&hash_ctx, data2, len2);
-	}
-	cf_hmac_update(&hash_ctx, &nonce, sizeof(nonce));
-	cf_hmac_finish(&hash_ctx, digest);
+	_Static_assert(AUTH_MAC_TAG_LEN == sizeof(auth_number_t), "Wrong tag size");
 
-	return (*(auth_number_t *)digest);
+	auth_number_t tag;
+	auth_mac_tag(&ctx->key, data1, len1, data2, len2, nonce, tag.bytes);
+	return tag;
 }
 
 
@@ -182,11 +223,14 @@ static int check_message_tag(const auth_context_t *ctx, uint64_t nonce, const vo
 
 void auth_master_init(auth_context_t *ctx, const uint8_t *key, uint64_t challenge)
 {
-	memcpy(ctx->key, key, sizeof(ctx->key));
+	_Static_assert(AUTH_KEY_LEN == 16, "The MAC backends use 128 bit keys");
+	auth_mac_init(&ctx->key, key);
 
 	printf("Init auth in master mode with k=%x and challenge=%08lx%08lx\n", key[0], (uint32_t)(challenge >> 32), (uint32_t)challenge);
 
 	ctx->nonce = challenge;
+	ctx->window = 0;
+	ctx->position = 0;
 	ctx->status = AUTH_MASTER;
 }
 
@@ -264,67 +308,202 @@ int auth_master_process_handshake(auth_context_t *ctx, const void *data, uint32_
 
 	// increment the nonce for the next sent packet
 	ctx->nonce += 2;
+	ctx->window = 0;
+	ctx->position = 0;
 
 	return 0;
 }
 
 
-int auth_master_sign(auth_context_t *ctx, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen)
+int auth_master_sign(auth_context_t *ctx, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen, uint64_t *nonce)
 {
 	if (!is_master(ctx) || !handshake_cplt(ctx))
 	{
 		return AUTH_WRONG_STATE;
 	}
 
-	printf("Sign packet with nonce nonce=%08lx%08lx\n", (uint32_t)(ctx->nonce >> 32), (uint32_t)ctx->nonce);
+	if (ctx->position >= AUTH_WINDOW_SIZE)
+	{
+		return AUTH_WINDOW_FULL;
+	}
+
+	// Next nonce after the already signed messages
+	uint64_t msg_nonce = nonce_at(ctx->nonce, ctx->position);
+
+	printf("Sign packet with nonce nonce=%08lx%08lx\n", (uint32_t)(msg_nonce >> 32), (uint32_t)msg_nonce);
 
-	// make tag with current nonce
-	return sign_message(ctx, ctx->nonce, data, len, result_len, add_data, add_datalen);
+	int res = sign_message(ctx, msg_nonce, data, len, result_len, add_data, add_datalen);
+	if (res != 0)
+	{
+		return res;
+	}
+
+	ctx->position++;
+
+	if (nonce)
+	{
+		*nonce = msg_nonce;
+	}
+
+	return 0;
 }
 
 
-int auth_master_check_ack(auth_context_t *ctx, const void *data, uint32_t offset, uint32_t len)
+int auth_master_check_ack(auth_context_t *ctx, const void *data, uint32_t offset, uint32_t len, uint64_t *acked_nonce)
 {
 	if (!is_master(ctx) || !handshake_cplt(ctx))
 	{
 		return AUTH_WRONG_STATE;
 	}
 
-	if (len != sizeof(auth_number_t) + offset)
+	if (len != sizeof(auth_number_t) + offset + 1)
 	{
 		// ack message is only the footer
 		return AUTH_WRONG_SIZE;
 	}
 
+	// Find the ack'ed message by the nonce code, the ack has the nonce of the message + 1
+	int8_t pos = get_nonce_position(ctx->nonce + 1, get_nonce_code(data, len));
+	if (pos < 0)
+	{
+		return AUTH_WRONG_NONCE;
+	}
+
+	if (pos >= ctx->position)
+	{
+		// Not signed yet -> This is a re-ack for an old message
+		pos -= AUTH_NONCE_SLOTS;
+	}
 
-	printf("Expect ack for nonce=%08lx%08lx\n", (uint32_t)(ctx->nonce >> 32), (uint32_t)ctx->nonce);
+	uint64_t msg_nonce = nonce_at(ctx->nonce, pos);
 
-	uint64_t ack_expected_nonce = ctx->nonce + 1;
+	printf("Got ack for nonce=%08lx%08lx\n", (uint32_t)(msg_nonce >> 32), (uint32_t)msg_nonce);
 
 	uint32_t msg_len = len;
 
-	int res = check_message_tag(ctx, ack_expected_nonce, data, &msg_len, NULL, 0);
+	int res = check_message_tag(ctx, msg_nonce + 1, data, &msg_len, NULL, 0);
 	if (res != 0)
 	{
 		return res;
 	}
 
-	// advance nonce by 2
-	ctx->nonce += 2;
+	// The ack is authentic, mark the message and the confirmed messages before it
+	int8_t ack_before = ((const uint8_t *)data)[offset];
+	if (ack_before >= AUTH_WINDOW_SIZE)
+	{
+		ack_before = AUTH_WINDOW_SIZE - 1;
+	}
+
+	for (int8_t i = pos - ack_before; i <= pos; i++)
+	{
+		if (i >= 0)
+		{
+			ctx->window |= 1 << i;
+		}
+	}
+
+	// Slide the window over all ack'ed messages
+	while (ctx->position > 0 && (ctx->window & 0x01))
+	{
+		ctx->nonce += 2;
+		ctx->window >>= 1;
+		ctx->position--;
+	}
+
+	if (acked_nonce)
+	{
+		*acked_nonce = msg_nonce;
+	}
+
+	return 0;
+}
+
+
+uint8_t auth_master_is_acked(const auth_context_t *ctx, uint64_t nonce)
+{
+	int64_t pos = (int64_t)(nonce - ctx->nonce) / 2;
+	if (pos < 0)
+	{
+		// Before the window
+		return 1;
+	}
+
+	if (pos >= ctx->position)
+	{
+		// Not signed yet
+		return 0;
+	}
+
+	return (ctx->window >> pos) & 0x01;
+}
+
+
+uint64_t auth_master_get_ticket(const auth_context_t *ctx)
+{
+	// Everything before the oldest message that has not been ack'ed has been received
+	return nonce_at(ctx->nonce, -1);
+}
+
+
+int auth_master_make_resume(auth_context_t *ctx, uint64_t ticket, void *data, uint32_t len, uint32_t *result_len, const void *add_data, uint32_t add_datalen, uint64_t *nonce)
+{
+	if (!is_master(ctx))
+	{
+		return AUTH_WRONG_STATE;
+	}
+
+	if (*result_len < len + sizeof(auth_number_t) * 2)
+	{
+		return -ENOMEM;
+	}
+
+	uint64_t resume_nonce = ticket + AUTH_RESUME_STEP;
+
+	printf("Resume channel with nonce=%08lx%08lx\n", (uint32_t)(resume_nonce >> 32), (uint32_t)resume_nonce);
+
+	// The slave can't know the nonce, so it is sent with the message
+	memcpy(((uint8_t *)data) + len, &resume_nonce, sizeof(resume_nonce));
+
+	int res = sign_message(ctx, resume_nonce, data, len + sizeof(auth_number_t), result_len, add_data, add_datalen);
+	if (res != 0)
+	{
+		return res;
+	}
+
+	// The channel is usable now, the resume message is the first one in the window
+	ctx->nonce = resume_nonce;
+	ctx->window = 0;
+	ctx->position = 1;
+	ctx->status = AUTH_MASTER | AUTH_HANDSHAKE_CPLT;
+
+	if (nonce)
+	{
+		*nonce = resume_nonce;
+	}
+
 	return 0;
 }
 
 
 void auth_slave_init(auth_context_t *ctx, const uint8_t *key, uint64_t nonce)
 {
-	memcpy(ctx->key, key, sizeof(ctx->key));
+	auth_mac_init(&ctx->key, key);
 	printf("Init auth in slave mode with k=%x and nonce=%08lx%08lx\n", key[0], (uint32_t)(nonce >> 32), (uint32_t)nonce);
 	ctx->nonce = nonce;
+	ctx->window = 0;
+	ctx->position = 0;
 	ctx->status = AUTH_SLAVE;
 
 }
 
 
+void auth_slave_init_resumed(auth_context_t *ctx, const uint8_t *key, uint64_t ticket)
+{
+	auth_slave_init(ctx, key, ticket);
+	ctx->status |= AUTH_HANDSHAKE_CPLT;
+}
+
+
 int auth_slave_handshake(auth_context_t *ctx, const void *inmsg, uint32_t inofs, uint32_t inlen, void *outmsg, uint32_t outofs, uint32_t *outlen)
 {
 	if (is_master(ctx))
@@ -343,6 +522,14 @@ int auth_slave_handshake(auth_context_t *ctx, const void *inmsg, uint32_t inofs,
 		return AUTH_WRONG_SIZE;
 	}
 
+	// Messages ahead of the nonce may have been received already, skip them so that they can't be replayed
+	while (ctx->window)
+	{
+		ctx->nonce += 2;
+		ctx->window >>= 1;
+	}
+	ctx->position = 0;
+
 	printf("Make hs2 with nonce=%08lx%08lx\n", (uint32_t)(ctx->nonce >> 32), (uint32_t)ctx->nonce);
 
 	auth_number_t *hs2_values = (auth_number_t *)(((uint8_t *)outmsg) + outofs);
@@ -364,6 +551,7 @@ int auth_slave_handshake(auth_context_t *ctx, const void *inmsg, uint32_t inofs,
 
 
 	ctx->status |= AUTH_HANDSHAKE_PEND;
+	ctx->status &= ~AUTH_RESUMED;
 
 	return 0;
 }
@@ -382,51 +570,156 @@ int auth_slave_verify(auth_context_t *ctx, const void *data, uint32_t *len, cons
 		return AUTH_WRONG_STATE;
 	}
 
+	if (*len < sizeof(auth_number_t))
+	{
+		return AUTH_WRONG_SIZE;
+	}
+
 	/*
-	 * We expect a new message to have nonce + 2 as nonce
+	 * New messages are in the window after the nonce (position 1 to AUTH_WINDOW_SIZE),
+	 * the other positions are messages before the nonce.
 	 */
-	uint64_t nonce_expected = ctx->nonce + 2;
+	int8_t pos = get_nonce_position(ctx->nonce, get_nonce_code(data, *len));
+	if (pos < 0)
+	{
+		return AUTH_WRONG_NONCE;
+	}
 
-	int res = check_message_tag(ctx, nonce_expected, data, len, add_data, add_datalen);
+	if (pos == 0 || pos > AUTH_WINDOW_SIZE)
+	{
+		// If an ack was lost, i may receive an old nonce again, this is reported as a special error.
+		ctx->position = (pos == 0) ? 0 : pos - AUTH_NONCE_SLOTS;
+		return AUTH_OLD_NONCE;
+	}
 
-	if (res == AUTH_WRONG_NONCE)
+	if (ctx->window & (1 << (pos - 1)))
 	{
-		// If an ack was lost, i may receive the last nonce again, this is reported as a special error.
+		// Already received within the window
+		ctx->position = pos;
+		return AUTH_OLD_NONCE;
+	}
 
-		auth_number_t *tag = (auth_number_t *)(((uint8_t *)data) + (*len) - sizeof(auth_number_t));
+	int res = check_message_tag(ctx, nonce_at(ctx->nonce, pos), data, len, add_data, add_datalen);
+	if (res != 0)
+	{
+		return res;
+	}
 
-		// Check if the 4-bit nonce code matches the old nonce
-		if (((tag->bytes[0] & 0xF0) >> 4) == (ctx->nonce & 0x0F))
-		{
-			return AUTH_OLD_NONCE;
-		}
+	// tag ok -> packet is valid
+	// => mark as received and slide the window over all messages received in order
 
-		return res;
+	ctx->window |= 1 << (pos - 1);
+	ctx->position = pos;
+
+	while (ctx->window & 0x01)
+	{
+		ctx->nonce += 2;
+		ctx->window >>= 1;
+		ctx->position--;
 	}
-	else if (res != 0)
+
+	return 0;
+}
+
+
+int auth_slave_resume(auth_context_t *ctx, const void *data, uint32_t *len, const void *add_data, uint32_t add_datalen)
+{
+	if (is_master(ctx) || !(ctx->status & (AUTH_HANDSHAKE_CPLT | AUTH_HANDSHAKE_PEND)))
+	{
+		// Nothing to resume
+		return AUTH_WRONG_STATE;
+	}
+
+	if (*len < sizeof(auth_number_t) * 2)
+	{
+		return AUTH_WRONG_SIZE;
+	}
+
+	uint64_t resume_nonce;
+	memcpy(&resume_nonce, ((const uint8_t *)data) + *len - sizeof(auth_number_t) * 2, sizeof(resume_nonce));
+
+	/*
+	 * The ticket (resume nonce - AUTH_RESUME_STEP) has been reported by this channel, so it can't be ahead of the
+	 * current nonce. This binds the resume message to the current channel: After a reboot the nonce is random,
+	 * a resume message recorded before is accepted only with a probability of about 2^-32.
+	 * Messages up to the end of the window may have been received already, the resume nonce must be after them.
+	 * Only the resume message of the current channel has the nonce itself (if nothing has been received after it).
+	 * The difference must be even, otherwise the nonce codes of the messages and the acks would be mixed up.
+	 */
+	uint64_t diff = resume_nonce - ctx->nonce;
+	if ((diff & 0x01) || diff > AUTH_RESUME_STEP)
+	{
+		return AUTH_WRONG_NONCE;
+	}
+
+	if ((diff == 0 && !(ctx->status & AUTH_RESUMED)) || (diff != 0 && diff <= 2 * AUTH_WINDOW_SIZE))
+	{
+		return AUTH_WRONG_NONCE;
+	}
+
+	uint32_t msg_len = *len;
+	int res = check_message_tag(ctx, resume_nonce, data, &msg_len, add_data, add_datalen);
+	if (res != 0)
 	{
 		return res;
 	}
 
-	// tag ok -> packet is valid
-	// => return ok and increment nonce
+	if (diff == 0)
+	{
+		// Retransmission, ack it again
+		ctx->position = 0;
+		return AUTH_OLD_NONCE;
+	}
+
+	printf("Resume channel with nonce=%08lx%08lx\n", (uint32_t)(resume_nonce >> 32), (uint32_t)resume_nonce);
+
+	// Continue like after a handshake with the resume message as the last received message
+	ctx->nonce = resume_nonce;
+	ctx->window = 0;
+	ctx->position = 0;
+	ctx->status = AUTH_SLAVE | AUTH_HANDSHAKE_CPLT | AUTH_RESUMED;
+
+	// Strip the nonce as well
+	(*len) = msg_len - sizeof(auth_number_t);
 
-	ctx->nonce += 2;
 	return 0;
 }
 
 
-int auth_slave_make_ack(auth_context_t *ctx, void *data, uint32_t offset, uint32_t *len)
+int auth_slave_make_ack(auth_context_t *ctx, void *data, uint32_t offset, uint32_t *len, uint8_t ack_before)
 {
 	if (is_master(ctx) || !handshake_cplt(ctx))
 	{
 		return AUTH_WRONG_STATE;
 	}
 
-	// make an empty packet with nonce + 1
-	uint64_t ack_num = ctx->nonce + 1;
+	if (*len < offset + 1)
+	{
+		return -ENOMEM;
+	}
 
-	return sign_message(ctx, ack_num, data, offset, len, NULL, 0);
+	// Only confirm received messages, everything up to the nonce has been received.
+	uint8_t confirmed = 0;
+	while (confirmed < ack_before && confirmed < AUTH_WINDOW_SIZE - 1)
+	{
+		int8_t p = ctx->position - confirmed - 1;
+		if (p > 0 && (ctx->window & (1 << (p - 1))) == 0)
+		{
+			break;
+		}
+		confirmed++;
+	}
 
-	return 0;
+	((uint8_t *)data)[offset] = confirmed;
+
+	// make a packet with the nonce of the message + 1
+	uint64_t ack_num = nonce_at(ctx->nonce, ctx->position) + 1;
+
+	return sign_message(ctx, ack_num, data, offset + 1, len, NULL, 0);
+}
+
+
+uint8_t auth_slave_last_slot(const auth_context_t *ctx)
+{
+	return (nonce_at(ctx->nonce, ctx->position) >> 1) & (AUTH_NONCE_SLOTS - 1);
 }
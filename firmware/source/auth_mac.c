@@ -0,0 +1,248 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "auth_mac.h"
+#include <string.h>
+
+#if defined(AUTH_MAC_AES_CMAC)
+
+#include "aes.h"
+#include "modes.h"
+
+const char auth_mac_name[] = "AES-128-CMAC";
+
+void auth_mac_init(auth_mac_key_t *mac_key, const uint8_t *key)
+{
+	memcpy(mac_key->key, key, sizeof(mac_key->key));
+}
+
+
+void auth_mac_tag(const auth_mac_key_t *mac_key, const void *data1, uint32_t len1, const void *data2, uint32_t len2,
+                  uint64_t nonce, uint8_t tag[AUTH_MAC_TAG_LEN])
+{
+	cf_aes_context aes;
+	cf_cmac_stream cmac;
+	uint8_t mac[AES_BLOCKSZ];
+
+	cf_aes_init(&aes, mac_key->key, sizeof(mac_key->key));
+	cf_cmac_stream_init(&cmac, &cf_aes, &aes);
+
+	if (len1 != 0)
+	{
+		cf_cmac_stream_update(&cmac, data1, len1, 0);
+	}
+
+	if (len2 != 0)
+	{
+		cf_cmac_stream_update(&cmac, data2, len2, 0);
+	}
+
+	cf_cmac_stream_update(&cmac, (const uint8_t *)&nonce, sizeof(nonce), 1);
+	cf_cmac_stream_final(&cmac, mac);
+
+	memcpy(tag, mac, AUTH_MAC_TAG_LEN);
+
+	// Don't leave the key schedule on the stack
+	cf_aes_finish(&aes);
+}
+
+#elif defined(AUTH_MAC_SIPHASH)
+
+/*
+ * SipHash-2-4 (Aumasson, Bernstein), a PRF for short inputs with a 64 bit output.
+ * This is not part of cifra.
+ */
+
+const char auth_mac_name[] = "SipHash-2-4";
+
+typedef struct
+{
+	uint64_t v[4];
+
+	// Bytes of the current (incomplete) word
+	uint64_t word;
+
+	// Number of bytes processed so far
+	uint32_t len;
+} siphash_state_t;
+
+
+static inline uint64_t rotl(uint64_t x, uint8_t b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+
+static inline void sipround(uint64_t *v)
+{
+	v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+	v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+}
+
+
+static void siphash_compress(siphash_state_t *s, uint64_t m)
+{
+	s->v[3] ^= m;
+	sipround(s->v);
+	sipround(s->v);
+	s->v[0] ^= m;
+}
+
+
+static void siphash_update(siphash_state_t *s, const void *data, uint32_t len)
+{
+	const uint8_t *d = data;
+	while (len--)
+	{
+		s->word |= ((uint64_t)*(d++)) << (8 * (s->len & 0x07));
+		s->len++;
+
+		if ((s->len & 0x07) == 0)
+		{
+			siphash_compress(s, s->word);
+			s->word = 0;
+		}
+	}
+}
+
+
+static uint64_t load_le64(const uint8_t *p)
+{
+	uint64_t r = 0;
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		r |= ((uint64_t)p[i]) << (8 * i);
+	}
+	return r;
+}
+
+
+void auth_mac_init(auth_mac_key_t *mac_key, const uint8_t *key)
+{
+	mac_key->k0 = load_le64(key);
+	mac_key->k1 = load_le64(key + 8);
+}
+
+
+void auth_mac_tag(const auth_mac_key_t *mac_key, const void *data1, uint32_t len1, const void *data2, uint32_t len2,
+                  uint64_t nonce, uint8_t tag[AUTH_MAC_TAG_LEN])
+{
+	siphash_state_t s;
+	s.v[0] = mac_key->k0 ^ 0x736f6d6570736575ULL;
+	s.v[1] = mac_key->k1 ^ 0x646f72616e646f6dULL;
+	s.v[2] = mac_key->k0 ^ 0x6c7967656e657261ULL;
+	s.v[3] = mac_key->k1 ^ 0x7465646279746573ULL;
+	s.word = 0;
+	s.len = 0;
+
+	siphash_update(&s, data1, len1);
+	siphash_update(&s, data2, len2);
+	siphash_update(&s, &nonce, sizeof(nonce));
+
+	// Last word contains the length in the top byte
+	siphash_compress(&s, s.word | (((uint64_t)s.len) << 56));
+
+	s.v[2] ^= 0xff;
+	sipround(s.v);
+	sipround(s.v);
+	sipround(s.v);
+	sipround(s.v);
+
+	uint64_t result = s.v[0] ^ s.v[1] ^ s.v[2] ^ s.v[3];
+	for (uint8_t i = 0; i < AUTH_MAC_TAG_LEN; i++)
+	{
+		tag[i] = (uint8_t)(result >> (8 * i));
+	}
+}
+
+#else
+
+#include "sha2.h"
+
+const char auth_mac_name[] = "HMAC-SHA256";
+
+/*
+ * Computes the HMAC-SHA256 midstates for the key, these are the hash states after the first block
+ * of the inner (key ^ ipad) and outer (key ^ opad) hash.
+ * This saves two SHA-256 compressions per tag compared to cf_hmac_init() for every tag.
+ */
+void auth_mac_init(auth_mac_key_t *mac_key, const uint8_t *key)
+{
+	_Static_assert(sizeof(mac_key->inner) == sizeof(((cf_sha256_context *)0)->H), "Wrong HMAC midstate size");
+
+	cf_sha256_context hash;
+	uint8_t block[CF_SHA256_BLOCKSZ];
+
+	// The key is shorter than a block -> zero padded
+	memset(block, 0x36, sizeof(block));
+	for (uint8_t i = 0; i < 16; i++)
+	{
+		block[i] ^= key[i];
+	}
+
+	cf_sha256_init(&hash);
+	cf_sha256_update(&hash, block, sizeof(block));
+	memcpy(mac_key->inner, hash.H, sizeof(mac_key->inner));
+
+	memset(block, 0x5c, sizeof(block));
+	for (uint8_t i = 0; i < 16; i++)
+	{
+		block[i] ^= key[i];
+	}
+
+	cf_sha256_init(&hash);
+	cf_sha256_update(&hash, block, sizeof(block));
+	memcpy(mac_key->outer, hash.H, sizeof(mac_key->outer));
+
+	// Don't leave the key on the stack
+	memset(block, 0, sizeof(block));
+	memset(&hash, 0, sizeof(hash));
+}
+
+
+/*
+ * Initializes a hash context to continue after the first block from a stored midstate.
+ */
+static void restore_midstate(cf_sha256_context *hash, const uint32_t *midstate)
+{
+	memset(hash, 0, sizeof(*hash));
+	memcpy(hash->H, midstate, sizeof(hash->H));
+	hash->blocks = 1;
+}
+
+
+void auth_mac_tag(const auth_mac_key_t *mac_key, const void *data1, uint32_t len1, const void *data2, uint32_t len2,
+                  uint64_t nonce, uint8_t tag[AUTH_MAC_TAG_LEN])
+{
+	cf_sha256_context hash;
+	uint8_t digest[CF_SHA256_HASHSZ];
+
+	// Inner hash
+	restore_midstate(&hash, mac_key->inner);
+
+	if (len1 != 0)
+	{
+		cf_sha256_update(&hash, data1, len1);
+	}
+
+	if (len2 != 0)
+	{
+		cf_sha256_update(&hash, data2, len2);
+	}
+	cf_sha256_update(&hash, &nonce, sizeof(nonce));
+	cf_sha256_digest_final(&hash, digest);
+
+	// Outer hash over the inner digest
+	restore_midstate(&hash, mac_key->outer);
+	cf_sha256_update(&hash, digest, sizeof(digest));
+	cf_sha256_digest_final(&hash, digest);
+
+	memcpy(tag, digest, AUTH_MAC_TAG_LEN);
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include "tinyprintf.h"
 
 static const cli_command_t *command_list = NULL;
+static cli_tag_callback_t tag_handler = NULL;
 
 
 // Splits a command into parts
@@ -113,6 +114,12 @@ void cli_set_commandlist(const cli_command_t *list)
 }
 
 
+void cli_set_tag_handler(cli_tag_callback_t cb)
+{
+	tag_handler = cb;
+}
+
+
 void cli_evaluate(char *buffer)
 {
 	if (!command_list)
@@ -128,6 +135,25 @@ void cli_evaluate(char *buffer)
 		return;
 	}
 
+	const char *tag = NULL;
+	if (argv[0][0] == '@' && tag_handler)
+	{
+		// Tagged command, the tag is not passed to the command
+		tag = argv[0] + 1;
+		argc--;
+		memmove(argv, argv + 1, argc * sizeof(argv[0]));
+
+		if (argc == 0)
+		{
+			return;
+		}
+	}
+
+	if (tag_handler && !tag_handler(tag))
+	{
+		return;
+	}
+
 	if (strcmp("help", argv[0]) == 0)
 	{
 		print_help();
@@ -57,6 +57,52 @@ void cmd_routes(int argc, char **argv)
 }
 
 
+/*
+ * hop_channels <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of the next hops
+ */
+void cmd_hop_channels(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		printf("USAGE: hop_channels <HOP1>:<CH1>,<HOP2>:<CH2>,...\n\n"
+			   "HOPn:CHn Packets for the next hop HOPn will be sent on channel CHn\n"
+			   "         Channel n is at 433.2 MHz + n * 100 kHz (1 - %u),\n"
+			   "         0 is the frequency of this node.\n\n", MESHNW_CHANNEL_MAX);
+		return;
+	}
+
+	const char *channels = argv[1];
+
+	while(channels[0] != 0)
+	{
+		nodeid_t hop;
+		nodeid_t channel;
+		if (utils_parse_route(&channels, &hop, &channel) != 0)
+		{
+			return;
+		}
+
+		if (!meshnw_set_hop_channel(hop, channel))
+		{
+			return;
+		}
+		printf("Set channel of hop %u to %u\n", hop, channel);
+
+		if (channels[0] != 0 && channels[0] != ',')
+		{
+			printf("Unexpected delim: %i(%c)\n", channels[0], channels[0]);
+			return;
+		}
+
+		if (channels[0] == ',')
+		{
+			channels++;
+		}
+	}
+}
+
+
 /*
  * ping <node_id>
  *   Debug ping to any node
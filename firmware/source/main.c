@@ -22,15 +22,19 @@
 
 #include "tinyprintf.h"
 #include "serial_getchar_dma.h"
+#include "serial_tx_dma.h"
 #include "cli.h"
 #include "commands_common.h"
 #include "meshnw.h"
-#include "isrsafe_printf.h"
 
 #if !defined(MASTER) && defined(WASCHV2)
 #include "debug_command_queue.h"
 #endif
 
+#ifdef MASTER
+#include "serial_frame.h"
+#endif
+
 #ifdef WASCHV2
 // Clock for the STM32F401
 const struct rcc_clock_scale hse_8_84mhz =
@@ -58,20 +62,95 @@ const struct rcc_clock_scale hse_8_84mhz =
 // This resides on the stack of the CLI task so keep the stack size in mind when changing this!
 #define CLI_CMD_BUFFER_LENGTH 200
 
+// Max time in ms the CLI waits for input while no command queue is running.
+// The command queue can be started by another thread, so the CLI needs to check it from time to time.
+#define CLI_QUEUE_CHECK_INTERVAL 100
+
 #define USART_CLI USART1
 #define USART_CLI_RCC RCC_USART1
 
 StaticTask_t cliTaskBuffer;
 StackType_t cliTaskStack[CLI_TASK_STACK_SIZE];
 
+#ifdef MASTER
+static serial_frame_rx_t rx_frame;
+#endif
+
 void node_init(void);
 extern cli_command_t cli_commands [];
 
 static void tpf_putcf(void *ptr, char c)
 {
 	(void)ptr;
-	usart_send_blocking(USART_CLI, c);
+#ifdef MASTER
+	if (serial_frame_enabled())
+	{
+		serial_frame_log_putc(c);
+		return;
+	}
+#endif
+	serial_putchar(c);
+}
+
+
+#ifdef MASTER
+static void serial_frame_write(const uint8_t *data, uint32_t len, bool important)
+{
+	serial_tx_dma_write(data, len, important);
+}
+#endif
+
+
+static void print_prompt(uint16_t tag)
+{
+	(void)tag;
+#ifdef CLI_PROMPT
+#ifdef MASTER
+	if (serial_frame_enabled())
+	{
+		serial_frame_send(SERIAL_FRAME_PROMPT, &tag, sizeof(tag));
+		return;
+	}
+#endif
+	// The controller waits for the prompt, so it must not be lost or truncated
+	serial_tx_dma_write(CLI_PROMPT, sizeof(CLI_PROMPT) - 1, true);
+#endif
+}
+
+
+#ifdef MASTER
+/*
+ * Processes a frame of the binary protocol, commands are passed to the CLI with their tag.
+ */
+static void handle_frame(uint8_t *frame, int len, char *buffer)
+{
+	if (frame[0] != SERIAL_FRAME_CMD || len < 3)
+	{
+		printf("Ignored serial frame of type %u\n", frame[0]);
+		return;
+	}
+
+	uint16_t tag = frame[1] | (frame[2] << 8);
+	int cmd_len = len - 3;
+	int pos = 0;
+
+	if (tag)
+	{
+		pos = snprintf(buffer, CLI_CMD_BUFFER_LENGTH, "@%u ", tag);
+	}
+
+	if (cmd_len > CLI_CMD_BUFFER_LENGTH - 1 - pos)
+	{
+		cmd_len = CLI_CMD_BUFFER_LENGTH - 1 - pos;
+	}
+
+	memcpy(buffer + pos, &frame[3], cmd_len);
+	buffer[pos + cmd_len] = 0;
+
+	cli_evaluate(buffer);
+	print_prompt(tag);
 }
+#endif
 
 
 static void init_usart(void)
@@ -126,10 +205,27 @@ static void cliTask(void *arg)
 
 		if (c == INT16_MIN)
 		{
-			taskYIELD();
+			// Sleep until the serial input notifies about new chars
+#if !defined(MASTER) && defined(WASCHV2)
+			ulTaskNotifyTake(pdTRUE, CLI_QUEUE_CHECK_INTERVAL);
+#else
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
 			continue;
 		}
 
+#ifdef MASTER
+		if (serial_frame_enabled())
+		{
+			int len = serial_frame_receive(&rx_frame, c);
+			if (len > 0)
+			{
+				handle_frame(rx_frame.data, len, buffer);
+			}
+			continue;
+		}
+#endif
+
 		if (c == '\r' || c == '\n' || buffer_pos >= (CLI_CMD_BUFFER_LENGTH - 1))
 		{
 			if (buffer_pos)
@@ -137,9 +233,7 @@ static void cliTask(void *arg)
 				buffer[buffer_pos] = 0;
 				cli_evaluate(buffer);
 				buffer_pos = 0;
-#ifdef CLI_PROMPT
-				ISRSAFE_PRINTF(CLI_PROMPT);
-#endif
+				print_prompt(0);
 			}
 		}
 		else
@@ -162,12 +256,16 @@ int main(void)
 
 	init_usart();
 	serial_getchar_dma_init();
+	serial_tx_dma_init();
 	init_printf(NULL, &tpf_putcf);
+#ifdef MASTER
+	serial_frame_init(&serial_frame_write);
+#endif
 
 	printf("Wasch node starting...\n");
 	node_init();
 
-	xTaskCreateStatic(
+	TaskHandle_t cli_task = xTaskCreateStatic(
 		&cliTask,
 		"CLI",
 		CLI_TASK_STACK_SIZE,
@@ -176,6 +274,8 @@ int main(void)
 		cliTaskStack,
 		&cliTaskBuffer);
 
+	serial_getchar_set_notify_task(cli_task);
+
 
 	vTaskStartScheduler();
 
@@ -1,4 +1,4 @@
-FILES += master_config master_sensorconnection master_node master_main
+FILES += master_config master_sensorconnection master_node master_notify master_main timer_wheel serial_frame
 
 vpath %.c source/master
 
@@ -9,12 +9,16 @@
 #include "master_config.h"
 #include "cli.h"
 #include "commands_common.h"
+#include "serial_frame.h"
+#include "serial_tx_dma.h"
 #include "tinyprintf.h"
 
 
 /*
  * connect <NODE> <FIRST_HOP>
  *   Connect to a node
+ * resume <NODE> <TICKET> <TIMEOUT>
+ *   Resume the connection to a node
  * reset_routes <NODE> <DST1>,<HOP1> <DST2,HOP2> ...
  *   Reset node and push new routes
  * set_routes <NODE> <DST1>,<HOP1> <DST2,HOP2> ...
@@ -31,13 +35,21 @@
  *   Check if connected node is still alive
  * routes <DST1>:<HOP1>,<DST2>:<HOP2>,...
  *   Set the master routes
+ * set_hop_channels <NODE> <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of next hops on a node
+ * hop_channels <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of the master's next hops
+ * binary
+ *   Switch to the binary serial protocol
  */
 const cli_command_t cli_commands[] = {
     { "config",        "Node configuration",                    master_config_set_cmd },
     { "connect",       "Connect to a node",                     master_node_cmd_connect },
+    { "resume",        "Resume the connection to a node",       master_node_cmd_resume },
     { "retransmit",    "Re-sent timeouted packet",              master_node_cmd_retransmit },
     { "reset_routes",  "Reset node and set routes",             master_node_cmd_node_routes },
     { "set_routes",    "Set routes on a node",                  master_node_cmd_node_routes },
+    { "set_hop_channels", "Set the channels of next hops on a node", master_node_cmd_hop_channels },
     { "cfg_sensor",    "Sets the sensor configuration",         master_node_cmd_configure_sensor },
     { "cfg_freq_chn",  "Configures a frequency sensor channel", master_node_cmd_configure_freq_sensor },
     { "enable_sensor", "Sets the active sensor channels",       master_node_cmd_enable_sensor },
@@ -47,10 +59,18 @@ const cli_command_t cli_commands[] = {
     { "ping",          "Sends an echo reuest",                  cmd_ping },
     { "authping",      "Sends a conneted node is still alive",  master_node_cmd_authping },
     { "led",           "Set the LEDs of a node",                master_node_cmd_led },
+    { "led_update",    "Set single LEDs of a node",             master_node_cmd_led_update },
     { "rebuild_status_channel", "Request a node to rebuild the status channel", master_node_cmd_rebuild_status_channel },
     { "cfg_status_change_indicator", "Configure the status change indicator LEDs.", master_node_cmd_configure_status_change_indicator },
     { "routes",        "Sets the routes for the master node",  cmd_routes },
+    { "hop_channels",  "Sets the channels of the next hops",   cmd_hop_channels },
     { "sx127x",        "RF modem debug",                       sx127x_test_cmd },
+    { "linkstats",     "Prints the link statistics",           meshnw_cmd_linkstats },
+    { "txstats",       "Prints the serial output statistics",  serial_tx_dma_cmd_stats },
+#ifdef MESHNW_TDMA
+    { "tdma",          "Prints the state of the slotted MAC",  meshnw_cmd_tdma },
+#endif
+    { "binary",        "Switches to the binary serial protocol", serial_frame_cmd_binary },
     { "reboot",        "Reboots (resets) the MCU",             cmd_reboot },
     { NULL, NULL, NULL }
 };
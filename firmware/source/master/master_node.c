@@ -20,18 +20,28 @@
  *   Begin of a block with <COUNT> raw frame values from <NODE_ID>
  *   The actual values will be printed linewise afterwards (prefixed with a '*')
  * TIMEOUT<NODE_ID>
- *   Retransmission limit reached
+ *   No ACK within the retransmission timeout (based on the measured round trip time)
+ * SESSION<NODE_ID>-<TICKET>
+ *   Session ticket (hex) of the config channel after a connect or resume, can be used for a resume later
  * ERR
  *   Some error with the last command.
  *
+ * Commands can be tagged with a number (@<TAG> <COMMAND> <ARGS>, TAG 1 - 65535).
+ * The tag is appended to the PEND, ACK, TIMEOUT and ERR requests of the command (e.g. ACK<NODE_ID>-<ACK_CODE>@<TAG>).
+ *
+ * After the binary command, the requests, commands and all other output are sent as typed frames instead
+ * (see serial_frame.h and master_notify.h).
+ *
  * Commands:
  * Commands can be sent by the user or automatically.
  *
  * Defined commands:
  * connect <NODE> <FIRST_HOP> <TIMEOUT>
  *   Connect to a node
+ * resume <NODE> <TICKET> <TIMEOUT>
+ *   Resume the connection to a configured node after a restart
  * retransmit <NODE>
- *   Re-send last packet
+ *   Re-send all packets that have not been ack'ed
  * reset_routes <NODE> <DST1>,<HOP1> <DST2,HOP2> ...
  *   Reset node and push new routes
  * set_routes <NODE> <DST1>,<HOP1> <DST2,HOP2> ...
@@ -46,8 +56,18 @@
  *   Debug ping to any node
  * authping <node_id>
  *   Check if connected node is still alive
+ * led <NODE> <LED1> ... <LEDn>
+ *   Set all LEDs of a node
+ * led_update <NODE> <LED1>:<COLOR1>,<LED2>:<COLOR2>,...
+ *   Set single LEDs of a node
  * routes <DST1>:<HOP1>,<DST2>:<HOP2>,...
  *   Set the master routes
+ * set_hop_channels <NODE> <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of next hops on a node
+ * hop_channels <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of the master's next hops
+ * binary
+ *   Switch to the binary protocol until the next reset
  */
 
 #include "master_node.h"
@@ -61,16 +81,28 @@
 
 #include "meshnw.h"
 #include "master_sensorconnection.h"
+#include "cli.h"
 #include "messagetypes.h"
 #include "utils.h"
 #include "tinyprintf.h"
-#include "isrsafe_printf.h"
+#include "master_notify.h"
 
+/*
+ * Maximum number of connected nodes, can be set with "make MASTER_MAX_NODES=<n>".
+ * A connection needs about 200 bytes with HMAC-SHA256 (about 100 bytes with the other MACs),
+ * the retransmission buffers are shared by all connections.
+ */
+#ifdef MASTER_MAX_NODES
+#define MAX_ACTIVE_SENSORS MASTER_MAX_NODES
+#elif defined(WASCHV1)
 #define MAX_ACTIVE_SENSORS 32
+#else
+#define MAX_ACTIVE_SENSORS 128
+#endif
 
-#define MASTER_NODE ((nodeid_t)0)
+_Static_assert(MAX_ACTIVE_SENSORS <= MESHNW_MAX_NODEID, "More connections than node ids");
 
-#define MESSAGE_LOOP_DELAY 1000 // 1s
+#define MASTER_NODE ((nodeid_t)0)
 
 // Stack size of the maaaster thread (in words)
 #define MESSAGE_THD_STACK_SIZE 512
@@ -80,41 +112,79 @@ StackType_t message_thd_stack[MESSAGE_THD_STACK_SIZE];
 
 struct
 {
+	// Connections in the order they have been created, a connection is never removed.
 	sensor_connection_t nodes[MAX_ACTIVE_SENSORS];
+
+	// Number of used entries in nodes
+	uint8_t num_nodes;
+
+	// Index (+1) of the connection in nodes for every node id, 0 if there is no connection for this node.
+	uint8_t node_index[MESHNW_MAX_NODEID + 1];
+
+	// Tag of the current command, 0 if it has no tag
+	uint16_t tag;
 } master;
 
 
 static sensor_connection_t *find_node(nodeid_t node)
 {
-	for (uint8_t i = 0; i < ARRAYSIZE(master.nodes); i++)
+	if (node > MESHNW_MAX_NODEID || master.node_index[node] == 0)
 	{
-		if (sensor_connection_node(&master.nodes[i]) == node)
-		{
-			return &master.nodes[i];
-		}
+		return NULL;
+	}
+
+	sensor_connection_t *n = &master.nodes[master.node_index[node] - 1];
+
+	// Not yet initialized (e.g. failed connect)
+	if (sensor_connection_node(n) != node)
+	{
+		return NULL;
 	}
 
-	return NULL;
+	return n;
 }
 
 
+/*
+ * Gets the connection for a node or assigns a new one.
+ * This is only called from the CLI thread, the other threads ignore a new connection until its node id is set.
+ */
 static sensor_connection_t *find_or_init_node(nodeid_t node)
 {
-	sensor_connection_t *n = find_node(node);
-	if (n != NULL)
+	if (node > MESHNW_MAX_NODEID)
 	{
-		return n;
+		return NULL;
 	}
 
-	for (uint8_t i = 0; i < ARRAYSIZE(master.nodes); i++)
+	if (master.node_index[node] != 0)
 	{
-		if (sensor_connection_node(&master.nodes[i]) == 0)
-		{
-			return &master.nodes[i];
-		}
+		return &master.nodes[master.node_index[node] - 1];
 	}
 
-	return NULL;
+	if (master.num_nodes >= ARRAYSIZE(master.nodes))
+	{
+		return NULL;
+	}
+
+	// The new entry is still zeroed
+	master.num_nodes++;
+	master.node_index[node] = master.num_nodes;
+	return &master.nodes[master.num_nodes - 1];
+}
+
+
+/*
+ * Gets the connection for a command, the notifications for the command get its tag.
+ */
+static sensor_connection_t *command_node(nodeid_t node, bool init)
+{
+	sensor_connection_t *con = init ? find_or_init_node(node) : find_node(node);
+	if (con)
+	{
+		sensor_connection_set_tag(con, master.tag);
+	}
+
+	return con;
 }
 
 
@@ -132,7 +202,33 @@ static void dispatch_packet(nodeid_t src, uint8_t *data, uint32_t len)
 
 static void print_err_text(void)
 {
-	ISRSAFE_PRINTF("###ERR\n");
+	master_notify_err(master.tag);
+}
+
+
+/*
+ * Called by the CLI before every command with the tag of the command (NULL if untagged).
+ */
+static bool set_command_tag(const char *tag)
+{
+	master.tag = 0;
+
+	if (!tag)
+	{
+		return true;
+	}
+
+	char *end;
+	unsigned long t = strtoul(tag, &end, 10);
+	if (end == tag || *end != 0 || t == 0 || t > 0xffff)
+	{
+		printf("Invalid tag: \"%s\"\n", tag);
+		print_err_text();
+		return false;
+	}
+
+	master.tag = t;
+	return true;
 }
 
 
@@ -147,7 +243,8 @@ void master_node_cmd_connect(int argc, char **argv)
 		printf("USAGE: connect <NODE> <FIRST_HOP> <TIMEOUT>\n\n"
 			   "NODE      The address of the node\n"
 			   "FIRST_HOP First hop in the answer path of the node\n"
-			   "TIMEOUT   Timeout for this connection\n");
+			   "TIMEOUT   Initial timeout in seconds for this connection,\n"
+			   "          used until the round trip time has been measured\n");
 		print_err_text();
 		return;
 	}
@@ -167,7 +264,7 @@ void master_node_cmd_connect(int argc, char **argv)
 	}
 
 
-	sensor_connection_t *con = find_or_init_node(dst);
+	sensor_connection_t *con = command_node(dst, true);
 	if (!con)
 	{
 		printf("Connection limit reached!\n");
@@ -187,9 +284,62 @@ void master_node_cmd_connect(int argc, char **argv)
 }
 
 
+/*
+ * resume <NODE> <TICKET> <TIMEOUT>
+ *   Resume the connection to a configured node after a restart
+ */
+void master_node_cmd_resume(int argc, char **argv)
+{
+	if (argc != 4)
+	{
+		printf("USAGE: resume <NODE> <TICKET> <TIMEOUT>\n\n"
+			   "NODE      The address of the node\n"
+			   "TICKET    Session ticket (hex) from the last connection to the node\n"
+			   "TIMEOUT   Initial timeout in seconds for this connection\n"
+			   "The node keeps its configuration, if it does not reply, it needs to be connected.\n");
+		print_err_text();
+		return;
+	}
+
+	nodeid_t dst = utils_parse_nodeid(argv[1], 1);
+	if (dst == MESHNW_INVALID_NODE)
+	{
+		print_err_text();
+		return;
+	}
+
+	char *end;
+	uint64_t ticket = strtoull(argv[2], &end, 16);
+	if (end == argv[2] || *end != 0)
+	{
+		printf("Invalid ticket: %s\n", argv[2]);
+		print_err_text();
+		return;
+	}
+
+	sensor_connection_t *con = command_node(dst, true);
+	if (!con)
+	{
+		printf("Connection limit reached!\n");
+		print_err_text();
+		return;
+	}
+
+	uint16_t timeout = atoi(argv[3]);
+
+	int res = sensor_connection_resume(con, dst, ticket, MASTER_NODE, timeout);
+	if (res != 0)
+	{
+		printf("Connection resume for node %u failed with error %i\n", dst, res);
+		print_err_text();
+		return;
+	}
+}
+
+
 /*
  * retransmit <NODE>
- *   Re-send last packet
+ *   Re-send all packets that have not been ack'ed
  */
 void master_node_cmd_retransmit(int argc, char **argv)
 {
@@ -209,7 +359,7 @@ void master_node_cmd_retransmit(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -255,7 +405,7 @@ void master_node_cmd_node_routes(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -279,6 +429,47 @@ void master_node_cmd_node_routes(int argc, char **argv)
 }
 
 
+/*
+ * set_hop_channels <NODE> <HOP1>:<CH1>,<HOP2>:<CH2>,...
+ *   Set the channels of next hops on a node
+ */
+void master_node_cmd_hop_channels(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		printf("USAGE: set_hop_channels <NODE> <HOP1>:<CH1>,<HOP2>:<CH2>,...\n\n"
+			   "NODE      Address of the node\n"
+			   "HOPn:CHn  Packets for the next hop HOPn will be sent on channel CHn\n"
+			   "          Channel 0 is the frequency of the node itself.\n");
+		print_err_text();
+		return;
+	}
+
+	nodeid_t dst = utils_parse_nodeid(argv[1], 1);
+	if (dst == MESHNW_INVALID_NODE)
+	{
+		print_err_text();
+		return;
+	}
+
+	sensor_connection_t *con = command_node(dst, false);
+	if (!con)
+	{
+		printf("Not connected!\n");
+		print_err_text();
+		return;
+	}
+
+	int res = sensor_connection_set_hop_channels(con, argv[2]);
+	if (res != 0)
+	{
+		printf("Hop channel request for node %u failed with error %i\n", dst, res);
+		print_err_text();
+		return;
+	}
+}
+
+
 /*
  * configure_sensor <NODE> <CHANNEL> <IF> <MAT> <WND> <RF>
  *   Configure sensor on node
@@ -311,7 +502,7 @@ void master_node_cmd_configure_sensor(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -355,7 +546,7 @@ void master_node_cmd_enable_sensor(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -405,7 +596,7 @@ void master_node_cmd_raw_frames(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -449,7 +640,7 @@ void master_node_cmd_raw_status(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -488,7 +679,7 @@ void master_node_cmd_authping(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -525,7 +716,7 @@ void master_node_cmd_led(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -542,6 +733,47 @@ void master_node_cmd_led(int argc, char **argv)
 	}
 }
 
+/*
+ * led_update <NODE> <LED1>:<COLOR1>,<LED2>:<COLOR2>,...
+ *   Set single LEDs of a node, the other LEDs keep their color
+ */
+void master_node_cmd_led_update(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		printf("USAGE: led_update <NODE> <LED1>:<COLOR1>,<LED2>:<COLOR2>,...\n\n"
+			   "NODE      Address of the destination node\n"
+			   "LEDn      Index of the LED\n"
+			   "COLORn    Color mode of the LED.\n"
+			   "          See the color table of the node for details.\n");
+		print_err_text();
+		return;
+	}
+
+	nodeid_t dst = utils_parse_nodeid(argv[1], 1);
+	if (dst == MESHNW_INVALID_NODE)
+	{
+		print_err_text();
+		return;
+	}
+
+	sensor_connection_t *con = command_node(dst, false);
+	if (!con)
+	{
+		printf("Not connected!\n");
+		print_err_text();
+		return;
+	}
+
+	int res = sensor_connection_led_update(con, argv[2]);
+	if (res != 0)
+	{
+		printf("Send led update request to node %u failed with error %i\n", dst, res);
+		print_err_text();
+		return;
+	}
+}
+
 /*
  * rebuild_status_channel <node_id>
  *   Tell a node to rebuild its status channel.
@@ -564,7 +796,7 @@ void master_node_cmd_rebuild_status_channel(int argc, char **argv)
         return;
     }
 
-    sensor_connection_t *con = find_node(dst);
+    sensor_connection_t *con = command_node(dst, false);
     if (!con)
     {
         printf("Not connected!\n");
@@ -603,7 +835,7 @@ void master_node_cmd_configure_status_change_indicator(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -644,7 +876,7 @@ void master_node_cmd_configure_freq_sensor(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -704,7 +936,7 @@ void master_node_cmd_storage_ctl(int argc, char **argv)
 		return;
 	}
 
-	sensor_connection_t *con = find_node(dst);
+	sensor_connection_t *con = command_node(dst, false);
 	if (!con)
 	{
 		printf("Not connected!\n");
@@ -819,20 +1051,11 @@ void master_node_cmd_storage_ctl(int argc, char **argv)
 static void message_thread(void *arg)
 {
 	(void) arg;
-    TickType_t last = xTaskGetTickCount();
 
 	while(1)
 	{
-		vTaskDelayUntil(&last, MESSAGE_LOOP_DELAY);
-
-		// update all connections
-		for (uint8_t i = 0; i < ARRAYSIZE(master.nodes); i++)
-		{
-			if (sensor_connection_node(&master.nodes[i]) != 0)
-			{
-				sensor_connection_update(&master.nodes[i]);
-			}
-		}
+		// Sleep until the next timeout, a connection that arms an earlier timeout wakes up the thread
+		ulTaskNotifyTake(pdTRUE, sensor_connection_process_timers());
 	}
 }
 
@@ -866,13 +1089,14 @@ static void message_callback(nodeid_t src, void *data, uint8_t len)
 int master_node_init(void)
 {
 	printf("Start node in MASTER mode, id = %u\n", MASTER_NODE);
-	memset(master.nodes, 0, sizeof(master.nodes));
+	memset(&master, 0, sizeof(master));
 
 	static const sx127x_rf_config_t rf_config = { 433500000, 10 , 10, 2, 7 };
 
 	meshnw_init(MASTER_NODE, &rf_config, message_callback);
+	cli_set_tag_handler(set_command_tag);
 
-	xTaskCreateStatic(
+	TaskHandle_t message_thd = xTaskCreateStatic(
 		&message_thread,
 		"MESSAGE",
 	    MESSAGE_THD_STACK_SIZE,
@@ -881,5 +1105,7 @@ int master_node_init(void)
 		message_thd_stack,
 		&message_thd_buffer);
 
+	sensor_connection_init_timers(message_thd);
+
 	return 0;
 }
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+#include "master_notify.h"
+#include <string.h>
+#include <stdarg.h>
+
+#include "serial_frame.h"
+#include "serial_tx_dma.h"
+#include "utils.h"
+#include "tinyprintf.h"
+
+
+// Every raw value is sent as 16 bit number
+#define MAX_RAW_VALUES ((SERIAL_FRAME_MAX_SIZE - 2) / 2)
+
+// Max length of a notification line, the longest one is a traced STATUS
+#define MAX_LINE_LENGTH 64
+
+
+/*
+ * Prints a notification line in the text mode.
+ * The controller parses these lines, so the line is written completely or dropped, but never truncated.
+ */
+static void notify_line(const char *fmt, ...)
+{
+	char line[MAX_LINE_LENGTH];
+
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if (len <= 0 || len >= (int)sizeof(line))
+	{
+		return;
+	}
+
+	serial_tx_dma_write(line, len, true);
+}
+
+
+/*
+ * Sends a frame with the node id and a 16 bit value.
+ */
+static void send_node_frame(uint8_t type, uint8_t node, uint16_t value)
+{
+	uint8_t frame[3] = { node, (uint8_t)value, (uint8_t)(value >> 8) };
+	serial_frame_send(type, frame, sizeof(frame));
+}
+
+
+void master_notify_pend(uint8_t node, uint16_t tag)
+{
+	if (serial_frame_enabled())
+	{
+		send_node_frame(SERIAL_FRAME_PEND, node, tag);
+	}
+	else if (tag)
+	{
+		notify_line("###PEND%u@%u\n", node, tag);
+	}
+	else
+	{
+		notify_line("###PEND%u\n", node);
+	}
+}
+
+
+void master_notify_ack(uint8_t node, uint8_t code, uint16_t tag)
+{
+	if (serial_frame_enabled())
+	{
+		uint8_t frame[4] = { node, code, (uint8_t)tag, (uint8_t)(tag >> 8) };
+		serial_frame_send(SERIAL_FRAME_ACK, frame, sizeof(frame));
+	}
+	else if (tag)
+	{
+		notify_line("###ACK%u-%u@%u\n", node, code, tag);
+	}
+	else
+	{
+		notify_line("###ACK%u-%u\n", node, code);
+	}
+}
+
+
+void master_notify_timeout(uint8_t node, uint16_t tag)
+{
+	if (serial_frame_enabled())
+	{
+		send_node_frame(SERIAL_FRAME_TIMEOUT, node, tag);
+	}
+	else if (tag)
+	{
+		notify_line("###TIMEOUT%u@%u\n", node, tag);
+	}
+	else
+	{
+		notify_line("###TIMEOUT%u\n", node);
+	}
+}
+
+
+void master_notify_status(uint8_t node, uint16_t status)
+{
+	if (serial_frame_enabled())
+	{
+		send_node_frame(SERIAL_FRAME_STATUS, node, status);
+	}
+	else
+	{
+		notify_line("###STATUS%u-%u\n", node, status);
+	}
+}
+
+
+void master_notify_status_traced(uint8_t node, uint16_t status, const msg_status_trace_t *trace, uint32_t received_ms)
+{
+	uint16_t adc_cycle = u16_from_unaligned(&trace->adc_cycle);
+	uint16_t age_ms = u16_from_unaligned(&trace->age_ms);
+
+	if (serial_frame_enabled())
+	{
+		uint8_t frame[12] = { node, (uint8_t)status, (uint8_t)(status >> 8),
+		                      (uint8_t)adc_cycle, (uint8_t)(adc_cycle >> 8),
+		                      (uint8_t)age_ms, (uint8_t)(age_ms >> 8),
+		                      trace->attempt };
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			frame[8 + i] = (uint8_t)(received_ms >> (i * 8));
+		}
+		serial_frame_send(SERIAL_FRAME_STATUS, frame, sizeof(frame));
+	}
+	else
+	{
+		notify_line("###STATUS%u-%u T%u,%u,%u,%lu\n", node, status, adc_cycle, age_ms, trace->attempt, received_ms);
+	}
+}
+
+
+void master_notify_session(uint8_t node, uint64_t ticket)
+{
+	if (serial_frame_enabled())
+	{
+		uint8_t frame[9];
+		frame[0] = node;
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			frame[i + 1] = (uint8_t)(ticket >> (i * 8));
+		}
+		serial_frame_send(SERIAL_FRAME_SESSION, frame, sizeof(frame));
+	}
+	else
+	{
+		notify_line("###SESSION%u-%08lx%08lx\n", node, (uint32_t)(ticket >> 32), (uint32_t)ticket);
+	}
+}
+
+
+void master_notify_err(uint16_t tag)
+{
+	if (serial_frame_enabled())
+	{
+		serial_frame_send(SERIAL_FRAME_ERR, &tag, sizeof(tag));
+	}
+	else if (tag)
+	{
+		notify_line("###ERR@%u\n", tag);
+	}
+	else
+	{
+		notify_line("###ERR\n");
+	}
+}
+
+
+void master_notify_raw(uint8_t node, const uint16_t *values, uint8_t count)
+{
+	if (serial_frame_enabled())
+	{
+		if (count > MAX_RAW_VALUES)
+		{
+			count = MAX_RAW_VALUES;
+		}
+
+		uint8_t frame[1 + MAX_RAW_VALUES * 2];
+		frame[0] = node;
+		memcpy(&frame[1], values, count * 2);
+		serial_frame_send(SERIAL_FRAME_RAW, frame, 1 + count * 2);
+		return;
+	}
+
+	printf("RAW%u-%u\n", node, count);
+	for (uint8_t i = 0; i < count; i++)
+	{
+		// Need to be carefull about the alignment
+		printf("*%u\n", u16_from_unaligned(&values[i]));
+	}
+}
@@ -8,37 +8,380 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <task.h>
+#include <semphr.h>
 
 #include "master_config.h"
 #include "meshnw.h"
 #include "messagetypes.h"
+#include "auth_mac.h"
 #include "utils.h"
 #include "tinyprintf.h"
-#include "isrsafe_printf.h"
+#include "master_notify.h"
 
-static void print_pending_msg(uint8_t id)
+// Retransmission buffers, shared by all connections
+static struct
 {
-	ISRSAFE_PRINTF("###PEND%u\n", id);
+	sensor_connection_msg_t msgs[SENSOR_CONNECTION_MSG_POOL_SIZE];
+
+	// Bit n is set if msgs[n] is in use
+	uint8_t used[(SENSOR_CONNECTION_MSG_POOL_SIZE + 7) / 8];
+} msg_pool;
+
+
+// Longest time between two sensor_connection_process_timers() calls (in ticks)
+#define MAX_TIMER_SLEEP 10000
+
+// Timeouts of all connections
+static struct
+{
+	timer_wheel_t wheel;
+
+	// The timers are armed from the CLI and the receive thread
+	SemaphoreHandle_t mutex;
+	StaticSemaphore_t mutex_buffer;
+
+	// Processes the timers, sleeps until wake_at
+	TaskHandle_t task;
+	TickType_t wake_at;
+} timers;
+
+/*
+ * The outstanding messages and the config channel of the connections are changed by the CLI (commands),
+ * the receive thread (acks) and the message thread (timeouts).
+ * A single recursive mutex protects all connections, a mutex per connection would need too much RAM.
+ * It is taken before the timer mutex.
+ */
+static struct
+{
+	SemaphoreHandle_t mutex;
+	StaticSemaphore_t mutex_buffer;
+} con_lock;
+
+
+static inline void lock_connections(void)
+{
+	xSemaphoreTakeRecursive(con_lock.mutex, portMAX_DELAY);
+}
+
+
+static inline void unlock_connections(void)
+{
+	xSemaphoreGiveRecursive(con_lock.mutex);
+}
+
+
+/*
+ * -- Config channel --
+ * Tells the interface the session ticket of the config channel, this is used to resume the channel after a restart.
+ */
+static void print_session_ticket(sensor_connection_t *con)
+{
+	master_notify_session(con->node_id, auth_master_get_ticket(&con->auth_config));
+}
+
+/*
+ * Takes a buffer from the message pool.
+ * Returns the index + 1 of the buffer or 0 if all buffers are in use.
+ * Buffers are allocated by the commands and freed by the acks, which run in different threads.
+ */
+static uint8_t alloc_msg_buffer(void)
+{
+	uint8_t res = 0;
+
+	taskENTER_CRITICAL();
+	for (uint8_t i = 0; i < SENSOR_CONNECTION_MSG_POOL_SIZE; i++)
+	{
+		if (!(msg_pool.used[i / 8] & (1 << (i % 8))))
+		{
+			msg_pool.used[i / 8] |= (1 << (i % 8));
+			res = i + 1;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+
+	return res;
+}
+
+
+/*
+ * Returns a buffer to the message pool, <buffer> is the index + 1 as returned by alloc_msg_buffer().
+ */
+static void free_msg_buffer(uint8_t buffer)
+{
+	if (buffer == 0)
+	{
+		return;
+	}
+
+	buffer--;
+
+	taskENTER_CRITICAL();
+	msg_pool.used[buffer / 8] &= ~(1 << (buffer % 8));
+	taskEXIT_CRITICAL();
+}
+
+
+/*
+ * -- Config channel --
+ * Gets the slot of the outstanding message <index> in the ring buffer, 0 is the oldest one.
+ */
+static inline uint8_t *get_msg_slot(sensor_connection_t *con, uint8_t index)
+{
+	return &con->msgs[(con->first_msg + index) % SENSOR_CONNECTION_WINDOW];
+}
+
+
+/*
+ * -- Config channel --
+ * Gets the outstanding message <index>, 0 is the oldest one.
+ * All outstanding messages and the next one after next_msg_buffer() have a buffer,
+ * NULL is returned if the slot has none.
+ */
+static inline sensor_connection_msg_t *get_msg(sensor_connection_t *con, uint8_t index)
+{
+	uint8_t slot = *get_msg_slot(con, index);
+	if (slot == 0)
+	{
+		return NULL;
+	}
+
+	return &msg_pool.msgs[slot - 1];
+}
+
+
+/*
+ * -- Config channel --
+ * Gets the message type of the oldest outstanding message, 0 if there is none.
+ */
+static uint8_t first_msg_type(sensor_connection_t *con)
+{
+	sensor_connection_msg_t *msg = con->num_msgs > 0 ? get_msg(con, 0) : NULL;
+	return msg ? msg->data[0] : 0;
+}
+
+
+/*
+ * -- Config channel --
+ * Returns all buffers of a connection to the pool.
+ */
+static void free_msgs(sensor_connection_t *con)
+{
+	for (uint8_t i = 0; i < SENSOR_CONNECTION_WINDOW; i++)
+	{
+		free_msg_buffer(con->msgs[i]);
+		con->msgs[i] = 0;
+	}
+
+	con->first_msg = 0;
+	con->num_msgs = 0;
+}
+
+
+/*
+ * -- Config channel --
+ * Returns true if the hs1 (or the resume) has been sent but the hs2 (resume ack) has not been received yet.
+ */
+static bool handshake_pending(sensor_connection_t *con)
+{
+	uint8_t type = first_msg_type(con);
+	return type == MSG_TYPE_AUTH_HS_1 || type == MSG_TYPE_AUTH_RESUME;
 }
 
+
 /*
  * -- Config channel --
- * Sends the packet in the last packet buffer to the node and resets the timeout
+ * Gets the buffer for the next message, the buffer is taken from the pool if needed.
+ * Returns NULL if no more messages can be sent now.
+ * Only the CLI sends messages, so the buffer stays the next one until sign_and_send_msg() (acks only remove
+ * messages at the start of the ring, this does not move the slot after the last one).
  */
-static bool send_last_packet(sensor_connection_t *con)
+static uint8_t *next_msg_buffer(sensor_connection_t *con)
 {
-	bool res = meshnw_send(con->node_id, con->last_sent_message, con->last_sent_message_len);
+	uint8_t *buffer = NULL;
+
+	lock_connections();
+	if (con->num_msgs < SENSOR_CONNECTION_WINDOW && !handshake_pending(con))
+	{
+		uint8_t *slot = get_msg_slot(con, con->num_msgs);
+		if (*slot == 0)
+		{
+			// Stays in the slot until the message is ack'ed, even if it is not sent now.
+			*slot = alloc_msg_buffer();
+		}
+
+		if (*slot == 0)
+		{
+			printf("All message buffers are in use!\n");
+		}
+		else
+		{
+			buffer = get_msg(con, con->num_msgs)->data;
+		}
+	}
+	unlock_connections();
+
+	return buffer;
+}
+
+
+/*
+ * -- Config channel --
+ * Sends an outstanding message to the node and restarts its timer
+ */
+static bool send_msg(sensor_connection_t *con, sensor_connection_msg_t *msg)
+{
+	bool res = meshnw_send(con->node_id, msg->data, msg->len);
 	if (!res)
 	{
 		printf("Failed to send message to node %u.\n", con->node_id);
 	}
 
-	con->timeout_counter= 0;
+	msg->sent_at = xTaskGetTickCount();
 
 	return res;
 }
 
 
+/*
+ * -- Config channel --
+ * Arms the timer of the connection for the oldest message that has not been ack'ed.
+ * The timer is stopped if there is no such message or if the TIMEOUT has already been sent.
+ */
+static void update_timer(sensor_connection_t *con)
+{
+	sensor_connection_msg_t *oldest = NULL;
+	if (!con->timed_out)
+	{
+		for (uint8_t i = 0; i < con->num_msgs; i++)
+		{
+			sensor_connection_msg_t *msg = get_msg(con, i);
+			if (msg && !msg->acked)
+			{
+				oldest = msg;
+				break;
+			}
+		}
+	}
+
+	bool wake = false;
+
+	xSemaphoreTake(timers.mutex, portMAX_DELAY);
+	if (oldest)
+	{
+		// the timeout is doubled with every retransmission
+		TickType_t deadline = oldest->sent_at + rtt_timeout(&con->rtt, con->retransmissions);
+		timer_wheel_arm(&timers.wheel, &con->timer, deadline);
+
+		if ((int32_t)(deadline - timers.wake_at) < 0)
+		{
+			timers.wake_at = deadline;
+			wake = true;
+		}
+	}
+	else
+	{
+		timer_wheel_disarm(&timers.wheel, &con->timer);
+	}
+	xSemaphoreGive(timers.mutex);
+
+	if (wake)
+	{
+		xTaskNotifyGive(timers.task);
+	}
+}
+
+
+/*
+ * -- Config channel --
+ * Adds the message in the next message buffer to the outstanding messages and sends it.
+ */
+static void add_and_send_msg(sensor_connection_t *con, uint32_t len)
+{
+	if (con->num_msgs == 0)
+	{
+		// Nothing outstanding, start with a new timeout
+		con->timed_out = 0;
+		con->retransmissions = 0;
+	}
+
+	sensor_connection_msg_t *msg = get_msg(con, con->num_msgs);
+	if (!msg)
+	{
+		printf("No message buffer for node %u\n", con->node_id);
+		return;
+	}
+
+	msg->len = len;
+	msg->retransmitted = 0;
+	msg->acked = 0;
+	msg->tag = con->tag;
+	con->num_msgs++;
+
+	master_notify_pend(con->node_id, msg->tag);
+
+	send_msg(con, msg);
+	update_timer(con);
+}
+
+
+/*
+ * -- Config channel --
+ * Updates the round trip time when a message has been acknowledged.
+ */
+static void update_rtt(sensor_connection_t *con, const sensor_connection_msg_t *msg)
+{
+	if (!msg->retransmitted)
+	{
+		rtt_update(&con->rtt, xTaskGetTickCount() - msg->sent_at);
+	}
+	else
+	{
+		// Can't tell which transmission has been ack'ed
+		rtt_keep_backoff(&con->rtt, con->retransmissions);
+	}
+
+	printf("RTT of %u: srtt=%lu rttvar=%lu timeout=%lu\n", con->node_id,
+	       rtt_get_srtt(&con->rtt), rtt_get_rttvar(&con->rtt), rtt_timeout(&con->rtt, 0));
+}
+
+
+/*
+ * -- Config channel --
+ * Notifies the interface about the ack'ed messages at the start of the window and removes them.
+ * The ACKs are always reported in the order the messages have been sent.
+ */
+static void complete_acked_msgs(sensor_connection_t *con)
+{
+	while (con->num_msgs > 0)
+	{
+		sensor_connection_msg_t *msg = get_msg(con, 0);
+		if (msg && !msg->acked)
+		{
+			break;
+		}
+
+		if (msg)
+		{
+			master_notify_ack(con->node_id, msg->ack_code, msg->tag);
+		}
+
+		uint8_t *slot = get_msg_slot(con, 0);
+		free_msg_buffer(*slot);
+		*slot = 0;
+
+		con->first_msg = (con->first_msg + 1) % SENSOR_CONNECTION_WINDOW;
+		con->num_msgs--;
+
+		// Progress -> the next message starts without backoff
+		con->retransmissions = 0;
+	}
+
+	update_timer(con);
+}
+
+
 /*
  * -- Status channel --
  * Handles incoming hs1 requests from the sensor node.
@@ -82,9 +425,9 @@ static void handle_hs1(sensor_connection_t *con, uint8_t *message, uint8_t len)
  */
 static void handle_hs2(sensor_connection_t *con, uint8_t *message, uint8_t len)
 {
-	if (!con->ack_outstanding)
+	if (first_msg_type(con) != MSG_TYPE_AUTH_HS_1)
 	{
-		// The hs2 is treated like an ack, so ack_outstanding must be set.
+		// The hs2 is treated like an ack for the hs1, so the hs1 must be outstanding.
 		// Otherwise this means we got a hs2 without asking for it.
 		printf("Received unexpected hs2\n");
 		return;
@@ -102,14 +445,70 @@ static void handle_hs2(sensor_connection_t *con, uint8_t *message, uint8_t len)
 	}
 
 	// Handshake OK => Channel built!
-	con->ack_outstanding = 0;
-	ISRSAFE_PRINTF("###ACK%u-%u\n", con->node_id, hs2->status);
+	sensor_connection_msg_t *msg = get_msg(con, 0);
+	msg->acked = 1;
+	msg->ack_code = hs2->status;
+	update_rtt(con, msg);
+	print_session_ticket(con);
+	complete_acked_msgs(con);
 	printf("Auth handshake complete for %u\n", con->node_id);
 
 	if (hs2->channels != con->current_status)
 	{
 		// Signal status change
-		ISRSAFE_PRINTF("###STATUS%u-%u\n", con->node_id, hs2->channels);
+		master_notify_status(con->node_id, hs2->channels);
+	}
+}
+
+
+/*
+ * -- Config channel --
+ * Handles the ack for the resume message.
+ * Like the hs2, this completes the connection buildup. If the node has a status channel,
+ * it is continued from the ticket in the ack.
+ */
+static void handle_resume_ack(sensor_connection_t *con, uint8_t *message, uint8_t len)
+{
+	if (first_msg_type(con) != MSG_TYPE_AUTH_RESUME)
+	{
+		printf("Received unexpected resume ack\n");
+		return;
+	}
+
+	msg_auth_resume_ack_t *rack = (msg_auth_resume_ack_t *)message;
+	int res = auth_master_check_ack(&con->auth_config, message, sizeof(*rack), len, NULL);
+
+	if (res != 0)
+	{
+		printf("Invalid resume ack from %u, error: %i\n", con->node_id, res);
+		return;
+	}
+
+	if (rack->status & MSG_HS_2_STATUS_SCH)
+	{
+		// The ticket is authenticated by the ack, so old status messages can't be replayed.
+		uint64_t ticket;
+		memcpy(&ticket, &rack->status_ticket, sizeof(ticket));
+
+		const node_auth_keys_t *keys = master_config_get_keys(con->node_id);
+		if (keys != NULL)
+		{
+			auth_slave_init_resumed(&con->auth_status, keys->key_status, ticket);
+		}
+	}
+
+	sensor_connection_msg_t *msg = get_msg(con, 0);
+	msg->acked = 1;
+	msg->ack_code = rack->status;
+	update_rtt(con, msg);
+	print_session_ticket(con);
+	complete_acked_msgs(con);
+	printf("Resume complete for %u\n", con->node_id);
+
+	if (rack->channels != con->current_status)
+	{
+		con->current_status = rack->channels;
+		master_notify_status(con->node_id, rack->channels);
 	}
 }
 
@@ -117,11 +516,12 @@ static void handle_hs2(sensor_connection_t *con, uint8_t *message, uint8_t len)
 /*
  * -- Config channel --
  * Handles acks from the sensor.
- * An ack confirms that the last command was received by the sensor.
+ * An ack confirms that a command was received by the sensor,
+ * it can also confirm successful commands before it (if their acks have been lost).
  */
 static void handle_ack(sensor_connection_t *con, uint8_t *message, uint8_t len)
 {
-	if (!con->ack_outstanding)
+	if (con->num_msgs == 0 || handshake_pending(con))
 	{
 		// Was not waiting for an ACK
 		printf("Received unexpected ack\n");
@@ -132,7 +532,8 @@ static void handle_ack(sensor_connection_t *con, uint8_t *message, uint8_t len)
 
 	// Give the ACK to the auth module.
 	// If it accepts the ack, it will update its internal state.
-	int res = auth_master_check_ack(&con->auth_config, message, sizeof(*ack), len);
+	uint64_t acked_nonce;
+	int res = auth_master_check_ack(&con->auth_config, message, sizeof(*ack), len, &acked_nonce);
 
 	if (res != 0)
 	{
@@ -140,9 +541,30 @@ static void handle_ack(sensor_connection_t *con, uint8_t *message, uint8_t len)
 		return;
 	}
 
+	for (uint8_t i = 0; i < con->num_msgs; i++)
+	{
+		sensor_connection_msg_t *msg = get_msg(con, i);
+		if (!msg || msg->acked)
+		{
+			continue;
+		}
+
+		if (msg->nonce == acked_nonce)
+		{
+			msg->acked = 1;
+			msg->ack_code = ack->result_code;
+			update_rtt(con, msg);
+		}
+		else if (auth_master_is_acked(&con->auth_config, msg->nonce))
+		{
+			// Confirmed by the ack of a later message, the node only does this for successful commands.
+			msg->acked = 1;
+			msg->ack_code = ACK_OK;
+		}
+	}
+
 	// ACK ok -> notify the interface
-	con->ack_outstanding = 0;
-	ISRSAFE_PRINTF("###ACK%u-%u\n", con->node_id, ack->result_code);
+	complete_acked_msgs(con);
 }
 
 
@@ -164,8 +586,8 @@ static void ack_status_message(sensor_connection_t *con)
 	// Can't fail on this side so the ack code is always 0
 	ack->result_code = 0;
 
-	// Request ack packet from auth...
-	int res = auth_slave_make_ack(&con->auth_status, ack_buffer, sizeof(*ack), &ack_len);
+	// Request ack packet from auth, the result is always the same so the ack confirms all status messages before.
+	int res = auth_slave_make_ack(&con->auth_status, ack_buffer, sizeof(*ack), &ack_len, AUTH_WINDOW_SIZE - 1);
 	if (res != 0)
 	{
 		printf("Failed to make ack for node %u. Error: %i\n", con->node_id, res);
@@ -187,6 +609,16 @@ static void ack_status_message(sensor_connection_t *con)
  */
 static void handle_status_update(sensor_connection_t *con, uint8_t *message, uint8_t len)
 {
+	uint32_t received_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+
+	// The trace is appended after the MAC, it is not part of the signed message
+	const msg_status_trace_t *trace = NULL;
+	if (len == sizeof(msg_status_update_t) + AUTH_MAC_TAG_LEN + sizeof(msg_status_trace_t))
+	{
+		len -= sizeof(msg_status_trace_t);
+		trace = (const msg_status_trace_t *)(message + len);
+	}
+
 	uint32_t contents_len = len;
 
 	// Check the MAC
@@ -225,7 +657,14 @@ static void handle_status_update(sensor_connection_t *con, uint8_t *message, uin
 	ack_status_message(con);
 
 	// Notify interface about status change
-	ISRSAFE_PRINTF("###STATUS%u-%u\n", con->node_id, con->current_status);
+	if (trace)
+	{
+		master_notify_status_traced(con->node_id, con->current_status, trace, received_ms);
+	}
+	else
+	{
+		master_notify_status(con->node_id, con->current_status);
+	}
 	return;
 }
 
@@ -246,12 +685,7 @@ static void handle_raw_frames(sensor_connection_t *con, uint8_t *message, uint8_
 		return;
 	}
 
-	printf("RAW%u-%u\n", con->node_id, count);
-	for (uint8_t i = 0; i < count; i++)
-	{
-		// Need to be carefull about the alignment
-		printf("*%u\n", u16_from_unaligned(&raw->values[i]));
-	}
+	master_notify_raw(con->node_id, raw->values, count);
 }
 
 
@@ -296,6 +730,48 @@ static void handle_raw_status(sensor_connection_t *con, uint8_t *message, uint8_
 	}
 }
 
+/*
+ * -- Un-authenticated data --
+ *  Processes link statistics sent by the sensor.
+ */
+static void handle_link_stats(sensor_connection_t *con, uint8_t *message, uint8_t len)
+{
+	msg_link_stats_t *ls = (msg_link_stats_t *)message;
+
+	if (len < sizeof(*ls))
+	{
+		printf("Received link stats message with wrong size: %u\n", len);
+		return;
+	}
+
+	// Number of entries is defined by the message size
+	uint8_t count = (len - sizeof(*ls)) / sizeof(ls->entries[0]);
+	if (count > MSG_LINK_STATS_MAX_ENTRIES)
+	{
+		count = MSG_LINK_STATS_MAX_ENTRIES;
+	}
+
+	meshnw_link_stats_t stats[MSG_LINK_STATS_MAX_ENTRIES];
+	for (uint8_t i = 0; i < count; i++)
+	{
+		// Need to be carefull about the alignment
+		stats[i].node = ls->entries[i].node;
+		stats[i].rx = u16_from_unaligned(&ls->entries[i].rx);
+		stats[i].tx = u16_from_unaligned(&ls->entries[i].tx);
+		stats[i].fwd = u16_from_unaligned(&ls->entries[i].fwd);
+		stats[i].drop = u16_from_unaligned(&ls->entries[i].drop);
+		stats[i].tx_fail = u16_from_unaligned(&ls->entries[i].tx_fail);
+		stats[i].rssi = ls->entries[i].rssi;
+		stats[i].snr = ls->entries[i].snr;
+		stats[i].fwd_delay = u16_from_unaligned(&ls->entries[i].fwd_delay);
+	}
+
+	printf("Link statistics for node %u (entries %u - %u of %u, RSSI in dBm, delay in ms)\n",
+	       con->node_id, ls->first + 1, ls->first + count, ls->total);
+	meshnw_print_link_stats(stats, count);
+}
+
+
 /*
  * -- Un-authenticated data --
  *  Processes storage status data sent by the sensor.
@@ -399,35 +875,44 @@ static int parse_int16_list(const char *str, int16_t *out_signed, uint16_t *out_
 
 
 /*
- * Signs and sends the message in the transmission buffer.
+ * Signs and sends the message in the next message buffer.
  * A message sent this was must be ack'ed.
  */
 static int sign_and_send_msg(sensor_connection_t *con, uint32_t len)
 {
-	uint32_t packet_len = sizeof(con->last_sent_message);
-	int res = auth_master_sign(&con->auth_config, con->last_sent_message, len, &packet_len, con->auth_add_data_cfg, sizeof(con->auth_add_data_cfg));
+	lock_connections();
 
-	if (res != 0)
+	int res = -ENOMEM;
+	sensor_connection_msg_t *msg = get_msg(con, con->num_msgs);
+	if (msg)
 	{
-		printf("Failed to sign route request for node %u with error %i\n", con->node_id, res);
-		return res;
-	}
-
-	con->last_sent_message_len = packet_len;
-	con->ack_outstanding = 1;
+		uint32_t packet_len = sizeof(msg->data);
+		res = auth_master_sign(&con->auth_config, msg->data, len, &packet_len, con->auth_add_data_cfg, sizeof(con->auth_add_data_cfg), &msg->nonce);
 
-	print_pending_msg(con->node_id);
+		if (res == 0)
+		{
+			add_and_send_msg(con, packet_len);
+		}
+		else
+		{
+			printf("Failed to sign route request for node %u with error %i\n", con->node_id, res);
+		}
+	}
 
-	send_last_packet(con);
-	return 0;
+	unlock_connections();
+	return res;
 }
 
 
-int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t node_reply_hop, nodeid_t master, uint8_t timeout)
+/*
+ * Initializes the connection data structure and the auth contexts for a new connection attempt.
+ */
+static int init_connection(sensor_connection_t *con, nodeid_t node, nodeid_t master, uint8_t timeout)
 {
-	// the message buffer needs to be 16 bit aligned,
+	// the message buffers need to be 16 bit aligned,
 	// this way i can directly access 16 bit values within this buffer (as long as they are aligned)
-	_Static_assert((offsetof(sensor_connection_t, last_sent_message) % sizeof(uint16_t) == 0), "Wrong alignment of last sent message buffer");
+	_Static_assert((offsetof(sensor_connection_msg_t, data) % sizeof(uint16_t) == 0), "Wrong alignment of the message buffers");
+	_Static_assert((sizeof(sensor_connection_msg_t) % sizeof(uint16_t) == 0), "Wrong alignment of the message buffers");
 
 	// Just to be sure: Check the alignment of the connection structure
 	if (((uint32_t) con) & 0x01)
@@ -437,8 +922,27 @@ int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t nod
 		return -EINVAL;
 	}
 
-	// initialize data in con
+	// The round trip time does not change with a reconnect, keep it if the node was connected before
+	rtt_estimator_t rtt = con->rtt;
+	bool keep_rtt = con->node_id == node && rtt_get_srtt(&rtt) != 0;
+
+	// Outstanding messages of an old connection are discarded
+	free_msgs(con);
+	update_timer(con);
+
+	// initialize data in con, the tag belongs to the connect command
+	uint16_t tag = con->tag;
 	memset(con, 0, sizeof(*con));
+	con->tag = tag;
+
+	if (keep_rtt)
+	{
+		con->rtt = rtt;
+	}
+	else
+	{
+		rtt_init(&con->rtt, (uint32_t)timeout * 1000);
+	}
 
 	// get new random numbers
 	// need to check if this makes any problems as this turns of the rf module
@@ -468,18 +972,39 @@ int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t nod
 	con->auth_add_data_sta[0] = node;
 	con->auth_add_data_sta[1] = master;
 
-	// Now send the hs1, the data is written directly into the last message buffer
+	return 0;
+}
+
+
+/*
+ * Starts a new connection with the hs1, called with the connections locked.
+ */
+static int connect_node(sensor_connection_t *con, nodeid_t node, nodeid_t node_reply_hop, nodeid_t master, uint8_t timeout)
+{
+	int res = init_connection(con, node, master, timeout);
+	if (res != 0)
+	{
+		return res;
+	}
+
+	// Now send the hs1, the data is written directly into the first message buffer
+
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
+	{
+		return -ENOMEM;
+	}
 
-	uint32_t msg_len = sizeof(con->last_sent_message);
+	uint32_t msg_len = SENSOR_CONNECTION_MSG_SIZE;
 
-	msg_auth_hs_1_t *hs1 = (msg_auth_hs_1_t *)con->last_sent_message;
+	msg_auth_hs_1_t *hs1 = (msg_auth_hs_1_t *)buffer;
 
 	hs1->type = MSG_TYPE_AUTH_HS_1;
 
 	// Tell the node it's next hop to send the handshake to
 	hs1->reply_route = node_reply_hop;
 
-	int res = auth_master_make_handshake(&con->auth_config, con->last_sent_message, sizeof(*hs1), &msg_len);
+	res = auth_master_make_handshake(&con->auth_config, buffer, sizeof(*hs1), &msg_len);
 
 	if (res != 0)
 	{
@@ -487,16 +1012,66 @@ int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t nod
 		return 1;
 	}
 
-	con->last_sent_message_len = msg_len;
-	con->ack_outstanding = 1;
+	add_and_send_msg(con, msg_len);
+	return 0;
+}
+
 
-	print_pending_msg(con->node_id);
+int sensor_connection_init(sensor_connection_t *con, nodeid_t node, nodeid_t node_reply_hop, nodeid_t master, uint8_t timeout)
+{
+	lock_connections();
+	int res = connect_node(con, node, node_reply_hop, master, timeout);
+	unlock_connections();
+	return res;
+}
+
+
+/*
+ * Starts a new connection with the resume message, called with the connections locked.
+ */
+static int resume_node(sensor_connection_t *con, nodeid_t node, uint64_t ticket, nodeid_t master, uint8_t timeout)
+{
+	int res = init_connection(con, node, master, timeout);
+	if (res != 0)
+	{
+		return res;
+	}
+
+	// The resume is treated like the hs1, it is the only outstanding message until the node replies.
+	if (!next_msg_buffer(con))
+	{
+		return -ENOMEM;
+	}
+
+	sensor_connection_msg_t *msg = get_msg(con, 0);
+	uint32_t msg_len = sizeof(msg->data);
+
+	msg_auth_resume_t *resume = (msg_auth_resume_t *)msg->data;
+	resume->type = MSG_TYPE_AUTH_RESUME;
+
+	res = auth_master_make_resume(&con->auth_config, ticket, msg->data, sizeof(*resume), &msg_len,
+	                              con->auth_add_data_cfg, sizeof(con->auth_add_data_cfg), &msg->nonce);
+
+	if (res != 0)
+	{
+		printf("auth_master_make_resume failed with error %i\n", res);
+		return 1;
+	}
 
-	send_last_packet(con);
+	add_and_send_msg(con, msg_len);
 	return 0;
 }
 
 
+int sensor_connection_resume(sensor_connection_t *con, nodeid_t node, uint64_t ticket, nodeid_t master, uint8_t timeout)
+{
+	lock_connections();
+	int res = resume_node(con, node, ticket, master, timeout);
+	unlock_connections();
+	return res;
+}
+
+
 void sensor_connection_handle_packet(sensor_connection_t *con, uint8_t *data, uint32_t len)
 {
 	if (len == 0)
@@ -507,21 +1082,26 @@ void sensor_connection_handle_packet(sensor_connection_t *con, uint8_t *data, ui
 	/*
 	 * Call the handler function for the message type
 	 */
+	lock_connections();
 	msg_union_t *msg = (msg_union_t *)data;
 	switch(msg->type)
 	{
 		case MSG_TYPE_AUTH_HS_1:
 			handle_hs1(con, data, len);
-			return;
+			break;
 
 		case MSG_TYPE_AUTH_HS_2:
 			handle_hs2(con, data, len);
-			return;
+			break;
 
 		case MSG_TYPE_AUTH_ACK:
 			handle_ack(con, data, len);
 			break;
 
+		case MSG_TYPE_AUTH_RESUME_ACK:
+			handle_resume_ack(con, data, len);
+			break;
+
 		case MSG_TYPE_STATUS_UPDATE:
 			handle_status_update(con, data, len);
 			break;
@@ -538,56 +1118,132 @@ void sensor_connection_handle_packet(sensor_connection_t *con, uint8_t *data, ui
 			handle_storage_status(con, data, len);
 			break;
 
+		case MSG_TYPE_LINK_STATS:
+			handle_link_stats(con, data, len);
+			break;
+
 		default:
 			printf("Got message with unexpected code %u from %u\n", msg->type, con->node_id);
 	}
+	unlock_connections();
 }
 
 
-void sensor_connection_update(sensor_connection_t *con)
+/*
+ * -- Config channel --
+ * Called when the timer of the connection expires.
+ * Sends the TIMEOUT notification if the oldest message that has not been ack'ed timed out.
+ */
+static void handle_timeout(sensor_connection_t *con)
 {
-	if (!con->ack_outstanding)
+	if (con->timed_out)
 	{
-		// no ack outstanding -> nothing to do
+		// already timeouted
 		return;
 	}
 
-	if (con->timeout_counter == 0xff)
+	// The oldest message that has not been ack'ed times out first
+	for (uint8_t i = 0; i < con->num_msgs; i++)
 	{
-		// already timeouted
+		sensor_connection_msg_t *msg = get_msg(con, i);
+		if (!msg || msg->acked)
+		{
+			continue;
+		}
+
+		// check the timeout, it is doubled with every retransmission
+		if (xTaskGetTickCount() - msg->sent_at < rtt_timeout(&con->rtt, con->retransmissions))
+		{
+			// Not yet reached, the message has been sent again after the timer was armed
+			update_timer(con);
+			return;
+		}
+
+		// Mark that i already sent the TIMEOUT notification
+		con->timed_out = 1;
+		master_notify_timeout(con->node_id, msg->tag);
 		return;
 	}
+}
+
+
+void sensor_connection_init_timers(TaskHandle_t task)
+{
+	con_lock.mutex = xSemaphoreCreateRecursiveMutexStatic(&con_lock.mutex_buffer);
+	timers.mutex = xSemaphoreCreateMutexStatic(&timers.mutex_buffer);
+	timers.task = task;
 
-	// check the timeout counter
-	if (con->timeout_counter < con->timeout)
+	TickType_t now = xTaskGetTickCount();
+	timer_wheel_init(&timers.wheel, now);
+	timers.wake_at = now;
+}
+
+
+TickType_t sensor_connection_process_timers(void)
+{
+	xSemaphoreTake(timers.mutex, portMAX_DELAY);
+
+	timer_wheel_timer_t *t;
+	while ((t = timer_wheel_expire(&timers.wheel, xTaskGetTickCount())) != NULL)
 	{
-		// Not yet reached limit -> Increment it
-		con->timeout_counter++;
-		return;
+		sensor_connection_t *con = (sensor_connection_t *)((uint8_t *)t - offsetof(sensor_connection_t, timer));
+
+		// The handler may arm the timer again, the connections are locked before the timers
+		xSemaphoreGive(timers.mutex);
+		lock_connections();
+		handle_timeout(con);
+		unlock_connections();
+		xSemaphoreTake(timers.mutex, portMAX_DELAY);
 	}
 
-	// Set timeout counter to 0xff to mark that i already sent the TIMEOUT notification
-	con->timeout_counter = 0xff;
-	ISRSAFE_PRINTF("###TIMEOUT%u\n", con->node_id);
+	TickType_t now = xTaskGetTickCount();
+	TickType_t next = timer_wheel_next(&timers.wheel, now, MAX_TIMER_SLEEP);
+	timers.wake_at = now + next;
 
+	xSemaphoreGive(timers.mutex);
+	return next;
+}
+
+
+void sensor_connection_set_tag(sensor_connection_t *con, uint16_t tag)
+{
+	con->tag = tag;
 }
 
 
 int sensor_connection_retransmit(sensor_connection_t *con)
 {
-	if (!con->ack_outstanding || con->timeout_counter <= con->timeout)
+	lock_connections();
+	if (con->num_msgs == 0 || !con->timed_out)
 	{
 		// should not be called in this case
+		unlock_connections();
 		printf("Illegal call to sensor_connection_retransmit!\n");
 		return 1;
 	}
 
-	print_pending_msg(con->node_id);
+	master_notify_pend(con->node_id, con->tag);
 
-	// re-send the message, this also resets the timer
+	if (con->retransmissions < 0xff)
+	{
+		con->retransmissions++;
+	}
+
+	// re-send all messages that have not been ack'ed, this also resets their timers
 	printf("Do retransmission to node %u\n", con->node_id);
-	send_last_packet(con);
+	for (uint8_t i = 0; i < con->num_msgs; i++)
+	{
+		sensor_connection_msg_t *msg = get_msg(con, i);
+		if (msg && !msg->acked)
+		{
+			msg->retransmitted = 1;
+			send_msg(con, msg);
+		}
+	}
 
+	con->timed_out = 0;
+	update_timer(con);
+	unlock_connections();
 	return 0;
 }
 
@@ -599,14 +1255,15 @@ int sensor_connection_set_routes(sensor_connection_t *con, uint8_t reset, const
 	 * If this is too large, either the static assert or the suth will fail.
 	 */
 	static const uint8_t MAX_ROUTES = 20;
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send route request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send route request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_route_data_t *routemsg = (msg_route_data_t *)con->last_sent_message;
-	_Static_assert(MAX_ROUTES <= (sizeof(con->last_sent_message) - sizeof(*routemsg)) / sizeof(routemsg->r[0]) + 1, "Route packet too long");
+	msg_route_data_t *routemsg = (msg_route_data_t *)buffer;
+	_Static_assert(MAX_ROUTES <= (SENSOR_CONNECTION_MSG_SIZE - sizeof(*routemsg)) / sizeof(routemsg->r[0]) + 1, "Route packet too long");
 
 	if (reset)
 	{
@@ -667,19 +1324,91 @@ int sensor_connection_set_routes(sensor_connection_t *con, uint8_t reset, const
 }
 
 
+int sensor_connection_set_hop_channels(sensor_connection_t *con, const char *channels)
+{
+	static const uint8_t MAX_ENTRIES = 20;
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
+	{
+		printf("Can't send hop channel request to %u, too many commands are outstanding.\n", con->node_id);
+		return -EBUSY;
+	}
+
+	msg_hop_channels_t *hchmsg = (msg_hop_channels_t *)buffer;
+	_Static_assert(MAX_ENTRIES <= (SENSOR_CONNECTION_MSG_SIZE - sizeof(*hchmsg)) / sizeof(hchmsg->c[0]) + 1, "Hop channel packet too long");
+
+	hchmsg->type = MSG_TYPE_HOP_CHANNELS;
+
+	uint8_t current = 0;
+
+	// parse the hop:channel pairs, these have the same format as the routes
+	while(channels[0] != 0)
+	{
+		if (current >= MAX_ENTRIES)
+		{
+			printf("To many entries in hop channel command, max number of entries: %u\n", MAX_ENTRIES);
+			return 1;
+		}
+
+		if (utils_parse_route(&channels, &hchmsg->c[current].hop, &hchmsg->c[current].channel) != 0)
+		{
+			return 1;
+		}
+
+		if (hchmsg->c[current].channel > MESHNW_CHANNEL_MAX)
+		{
+			printf("Invalid channel %u, max channel: %u\n", hchmsg->c[current].channel, MESHNW_CHANNEL_MAX);
+			return 1;
+		}
+
+		if (channels[0] != 0 && channels[0] != ',')
+		{
+			printf("Unexpected hop channel delim: %i(%c)\n", channels[0], channels[0]);
+			return 1;
+		}
+
+		if (channels[0] == ',')
+		{
+			channels++;
+		}
+
+		current++;
+	}
+
+	if (current == 0)
+	{
+		printf("No hop channels specified!\n");
+		return 1;
+	}
+
+	// now sign the packet
+	uint32_t len = sizeof(*hchmsg) + (current - 1) * sizeof(hchmsg->c[0]);
+	int res = sign_and_send_msg(con, len);
+
+	if (res != 0)
+	{
+		printf("Failed to sign hop channel request for node %u with error %i\n", con->node_id, res);
+		return 1;
+	}
+
+	return 0;
+}
+
+
 int sensor_connection_configure_sensor(sensor_connection_t *con, uint8_t channel, const char *input_filter, const char *st_matrix, const char *st_window, const char *reject_filter)
 {
-	_Static_assert(sizeof(msg_configure_sensor_t) < sizeof(con->last_sent_message), "Config message size exceeds size limt");
+	_Static_assert(sizeof(msg_configure_sensor_t) < SENSOR_CONNECTION_MSG_SIZE, "Config message size exceeds size limt");
 
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send config request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send config request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
 	// i can do this (and still access the struct normally)
 	// because there are only 16 bit values in here and the above ensures 16 bit alignment.
-	msg_configure_sensor_t *msg = (msg_configure_sensor_t *)con->last_sent_message;
+	msg_configure_sensor_t *msg = (msg_configure_sensor_t *)buffer;
 
 	msg->type = MSG_TYPE_CONFIGURE_SENSOR_CHANNEL;
 	msg->channel_id = channel;
@@ -752,13 +1481,14 @@ int sensor_connection_configure_sensor(sensor_connection_t *con, uint8_t channel
 
 int sensor_connection_enable_sensors(sensor_connection_t *con, uint16_t mask, uint16_t samples_per_sec)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send enable sensor request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send enable sensor request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_start_sensor_t *startmsg = (msg_start_sensor_t *)con->last_sent_message;
+	msg_start_sensor_t *startmsg = (msg_start_sensor_t *)buffer;
 
 	startmsg->type = MSG_TYPE_START_SENSOR;
 	startmsg->status_retransmission_delay = con->timeout;
@@ -785,13 +1515,14 @@ int sensor_connection_enable_sensors(sensor_connection_t *con, uint16_t mask, ui
 
 int sensor_connection_authping(sensor_connection_t *con)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send authping to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send authping to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_nop_t *nopmsg = (msg_nop_t *)con->last_sent_message;
+	msg_nop_t *nopmsg = (msg_nop_t *)buffer;
 
 	nopmsg->type = MSG_TYPE_NOP;
 
@@ -810,17 +1541,18 @@ int sensor_connection_authping(sensor_connection_t *con)
 
 int sensor_connection_led(sensor_connection_t *con, int num_leds, char **leds)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send led request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send led request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
 
-	msg_led_t *ledmsg = (msg_led_t *)con->last_sent_message;
+	msg_led_t *ledmsg = (msg_led_t *)buffer;
 
 	uint8_t bytes = (num_leds - 1) / 2 + 1;
-	if (bytes + sizeof(*ledmsg) > sizeof(con->last_sent_message))
+	if (bytes + sizeof(*ledmsg) > SENSOR_CONNECTION_MSG_SIZE)
 	{
 		printf("Too many leds in LED request\n");
 		return -EINVAL;
@@ -858,15 +1590,91 @@ int sensor_connection_led(sensor_connection_t *con, int num_leds, char **leds)
 }
 
 
+int sensor_connection_led_update(sensor_connection_t *con, const char *leds)
+{
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
+	{
+		printf("Can't send led update request to %u, too many commands are outstanding.\n", con->node_id);
+		return -EBUSY;
+	}
+
+	msg_led_update_t *ledmsg = (msg_led_update_t *)buffer;
+	static const uint8_t MAX_ENTRIES = (SENSOR_CONNECTION_MSG_SIZE - sizeof(*ledmsg)) / sizeof(ledmsg->data[0]) + 1;
+
+	ledmsg->type = MSG_TYPE_LED_UPDATE;
+
+	uint8_t current = 0;
+
+	// parse the led:color pairs, these have the same format as the routes
+	while(leds[0] != 0)
+	{
+		if (current >= MAX_ENTRIES)
+		{
+			printf("To many entries in led update command, max number of entries: %u\n", MAX_ENTRIES);
+			return 1;
+		}
+
+		nodeid_t led;
+		nodeid_t color;
+		if (utils_parse_route(&leds, &led, &color) != 0)
+		{
+			return 1;
+		}
+
+		if (led > 0x0f || color > 0x0f)
+		{
+			printf("Invalid led %u or color %u\n", led, color);
+			return 1;
+		}
+
+		ledmsg->data[current].led = led;
+		ledmsg->data[current].color = color;
+
+		if (leds[0] != 0 && leds[0] != ',')
+		{
+			printf("Unexpected led update delim: %i(%c)\n", leds[0], leds[0]);
+			return 1;
+		}
+
+		if (leds[0] == ',')
+		{
+			leds++;
+		}
+
+		current++;
+	}
+
+	if (current == 0)
+	{
+		printf("No leds specified!\n");
+		return 1;
+	}
+
+	// sign and send
+	uint32_t len = sizeof(*ledmsg) + (current - 1) * sizeof(ledmsg->data[0]);
+	int res = sign_and_send_msg(con, len);
+
+	if (res != 0)
+	{
+		printf("Failed to sign led update request for node %u with error %i\n", con->node_id, res);
+		return 1;
+	}
+
+	return 0;
+}
+
+
 int sensor_connection_rebuild_status_channel(sensor_connection_t *con)
 {
-    if (con->ack_outstanding)
+    uint8_t *buffer = next_msg_buffer(con);
+    if (!buffer)
     {
-        printf("Can't send rebuild_status_channel to %u, ACK for last command is still outstanding.\n", con->node_id);
+        printf("Can't send rebuild_status_channel to %u, too many commands are outstanding.\n", con->node_id);
         return -EBUSY;
     }
 
-    msg_nop_t *nopmsg = (msg_nop_t *)con->last_sent_message;
+    msg_nop_t *nopmsg = (msg_nop_t *)buffer;
 
     nopmsg->type = MSG_TYPE_REBUILD_STATUS_CHANNEL;
 
@@ -885,19 +1693,20 @@ int sensor_connection_rebuild_status_channel(sensor_connection_t *con)
 
 int sensor_connection_configure_status_change_indicator(sensor_connection_t *con, int num_channels, char **channels)
 {
-    if (con->ack_outstanding)
+    uint8_t *buffer = next_msg_buffer(con);
+    if (!buffer)
     {
-        printf("Can't send configure_status_change_indicator to %u, ACK for last command is still outstanding.\n", con->node_id);
+        printf("Can't send configure_status_change_indicator to %u, too many commands are outstanding.\n", con->node_id);
         return -EBUSY;
     }
 
-    msg_configure_status_change_indicator_t *cscimsg = (msg_configure_status_change_indicator_t *)con->last_sent_message;
+    msg_configure_status_change_indicator_t *cscimsg = (msg_configure_status_change_indicator_t *)buffer;
 
     cscimsg->type = MSG_TYPE_CONFIGURE_STATUS_CHANGE_INDICATOR;
 
 	size_t message_size = sizeof(*cscimsg) + num_channels * sizeof(cscimsg->data[0]);
 
-	if (message_size > sizeof(con->last_sent_message))
+	if (message_size > SENSOR_CONNECTION_MSG_SIZE)
 	{
 		printf("Too many channels in one request\n");
 		return -EINVAL;
@@ -930,13 +1739,14 @@ int sensor_connection_configure_status_change_indicator(sensor_connection_t *con
 
 int sensor_connection_get_raw_data(sensor_connection_t *con, uint8_t channel, uint16_t num_frames)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send raw data request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send raw data request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_begin_send_raw_frames_t *rfmsg = (msg_begin_send_raw_frames_t *)con->last_sent_message;
+	msg_begin_send_raw_frames_t *rfmsg = (msg_begin_send_raw_frames_t *)buffer;
 
 	rfmsg->type = MSG_TYPE_BEGIN_SEND_RAW_FRAMES;
 	rfmsg->channel = channel;
@@ -959,13 +1769,14 @@ int sensor_connection_get_raw_data(sensor_connection_t *con, uint8_t channel, ui
 
 int sensor_connection_get_raw_status(sensor_connection_t *con)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send raw status request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send raw status request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_get_raw_status_t *rsmsg = (msg_get_raw_status_t *)con->last_sent_message;
+	msg_get_raw_status_t *rsmsg = (msg_get_raw_status_t *)buffer;
 
 	rsmsg->type = MSG_TYPE_GET_RAW_STATUS;
 
@@ -984,13 +1795,14 @@ int sensor_connection_get_raw_status(sensor_connection_t *con)
 
 int sensor_connection_configure_freq_channel(sensor_connection_t *con, uint8_t channel, uint16_t threshold, uint8_t num_samples, uint8_t negative_threshold)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send configure frequency channel request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send configure frequency channel request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_configure_freq_channel_t *acmsg = (msg_configure_freq_channel_t *)con->last_sent_message;
+	msg_configure_freq_channel_t *acmsg = (msg_configure_freq_channel_t *)buffer;
 
 	acmsg->type = MSG_TYPE_CONFIGURE_FREQ_CHANNEL;
 	acmsg->channel_id = channel;
@@ -1013,17 +1825,18 @@ int sensor_connection_configure_freq_channel(sensor_connection_t *con, uint8_t c
 
 int sensor_connection_storage_ctl(sensor_connection_t *con, uint8_t req, uint8_t *param, uint8_t param_len)
 {
-	if (con->ack_outstanding)
+	uint8_t *buffer = next_msg_buffer(con);
+	if (!buffer)
 	{
-		printf("Can't send storage ctl request to %u, ACK for last command is still outstanding.\n", con->node_id);
+		printf("Can't send storage ctl request to %u, too many commands are outstanding.\n", con->node_id);
 		return -EBUSY;
 	}
 
-	msg_storage_ctl_t *sctl = (msg_storage_ctl_t *)con->last_sent_message;
+	msg_storage_ctl_t *sctl = (msg_storage_ctl_t *)buffer;
 	sctl->type = MSG_TYPE_STORAGE_CTL;
 	sctl->request = req;
 
-	if (sizeof(con->last_sent_message) < sizeof(*sctl) + param_len)
+	if (SENSOR_CONNECTION_MSG_SIZE < sizeof(*sctl) + param_len)
 	{
 		printf("Parameter too long!\n");
 		return -EINVAL;
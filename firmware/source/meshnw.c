@@ -6,6 +6,7 @@
 
 #include "meshnw.h"
 #include "sx127x.h"
+#include "sx127x_config.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -32,6 +33,14 @@
 // Stack size of the receiving thread (in words)
 #define RECV_THD_STACK_SIZE 512
 
+// Frequency of the channel 0 and the spacing between the channels
+#define CHANNEL_BASE_FREQUENCY 433200000
+#define CHANNEL_SPACING           100000
+
+_Static_assert(CHANNEL_BASE_FREQUENCY + CHANNEL_SPACING >= SX127X_CONFIG_LORA_FREQUENCY_MIN &&
+               CHANNEL_BASE_FREQUENCY + MESHNW_CHANNEL_MAX * CHANNEL_SPACING <= SX127X_CONFIG_LORA_FREQUENCY_MAX,
+               "Channels exceed the allowed frequency range");
+
 /*
  * The structure definition of a layer 3 packet.
  * The lower layers are handled by the RF hardware, the higher layers by the callbacks.
@@ -65,6 +74,173 @@ typedef struct
  */
 #define MESHNW_MAX_OTA_PACKET_SIZE (MESHNW_MAX_PACKET_SIZE + sizeof(layer3_packet_header_t))
 
+#ifdef MESHNW_TDMA
+
+/*
+ * Time slotted MAC
+ *
+ * Time is divided into frames of TDMA_NUM_SLOTS slots.
+ * The master starts every frame with a sync beacon, which is re-broadcasted by the relays,
+ * so that every node knows the start of the current frame.
+ * The first TDMA_MASTER_SLOTS slots belong to the master, it sends the beacon and the packets for the whole network there.
+ * The remaining slots are split into bands, every depth in the routing tree has a downstream and an upstream band:
+ *
+ *   | master | down 1 | down 2 | down 3 | down 4 | up 4 | up 3 | up 2 | up 1 |
+ *
+ * Packets towards the master are sent in the upstream band, all others in the downstream band.
+ * With this order, a status update travels up to the master within one frame and its ack travels back down in the next one.
+ * The bands near the master have more slots, all packets have to pass there while the deeper bands
+ * are used by many parents in parallel.
+ *
+ * Inside of the bands, the slots are assigned by the parent:
+ * The children of a node are the next hops in its routing table (except the one towards the master),
+ * the routing table also tells how many nodes are behind every child.
+ * Every child gets at least one slot of the band, the remaining slots are handed out in proportion to the
+ * number of nodes behind the children because their packets have to pass there.
+ * The beacon carries the owner of every slot (the same for both directions), so the children of one parent never collide.
+ * A node without a slot in the beacon of its parent (no routes set yet or more children than slots)
+ * falls back to the slot (node_id % band size).
+ * Nodes with different parents may get the same slot, this only collides if they are in range of the other parent.
+ *
+ * A node only transmits in its own slots, all packets (including forwarded ones) are queued until then.
+ * As long as a node has no time reference (no beacon received), it falls back to sending immediately.
+ */
+
+// Number of slots of the master at the start of every frame
+#define TDMA_MASTER_SLOTS     4
+
+// Number of tree levels with own bands of slots, deeper nodes share the last bands
+#define TDMA_MAX_DEPTH        4
+
+// Number of slots in each of the two bands of every depth
+#define TDMA_BAND_1_SLOTS     6
+#define TDMA_BAND_2_SLOTS     4
+#define TDMA_BAND_3_SLOTS     2
+#define TDMA_BAND_4_SLOTS     2
+
+// Size of the largest band
+#define TDMA_MAX_BAND_SLOTS   TDMA_BAND_1_SLOTS
+
+#define TDMA_NUM_SLOTS        (TDMA_MASTER_SLOTS + 2 * (TDMA_BAND_1_SLOTS + TDMA_BAND_2_SLOTS + TDMA_BAND_3_SLOTS + TDMA_BAND_4_SLOTS))
+
+// Time added at the begin and the end of every slot to compensate for drift and polling delays (in ms)
+#define TDMA_GUARD_TIME_MS    50
+
+// Number of frames without a beacon until the time reference is considered lost
+#define TDMA_SYNC_LOSS_FRAMES 3
+
+// Number of packets that can be queued until the next own slot
+#define TDMA_TX_QUEUE_LENGTH  8
+
+/*
+ * Payload of a beacon.
+ * A beacon is a layer 3 packet with next_hop and dst set to MESHNW_INVALID_NODE,
+ * src is the node that sent (or re-broadcasted) the beacon.
+ */
+typedef struct
+{
+	// The node that started the frame (the master)
+	nodeid_t root;
+
+	// Depth of the sender in the routing tree (0 for the master)
+	uint8_t depth;
+
+	// Slot length in ms, this is defined by the master
+	uint16_t slot_len;
+
+	// Number of the current frame
+	uint16_t frame;
+
+	// Time between the start of the frame and the start of this transmission in ms
+	uint32_t offset;
+
+	// Owner of every slot in the bands of the sender's children, MESHNW_INVALID_NODE if unused
+	nodeid_t slot_owner[TDMA_MAX_BAND_SLOTS];
+} __attribute__((packed)) tdma_beacon_t;
+
+typedef struct
+{
+	// Time at which the packet has been received (forwarded packets) or passed to meshnw_send()
+	TickType_t queued_at;
+	uint8_t len;
+	uint8_t data[MESHNW_MAX_OTA_PACKET_SIZE];
+} tdma_queued_packet_t;
+
+typedef struct
+{
+	// Start of the current frame (in ticks)
+	TickType_t frame_start;
+	uint16_t frame;
+
+	// Slot length in ms, only valid if synced
+	uint16_t slot_len;
+
+	// Number of the frame in which the last beacon was accepted
+	uint16_t last_sync_frame;
+
+	// true if this node has a valid time reference
+	bool synced;
+
+	// Channels on which a beacon needs to be sent in the next own slot (one bit per channel)
+	uint16_t beacon_channels;
+
+	// Depth of this node in the routing tree
+	uint8_t depth;
+
+	// Slots this node is allowed to send in (one bit per slot)
+	uint32_t own_slots;
+
+	// The own slots in the upstream band, a subset of own_slots
+	uint32_t up_slots;
+
+	// The root of the tree and the node we got the time reference from
+	nodeid_t root;
+	nodeid_t parent;
+
+	// Packets waiting for the own slot
+	tdma_queued_packet_t tx_queue[TDMA_TX_QUEUE_LENGTH];
+	uint8_t tx_queue_first;
+	uint8_t tx_queue_count;
+} tdma_data_t;
+
+static const uint8_t tdma_band_slots[TDMA_MAX_DEPTH] =
+{
+	TDMA_BAND_1_SLOTS,
+	TDMA_BAND_2_SLOTS,
+	TDMA_BAND_3_SLOTS,
+	TDMA_BAND_4_SLOTS
+};
+
+#endif
+
+/*
+ * The moving averages of the link statistics are stored scaled by LINK_STATS_AVG_SCALE,
+ * every new sample has a weight of 1 / LINK_STATS_AVG_WEIGHT.
+ */
+#define LINK_STATS_AVG_SCALE  16
+#define LINK_STATS_AVG_WEIGHT 8
+
+typedef struct
+{
+	// MESHNW_INVALID_NODE if unused
+	nodeid_t node;
+
+	uint16_t rx;
+	uint16_t tx;
+	uint16_t fwd;
+	uint16_t drop;
+	uint16_t tx_fail;
+
+	// Moving averages (see LINK_STATS_AVG_SCALE)
+	int32_t rssi_avg;
+	int32_t snr_avg;
+	int32_t fwd_delay_avg;
+	bool fwd_delay_valid;
+
+	// Time of the last update, the least recently used entry is replaced by a new neighbour
+	TickType_t last_update;
+} link_stats_entry_t;
+
 /*
  * This struct bundles all globals to make it a bit less ugly.
  */
@@ -92,6 +268,21 @@ typedef struct
 	// If this is zero, incoming packets with destination addres unqual to my address are dropped.
 	// Otherwise they are forwarded  according to the routing table.
 	uint8_t enable_forwarding;
+
+	// Receive frequency of this node
+	uint32_t frequency;
+
+	// Channel of every next hop, MESHNW_CHANNEL_OWN if the hop uses the same frequency as this node.
+	uint8_t hop_channel[MESHNW_MAX_NODEID + 1];
+
+	// true while the modem is tuned to the channel of another node, see radio_restore_channel()
+	bool foreign_channel;
+
+	link_stats_entry_t link_stats[MESHNW_LINK_STATS_ENTRIES];
+
+#ifdef MESHNW_TDMA
+	tdma_data_t tdma;
+#endif
 } meshnw_context_data_t;
 
 static meshnw_context_data_t context = {};
@@ -127,10 +318,725 @@ static nodeid_t get_route(nodeid_t destination)
 	return context.routing_table[destination];
 }
 
+
+static uint32_t channel_frequency(uint8_t channel)
+{
+	return CHANNEL_BASE_FREQUENCY + (uint32_t)channel * CHANNEL_SPACING;
+}
+
+
+/*
+ * Gets the channel a packet for <hop> has to be sent on.
+ * Explicit channels that are equal to the own frequency are mapped to MESHNW_CHANNEL_OWN.
+ */
+static uint8_t get_hop_channel(nodeid_t hop)
+{
+	if (hop > MESHNW_MAX_NODEID)
+	{
+		return MESHNW_CHANNEL_OWN;
+	}
+
+	uint8_t channel = context.hop_channel[hop];
+	if (channel_frequency(channel) == context.frequency)
+	{
+		return MESHNW_CHANNEL_OWN;
+	}
+
+	return channel;
+}
+
+
+/*
+ * Switches the modem back to the own frequency after a transmission on another channel.
+ * This is not possible while the transmission is still running, so recv_thread calls this on every poll
+ * until it succeeds.
+ * Returns true if the modem is on the own frequency.
+ * Must be called with the mutex held.
+ */
+static bool radio_restore_channel(void)
+{
+	if (!context.foreign_channel)
+	{
+		return true;
+	}
+
+	// Fails while the modem is still sending
+	if (!sx127x_set_frequency(context.frequency))
+	{
+		return false;
+	}
+
+	context.foreign_channel = false;
+	return true;
+}
+
+
+/*
+ * Sends a packet on the specified channel.
+ * For channels other than the own one, the modem is switched to the channel,
+ * recv_thread switches it back as soon as the transmission is complete.
+ * Must be called with the mutex held.
+ */
+static bool radio_send(const uint8_t *packet, uint8_t len, uint8_t channel)
+{
+	if (!radio_restore_channel())
+	{
+		printf("Send packet failed because the modem is busy\n");
+		return false;
+	}
+
+	if (channel == MESHNW_CHANNEL_OWN)
+	{
+		return sx127x_send(packet, len);
+	}
+
+	// Don't switch the frequency while a packet is being received
+	if (sx127x_is_busy())
+	{
+		printf("Send packet failed because the modem is busy\n");
+		return false;
+	}
+
+	if (!sx127x_set_frequency(channel_frequency(channel)))
+	{
+		return false;
+	}
+
+	context.foreign_channel = true;
+
+	bool ret = sx127x_send(packet, len);
+	if (!ret)
+	{
+		radio_restore_channel();
+	}
+
+	return ret;
+}
+
+
+/*
+ * Adds a sample to a moving average.
+ */
+static int32_t link_stats_avg(int32_t avg, int32_t sample)
+{
+	return avg + (sample * LINK_STATS_AVG_SCALE - avg) / LINK_STATS_AVG_WEIGHT;
+}
+
+
+/*
+ * Gets the link statistics entry of a neighbour.
+ * If there is no entry yet, the least recently used one is reset and assigned to the neighbour.
+ * Must be called with the mutex held.
+ */
+static link_stats_entry_t *link_stats_get(nodeid_t node)
+{
+	if (node > MESHNW_MAX_NODEID)
+	{
+		return NULL;
+	}
+
+	TickType_t now = xTaskGetTickCount();
+	link_stats_entry_t *lru = &context.link_stats[0];
+
+	for (uint32_t i = 0; i < MESHNW_LINK_STATS_ENTRIES; i++)
+	{
+		link_stats_entry_t *e = &context.link_stats[i];
+		if (e->node == node)
+		{
+			e->last_update = now;
+			return e;
+		}
+
+		if (lru->node <= MESHNW_MAX_NODEID &&
+		    (e->node > MESHNW_MAX_NODEID || now - e->last_update > now - lru->last_update))
+		{
+			lru = e;
+		}
+	}
+
+	memset(lru, 0, sizeof(*lru));
+	lru->node = node;
+	lru->last_update = now;
+	return lru;
+}
+
+
+/*
+ * Gets the neighbour a packet from <src> has been received from.
+ */
+static nodeid_t link_stats_neighbour(nodeid_t src)
+{
+	nodeid_t hop = get_route(src);
+	return hop <= MESHNW_MAX_NODEID ? hop : src;
+}
+
+
+/*
+ * Updates the statistics for a packet received from <neighbour>.
+ */
+static void link_stats_update_rx(nodeid_t neighbour, uint8_t rssi, int8_t snr)
+{
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+
+	link_stats_entry_t *e = link_stats_get(neighbour);
+	if (e)
+	{
+		if (e->rx == 0)
+		{
+			e->rssi_avg = rssi * LINK_STATS_AVG_SCALE;
+			e->snr_avg = snr * LINK_STATS_AVG_SCALE;
+		}
+		else
+		{
+			e->rssi_avg = link_stats_avg(e->rssi_avg, rssi);
+			e->snr_avg = link_stats_avg(e->snr_avg, snr);
+		}
+		e->rx++;
+	}
+
+	xSemaphoreGive(context.mutex);
+}
+
+
+/*
+ * Updates the statistics for a packet received from <neighbour> that had to be forwarded.
+ * success    true if the packet has been forwarded (or queued), false if it has been dropped
+ */
+static void link_stats_update_fwd(nodeid_t neighbour, bool success)
+{
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+
+	link_stats_entry_t *e = link_stats_get(neighbour);
+	if (e)
+	{
+		if (success)
+		{
+			e->fwd++;
+		}
+		else
+		{
+			e->drop++;
+		}
+	}
+
+	xSemaphoreGive(context.mutex);
+}
+
+
+/*
+ * Updates the statistics for a send attempt of a packet to its next hop.
+ * success    true if the packet has been passed to the modem
+ * queued_at  Time at which the packet has been received or passed to meshnw_send()
+ * Must be called with the mutex held.
+ */
+static void link_stats_update_tx(const uint8_t *packet, bool success, TickType_t queued_at)
+{
+	const layer3_packet_header_t *hdr = (const layer3_packet_header_t *)packet;
+
+	link_stats_entry_t *e = link_stats_get(hdr->next_hop);
+	if (!e)
+	{
+		return;
+	}
+
+	if (!success)
+	{
+		e->tx_fail++;
+		return;
+	}
+
+	e->tx++;
+
+	if (hdr->src != context.my_node_id)
+	{
+		int32_t delay = xTaskGetTickCount() - queued_at;
+		e->fwd_delay_avg = e->fwd_delay_valid ? link_stats_avg(e->fwd_delay_avg, delay) : delay * LINK_STATS_AVG_SCALE;
+		e->fwd_delay_valid = true;
+	}
+}
+
+#ifdef MESHNW_TDMA
+
+/*
+ * Gets the first slot of the upstream (up = true) or downstream band of the nodes with the specified depth.
+ * The number of slots in the band is written to len.
+ */
+static uint32_t tdma_band(uint8_t depth, bool up, uint32_t *len)
+{
+	_Static_assert(TDMA_NUM_SLOTS <= 32, "The slots must fit into the own_slots bitmask");
+
+	if (depth < 1)
+	{
+		depth = 1;
+	}
+	else if (depth > TDMA_MAX_DEPTH)
+	{
+		// Deeper nodes share the last bands
+		depth = TDMA_MAX_DEPTH;
+	}
+
+	uint32_t start = TDMA_MASTER_SLOTS;
+	for (uint32_t d = 1; d < depth; d++)
+	{
+		start += tdma_band_slots[d - 1];
+	}
+
+	if (up)
+	{
+		// The upstream bands are in reverse order after the downstream bands
+		for (uint32_t d = depth; d <= TDMA_MAX_DEPTH; d++)
+		{
+			start += tdma_band_slots[d - 1];
+		}
+		for (uint32_t d = TDMA_MAX_DEPTH; d > depth; d--)
+		{
+			start += tdma_band_slots[d - 1];
+		}
+	}
+
+	*len = tdma_band_slots[depth - 1];
+	return start;
+}
+
+
+#ifndef MASTER
+/*
+ * Gets the slots this node is allowed to send in the upstream (up = true) or downstream band (one bit per slot).
+ * depth is the own depth, beacon the last beacon of the parent.
+ */
+static uint32_t tdma_own_slots(uint8_t depth, bool up, const tdma_beacon_t *beacon)
+{
+	uint32_t len;
+	uint32_t band = tdma_band(depth, up, &len);
+
+	uint32_t slots = 0;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		if (beacon->slot_owner[i] == context.my_node_id)
+		{
+			slots |= 1u << (band + i);
+		}
+	}
+
+	if (slots == 0)
+	{
+		// Not known to the parent
+		slots = 1u << (band + context.my_node_id % len);
+	}
+
+	return slots;
+}
+#endif
+
+
+/*
+ * Assigns the slots of the bands of the children (see above).
+ * Writes the owner of every slot to slot_owner.
+ */
+static void tdma_assign_slots(nodeid_t *slot_owner)
+{
+	nodeid_t children[TDMA_MAX_BAND_SLOTS];
+	uint32_t weight[TDMA_MAX_BAND_SLOTS] = {};
+	uint32_t num_slots[TDMA_MAX_BAND_SLOTS] = {};
+	uint32_t count = 0;
+
+	uint32_t len;
+	tdma_band(context.tdma.depth + 1, false, &len);
+
+	// Collect the children in ascending order (one bit per node)
+	uint32_t hops[(MESHNW_MAX_NODEID + 32) / 32] = {};
+	nodeid_t upstream = get_route(context.tdma.root);
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		nodeid_t hop = context.routing_table[i];
+		if (hop <= MESHNW_MAX_NODEID && hop != upstream && i != context.tdma.root)
+		{
+			hops[hop / 32] |= 1u << (hop % 32);
+		}
+	}
+
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID && count < len; i++)
+	{
+		if (hops[i / 32] & (1u << (i % 32)))
+		{
+			children[count++] = i;
+		}
+	}
+
+	// Count the nodes behind every child
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		for (uint32_t c = 0; c < count; c++)
+		{
+			if (context.routing_table[i] == children[c] && i != context.tdma.root)
+			{
+				weight[c]++;
+			}
+		}
+	}
+
+	// One slot for every child, the remaining ones go to the child with the most nodes per slot
+	for (uint32_t i = 0; i < count; i++)
+	{
+		num_slots[i] = 1;
+	}
+
+	for (uint32_t i = count; i < len && count > 0; i++)
+	{
+		uint32_t best = 0;
+		for (uint32_t c = 1; c < count; c++)
+		{
+			if (weight[c] * num_slots[best] > weight[best] * num_slots[c])
+			{
+				best = c;
+			}
+		}
+		num_slots[best]++;
+	}
+
+	// Interleave the slots of the children to spread them over the band
+	uint32_t slot = 0;
+	for (uint32_t round = 0; slot < len && count > 0; round++)
+	{
+		for (uint32_t c = 0; c < count; c++)
+		{
+			if (num_slots[c] > round)
+			{
+				slot_owner[slot++] = children[c];
+			}
+		}
+	}
+
+	while (slot < TDMA_MAX_BAND_SLOTS)
+	{
+		slot_owner[slot++] = MESHNW_INVALID_NODE;
+	}
+}
+
+
+/*
+ * Gets the channels of the nodes behind this node in the routing tree (one bit per channel).
+ * The beacon needs to be re-broadcasted on these channels.
+ */
+static uint16_t tdma_downstream_channels(void)
+{
+	uint16_t channels = 0;
+	nodeid_t upstream = get_route(context.tdma.root);
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		nodeid_t hop = context.routing_table[i];
+		if (hop <= MESHNW_MAX_NODEID && hop != upstream && i != context.tdma.root)
+		{
+			channels |= 1 << get_hop_channel(hop);
+		}
+	}
+
+	return channels;
+}
+
+
+/*
+ * Moves the frame start forward to the current frame.
+ * Must be called with the mutex held.
+ */
+static void tdma_update_frame(TickType_t now)
+{
+	if (context.tdma.slot_len == 0)
+	{
+		return;
+	}
+
+	const uint32_t frame_len = context.tdma.slot_len * TDMA_NUM_SLOTS;
+	while ((uint32_t)(now - context.tdma.frame_start) >= frame_len)
+	{
+		context.tdma.frame_start += frame_len;
+		context.tdma.frame++;
+
+#ifdef MASTER
+		// The master starts every frame with a beacon
+		context.tdma.beacon_channels = tdma_downstream_channels();
+		if (context.tdma.beacon_channels == 0)
+		{
+			context.tdma.beacon_channels = 1 << MESHNW_CHANNEL_OWN;
+		}
+		context.tdma.last_sync_frame = context.tdma.frame;
+#endif
+	}
+
+	if (context.tdma.synced &&
+	    (uint16_t)(context.tdma.frame - context.tdma.last_sync_frame) > TDMA_SYNC_LOSS_FRAMES)
+	{
+		printf("TDMA: Lost time reference\n");
+		context.tdma.synced = false;
+	}
+}
+
+
+/*
+ * Sends a beacon for the current frame on the specified channel.
+ * Must be called with the mutex held.
+ */
+static bool tdma_send_beacon(TickType_t now, uint8_t channel)
+{
+	uint8_t packet[sizeof(layer3_packet_header_t) + sizeof(tdma_beacon_t)];
+	layer3_packet_header_t *hdr = (layer3_packet_header_t *)packet;
+	tdma_beacon_t *beacon = (tdma_beacon_t *)(&packet[sizeof(layer3_packet_header_t)]);
+
+	hdr->next_hop = MESHNW_INVALID_NODE;
+	hdr->dst = MESHNW_INVALID_NODE;
+	hdr->src = context.my_node_id;
+
+	beacon->root = context.tdma.root;
+	beacon->depth = context.tdma.depth;
+	beacon->slot_len = context.tdma.slot_len;
+	beacon->frame = context.tdma.frame;
+	beacon->offset = now - context.tdma.frame_start;
+	tdma_assign_slots(beacon->slot_owner);
+
+	return radio_send(packet, sizeof(packet), channel);
+}
+
+
+/*
+ * Handles a received beacon and updates the time reference.
+ * rx_time is the time at which the packet has been read from the modem.
+ */
+static void tdma_handle_beacon(nodeid_t sender, const uint8_t *data, uint8_t len, TickType_t rx_time)
+{
+#ifdef MASTER
+	// The master is the time reference, so it ignores all beacons
+	(void)sender;
+	(void)data;
+	(void)len;
+	(void)rx_time;
+#else
+	if (len != sizeof(tdma_beacon_t))
+	{
+		printf("Discard beacon with invalid size %u\n", len);
+		return;
+	}
+
+	tdma_beacon_t beacon;
+	memcpy(&beacon, data, sizeof(beacon));
+
+	if (beacon.slot_len == 0)
+	{
+		return;
+	}
+
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+
+	nodeid_t upstream = get_route(beacon.root);
+	if (upstream <= MESHNW_MAX_NODEID)
+	{
+		// Routes are set -> Only follow the next hop towards the root
+		if (sender != upstream)
+		{
+			xSemaphoreGive(context.mutex);
+			return;
+		}
+	}
+	else if (context.tdma.synced &&
+	         sender != context.tdma.parent &&
+	         beacon.depth + 1 >= context.tdma.depth)
+	{
+		// No routes yet -> Prefer the node closest to the root
+		xSemaphoreGive(context.mutex);
+		return;
+	}
+
+	if (!context.tdma.synced || context.tdma.parent != sender)
+	{
+		printf("TDMA: Synchronized to %u (depth %u)\n", sender, beacon.depth + 1);
+	}
+
+	// The sender started the transmission <offset> ms after its frame start,
+	// the transmission itself took the time on air.
+	uint32_t toa_ms = sx127x_get_time_on_air_us(sizeof(layer3_packet_header_t) + sizeof(tdma_beacon_t)) / 1000;
+
+	context.tdma.frame_start = rx_time - toa_ms - beacon.offset;
+	context.tdma.frame = beacon.frame;
+	context.tdma.slot_len = beacon.slot_len;
+	context.tdma.last_sync_frame = beacon.frame;
+	context.tdma.root = beacon.root;
+	context.tdma.parent = sender;
+	context.tdma.depth = beacon.depth + 1;
+	context.tdma.up_slots = tdma_own_slots(context.tdma.depth, true, &beacon);
+	context.tdma.own_slots = tdma_own_slots(context.tdma.depth, false, &beacon) | context.tdma.up_slots;
+	context.tdma.synced = true;
+
+	tdma_update_frame(xTaskGetTickCount());
+
+	if (context.enable_forwarding)
+	{
+		context.tdma.beacon_channels = tdma_downstream_channels();
+	}
+
+	xSemaphoreGive(context.mutex);
+#endif
+}
+
+
+/*
+ * Queues a packet for the next own slot.
+ * Must be called with the mutex held.
+ */
+static bool tdma_enqueue(const uint8_t *packet, uint8_t len, TickType_t queued_at)
+{
+	if (context.tdma.tx_queue_count >= TDMA_TX_QUEUE_LENGTH)
+	{
+		printf("TDMA: TX queue full\n");
+		return false;
+	}
+
+	uint32_t idx = (context.tdma.tx_queue_first + context.tdma.tx_queue_count) % TDMA_TX_QUEUE_LENGTH;
+	memcpy(context.tdma.tx_queue[idx].data, packet, len);
+	context.tdma.tx_queue[idx].len = len;
+	context.tdma.tx_queue[idx].queued_at = queued_at;
+	context.tdma.tx_queue_count++;
+
+	return true;
+}
+
+
+/*
+ * Removes the packet at position <pos> (0 is the oldest one) from the queue.
+ * Must be called with the mutex held.
+ */
+static void tdma_dequeue(uint32_t pos)
+{
+	// Move the newer packets forward to close the gap
+	for (uint32_t i = pos; i + 1 < context.tdma.tx_queue_count; i++)
+	{
+		context.tdma.tx_queue[(context.tdma.tx_queue_first + i) % TDMA_TX_QUEUE_LENGTH] =
+			context.tdma.tx_queue[(context.tdma.tx_queue_first + i + 1) % TDMA_TX_QUEUE_LENGTH];
+	}
+
+	context.tdma.tx_queue_count--;
+}
+
+
+/*
+ * Sends the pending beacon and the queued packets if the current slot is the own slot.
+ * Must be called periodically with the mutex held.
+ */
+static void tdma_process(void)
+{
+	TickType_t now = xTaskGetTickCount();
+	tdma_update_frame(now);
+
+	if (!context.tdma.synced)
+	{
+		// No time reference -> Flush the queue, there is no own slot to wait for.
+		while (context.tdma.tx_queue_count > 0 && !sx127x_is_busy())
+		{
+			tdma_queued_packet_t *pkt = &context.tdma.tx_queue[context.tdma.tx_queue_first];
+			layer3_packet_header_t *hdr = (layer3_packet_header_t *)pkt->data;
+			bool ret = radio_send(pkt->data, pkt->len, get_hop_channel(hdr->next_hop));
+			link_stats_update_tx(pkt->data, ret, pkt->queued_at);
+			if (!ret)
+			{
+				// Keep the packet, it is sent with the next call
+				break;
+			}
+			context.tdma.tx_queue_first = (context.tdma.tx_queue_first + 1) % TDMA_TX_QUEUE_LENGTH;
+			context.tdma.tx_queue_count--;
+		}
+		return;
+	}
+
+	uint32_t t = now - context.tdma.frame_start;
+	uint32_t slot = t / context.tdma.slot_len;
+	if (slot >= TDMA_NUM_SLOTS || (context.tdma.own_slots & (1u << slot)) == 0)
+	{
+		return;
+	}
+
+	uint32_t slot_start = slot * context.tdma.slot_len + TDMA_GUARD_TIME_MS;
+	uint32_t slot_end = (slot + 1) * context.tdma.slot_len - TDMA_GUARD_TIME_MS;
+
+	if (t < slot_start || t >= slot_end || sx127x_is_busy())
+	{
+		return;
+	}
+
+	bool up = (context.tdma.up_slots & (1u << slot)) != 0;
+
+	if (context.tdma.beacon_channels != 0 && !up)
+	{
+		uint8_t channel = 0;
+		while ((context.tdma.beacon_channels & (1 << channel)) == 0)
+		{
+			channel++;
+		}
+
+		if (tdma_send_beacon(now, channel))
+		{
+			context.tdma.beacon_channels &= ~(1 << channel);
+		}
+
+		// The queued packets follow as soon as the beacon is out
+		return;
+	}
+
+	// Send the oldest packet for the direction of the current slot
+	nodeid_t upstream = get_route(context.tdma.root);
+	for (uint32_t i = 0; i < context.tdma.tx_queue_count; i++)
+	{
+		tdma_queued_packet_t *pkt = &context.tdma.tx_queue[(context.tdma.tx_queue_first + i) % TDMA_TX_QUEUE_LENGTH];
+		layer3_packet_header_t *hdr = (layer3_packet_header_t *)pkt->data;
+		if ((hdr->next_hop == upstream) != up)
+		{
+			continue;
+		}
+
+		// Only start the transmission if it ends before the end of the slot
+		if (t + sx127x_get_time_on_air_us(pkt->len) / 1000 + 1 > slot_end)
+		{
+			return;
+		}
+
+		bool ret = radio_send(pkt->data, pkt->len, get_hop_channel(hdr->next_hop));
+		link_stats_update_tx(pkt->data, ret, pkt->queued_at);
+		if (ret)
+		{
+			tdma_dequeue(i);
+		}
+		return;
+	}
+}
+
+
+/*
+ * Sets up the time slotted MAC, must be called after the modem has been initialized.
+ */
+static void tdma_init(void)
+{
+	memset(&context.tdma, 0, sizeof(context.tdma));
+	context.tdma.root = MESHNW_INVALID_NODE;
+	context.tdma.parent = MESHNW_INVALID_NODE;
+
+#ifdef MASTER
+	// The master defines the slot length, a slot must be long enough for a packet of max size
+	context.tdma.slot_len = sx127x_get_time_on_air_us(MESHNW_MAX_OTA_PACKET_SIZE) / 1000 + 1 + 2 * TDMA_GUARD_TIME_MS;
+	context.tdma.root = context.my_node_id;
+	context.tdma.frame_start = xTaskGetTickCount();
+	context.tdma.synced = true;
+	context.tdma.beacon_channels = 1 << MESHNW_CHANNEL_OWN;
+	context.tdma.own_slots = (1 << TDMA_MASTER_SLOTS) - 1;
+
+	printf("TDMA: Slot length: %u ms, frame length: %u ms\n",
+	       context.tdma.slot_len, context.tdma.slot_len * TDMA_NUM_SLOTS);
+#endif
+}
+
+#endif
+
 /*
  * Sends/Forwards a packet to the next hop specified in the routing table
+ * queued_at is the time at which the packet has been received or passed to meshnw_send().
  */
-static bool forward_packet(void *packet, uint8_t len)
+static bool forward_packet(void *packet, uint8_t len, TickType_t queued_at)
 {
 	layer3_packet_header_t *hdr = (layer3_packet_header_t *)packet;
 
@@ -157,8 +1063,27 @@ static bool forward_packet(void *packet, uint8_t len)
 	printf("Send packet\n");
 	hexdump(packet, len);
 
+#ifdef MESHNW_TDMA
+	bool ret;
+	if (context.tdma.synced)
+	{
+		// With a valid time reference, the packet has to wait for the own slot
+		ret = tdma_enqueue(packet, len, queued_at);
+		if (!ret)
+		{
+			link_stats_update_tx(packet, false, queued_at);
+		}
+	}
+	else
+	{
+		ret = radio_send(packet, len, get_hop_channel(hdr->next_hop));
+		link_stats_update_tx(packet, ret, queued_at);
+	}
+#else
 	// Send packet, next_hop specifies the receiver
-	bool ret = sx127x_send(packet, len);
+	bool ret = radio_send(packet, len, get_hop_channel(hdr->next_hop));
+	link_stats_update_tx(packet, ret, queued_at);
+#endif
 
 	xSemaphoreGive(context.mutex);
 
@@ -180,6 +1105,9 @@ static bool forward_packet(void *packet, uint8_t len)
  */
 static void handle_rx_cplt(uint8_t *packet, uint8_t len)
 {
+	// Take the time before printing anything, the beacon handler needs the exact rx time
+	TickType_t rx_time = xTaskGetTickCount();
+
 	// Check if length is in bounds
 	if (len < (int)sizeof(layer3_packet_header_t) + 1)
 	{
@@ -208,6 +1136,19 @@ static void handle_rx_cplt(uint8_t *packet, uint8_t len)
 
 	hexdump(packet, len);
 
+#ifdef MESHNW_TDMA
+	if (hdr->next_hop == MESHNW_INVALID_NODE && hdr->dst == MESHNW_INVALID_NODE)
+	{
+		// Beacons are broadcasted, the source is always the sender
+		link_stats_update_rx(hdr->src, rssi, snr);
+		tdma_handle_beacon(hdr->src,
+		                   packet + sizeof(layer3_packet_header_t),
+		                   len - sizeof(layer3_packet_header_t),
+		                   rx_time);
+		return;
+	}
+#endif
+
 	if (hdr->next_hop != context.my_node_id)
 	{
 		// II (not for me) => discard
@@ -215,6 +1156,9 @@ static void handle_rx_cplt(uint8_t *packet, uint8_t len)
 		return;
 	}
 
+	nodeid_t neighbour = link_stats_neighbour(hdr->src);
+	link_stats_update_rx(neighbour, rssi, snr);
+
 	if (hdr->dst == context.my_node_id)
 	{
 		// III (data for the current node) => call callback
@@ -228,11 +1172,23 @@ static void handle_rx_cplt(uint8_t *packet, uint8_t len)
 
 		// Add a small delay here so that the other receivers in range
 		// can read the old message from the buffer before the new messsage starts.
-		vTaskDelay(30);
-		if (!forward_packet(packet, len))
+		// With the slotted MAC, the packet is delayed until the own slot anyway.
+#ifdef MESHNW_TDMA
+		if (!context.tdma.synced)
+#endif
+		{
+			vTaskDelay(30);
+		}
+		bool ret = forward_packet(packet, len, rx_time);
+		if (!ret)
 		{
 			printf("Failed to forward packet!\n");
 		}
+		link_stats_update_fwd(neighbour, ret);
+	}
+	else
+	{
+		link_stats_update_fwd(neighbour, false);
 	}
 }
 
@@ -253,6 +1209,15 @@ static void recv_thread(void *arg)
 		vTaskDelay(5); // 5ms @ 1kHz tick rate
 
 		xSemaphoreTake(context.mutex, portMAX_DELAY);
+		if (!radio_restore_channel())
+		{
+			// Still sending on another channel
+			xSemaphoreGive(context.mutex);
+			continue;
+		}
+#ifdef MESHNW_TDMA
+		tdma_process();
+#endif
 		uint8_t len = sx127x_recv(recv_buffer, sizeof(recv_buffer));
 		xSemaphoreGive(context.mutex);
 
@@ -294,11 +1259,23 @@ bool meshnw_init(nodeid_t id, const sx127x_rf_config_t *config, mesh_nw_message_
 	context.my_node_id = id;
 	context.recv_callback = cb;
 	context.enable_forwarding = 0;
+	context.frequency = config->frequency;
+	memset(context.hop_channel, MESHNW_CHANNEL_OWN, sizeof(context.hop_channel));
+
+	for (uint32_t i = 0; i < MESHNW_LINK_STATS_ENTRIES; i++)
+	{
+		context.link_stats[i].node = MESHNW_INVALID_NODE;
+	}
 
 	meshnw_clear_routes();
 
-	return sx127x_init(config);
+	bool res = sx127x_init(config);
+
+#ifdef MESHNW_TDMA
+	tdma_init();
+#endif
 
+	return res;
 }
 
 
@@ -327,7 +1304,7 @@ void meshnw_clear_routes(void)
 {
 	_Static_assert((sizeof(context.routing_table) / sizeof(context.routing_table[0]) == MESHNW_MAX_NODEID + 1), "Invalid routing table size");
 
-	for (uint32_t i = 0; i < MESHNW_MAX_NODEID; i++)
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
 	{
 		// Reset all routes to INVALID_NODE
 		context.routing_table[i] = MESHNW_INVALID_NODE;
@@ -338,6 +1315,22 @@ void meshnw_clear_routes(void)
 }
 
 
+bool meshnw_set_hop_channel(nodeid_t hop, uint8_t channel)
+{
+	if (hop > MESHNW_MAX_NODEID || channel > MESHNW_CHANNEL_MAX)
+	{
+		printf("Attempt to set invalid channel %u for hop %u\n", channel, hop);
+		return false;
+	}
+
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+	context.hop_channel[hop] = channel;
+	xSemaphoreGive(context.mutex);
+
+	return true;
+}
+
+
 bool meshnw_send(nodeid_t dst, void *data, uint8_t len)
 {
 	if (len + sizeof(layer3_packet_header_t) > MESHNW_MAX_OTA_PACKET_SIZE)
@@ -357,7 +1350,7 @@ bool meshnw_send(nodeid_t dst, void *data, uint8_t len)
 
 	// And call the forward function.
 	// This will set the "next_hop" in the packet to the value from the routing table for <dst>
-	return forward_packet(tx_buffer, sizeof(layer3_packet_header_t) + len);
+	return forward_packet(tx_buffer, sizeof(layer3_packet_header_t) + len, xTaskGetTickCount());
 }
 
 
@@ -371,3 +1364,93 @@ uint64_t meshnw_get_random(void)
 
 	return rand;
 }
+
+
+uint8_t meshnw_get_link_stats(meshnw_link_stats_t *stats, uint8_t max)
+{
+	uint8_t count = 0;
+
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+
+	for (uint32_t i = 0; i < MESHNW_LINK_STATS_ENTRIES && count < max; i++)
+	{
+		const link_stats_entry_t *e = &context.link_stats[i];
+		if (e->node > MESHNW_MAX_NODEID)
+		{
+			continue;
+		}
+
+		int32_t delay = e->fwd_delay_avg / LINK_STATS_AVG_SCALE;
+
+		stats[count].node = e->node;
+		stats[count].rx = e->rx;
+		stats[count].tx = e->tx;
+		stats[count].fwd = e->fwd;
+		stats[count].drop = e->drop;
+		stats[count].tx_fail = e->tx_fail;
+		stats[count].rssi = e->rssi_avg / LINK_STATS_AVG_SCALE;
+		stats[count].snr = e->snr_avg / LINK_STATS_AVG_SCALE;
+		stats[count].fwd_delay = delay > 0xFFFF ? 0xFFFF : delay;
+		count++;
+	}
+
+	xSemaphoreGive(context.mutex);
+
+	return count;
+}
+
+
+void meshnw_print_link_stats(const meshnw_link_stats_t *stats, uint8_t count)
+{
+	printf("Node     RX     TX    FWD   DROP   FAIL  RSSI  SNR/4  DELAY\n");
+	for (uint8_t i = 0; i < count; i++)
+	{
+		printf("%4u  %5u  %5u  %5u  %5u  %5u  %4i  %5i  %5u\n",
+		       stats[i].node, stats[i].rx, stats[i].tx, stats[i].fwd, stats[i].drop, stats[i].tx_fail,
+		       (int)stats[i].rssi - SX127X_CONFIG_RSSI_OFFSET, stats[i].snr, stats[i].fwd_delay);
+	}
+}
+
+
+void meshnw_cmd_linkstats(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	meshnw_link_stats_t stats[MESHNW_LINK_STATS_ENTRIES];
+	uint8_t count = meshnw_get_link_stats(stats, MESHNW_LINK_STATS_ENTRIES);
+
+	printf("Link statistics (RSSI in dBm, delay in ms)\n");
+	meshnw_print_link_stats(stats, count);
+}
+
+
+#ifdef MESHNW_TDMA
+void meshnw_cmd_tdma(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	xSemaphoreTake(context.mutex, portMAX_DELAY);
+	tdma_update_frame(xTaskGetTickCount());
+	bool synced = context.tdma.synced;
+	nodeid_t root = context.tdma.root;
+	nodeid_t parent = context.tdma.parent;
+	uint8_t depth = context.tdma.depth;
+	uint16_t frame = context.tdma.frame;
+	uint16_t slot_len = context.tdma.slot_len;
+	uint8_t queued = context.tdma.tx_queue_count;
+	uint32_t slots = context.tdma.own_slots;
+	xSemaphoreGive(context.mutex);
+
+	printf("Synchronized:   %u\n"
+	       "Root:           %u\n"
+	       "Parent:         %u\n"
+	       "Depth:          %u\n"
+	       "Frame:          %u\n"
+	       "Slot length:    %u ms\n"
+	       "Own slots:      0x%08lx (%u slots)\n"
+	       "Queued packets: %u\n",
+	       synced, root, parent, depth, frame, slot_len, slots, TDMA_NUM_SLOTS, queued);
+}
+#endif
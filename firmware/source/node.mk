@@ -5,7 +5,7 @@ else
 include source/sensor/sensor.mk
 endif
 
-FILES += main cli serial_getchar_dma sx127x utils commands_common meshnw auth
+FILES += main cli serial_getchar_dma serial_tx_dma sx127x utils commands_common meshnw auth auth_mac rtt_estimator
 
 vpath %.c source
 
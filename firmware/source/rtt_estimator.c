@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+#include "rtt_estimator.h"
+
+
+static uint32_t clamp_timeout(uint32_t timeout)
+{
+	if (timeout < RTT_MIN_TIMEOUT_MS)
+	{
+		return RTT_MIN_TIMEOUT_MS;
+	}
+
+	if (timeout > RTT_MAX_TIMEOUT_MS)
+	{
+		return RTT_MAX_TIMEOUT_MS;
+	}
+
+	return timeout;
+}
+
+
+void rtt_init(rtt_estimator_t *rtt, uint32_t initial_timeout_ms)
+{
+	rtt->srtt = 0;
+	rtt->rttvar = 0;
+	rtt->rto = clamp_timeout(initial_timeout_ms);
+}
+
+
+void rtt_update(rtt_estimator_t *rtt, uint32_t rtt_ms)
+{
+	if (rtt_ms == 0)
+	{
+		// 0 marks "no measurement"
+		rtt_ms = 1;
+	}
+
+	if (rtt->srtt == 0)
+	{
+		// First measurement
+		rtt->srtt = rtt_ms << 3;
+		rtt->rttvar = rtt_ms << 1;
+	}
+	else
+	{
+		// rttvar = 3/4 rttvar + 1/4 |srtt - rtt|
+		int32_t err = (int32_t)rtt_ms - (int32_t)(rtt->srtt >> 3);
+		if (err < 0)
+		{
+			err = -err;
+		}
+		rtt->rttvar = rtt->rttvar - (rtt->rttvar >> 2) + (uint32_t)err;
+
+		// srtt = 7/8 srtt + 1/8 rtt
+		rtt->srtt = rtt->srtt - (rtt->srtt >> 3) + rtt_ms;
+	}
+
+	// rto = srtt + 4 * rttvar
+	rtt->rto = clamp_timeout((rtt->srtt >> 3) + rtt->rttvar);
+}
+
+
+void rtt_keep_backoff(rtt_estimator_t *rtt, uint8_t backoff)
+{
+	rtt->rto = rtt_timeout(rtt, backoff);
+}
+
+
+uint32_t rtt_timeout(const rtt_estimator_t *rtt, uint8_t backoff)
+{
+	uint32_t timeout = rtt->rto;
+	while (backoff > 0 && timeout < RTT_MAX_TIMEOUT_MS)
+	{
+		timeout <<= 1;
+		backoff--;
+	}
+
+	return clamp_timeout(timeout);
+}
@@ -47,6 +47,7 @@ static const uint32_t CONFIG_NETWORK    = 0x00000001;
 static const uint32_t CONFIG_COLORTABLE = 0x00000002;
 static const uint32_t CONFIG_RF         = 0x00000004;
 static const uint32_t CONFIG_MISC       = 0x00000008;
+static const uint32_t CONFIG_CHANNEL    = 0x00000010;
 
 /*
  * The config data as stored in the flash.
@@ -61,6 +62,7 @@ typedef struct
 	color_table_t colortable;
 	sx127x_rf_config_t rf;
 	misc_config_t misc;
+	channel_config_t channel;
 } config_with_magic_t;
 
 
@@ -140,6 +142,23 @@ const misc_config_t *sensor_config_misc_settings(void)
 }
 
 
+const channel_config_t *sensor_config_channel_settings(void)
+{
+	static const channel_config_t defaultChannel = DefaultChannelSettings;
+	config_with_magic_t *cfg = (config_with_magic_t *)CONFIG_FLASH_ADDR;
+	if (cfg->magic != CONFIG_MAGIC)
+	{
+		return &defaultChannel;
+	}
+
+	if ((cfg->config_set & CONFIG_CHANNEL) == 0)
+	{
+		return &defaultChannel;
+	}
+	return &cfg->channel;
+}
+
+
 static int network_config(int argc, char **argv, config_with_magic_t *cfg)
 {
 	if (argc != 5)
@@ -326,11 +345,13 @@ static int misc_config(int argc, char **argv, config_with_magic_t *cfg)
 			   "                     The timer is reset when authenticated message arrives\n"
 			   "max_retransmissions  Max number of consecutive status retransmissions\n"
 			   "                     before the node reboots.\n"
-			   "rt_delay_random      Factor for the random part in the retransmission delay.\n"
-			   "rt_delay_lin         Divider for the number of retransmissions when calculating the delay.\n\n"
+			   "rt_delay_random      Random part of the retransmission delay in percent of the timeout.\n"
+			   "rt_delay_lin         Number of retransmissions before the timeout is doubled.\n\n"
 			   "Retransmission delay calculation:\n"
-			   "delay = base_delay + random(0, rt_delay_random * (1 + num_retransmissions / re_delay_lin)\n"
-			   "base_delay is the \"timeout\" specified on the master when connection to the node\n"
+			   "timeout = rto * 2^(num_retransmissions / rt_delay_lin)\n"
+			   "delay = timeout + random(0, timeout * rt_delay_random / 100)\n"
+			   "rto is calculated from the measured round trip time, until the first measurement\n"
+			   "the \"timeout\" specified on the master when connection to the node is used.\n"
 			   "num_retransmissions is the number of consecutive retransmissions.\n");
 		return 1;
 	}
@@ -355,6 +376,40 @@ static int misc_config(int argc, char **argv, config_with_magic_t *cfg)
 	return 0;
 }
 
+static int channel_config(int argc, char **argv, config_with_magic_t *cfg)
+{
+	if (argc == 3 && strcmp(argv[2], "get") == 0)
+	{
+		const channel_config_t *current = sensor_config_channel_settings();
+		printf("Current channel settings:\n%u\n", current->upstream_channel);
+		return 2;
+	}
+	else if (argc != 3)
+	{
+		printf("USAGE: config channel get\n"
+			   "USAGE: config channel <upstream_channel>\n\n"
+			   "upstream_channel  Channel of the next node towards the master.\n"
+			   "                  Channel n is at 433.2 MHz + n * 100 kHz (1 - " TOSTRING(MESHNW_CHANNEL_MAX) "),\n"
+			   "                  0 means the frequency from the rf config.\n"
+			   "                  Only required if the next node uses a different frequency.\n");
+		return 1;
+	}
+
+	uint32_t ch = strtoul(argv[2], NULL, 10);
+	if (ch > MESHNW_CHANNEL_MAX)
+	{
+		printf("Channel out of range!\n");
+		return 1;
+	}
+
+	cfg->channel.upstream_channel = (uint8_t)ch;
+
+	// set "channel configured" bit
+	cfg->config_set |= CONFIG_CHANNEL;
+
+	return 0;
+}
+
 void sensor_config_set_cmd(int argc, char **argv)
 {
 	if (argc < 2)
@@ -366,6 +421,7 @@ void sensor_config_set_cmd(int argc, char **argv)
 			   "    color    Colortable for the status LEDs\n"
 			   "    rf       Radio configuration\n"
 			   "    misc     Misc settings\n"
+			   "    channel  Channel of the upstream node\n"
 			   "    reset    Resets the whole config\n");
 		return;
 	}
@@ -399,6 +455,10 @@ void sensor_config_set_cmd(int argc, char **argv)
 	{
 		res = misc_config(argc, argv, &newCfg);
 	}
+	else if (strcmp(argv[1], "channel") == 0)
+	{
+		res = channel_config(argc, argv, &newCfg);
+	}
 	else if (strcmp(argv[1], "reset") == 0)
 	{
 		printf("Reset config!");
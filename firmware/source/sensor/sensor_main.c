@@ -12,6 +12,7 @@
 #include <semphr.h>
 
 #include "commands_common.h"
+#include "serial_tx_dma.h"
 #include "tinyprintf.h"
 #include "sensor_node.h"
 #include "sensor_config.h"
@@ -38,11 +39,17 @@ const cli_command_t cli_commands[] = {
     { "config",           "Node configuration",                      sensor_config_set_cmd },
     { "ping",             "Sends an echo reuest",                    cmd_ping },
     { "routes",           "Sets the routes for the node",            cmd_routes },
+    { "hop_channels",     "Sets the channels of the next hops",      cmd_hop_channels },
     { "raw",              "Enables / Disables raw data printing",    sensor_node_cmd_raw },
     { "led",              "RGB LED test",                            sensor_node_cmd_led },
     { "print_frames",     "Enbales / Disables frame value printing", sensor_node_cmd_print_frames },
     { "status",           "Prints node status",                      sensor_node_cmd_print_status },
     { "sx127x",           "RF modem debug",                          sx127x_test_cmd },
+    { "linkstats",        "Prints the link statistics",              meshnw_cmd_linkstats },
+    { "txstats",          "Prints the serial output statistics",     serial_tx_dma_cmd_stats },
+#ifdef MESHNW_TDMA
+    { "tdma",             "Prints the state of the slotted MAC",     meshnw_cmd_tdma },
+#endif
     { "reboot",           "Reboots (resets) the MCU",                cmd_reboot },
 #ifdef WASCHV1
     { "firmware_upgrade", "Firmware upgrade",                        sensor_node_cmd_firmware_upgrade },
@@ -28,6 +28,7 @@
 #include "tinyprintf.h"
 #include "sensor_adc.h"
 #include "led_status.h"
+#include "rtt_estimator.h"
 
 #ifdef WASCHV2
 #include "debug_file_logger.h"
@@ -52,6 +53,11 @@
  */
 #define NUM_OF_LED 5
 
+/*
+ * Ack result for a message that has been received but not ack'ed (yet).
+ */
+#define ACK_RESULT_UNKNOWN 0xff
+
 // Bits in the status field
 // Basic initialization complete, node is now active and can process messages
 #define STATUS_INIT_CPLT          0x00000001
@@ -185,6 +191,14 @@ struct
 	 */
 	uint16_t current_sensor_status;
 
+	/*
+	 * Number of adc thread cycles and the cycle / time of the last change of current_sensor_status.
+	 * These are sent in the trace of the status update messages.
+	 */
+	uint32_t adc_cycle;
+	uint32_t status_changed_cycle;
+	TickType_t status_changed_at;
+
 	/*
 	 * Number of raw frames to send.
 	 * This is always decremented. When the counter is zero no more raw frames are sent.
@@ -199,6 +213,12 @@ struct
 	 */
 	uint8_t debug_raw_status_requested;
 
+	/*
+	 * The link statistics are sent after the raw status, one packet per message loop iteration.
+	 * Nonzero if statistics need to be sent, the value is the index of the next entry + 1.
+	 */
+	uint8_t debug_link_stats_next;
+
 #ifdef WASCHV2
 	/*
 	 * Like debug_raw_status_requested, but for the storage status
@@ -213,16 +233,47 @@ struct
 	uint8_t last_status_msg_was_acked;
 
 	/*
-	 * The ack result of the last received control message.
+	 * The ack results of the last received control messages, indexed by the auth slot of the message.
 	 * This is used as the result if a message is re-acked.
 	 */
-	uint8_t last_ack_result;
+	uint8_t ack_results[AUTH_NONCE_SLOTS];
+
+	/*
+	 * The signed status update message, retransmissions send the same message again.
+	 * status_msg_len is 0 if a new message needs to be signed (new status or new status channel).
+	 */
+	uint8_t status_msg[sizeof(msg_status_update_t) + AUTH_MAC_TAG_LEN];
+	uint8_t status_msg_len;
+
+	// Cycle and time of the status change the current status message belongs to (for the trace)
+	uint32_t status_msg_cycle;
+	TickType_t status_msg_changed_at;
+
+	// Nonce of the status update message, used to check the ack
+	uint64_t status_msg_nonce;
 
 	/*
 	 * Base retransmission delay for status update messages
+	 * This is the initial timeout (in seconds) until the round trip time has been measured.
 	 */
 	uint8_t status_retransmission_base_delay;
 
+	/*
+	 * Round trip time of the status channel, the retransmission timeout is based on this.
+	 */
+	rtt_estimator_t status_rtt;
+
+	/*
+	 * Time when the last message on the status channel (status update or hs1) has been sent.
+	 */
+	TickType_t status_sent_at;
+
+	/*
+	 * Number of transmissions of the last message on the status channel (first one included).
+	 * This is used for the timeout and for calculating the time before a retransmission.
+	 */
+	uint32_t status_retransmission_counter;
+
 	/*
 	 * Buffer for the led color values
 	 * This is required because the LEDs tend to randomly change their color.
@@ -299,6 +350,15 @@ StackType_t message_thd_stack[MESSAGE_THD_STACK_SIZE];
  * |------------- ACK ----------->|
  */
 
+/*
+ * After a restart of the master, the master resumes the config channel with the session ticket
+ * it got after the handshake, instead of setting up the node again.
+ *
+ * M                              N
+ * |----------- RESUME ---------->| <- Config channel valid again, configuration is kept
+ * |<--------- RESUME ACK --------| <- Contains the ticket to continue the status channel
+ */
+
 /*
  * Returns a random number between 0 and max
  * Every time this function is called a new random value is generated.
@@ -311,14 +371,39 @@ static uint32_t get_random_delay(uint32_t max)
 }
 
 /*
- * Returns the retransmission delay for a packet on the status channel based on the number
- * of retransmissions and a random value.
+ * Returns the number of times the retransmission timeout is doubled after <rt_counter> retransmissions.
+ */
+static uint8_t calculate_retransmission_backoff(uint32_t rt_counter)
+{
+	uint32_t backoff = rt_counter / (ctx.misc_config->rt_delay_lin_div ? ctx.misc_config->rt_delay_lin_div : 1);
+	return backoff > 0xff ? 0xff : backoff;
+}
+
+/*
+ * Returns the retransmission delay in ms for a packet on the status channel based on the
+ * measured round trip time, the number of retransmissions and a random value.
  * Every time this function is called a new random value is generated.
  */
 static uint32_t calculate_retransmission_delay(uint32_t rt_counter)
 {
-	return get_random_delay(ctx.misc_config->rt_delay_random * (1 + rt_counter / ctx.misc_config->rt_delay_lin_div))
-			+ ctx.status_retransmission_base_delay;
+	uint32_t timeout = rtt_timeout(&ctx.status_rtt, calculate_retransmission_backoff(rt_counter));
+	return timeout + get_random_delay(timeout * ctx.misc_config->rt_delay_random / 100 + 1);
+}
+
+/*
+ * Updates the round trip time of the status channel when the last message has been answered.
+ */
+static void update_status_rtt(void)
+{
+	if (ctx.status_retransmission_counter <= 1)
+	{
+		rtt_update(&ctx.status_rtt, xTaskGetTickCount() - ctx.status_sent_at);
+	}
+	else
+	{
+		// Can't tell which transmission has been answered, keep the timeout of the last one
+		rtt_keep_backoff(&ctx.status_rtt, calculate_retransmission_backoff(ctx.status_retransmission_counter - 1));
+	}
 }
 
 
@@ -376,6 +461,27 @@ static void reset(void)
 }
 
 
+/*
+ * -- Config channel --
+ * Gets the basic node status for the hs2 and the resume ack (MSG_HS_2_STATUS_*).
+ */
+static uint8_t get_connection_status(void)
+{
+	uint8_t status = 0;
+	if (ctx.status & STATUS_INIT_ROUTES)
+	{
+		status |= MSG_HS_2_STATUS_ROUTES;
+	}
+
+	if ((ctx.status & STATUS_SENSORS_ACTIVE) && !(ctx.status & STATUS_SENSOR_TEST))
+	{
+		status |= MSG_HS_2_STATUS_SENSOR;
+	}
+
+	return status;
+}
+
+
 /*
  * -- Config channel --
  * Handles the incoming hs1 from the master to open the config channel.
@@ -413,18 +519,7 @@ static void handle_auth_slave_handshake(nodeid_t src, void *data, uint8_t len)
 	 * Some basic status information is packed into the handshake reply.
 	 * This information will be signed so it should be secure (tm)
 	 */
-
-	hs2->status = 0;
-	if (ctx.status & STATUS_INIT_ROUTES)
-	{
-		hs2->status |= MSG_HS_2_STATUS_ROUTES;
-	}
-
-	if ((ctx.status & STATUS_SENSORS_ACTIVE) && !(ctx.status & STATUS_SENSOR_TEST))
-	{
-		hs2->status |= MSG_HS_2_STATUS_SENSOR;
-	}
-
+	hs2->status = get_connection_status();
 	hs2->channels = ctx.current_sensor_status;
 
 	/*
@@ -468,6 +563,9 @@ static void handle_auth_slave_handshake(nodeid_t src, void *data, uint8_t len)
 
 		printf("Add temp route %u:%u\n", src, hs1->reply_route);
 
+		// The reply hop is the next node towards the master, it may use a different channel.
+		meshnw_set_hop_channel(hs1->reply_route, sensor_config_channel_settings()->upstream_channel);
+
 		// also, store the source address as master address, the route request is expected from the same address.
 		ctx.master_node = src;
 	}
@@ -482,10 +580,109 @@ static void handle_auth_slave_handshake(nodeid_t src, void *data, uint8_t len)
 	// Auth context for config channel is now init -> Now i can receive authenticated messages.
 	ctx.status |= STATUS_INIT_AUTH_CFG;
 
+	// The results of the old channel must not be confirmed on the new one.
+	memset(ctx.ack_results, ACK_RESULT_UNKNOWN, sizeof(ctx.ack_results));
+
 	led_status_system(LED_STATUS_SYSTEM_CONNECTED);
 }
 
 
+/*
+ * -- Config channel --
+ * Sends the ack for the resume message.
+ * The ack contains the same status as the hs2 and the ticket of the status channel,
+ * so that the master can continue the status channel as well.
+ */
+static void send_resume_ack(void)
+{
+	uint8_t out_buffer[MESHNW_MAX_PACKET_SIZE];
+	uint32_t rep_msg_len = sizeof(out_buffer);
+
+	msg_auth_resume_ack_t *rack = (msg_auth_resume_ack_t *)out_buffer;
+	rack->type = MSG_TYPE_AUTH_RESUME_ACK;
+	rack->status = get_connection_status();
+	rack->channels = ctx.current_sensor_status;
+
+	uint64_t ticket = 0;
+	if (ctx.status & STATUS_INIT_AUTH_STA)
+	{
+		rack->status |= MSG_HS_2_STATUS_SCH;
+		ticket = auth_master_get_ticket(&ctx.auth_status);
+	}
+	memcpy(&rack->status_ticket, &ticket, sizeof(ticket));
+
+	int res = auth_slave_make_ack(&ctx.auth_config, out_buffer, sizeof(*rack), &rep_msg_len, 0);
+	if (res != 0)
+	{
+		printf("auth_slave_make_ack failed with error %i\n", res);
+		return;
+	}
+
+	if (!meshnw_send(ctx.master_node, out_buffer, rep_msg_len))
+	{
+		printf("sending resume ack failed\n");
+	}
+}
+
+
+/*
+ * -- Config channel --
+ * Handles the resume message from a restarted master.
+ * This continues the config channel without a handshake, the routes, the sensor configuration
+ * and the status channel are kept.
+ */
+static void handle_auth_resume(nodeid_t src, void *data, uint8_t len)
+{
+	// Only a configured node can be resumed, otherwise the master needs to connect normally.
+	if ((ctx.status & STATUS_INIT_AUTH_CFG) == 0 || (ctx.status & STATUS_INIT_ROUTES) == 0)
+	{
+		printf("Received resume but the node is not configured\n");
+		return;
+	}
+
+	// The master address can't change without a new handshake.
+	if (src != ctx.master_node)
+	{
+		printf("Got resume from a node that is not the current master\n");
+		return;
+	}
+
+	struct
+	{
+		nodeid_t src;
+		nodeid_t dst;
+	} add_data;
+	add_data.src = src;
+	add_data.dst = ctx.current_node;
+
+	uint32_t msglen = len;
+	int res = auth_slave_resume(&ctx.auth_config, data, &msglen, &add_data, sizeof(add_data));
+
+	if (res == AUTH_OLD_NONCE)
+	{
+		// The ack has been lost -> send it again
+		printf("Received resume again -> re-ack\n");
+		send_resume_ack();
+		return;
+	}
+	else if (res != 0)
+	{
+		printf("auth_slave_resume failed with error %i\n", res);
+		return;
+	}
+
+	// The results of the old channel must not be confirmed on the resumed one.
+	memset(ctx.ack_results, ACK_RESULT_UNKNOWN, sizeof(ctx.ack_results));
+
+	if (!(ctx.status & STATUS_SENSOR_TEST))
+	{
+		ctx.config_channel_timeout_timer = 0;
+	}
+
+	send_resume_ack();
+}
+
+
 /*
  * -- Status channel --
  * Initiates the buildup of the status channel.
@@ -582,6 +779,10 @@ static void handle_auth_master_handshake(nodeid_t src, void *data, uint8_t len)
 	// No longer pending, valid now.
 	ctx.status &= ~STATUS_INIT_AUTH_STA_PEND;
 	ctx.status |= STATUS_INIT_AUTH_STA;
+	update_status_rtt();
+
+	// A status message signed on the old channel is not valid anymore, sign it again.
+	ctx.status_msg_len = 0;
 
 	led_status_system(LED_STATUS_SYSTEM_SCH_BUILT);
 }
@@ -589,9 +790,9 @@ static void handle_auth_master_handshake(nodeid_t src, void *data, uint8_t len)
 
 /*
  * -- Config channel --
- * Sends an ACK for a command on the config channel.
- * This function will also set the last_ack_result to
- * the ack_result passed as parameter.
+ * Sends an ACK for the last received command on the config channel.
+ * This function will also store the ack_result passed as parameter
+ * for the case the command is received again.
  */
 static void send_ack(uint8_t ack_result)
 {
@@ -615,10 +816,25 @@ static void send_ack(uint8_t ack_result)
 	ack->type = MSG_TYPE_AUTH_ACK;
 	ack->result_code = ack_result;
 
+	// Store ack result for the case i need to do a retransmission.
+	uint8_t slot = auth_slave_last_slot(&ctx.auth_config);
+	ctx.ack_results[slot] = ack_result & ~ACK_RETRANSMIT;
+
+	/*
+	 * The ack also confirms the successful commands directly before this one,
+	 * so the master doesn't need to retransmit them if their acks have been lost.
+	 */
+	uint8_t ack_before = 0;
+	while (ack_before < AUTH_WINDOW_SIZE - 1 &&
+	       ctx.ack_results[(slot - ack_before - 1) & (AUTH_NONCE_SLOTS - 1)] == ACK_OK)
+	{
+		ack_before++;
+	}
+
 	/*
 	 * Request auth to make an ACK packet with the given payload.
 	 */
-	int res = auth_slave_make_ack(&ctx.auth_config, out_buffer, sizeof(*ack), &rep_msg_len);
+	int res = auth_slave_make_ack(&ctx.auth_config, out_buffer, sizeof(*ack), &rep_msg_len, ack_before);
 
 	if (res != 0)
 	{
@@ -631,9 +847,6 @@ static void send_ack(uint8_t ack_result)
 	{
 		printf("sending slave ack reply failed\n");
 	}
-
-	// Store ack result for the case i need to do a retransmission.
-	ctx.last_ack_result = ack_result;
 }
 
 /*
@@ -661,7 +874,7 @@ static void handle_auth_master_ack(nodeid_t src, void *data, uint8_t len)
 	/*
 	 * Give packet to the auth module to check it.
 	 */
-	int res = auth_master_check_ack(&ctx.auth_status, data, sizeof(*ack), len);
+	int res = auth_master_check_ack(&ctx.auth_status, data, sizeof(*ack), len, NULL);
 	if (res != 0)
 	{
 		printf("auth_master_check_ack failed with error %i\n", res);
@@ -670,8 +883,8 @@ static void handle_auth_master_ack(nodeid_t src, void *data, uint8_t len)
 
 	printf("got ack from master with code %u\n", ack->result_code);
 
-	// Check if I was expecting an ack
-	if (ctx.last_status_msg_was_acked)
+	// Check if I was expecting an ack (for the current message)
+	if (ctx.last_status_msg_was_acked || !auth_master_is_acked(&ctx.auth_status, ctx.status_msg_nonce))
 	{
 		printf("unexpected status ack! there is no outstanding packet!\n");
 	}
@@ -680,6 +893,7 @@ static void handle_auth_master_ack(nodeid_t src, void *data, uint8_t len)
 		// The last message has been ack'ed.
 		// This means i may send the next status message now.
 		ctx.last_status_msg_was_acked = 1;
+		update_status_rtt();
 
 		led_status_system(LED_STATUS_SYSTEM_SCH_BUILT);
 	}
@@ -729,14 +943,21 @@ static int check_auth_message(nodeid_t src, void *data, uint32_t *len)
 	if (res == AUTH_OLD_NONCE)
 	{
 		/*
-		 * The nonce in the packet is the nonce of the last packet.
+		 * The nonce in the packet is the nonce of an already received packet.
 		 * This happens when an ACK has been lost and the master retransmitts the packet.
-		 * In this case the last ACK is sent again with the re-ack bit set.
+		 * In this case the ACK is sent again with the re-ack bit set.
 		 */
+		uint8_t result = ctx.ack_results[auth_slave_last_slot(&ctx.auth_config)];
+		if (result == ACK_RESULT_UNKNOWN)
+		{
+			printf("Received message with old nonce that has not been ack'ed\n");
+			return res;
+		}
+
 		printf("Received message with old nonce -> re-ack\n");
 
 		// set re-ack bit and ack
-		send_ack(ctx.last_ack_result | ACK_RETRANSMIT);
+		send_ack(result | ACK_RETRANSMIT);
 
 		return res;
 	}
@@ -746,6 +967,9 @@ static int check_auth_message(nodeid_t src, void *data, uint32_t *len)
 		return res;
 	}
 
+	// The result is stored when the message is ack'ed
+	ctx.ack_results[auth_slave_last_slot(&ctx.auth_config)] = ACK_RESULT_UNKNOWN;
+
 	if (!(ctx.status & STATUS_SENSOR_TEST))
 	{
 		/*
@@ -813,6 +1037,52 @@ static void handle_route_request(nodeid_t src, void *data, uint8_t len)
 }
 
 
+/*
+ * -- Config channel --
+ * Proceses a hop channel request.
+ */
+static void handle_hop_channels_request(nodeid_t src, void *data, uint8_t len)
+{
+	uint32_t msglen = len;
+
+	if (check_auth_message(src, data, &msglen) != 0)
+	{
+		// something is wrong with the auth, cant proceed
+		return;
+	}
+
+	msg_hop_channels_t *hch_msg = (msg_hop_channels_t *)data;
+	if (msglen < sizeof(*hch_msg))
+	{
+		printf("Received too small hop channel message with size %lu\n", msglen);
+
+		send_ack(ACK_WRONGSIZE);
+		return;
+	}
+
+	uint32_t num_entries = (msglen - sizeof(*hch_msg)) / sizeof(hch_msg->c) + 1;
+
+	// Check all entries first so that the message is either applied completely or not at all
+	for (uint32_t i = 0; i < num_entries; i++)
+	{
+		if (hch_msg->c[i].hop > MESHNW_MAX_NODEID || hch_msg->c[i].channel > MESHNW_CHANNEL_MAX)
+		{
+			printf("Invalid hop channel %u:%u\n", hch_msg->c[i].hop, hch_msg->c[i].channel);
+
+			send_ack(ACK_BADPARAM);
+			return;
+		}
+	}
+
+	for (uint32_t i = 0; i < num_entries; i++)
+	{
+		meshnw_set_hop_channel(hch_msg->c[i].hop, hch_msg->c[i].channel);
+	}
+
+	send_ack(ACK_OK);
+}
+
+
 /*
  * -- Config channel --
  * Proceses a sensor configuration request.
@@ -924,6 +1194,7 @@ static void handle_sensor_start_request(nodeid_t src, void *data, uint8_t len)
 	ASSERT_ALIGNED(msg_start_sensor_t, status_retransmission_delay);
 	ctx.active_sensor_channels = start_msg->active_sensors;
 	ctx.status_retransmission_base_delay = start_msg->status_retransmission_delay;
+	rtt_init(&ctx.status_rtt, (uint32_t)ctx.status_retransmission_base_delay * 1000);
 
 
 	/*
@@ -1029,9 +1300,28 @@ static void handle_nop_request(nodeid_t src, void *data, uint8_t len)
 }
 
 
+/*
+ * Sets the color of a single LED in the color table of the context.
+ */
+static void set_led_color(uint8_t led, uint8_t color)
+{
+	if (led & 0x01)
+	{
+		// Odd -> color is defined in the lower nibble
+		ctx.led_colors[led >> 1] = (ctx.led_colors[led >> 1] & 0xF0) | (color & 0x0F);
+	}
+	else
+	{
+		// Even -> color is defined in upper nibble
+		ctx.led_colors[led >> 1] = (ctx.led_colors[led >> 1] & 0x0F) | (color << 4);
+	}
+}
+
+
 /*
  * -- Config channel --
  * Proceses a LED request.
+ * A MSG_TYPE_LED message sets all LEDs, a MSG_TYPE_LED_UPDATE message only the listed ones.
  */
 static void handle_led_request(nodeid_t src, void *data, uint8_t len)
 {
@@ -1044,26 +1334,60 @@ static void handle_led_request(nodeid_t src, void *data, uint8_t len)
 
 	msg_led_t *led_msg = (msg_led_t *)data;
 
-	uint8_t color_bytes = msglen - sizeof(*led_msg);
+	if (led_msg->type == MSG_TYPE_LED_UPDATE)
+	{
+		msg_led_update_t *update_msg = (msg_led_update_t *)data;
+		if (msglen < sizeof(*update_msg))
+		{
+			printf("Received too small LED update message with size %lu\n", msglen);
+			send_ack(ACK_WRONGSIZE);
+			return;
+		}
 
-	static const uint32_t MAX_LED_BYTES = sizeof(ctx.led_colors) / sizeof(ctx.led_colors[0]);
+		uint32_t num_leds = (msglen - sizeof(*update_msg)) / sizeof(update_msg->data[0]) + 1;
 
-	if (color_bytes > MAX_LED_BYTES)
-	{
-		color_bytes = MAX_LED_BYTES;
-	}
+		// Check all entries first, the update is applied completely or not at all
+		for (uint32_t i = 0; i < num_leds; i++)
+		{
+			if (update_msg->data[i].led >= NUM_OF_LED)
+			{
+				printf("Attempt to set LED with invalid index %u\n", update_msg->data[i].led);
+				send_ack(ACK_BADINDEX);
+				return;
+			}
+		}
 
-	memcpy(ctx.led_colors, led_msg->data, color_bytes);
+		for (uint32_t i = 0; i < num_leds; i++)
+		{
+			set_led_color(update_msg->data[i].led, update_msg->data[i].color);
 
-	// Set undefined color values to 0
-	while (color_bytes < MAX_LED_BYTES)
-	{
-		ctx.led_colors[color_bytes] = 0;
-		color_bytes++;
+			// Only the updated LEDs stop blinking, the others may still wait for their update
+			ctx.led_blink_mask &= ~(1 << update_msg->data[i].led);
+		}
 	}
+	else
+	{
+		uint8_t color_bytes = msglen - sizeof(*led_msg);
+
+		static const uint32_t MAX_LED_BYTES = sizeof(ctx.led_colors) / sizeof(ctx.led_colors[0]);
+
+		if (color_bytes > MAX_LED_BYTES)
+		{
+			color_bytes = MAX_LED_BYTES;
+		}
+
+		memcpy(ctx.led_colors, led_msg->data, color_bytes);
+
+		// Set undefined color values to 0
+		while (color_bytes < MAX_LED_BYTES)
+		{
+			ctx.led_colors[color_bytes] = 0;
+			color_bytes++;
+		}
 
-	// Reset LEDs to non-blinking
-	ctx.led_blink_mask = 0;
+		// Reset LEDs to non-blinking
+		ctx.led_blink_mask = 0;
+	}
 
 	ctx.status |= STATUS_LED_SET;
 	ctx.status &= ~STATUS_NO_LED_UPDATE;
@@ -1071,6 +1395,7 @@ static void handle_led_request(nodeid_t src, void *data, uint8_t len)
 	send_ack(ACK_OK);
 }
 
+
 /*
  * -- Config channel --
  * Proceses a rebuild status channel request.
@@ -1372,10 +1697,16 @@ static void mesh_message_received(nodeid_t id, void *data, uint8_t len)
 		case MSG_TYPE_AUTH_ACK:
 			handle_auth_master_ack(id, data, len);
 			break;
+		case MSG_TYPE_AUTH_RESUME:
+			handle_auth_resume(id, data, len);
+			break;
 		case MSG_TYPE_ROUTE_RESET:
 		case MSG_TYPE_ROUTE_APPEND:
 			handle_route_request(id, data, len);
 			break;
+		case MSG_TYPE_HOP_CHANNELS:
+			handle_hop_channels_request(id, data, len);
+			break;
 		case MSG_TYPE_CONFIGURE_SENSOR_CHANNEL:
 			handle_sensor_cfg_request(id, data, len);
 			break;
@@ -1392,6 +1723,7 @@ static void mesh_message_received(nodeid_t id, void *data, uint8_t len)
 			handle_nop_request(id, data, len);
 			break;
 		case MSG_TYPE_LED:
+		case MSG_TYPE_LED_UPDATE:
 			handle_led_request(id, data, len);
 			break;
 		case MSG_TYPE_REBUILD_STATUS_CHANNEL:
@@ -1583,7 +1915,14 @@ static void adc_thread(void *arg)
 		}
 #endif
 
+		if (new_status != ctx.current_sensor_status)
+		{
+			// Set before the status, the message thread reads these after seeing the new status
+			ctx.status_changed_cycle = ctx.adc_cycle;
+			ctx.status_changed_at = xTaskGetTickCount();
+		}
 		ctx.current_sensor_status = new_status;
+		ctx.adc_cycle++;
 
 #ifdef DEBUG_FILE_LOGGER_AVAILABLE
 		debug_file_logger_log_raw_adc(adc_raw_value_buffer, NUM_OF_WASCH_CHANNELS);
@@ -1610,8 +1949,31 @@ static void adc_thread(void *arg)
 }
 
 
+/*
+ * Sends the signed status message with the trace for this transmission appended.
+ */
+static void send_status_msg_with_trace(void)
+{
+	uint8_t buffer[sizeof(ctx.status_msg) + sizeof(msg_status_trace_t)];
+	memcpy(buffer, ctx.status_msg, ctx.status_msg_len);
+
+	msg_status_trace_t *trace = (msg_status_trace_t *)(buffer + ctx.status_msg_len);
+
+	uint32_t age = (xTaskGetTickCount() - ctx.status_msg_changed_at) * portTICK_PERIOD_MS;
+	u16_to_unaligned(&trace->adc_cycle, (uint16_t)ctx.status_msg_cycle);
+	u16_to_unaligned(&trace->age_ms, age > 0xffff ? 0xffff : age);
+	trace->attempt = ctx.status_retransmission_counter < 0xff ? ctx.status_retransmission_counter + 1 : 0xff;
+
+	if (!meshnw_send(ctx.master_node, buffer, ctx.status_msg_len + sizeof(*trace)))
+	{
+		printf("sending status update failed.\n");
+	}
+}
+
+
 /*
  * Send a status update message to the master with the specified status.
+ * The message is only signed if status_msg_len is 0, otherwise the stored message is sent again.
  */
 static void send_status_update_message(uint16_t status)
 {
@@ -1622,11 +1984,16 @@ static void send_status_update_message(uint16_t status)
 		return;
 	}
 
-	// Buffer for the message
-	uint8_t out_buffer[MESHNW_MAX_PACKET_SIZE];
-	uint32_t status_msg_len = sizeof(out_buffer);
+	if (ctx.status_msg_len != 0)
+	{
+		// Retransmission
+		send_status_msg_with_trace();
+		return;
+	}
 
-	msg_status_update_t *sta = (msg_status_update_t *)out_buffer;
+	uint32_t status_msg_len = sizeof(ctx.status_msg);
+
+	msg_status_update_t *sta = (msg_status_update_t *)ctx.status_msg;
 
 	/*
 	 * Set the message type and data before calling sign so that the MAC can
@@ -1649,7 +2016,7 @@ static void send_status_update_message(uint16_t status)
 
 
 	// Sign the packet...
-	int res = auth_master_sign(&ctx.auth_status, out_buffer, sizeof(*sta), &status_msg_len, &add_data, sizeof(add_data));
+	int res = auth_master_sign(&ctx.auth_status, ctx.status_msg, sizeof(*sta), &status_msg_len, &add_data, sizeof(add_data), &ctx.status_msg_nonce);
 
 	if (res != 0)
 	{
@@ -1657,11 +2024,10 @@ static void send_status_update_message(uint16_t status)
 		return;
 	}
 
+	ctx.status_msg_len = status_msg_len;
+
 	// ... and send it.
-	if (!meshnw_send(ctx.master_node, out_buffer, status_msg_len))
-	{
-		printf("sending status update failed.\n");
-	}
+	send_status_msg_with_trace();
 }
 
 
@@ -1712,10 +2078,58 @@ static void send_raw_status_message(uint32_t rt_counter, uint32_t uptime)
 	}
 }
 
+/*
+ * Sends a message containing the link statistics from entry <first> on.
+ * returns the index of the first entry that did not fit into the message or 0 if all entries have been sent.
+ */
+static uint8_t send_link_stats_message(uint8_t first)
+{
+	meshnw_link_stats_t stats[MESHNW_LINK_STATS_ENTRIES];
+	uint8_t total = meshnw_get_link_stats(stats, MESHNW_LINK_STATS_ENTRIES);
+
+	msg_link_stats_t *ls;
+
+	// Buffer for the message
+	uint8_t out_buffer[sizeof(*ls) + sizeof(ls->entries[0]) * MSG_LINK_STATS_MAX_ENTRIES];
+
+	ls = (msg_link_stats_t *)out_buffer;
+
+	ls->type = MSG_TYPE_LINK_STATS;
+	ls->total = total;
+	ls->first = first;
+
+	uint8_t count = 0;
+	while (count < MSG_LINK_STATS_MAX_ENTRIES && first + count < total)
+	{
+		const meshnw_link_stats_t *s = &stats[first + count];
+		ls->entries[count].node = s->node;
+		u16_to_unaligned(&ls->entries[count].rx, s->rx);
+		u16_to_unaligned(&ls->entries[count].tx, s->tx);
+		u16_to_unaligned(&ls->entries[count].fwd, s->fwd);
+		u16_to_unaligned(&ls->entries[count].drop, s->drop);
+		u16_to_unaligned(&ls->entries[count].tx_fail, s->tx_fail);
+		ls->entries[count].rssi = s->rssi;
+		ls->entries[count].snr = s->snr;
+		u16_to_unaligned(&ls->entries[count].fwd_delay, s->fwd_delay);
+		count++;
+	}
+
+	if (!meshnw_send(ctx.master_node, out_buffer, sizeof(*ls) + sizeof(ls->entries[0]) * count))
+	{
+		printf("sending link stats failed.\n");
+	}
+
+	if (first + count < total)
+	{
+		return first + count;
+	}
+	return 0;
+}
+
 /*
  * Prints the current status on the serial console.
  */
-static void print_raw_status(uint32_t rt_counter, uint32_t uptime, uint32_t rt_timer, uint16_t master_sensor_status)
+static void print_raw_status(uint32_t rt_counter, uint32_t uptime, uint32_t rt_timeout, uint16_t master_sensor_status)
 {
 	printf("Node status\n");
 	printf("Node id:               %4u\n", ctx.current_node);
@@ -1728,7 +2142,9 @@ static void print_raw_status(uint32_t rt_counter, uint32_t uptime, uint32_t rt_t
 	printf("Uptime:            %8lu\n", uptime);
 	printf("ADC loop delay:    %8lu\n", ctx.sensor_loop_delay_ms);
 	printf("RT base delay:         %4u\n", ctx.status_retransmission_base_delay);
-	printf("RT timer:          %8lu\n", rt_timer);
+	printf("RT timeout (ms):   %8lu\n", rt_timeout);
+	printf("SRTT (ms):         %8lu\n", rtt_get_srtt(&ctx.status_rtt));
+	printf("RTTVAR (ms):       %8lu\n", rtt_get_rttvar(&ctx.status_rtt));
 	printf("Last message:      %8lu\n", ctx.config_channel_timeout_timer);
 
 	// now append channel data
@@ -1934,20 +2350,7 @@ static void check_status_change_indicators(uint16_t changed)
 			{
 				// We have configured a status change indicator for this channel -> set color and start blinking
 				uint8_t led = ctx.status_change_indicators[ch].led;
-				if (led & 0x01)
-				{
-					// Odd -> color is defined in the lower nibble
-					ctx.led_colors[led >> 1] =
-						(ctx.led_colors[led >> 1] & 0xF0) |
-						ctx.status_change_indicators[ch].color;
-				}
-				else
-				{
-					// Even -> color is defined in upper nibble
-					ctx.led_colors[led >> 1] =
-						(ctx.led_colors[led >> 1] & 0x0F) |
-						(ctx.status_change_indicators[ch].color << 4);
-				}
+				set_led_color(led, ctx.status_change_indicators[ch].color);
 
 				ctx.led_blink_mask |= (1 << led);
 			}
@@ -1969,6 +2372,9 @@ static void message_thread(void *arg)
 	// The message loop runs once per second.
 	static const uint32_t MESSAGE_LOOP_DELAY_MS = 1000;
 
+	// The status channel is checked more often, so retransmissions to close nodes are not delayed by the loop.
+	static const uint32_t STATUS_LOOP_DELAY_MS = 100;
+
 
 	/*
 	 * The sensor status of the last status update message to the host.
@@ -1981,19 +2387,16 @@ static void message_thread(void *arg)
 	uint16_t last_sent_sensor_status = 0;
 
 	/*
-	 * This counts the number of status message retransmissions.
-	 * This is used for the timeout and for calculating the time before a retransmission.
-	 */
-	uint32_t retransmission_counter = 0;
-
-	/*
-	 * Current time to wait before a retransmission.
+	 * Current time in ms to wait before a retransmission (starting at ctx.status_sent_at).
 	 */
-	uint32_t retransmission_timer = 0;
+	uint32_t retransmission_timeout = 0;
 
 	uint32_t total_retransmissions = 0;
 	uint32_t total_ticks = 0;
 
+	// Number of status loop iterations in the current message loop iteration
+	uint32_t status_ticks = 0;
+
 
     TickType_t last = xTaskGetTickCount();
 
@@ -2001,77 +2404,89 @@ static void message_thread(void *arg)
 	while(1)
 	{
 		WATCHDOG_FEED();
-		vTaskDelayUntil(&last, MESSAGE_LOOP_DELAY_MS);
-		total_ticks++;
+		vTaskDelayUntil(&last, STATUS_LOOP_DELAY_MS);
 
+		status_ticks++;
+		if (status_ticks >= MESSAGE_LOOP_DELAY_MS / STATUS_LOOP_DELAY_MS)
+		{
+			status_ticks = 0;
+			total_ticks++;
 
 #ifdef WASCHV2
-		if (test_switch_pressed(TEST_SWITCH_1))
-		{
-			init_channel_test_mode();
-		}
+			if (test_switch_pressed(TEST_SWITCH_1))
+			{
+				init_channel_test_mode();
+			}
 #endif
 
-		/*
-		 * Increment timeout timer for config messages.
-		 */
-		ctx.config_channel_timeout_timer++;
+			/*
+			 * Increment timeout timer for config messages.
+			 */
+			ctx.config_channel_timeout_timer++;
 
-		if (retransmission_counter > ctx.misc_config->max_status_retransmissions ||
-			ctx.config_channel_timeout_timer > ctx.misc_config->network_timeout)
-		{
-			printf("NETWORK TIMEOUT! Rebooting...\n");
-			system_reset();
-		}
-
-		ctx.adc_thread_watchdog++;
-		if (ctx.adc_thread_watchdog > ADC_THREAD_WATCHDOG_TIMEOUT)
-		{
-			printf("ADC THREAD DIED! Rebooting...\n");
-			system_reset();
-		}
-
-		if ((ctx.status & STATUS_LED_SET) == 0)
-		{
-			// LEDs not yet set -> do some animations
-			do_led_animation(total_ticks);
-		}
-		else
-		{
-			// Set LEDs to defined colors
-			update_leds(total_ticks);
-		}
+			if (ctx.status_retransmission_counter > ctx.misc_config->max_status_retransmissions ||
+				ctx.config_channel_timeout_timer > ctx.misc_config->network_timeout)
+			{
+				printf("NETWORK TIMEOUT! Rebooting...\n");
+				system_reset();
+			}
 
-		led_status_channels(ctx.active_sensor_channels, ctx.current_sensor_status);
+			ctx.adc_thread_watchdog++;
+			if (ctx.adc_thread_watchdog > ADC_THREAD_WATCHDOG_TIMEOUT)
+			{
+				printf("ADC THREAD DIED! Rebooting...\n");
+				system_reset();
+			}
 
-		if (ctx.debug_raw_status_requested)
-		{
-			if (ctx.debug_raw_status_requested == 255)
+			if ((ctx.status & STATUS_LED_SET) == 0)
 			{
-				print_raw_status(total_retransmissions, total_ticks, retransmission_timer, last_sent_sensor_status);
-				ctx.debug_raw_status_requested = 0;
+				// LEDs not yet set -> do some animations
+				do_led_animation(total_ticks);
 			}
 			else
 			{
-				ctx.debug_raw_status_requested--;
+				// Set LEDs to defined colors
+				update_leds(total_ticks);
+			}
+
+			led_status_channels(ctx.active_sensor_channels, ctx.current_sensor_status);
 
-				if (ctx.debug_raw_status_requested == 0)
+			if (ctx.debug_raw_status_requested)
+			{
+				if (ctx.debug_raw_status_requested == 255)
+				{
+					print_raw_status(total_retransmissions, total_ticks, retransmission_timeout, last_sent_sensor_status);
+					ctx.debug_raw_status_requested = 0;
+				}
+				else
 				{
-					send_raw_status_message(total_retransmissions, total_ticks);
+					ctx.debug_raw_status_requested--;
+
+					if (ctx.debug_raw_status_requested == 0)
+					{
+						send_raw_status_message(total_retransmissions, total_ticks);
+						ctx.debug_link_stats_next = 1;
+					}
 				}
 			}
-		}
+			else if (ctx.debug_link_stats_next)
+			{
+				// Sending the stats in the same iteration as the raw status would fail because the modem is still busy
+				uint8_t next = send_link_stats_message(ctx.debug_link_stats_next - 1);
+				ctx.debug_link_stats_next = next ? next + 1 : 0;
+			}
 
 #ifdef WASCHV2
-		if (ctx.storage_status_requested)
-		{
-			ctx.storage_status_requested--;
-			if (ctx.storage_status_requested == 0)
+			if (ctx.storage_status_requested)
 			{
-				send_storage_status_message();
+				ctx.storage_status_requested--;
+				if (ctx.storage_status_requested == 0)
+				{
+					send_storage_status_message();
+				}
 			}
-		}
 #endif
+		}
 
 
 		if (ctx.status & STATUS_SENSOR_TEST)
@@ -2089,16 +2504,13 @@ static void message_thread(void *arg)
 			if ((ctx.status & STATUS_SENSORS_ACTIVE) != 0)
 			{
 				// OK, time to build the status channel
-				if (retransmission_timer > 0)
-				{
-					retransmission_timer--;
-				}
-				else
+				if (xTaskGetTickCount() - ctx.status_sent_at >= retransmission_timeout)
 				{
 					init_status_auth();
-					// calculate / update rt timer / counter
-					retransmission_timer = calculate_retransmission_delay(retransmission_counter);
-					retransmission_counter++;
+					ctx.status_sent_at = xTaskGetTickCount();
+					// calculate / update rt timeout / counter
+					retransmission_timeout = calculate_retransmission_delay(ctx.status_retransmission_counter);
+					ctx.status_retransmission_counter++;
 					total_retransmissions++;
 				}
 			}
@@ -2132,14 +2544,9 @@ static void message_thread(void *arg)
 		{
 			// I -> Check / do retransmission
 
-			if (retransmission_timer > 0)
+			if (xTaskGetTickCount() - ctx.status_sent_at >= retransmission_timeout)
 			{
-				// Wait for timer
-				retransmission_timer--;
-			}
-			else
-			{
-				// Timer is 0 -> send now
+				// Timeout reached -> send now
 				send_update_message = 1;
 				total_retransmissions++;
 			}
@@ -2154,10 +2561,13 @@ static void message_thread(void *arg)
 
 			// Now i know that last_status_msg_was_acked is nonzero, therefore i may change the last status
 			last_sent_sensor_status = current_status;
+			ctx.status_msg_cycle = ctx.status_changed_cycle;
+			ctx.status_msg_changed_at = ctx.status_changed_at;
 
-			// reset acked status and counter
+			// reset acked status and counter, the new status needs a new message
 			ctx.last_status_msg_was_acked = 0;
-			retransmission_counter = 0;
+			ctx.status_retransmission_counter = 0;
+			ctx.status_msg_len = 0;
 
 			// Send message
 			send_update_message = 1;
@@ -2173,10 +2583,12 @@ static void message_thread(void *arg)
 			// need to send the message
 			send_status_update_message(last_sent_sensor_status);
 
-			// finally calculate the new retransmission timer
-			retransmission_timer = calculate_retransmission_delay(retransmission_counter);
-			retransmission_counter++;
-			printf("Status message sent, rt_t=%lu, rt_c=%lu\n", retransmission_timer, retransmission_counter);
+			ctx.status_sent_at = xTaskGetTickCount();
+
+			// finally calculate the new retransmission timeout
+			retransmission_timeout = calculate_retransmission_delay(ctx.status_retransmission_counter);
+			ctx.status_retransmission_counter++;
+			printf("Status message sent, rt_t=%lu, rt_c=%lu\n", retransmission_timeout, ctx.status_retransmission_counter);
 		}
 
 		xSemaphoreGive(ctx.mutex);
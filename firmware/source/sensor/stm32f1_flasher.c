@@ -27,6 +27,7 @@
 #include "utils.h"
 #include "watchdog.h"
 #include "tinyprintf.h"
+#include "serial_tx_dma.h"
 
 // Write everything but the config page
 #define NUM_PAGES_TO_FLASH 63
@@ -223,6 +224,10 @@ void flasher_start(uint32_t baudrate)
 
 
 	printf("About to change the baudrate for flashing to %lu.\nSee you on the other side.\n", baudrate);
+
+	// From now on the USART is written directly
+	serial_tx_dma_stop();
+
 	// We dont want any interrupt to interfere with our flasher
 	cm_disable_interrupts();
 
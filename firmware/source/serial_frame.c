@@ -0,0 +1,244 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+#include "serial_frame.h"
+#include <string.h>
+#include <libopencm3/cm3/cortex.h>
+#include "tinyprintf.h"
+
+// A COBS block has at most 254 data bytes
+#define COBS_MAX_BLOCK 254
+
+// Max size of an encoded frame: type + payload, CRC, two COBS length bytes and the delimiter
+#define ENCODED_MAX_SIZE (SERIAL_FRAME_MAX_SIZE + 2 + 2 + 1)
+
+static struct
+{
+	serial_frame_out_t out;
+	volatile bool enabled;
+
+	// Current line of the debug output
+	char log[SERIAL_FRAME_LOG_LENGTH];
+	uint8_t log_len;
+
+	// The frame that is being sent, only used with masked interrupts
+	uint8_t encoded[ENCODED_MAX_SIZE];
+} state;
+
+
+static uint16_t crc16(const uint8_t *data, uint32_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t b = 0; b < 8; b++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+
+/*
+ * Encodes the data with COBS, followed by the delimiter.
+ * Returns the encoded length, out must have space for len + 3 bytes.
+ */
+static uint32_t encode_cobs(const uint8_t *data, uint32_t len, uint8_t *out)
+{
+	uint32_t start = 0;
+	uint32_t pos = 0;
+	while (1)
+	{
+		// Every block is the data up to the next zero, the zero is replaced by the length byte
+		uint32_t end = start;
+		while (end < len && data[end] != 0 && end - start < COBS_MAX_BLOCK)
+		{
+			end++;
+		}
+
+		out[pos++] = end - start + 1;
+		for (uint32_t i = start; i < end; i++)
+		{
+			out[pos++] = data[i];
+		}
+
+		if (end == len)
+		{
+			break;
+		}
+
+		// A full block has no zero after it
+		start = (end - start == COBS_MAX_BLOCK) ? end : end + 1;
+	}
+
+	out[pos++] = 0;
+	return pos;
+}
+
+
+/*
+ * Decodes COBS in place, the data must not contain the delimiter.
+ * Returns the decoded length or -1 if the data is no valid COBS.
+ */
+static int cobs_decode(uint8_t *data, uint32_t len)
+{
+	uint32_t in = 0;
+	uint32_t out = 0;
+
+	while (in < len)
+	{
+		uint8_t code = data[in++];
+		if (in + code - 1 > len)
+		{
+			return -1;
+		}
+
+		for (uint8_t i = 1; i < code; i++)
+		{
+			data[out++] = data[in++];
+		}
+
+		if (code != COBS_MAX_BLOCK + 1 && in < len)
+		{
+			data[out++] = 0;
+		}
+	}
+
+	return out;
+}
+
+
+void serial_frame_init(serial_frame_out_t out)
+{
+	memset(&state, 0, sizeof(state));
+	state.out = out;
+}
+
+
+bool serial_frame_enabled(void)
+{
+	return state.enabled;
+}
+
+
+void serial_frame_enable(void)
+{
+	if (state.enabled)
+	{
+		return;
+	}
+
+	// The delimiter separates the first frame from the previous text output
+	static const uint8_t delimiter = 0;
+	uint32_t mask = cm_mask_interrupts(1);
+	state.out(&delimiter, 1, true);
+	state.enabled = true;
+	cm_mask_interrupts(mask);
+}
+
+
+void serial_frame_send(uint8_t type, const void *payload, uint32_t len)
+{
+	uint8_t frame[SERIAL_FRAME_MAX_SIZE + 2];
+
+	if (len > SERIAL_FRAME_MAX_SIZE - 1)
+	{
+		len = SERIAL_FRAME_MAX_SIZE - 1;
+	}
+
+	frame[0] = type;
+	memcpy(frame + 1, payload, len);
+	len++;
+
+	uint16_t crc = crc16(frame, len);
+	frame[len++] = (uint8_t)crc;
+	frame[len++] = (uint8_t)(crc >> 8);
+
+	// Frames from different threads must not be mixed
+	uint32_t mask = cm_mask_interrupts(1);
+	uint32_t encoded_len = encode_cobs(frame, len, state.encoded);
+	state.out(state.encoded, encoded_len, type != SERIAL_FRAME_LOG);
+	cm_mask_interrupts(mask);
+}
+
+
+void serial_frame_log_putc(char c)
+{
+	if (c == '\r')
+	{
+		return;
+	}
+
+	uint32_t mask = cm_mask_interrupts(1);
+
+	if (c != '\n')
+	{
+		state.log[state.log_len++] = c;
+	}
+
+	if (c == '\n' || state.log_len == SERIAL_FRAME_LOG_LENGTH)
+	{
+		serial_frame_send(SERIAL_FRAME_LOG, state.log, state.log_len);
+		state.log_len = 0;
+	}
+
+	cm_mask_interrupts(mask);
+}
+
+
+int serial_frame_receive(serial_frame_rx_t *rx, uint8_t c)
+{
+	if (c != 0)
+	{
+		if (rx->len < sizeof(rx->data))
+		{
+			rx->data[rx->len++] = c;
+		}
+		else
+		{
+			rx->overflow = 1;
+		}
+		return -1;
+	}
+
+	uint16_t len = rx->len;
+	uint8_t overflow = rx->overflow;
+	rx->len = 0;
+	rx->overflow = 0;
+
+	if (len == 0)
+	{
+		// Empty frame, e.g. an additional delimiter
+		return -1;
+	}
+
+	if (overflow)
+	{
+		printf("Dropped serial frame, too long\n");
+		return -1;
+	}
+
+	int res = cobs_decode(rx->data, len);
+	if (res < 3 || crc16(rx->data, res - 2) != (rx->data[res - 2] | (rx->data[res - 1] << 8)))
+	{
+		printf("Dropped invalid serial frame\n");
+		return -1;
+	}
+
+	return res - 2;
+}
+
+
+void serial_frame_cmd_binary(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	serial_frame_enable();
+}
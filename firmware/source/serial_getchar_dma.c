@@ -9,26 +9,75 @@
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
 
 
 #if defined(STM32F1)
 #define SERIAL_GETCHAR_DMA DMA1
 #define SERIAL_GETCHAR_DMA_RCC RCC_DMA1
 #define SERIAL_GETCHAR_DMA_CHANNEL DMA_CHANNEL5
+#define SERIAL_GETCHAR_DMA_IRQ NVIC_DMA1_CHANNEL5_IRQ
 #elif defined(STM32F4)
 #define SERIAL_GETCHAR_DMA DMA2
 #define SERIAL_GETCHAR_DMA_RCC RCC_DMA2
 #define SERIAL_GETCHAR_DMA_STREAM 2
 #define SERIAL_GETCHAR_DMA_CHANNEL DMA_SxCR_CHSEL_4
+#define SERIAL_GETCHAR_DMA_IRQ NVIC_DMA2_STREAM2_IRQ
 #else
 #error "Unknown CPU"
 #endif
 
 #define SERIAL_GETCHAR_USART USART1
-#define SERIAL_GETCHAR_DMA_BUFFERSIZE 32
+#define SERIAL_GETCHAR_USART_IRQ NVIC_USART1_IRQ
+
+#ifdef WASCHV1
+#define SERIAL_GETCHAR_DMA_BUFFERSIZE 128
+#else
+#define SERIAL_GETCHAR_DMA_BUFFERSIZE 512
+#endif
 
 static uint8_t dma_buffer[SERIAL_GETCHAR_DMA_BUFFERSIZE];
 static uint16_t last_read_index;
+static TaskHandle_t notify_task;
+
+
+static void notify_from_isr(void)
+{
+	if (!notify_task)
+	{
+		return;
+	}
+
+	BaseType_t woken = pdFALSE;
+	vTaskNotifyGiveFromISR(notify_task, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+
+void usart1_isr(void)
+{
+	if (USART_SR(SERIAL_GETCHAR_USART) & USART_SR_IDLE)
+	{
+		// The idle flag is cleared by reading the status and then the data register
+		(void)USART_DR(SERIAL_GETCHAR_USART);
+		notify_from_isr();
+	}
+}
+
+
+#if defined(STM32F1)
+void dma1_channel5_isr(void)
+{
+	dma_clear_interrupt_flags(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL, DMA_HTIF | DMA_TCIF);
+	notify_from_isr();
+}
+#else
+void dma2_stream2_isr(void)
+{
+	dma_clear_interrupt_flags(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM, DMA_HTIF | DMA_TCIF);
+	notify_from_isr();
+}
+#endif
 
 
 void serial_getchar_dma_init(void)
@@ -53,6 +102,8 @@ void serial_getchar_dma_init(void)
 	dma_set_memory_address(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL, (uint32_t)dma_buffer);
 
 	dma_enable_circular_mode(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL);
+	dma_enable_half_transfer_interrupt(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL);
+	dma_enable_transfer_complete_interrupt(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL);
 	dma_enable_channel(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_CHANNEL);
 #else
 	dma_stream_reset(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM);
@@ -69,11 +120,26 @@ void serial_getchar_dma_init(void)
 	dma_set_memory_address(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM, (uint32_t)dma_buffer);
 
 	dma_enable_circular_mode(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM);
+	dma_enable_half_transfer_interrupt(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM);
+	dma_enable_transfer_complete_interrupt(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM);
 	dma_enable_stream(SERIAL_GETCHAR_DMA, SERIAL_GETCHAR_DMA_STREAM);
 #endif
 
 	// Enable RX DMA for USART
 	usart_enable_rx_dma(SERIAL_GETCHAR_USART);
+
+	// The ISRs notify a task, so they must not have a higher priority than the kernel allows
+	nvic_set_priority(SERIAL_GETCHAR_DMA_IRQ, configKERNEL_INTERRUPT_PRIORITY);
+	nvic_set_priority(SERIAL_GETCHAR_USART_IRQ, configKERNEL_INTERRUPT_PRIORITY);
+	nvic_enable_irq(SERIAL_GETCHAR_DMA_IRQ);
+	nvic_enable_irq(SERIAL_GETCHAR_USART_IRQ);
+	USART_CR1(SERIAL_GETCHAR_USART) |= USART_CR1_IDLEIE;
+}
+
+
+void serial_getchar_set_notify_task(TaskHandle_t task)
+{
+	notify_task = task;
 }
 
 
@@ -0,0 +1,338 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+#include "serial_tx_dma.h"
+
+#include <stdbool.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include "tinyprintf.h"
+
+
+#if defined(STM32F1)
+#define SERIAL_TX_DMA DMA1
+#define SERIAL_TX_DMA_RCC RCC_DMA1
+#define SERIAL_TX_DMA_CHANNEL DMA_CHANNEL4
+#define SERIAL_TX_DMA_IRQ NVIC_DMA1_CHANNEL4_IRQ
+#elif defined(STM32F4)
+#define SERIAL_TX_DMA DMA2
+#define SERIAL_TX_DMA_RCC RCC_DMA2
+#define SERIAL_TX_DMA_STREAM 7
+#define SERIAL_TX_DMA_CHANNEL DMA_SxCR_CHSEL_4
+#define SERIAL_TX_DMA_IRQ NVIC_DMA2_STREAM7_IRQ
+#else
+#error "Unknown CPU"
+#endif
+
+#define SERIAL_TX_USART USART1
+
+// Size of the ring buffer, must be a power of two
+#ifndef SERIAL_TX_BUFFER_SIZE
+#ifdef WASCHV1
+#define SERIAL_TX_BUFFER_SIZE 512
+#else
+#define SERIAL_TX_BUFFER_SIZE 2048
+#endif
+#endif
+
+// Number of chars the debug output leaves free for blocks written with serial_tx_dma_write()
+#ifndef SERIAL_TX_RESERVE
+#define SERIAL_TX_RESERVE (SERIAL_TX_BUFFER_SIZE / 8)
+#endif
+
+#define RING_INDEX(x) ((x) & (SERIAL_TX_BUFFER_SIZE - 1))
+
+_Static_assert((SERIAL_TX_BUFFER_SIZE & (SERIAL_TX_BUFFER_SIZE - 1)) == 0, "SERIAL_TX_BUFFER_SIZE must be a power of two");
+
+
+static struct
+{
+	uint8_t buffer[SERIAL_TX_BUFFER_SIZE];
+
+	// Free running indices, head is the next char to write, tail the first char not yet sent
+	uint32_t head;
+	uint32_t tail;
+
+	// Number of chars in the running DMA transfer (0 = DMA idle)
+	uint16_t dma_len;
+
+	// Output is written directly after serial_tx_dma_stop()
+	bool stopped;
+
+	// Set if a char of the current debug line has been dropped, the rest of the line is dropped as well
+	bool drop_line;
+
+	// Statistics
+	uint32_t sent;
+	uint32_t dropped;
+	uint16_t max_used;
+} tx;
+
+
+/*
+ * Starts a DMA transfer for the next contiguous block of the buffer.
+ * Must be called with masked interrupts.
+ */
+static void start_dma(void)
+{
+	uint32_t used = tx.head - tx.tail;
+	if (tx.dma_len != 0 || used == 0)
+	{
+		return;
+	}
+
+	// Only up to the end of the buffer, the rest follows with the next transfer
+	uint32_t start = RING_INDEX(tx.tail);
+	uint32_t len = SERIAL_TX_BUFFER_SIZE - start;
+	if (len > used)
+	{
+		len = used;
+	}
+
+	tx.dma_len = len;
+
+#if defined(STM32F1)
+	dma_disable_channel(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+	dma_set_memory_address(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, (uint32_t)&tx.buffer[start]);
+	dma_set_number_of_data(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, len);
+	dma_enable_channel(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+#else
+	// The stream is disabled by the hardware at the end of the last transfer
+	dma_set_memory_address(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, (uint32_t)&tx.buffer[start]);
+	dma_set_number_of_data(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, len);
+	dma_enable_stream(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM);
+#endif
+}
+
+
+/*
+ * Checks if the running transfer is complete, removes the sent chars and starts the next transfer.
+ * Must be called with masked interrupts.
+ */
+static void poll_dma(void)
+{
+	if (tx.dma_len == 0)
+	{
+		return;
+	}
+
+#if defined(STM32F1)
+	if (!dma_get_interrupt_flag(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, DMA_TCIF))
+	{
+		return;
+	}
+	dma_clear_interrupt_flags(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, DMA_TCIF | DMA_HTIF);
+#else
+	if (!dma_get_interrupt_flag(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, DMA_TCIF))
+	{
+		return;
+	}
+	// All flags must be cleared before the stream can be enabled again
+	dma_clear_interrupt_flags(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, DMA_TCIF | DMA_HTIF | DMA_FEIF);
+#endif
+
+	tx.tail += tx.dma_len;
+	tx.sent += tx.dma_len;
+	tx.dma_len = 0;
+
+	start_dma();
+}
+
+
+#if defined(STM32F1)
+void dma1_channel4_isr(void)
+#else
+void dma2_stream7_isr(void)
+#endif
+{
+	uint32_t mask = cm_mask_interrupts(1);
+	poll_dma();
+	cm_mask_interrupts(mask);
+}
+
+
+void serial_tx_dma_init(void)
+{
+	rcc_periph_clock_enable(SERIAL_TX_DMA_RCC);
+
+#if defined(STM32F1)
+	dma_channel_reset(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+
+	dma_enable_memory_increment_mode(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+	dma_set_read_from_memory(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+	dma_set_peripheral_size(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, DMA_CCR_MSIZE_8BIT);
+
+	dma_set_peripheral_address(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL, (uint32_t)&USART_DR(SERIAL_TX_USART));
+	dma_enable_transfer_complete_interrupt(SERIAL_TX_DMA, SERIAL_TX_DMA_CHANNEL);
+#else
+	dma_stream_reset(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM);
+	dma_enable_memory_increment_mode(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM);
+	dma_set_transfer_mode(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_set_peripheral_size(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, DMA_SxCR_PSIZE_8BIT);
+	dma_set_memory_size(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, DMA_SxCR_MSIZE_8BIT);
+
+	dma_channel_select(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, SERIAL_TX_DMA_CHANNEL);
+
+	dma_set_peripheral_address(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM, (uint32_t)&USART_DR(SERIAL_TX_USART));
+	dma_enable_transfer_complete_interrupt(SERIAL_TX_DMA, SERIAL_TX_DMA_STREAM);
+#endif
+
+	// The ISR does not use any FreeRTOS functions, so the priority does not matter
+	nvic_enable_irq(SERIAL_TX_DMA_IRQ);
+
+	usart_enable_tx_dma(SERIAL_TX_USART);
+}
+
+
+/*
+ * Adds chars to the buffer and starts the DMA.
+ * Must be called with masked interrupts, the caller has to check the free space.
+ */
+static void put(const uint8_t *data, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		tx.buffer[RING_INDEX(tx.head)] = data[i];
+		tx.head++;
+	}
+
+	uint32_t used = tx.head - tx.tail;
+	if (used > tx.max_used)
+	{
+		tx.max_used = used;
+	}
+
+	start_dma();
+}
+
+
+void serial_putchar(char c)
+{
+	if (tx.stopped)
+	{
+		usart_send_blocking(SERIAL_TX_USART, c);
+		return;
+	}
+
+	uint32_t mask = cm_mask_interrupts(1);
+
+	// Makes progress if the interrupts are disabled (e.g. before the scheduler is started)
+	poll_dma();
+
+	uint32_t space = SERIAL_TX_BUFFER_SIZE - (tx.head - tx.tail);
+	if (tx.drop_line)
+	{
+		// Only the end of the line is kept, so that the next line starts at the beginning of a line
+		if (c == '\n' && space > 0)
+		{
+			put((const uint8_t *)&c, 1);
+			tx.drop_line = false;
+		}
+		else
+		{
+			tx.dropped++;
+		}
+	}
+	else if (space > SERIAL_TX_RESERVE)
+	{
+		put((const uint8_t *)&c, 1);
+	}
+	else
+	{
+		tx.dropped++;
+		tx.drop_line = (c != '\n');
+	}
+
+	cm_mask_interrupts(mask);
+}
+
+
+bool serial_tx_dma_write(const void *data, uint32_t len, bool use_reserve)
+{
+	if (tx.stopped)
+	{
+		for (uint32_t i = 0; i < len; i++)
+		{
+			usart_send_blocking(SERIAL_TX_USART, ((const uint8_t *)data)[i]);
+		}
+		return true;
+	}
+
+	uint32_t mask = cm_mask_interrupts(1);
+
+	poll_dma();
+
+	uint32_t space = SERIAL_TX_BUFFER_SIZE - (tx.head - tx.tail);
+	if (!use_reserve)
+	{
+		space = space > SERIAL_TX_RESERVE ? space - SERIAL_TX_RESERVE : 0;
+	}
+
+	bool ret = space >= len;
+	if (ret)
+	{
+		put(data, len);
+	}
+	else
+	{
+		tx.dropped += len;
+	}
+
+	cm_mask_interrupts(mask);
+
+	return ret;
+}
+
+
+void serial_tx_dma_flush(void)
+{
+	while (1)
+	{
+		uint32_t mask = cm_mask_interrupts(1);
+		poll_dma();
+		uint32_t used = tx.head - tx.tail;
+		cm_mask_interrupts(mask);
+
+		if (used == 0)
+		{
+			break;
+		}
+	}
+
+	// Wait for the last char to leave the shift register
+	while ((USART_SR(SERIAL_TX_USART) & USART_SR_TC) == 0);
+}
+
+
+void serial_tx_dma_stop(void)
+{
+	serial_tx_dma_flush();
+
+	nvic_disable_irq(SERIAL_TX_DMA_IRQ);
+	USART_CR3(SERIAL_TX_USART) &= ~USART_CR3_DMAT;
+	tx.stopped = true;
+}
+
+
+void serial_tx_dma_cmd_stats(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	// Copy first, the printf changes the values
+	uint32_t mask = cm_mask_interrupts(1);
+	uint32_t sent = tx.sent;
+	uint32_t dropped = tx.dropped;
+	uint16_t max_used = tx.max_used;
+	cm_mask_interrupts(mask);
+
+	printf("Serial output: %lu sent, %lu dropped, max %u of %u buffered\n", sent, dropped, max_used, SERIAL_TX_BUFFER_SIZE);
+}
@@ -111,6 +111,17 @@ static void init_io(void)
 }
 
 
+static void write_frequency(uint32_t frequency)
+{
+	//    freq = (FXOSC * frf) / 2^19
+	// => frf  = (freq * 2^19) / FXOSC
+	uint32_t frf = (uint32_t)((((uint64_t)frequency) * (1 << 19)) / SX127X_CONFIG_FXOSC);
+	sx127x_set_reg(SX127x_RegFrfMsb, frf >> 16);
+	sx127x_set_reg(SX127x_RegFrfMid, frf >> 8);
+	sx127x_set_reg(SX127x_RegFrfLsb, frf);
+}
+
+
 static bool config_sanity_check(const sx127x_rf_config_t *config)
 {
 	if (config->lora_spread_factor > SX127X_CONFIG_LORA_SPREAD_MAX ||
@@ -184,12 +195,7 @@ static bool init_rfm(const sx127x_rf_config_t *config)
 	}
 
 	// Set up the frequency
-	//    freq = (FXOSC * frf) / 2^19
-	// => frf  = (freq * 2^19) / FXOSC
-	uint32_t frf = (uint32_t)((((uint64_t)config->frequency) * (1 << 19)) / SX127X_CONFIG_FXOSC);
-	sx127x_set_reg(SX127x_RegFrfMsb, frf >> 16);
-	sx127x_set_reg(SX127x_RegFrfMid, frf >> 8);
-	sx127x_set_reg(SX127x_RegFrfLsb, frf);
+	write_frequency(config->frequency);
 
 	// Set tx power
 	uint8_t pa_config = 0;
@@ -250,24 +256,39 @@ bool sx127x_init(const sx127x_rf_config_t *cfg)
 }
 
 
+/*
+ * Checks if the modem is still sending (TX or FSTX mode).
+ */
+static bool check_tx_mode(uint8_t modereg)
+{
+	uint8_t mode = modereg & SX127x_RegOpMode_Mode_Mask;
+
+	if (mode != SX127x_RegOpMode_Mode_TX &&
+		mode != SX127x_RegOpMode_Mode_FSTX)
+	{
+		return false;
+	}
+
+	// If we are in FSTX mode, re-request the TX mode
+	// I'm not sure why this is required, but if I don't
+	// do this, the modem can get stuck in the FSTX mode!
+	if (mode == SX127x_RegOpMode_Mode_FSTX)
+	{
+		sx127x_set_reg(SX127x_RegOpMode, (modereg & ~SX127x_RegOpMode_Mode_Mask) | SX127x_RegOpMode_Mode_TX);
+	}
+
+	return true;
+}
+
+
 uint8_t sx127x_recv(uint8_t *buffer, uint8_t max)
 {
 	uint8_t modereg = sx127x_get_reg(SX127x_RegOpMode);
 	uint8_t mode = modereg & SX127x_RegOpMode_Mode_Mask;
 
-	if (mode == SX127x_RegOpMode_Mode_TX ||
-		mode == SX127x_RegOpMode_Mode_FSTX)
+	if (check_tx_mode(modereg))
 	{
 		// Currently in tx mode
-
-		// If we are in FSTX mode, re-request the TX mode
-		// I'm not sure why this is required, but if I don't
-		// do this, the modem can get stuck in the FSTX mode!
-		if (mode == SX127x_RegOpMode_Mode_FSTX)
-		{
-			sx127x_set_reg(SX127x_RegOpMode, (modereg & ~SX127x_RegOpMode_Mode_Mask) | SX127x_RegOpMode_Mode_TX);
-		}
-
 		return 0;
 	}
 
@@ -340,6 +361,34 @@ bool sx127x_send(const uint8_t *data, uint8_t len)
 }
 
 
+bool sx127x_set_frequency(uint32_t frequency)
+{
+	if (frequency > SX127X_CONFIG_LORA_FREQUENCY_MAX ||
+	    frequency < SX127X_CONFIG_LORA_FREQUENCY_MIN)
+	{
+		printf("RF frequency (%lu) out of allowed range (%u - %u)\n",
+		       frequency,
+		       SX127X_CONFIG_LORA_FREQUENCY_MIN,
+		       SX127X_CONFIG_LORA_FREQUENCY_MAX);
+		return false;
+	}
+
+	// Retuning would abort a packet that is still being sent
+	uint8_t mode = sx127x_get_reg(SX127x_RegOpMode);
+	if (check_tx_mode(mode))
+	{
+		return false;
+	}
+
+	// The frequency can only be changed in the sleep or standby mode.
+	// The next call to sx127x_recv() will re-enter the rx mode.
+	sx127x_set_reg(SX127x_RegOpMode, (mode & ~SX127x_RegOpMode_Mode_Mask) | SX127x_RegOpMode_Mode_STDBY);
+	write_frequency(frequency);
+
+	return true;
+}
+
+
 bool sx127x_is_busy(void)
 {
 	uint8_t mode = sx127x_get_reg(SX127x_RegOpMode);
@@ -353,7 +402,7 @@ bool sx127x_is_busy(void)
 		return !init_rfm(current_config);
 	}
 
-	if ((mode & SX127x_RegOpMode_Mode_Mask) == SX127x_RegOpMode_Mode_TX)
+	if (check_tx_mode(mode))
 	{
 		return true;
 	}
@@ -397,6 +446,28 @@ void sx127x_get_last_pkt_stats(uint8_t *rssi, int8_t *snr)
 	*snr = (int8_t)sx127x_get_reg(SX127x_RegPktSnrValue);
 }
 
+uint32_t sx127x_get_time_on_air_us(uint8_t len)
+{
+	// See the "Time on air" section of the SX127X datasheet.
+	// The driver uses the default preamble length (8 symbols), the explicit header mode and no payload CRC.
+	const uint32_t sf = current_config->lora_spread_factor;
+	const uint32_t sl_us = ((1UL << sf) * 1000000) / LORA_BANDWIDTH_TABLE[current_config->lora_bandwidth];
+	const uint32_t de = (sl_us > LORA_LOW_DR_OPT_THRESHOLD_US) ? 1 : 0;
+
+	int32_t num = 8 * (int32_t)len - 4 * (int32_t)sf + 28;
+	uint32_t den = 4 * (sf - 2 * de);
+
+	uint32_t payload_symbols = 8;
+	if (num > 0)
+	{
+		// lora_coderate 0 is 4/5 -> 5 symbols per code word
+		payload_symbols += ((num + den - 1) / den) * (current_config->lora_coderate + 5);
+	}
+
+	// The preamble is 8 + 4.25 symbols long
+	return (49 * sl_us) / 4 + payload_symbols * sl_us;
+}
+
 
 void sx127x_test_cmd(int argc, char **argv)
 {
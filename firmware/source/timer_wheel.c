@@ -0,0 +1,165 @@
+/*
+ * Copyright 2018 Daniel Frejek
+ * This source code is licensed under the MIT license that can be found
+ * in the LICENSE file.
+ */
+
+
+#include "timer_wheel.h"
+#include <string.h>
+
+#define SLOT_OF(t) (((t) >> TIMER_WHEEL_SLOT_SHIFT) % TIMER_WHEEL_SLOTS)
+
+// Compares with wrap around, true if a is before b
+#define BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+
+static void remove_timer(timer_wheel_t *wheel, timer_wheel_timer_t *timer)
+{
+	if (timer->prev)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		// First in the slot
+		wheel->slots[SLOT_OF(timer->deadline)] = timer->next;
+	}
+
+	if (timer->next)
+	{
+		timer->next->prev = timer->prev;
+	}
+
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->armed = 0;
+	wheel->num_timers--;
+}
+
+
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+
+void timer_wheel_arm(timer_wheel_t *wheel, timer_wheel_timer_t *timer, uint32_t deadline)
+{
+	timer_wheel_disarm(wheel, timer);
+
+	if (BEFORE(deadline, wheel->now))
+	{
+		// Already over, the slots before now are not visited again
+		deadline = wheel->now;
+	}
+
+	timer_wheel_timer_t **slot = &wheel->slots[SLOT_OF(deadline)];
+
+	timer->deadline = deadline;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot)
+	{
+		(*slot)->prev = timer;
+	}
+	*slot = timer;
+
+	timer->armed = 1;
+	wheel->num_timers++;
+}
+
+
+void timer_wheel_disarm(timer_wheel_t *wheel, timer_wheel_timer_t *timer)
+{
+	if (timer->armed)
+	{
+		remove_timer(wheel, timer);
+	}
+}
+
+
+timer_wheel_timer_t *timer_wheel_expire(timer_wheel_t *wheel, uint32_t now)
+{
+	if (BEFORE(now, wheel->now))
+	{
+		return NULL;
+	}
+
+	// Visit the slots from the last to the current time, every slot once if a round or more has passed
+	uint32_t first = wheel->now >> TIMER_WHEEL_SLOT_SHIFT;
+	uint32_t count = (now >> TIMER_WHEEL_SLOT_SHIFT) - first + 1;
+	if (count > TIMER_WHEEL_SLOTS)
+	{
+		count = TIMER_WHEEL_SLOTS;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		for (timer_wheel_timer_t *t = wheel->slots[(first + i) % TIMER_WHEEL_SLOTS]; t; t = t->next)
+		{
+			if (!BEFORE(now, t->deadline))
+			{
+				// Continue in this slot with the next call
+				if (i != 0)
+				{
+					wheel->now = (first + i) << TIMER_WHEEL_SLOT_SHIFT;
+				}
+
+				remove_timer(wheel, t);
+				return t;
+			}
+		}
+	}
+
+	wheel->now = now;
+	return NULL;
+}
+
+
+uint32_t timer_wheel_next(const timer_wheel_t *wheel, uint32_t now, uint32_t max)
+{
+	if (wheel->num_timers == 0)
+	{
+		return max;
+	}
+
+	uint32_t first = wheel->now >> TIMER_WHEEL_SLOT_SHIFT;
+
+	for (uint32_t i = 0; i < TIMER_WHEEL_SLOTS; i++)
+	{
+		// Only the timers of this round, later ones are found when the slot is visited the next time
+		uint32_t slot_end = (first + i + 1) << TIMER_WHEEL_SLOT_SHIFT;
+		uint32_t earliest = slot_end;
+
+		for (const timer_wheel_timer_t *t = wheel->slots[(first + i) % TIMER_WHEEL_SLOTS]; t; t = t->next)
+		{
+			if (BEFORE(t->deadline, earliest))
+			{
+				earliest = t->deadline;
+			}
+		}
+
+		if (earliest != slot_end)
+		{
+			if (!BEFORE(now, earliest))
+			{
+				return 0;
+			}
+
+			uint32_t res = earliest - now;
+			return res < max ? res : max;
+		}
+	}
+
+	// Nothing in this round
+	uint32_t round_end = (first + TIMER_WHEEL_SLOTS) << TIMER_WHEEL_SLOT_SHIFT;
+	if (!BEFORE(now, round_end))
+	{
+		return 0;
+	}
+
+	uint32_t res = round_end - now;
+	return res < max ? res : max;
+}
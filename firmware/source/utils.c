@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <libopencm3/cm3/scb.h>
 #include "tinyprintf.h"
+#include "serial_tx_dma.h"
 
 /*
  * Parses a single hex char and returs the number value
@@ -153,6 +154,8 @@ uint32_t u32_from_unaligned(const uint32_t *src)
 
 void system_reset(void)
 {
+	// Send the remaining output first, e.g. the reason for the reset
+	serial_tx_dma_flush();
 	SCB_AIRCR = SCB_AIRCR_VECTKEY | SCB_AIRCR_SYSRESETREQ;
 	for(;;);
 }
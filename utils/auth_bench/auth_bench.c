@@ -0,0 +1,395 @@
+/*
+ * Host benchmark for the auth module (firmware/source/auth.c)
+ *
+ * Runs the handshake and the message exchange of a config / status channel (sign, verify, ack, check ack)
+ * for typical message sizes and prints the time per operation and per MAC input byte.
+ * build_auth_bench.sh builds one binary per MAC backend (see auth_mac.h).
+ * As a reference, HMAC-SHA256 is also computed with cf_hmac_init() for every tag, like it was done before
+ * the midstates were cached in the auth context.
+ *
+ * Before the benchmark, the backend is checked against a known answer and the resume of a channel is checked,
+ * including replays of resume messages.
+ *
+ * USAGE: auth_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES
+#endif
+
+#include "auth.h"
+#include "sha2.h"
+#include "hmac.h"
+
+// Size of the header in front of the auth data (message type + ack code in acks)
+#define ACK_HEADER_LEN 2
+
+// Size of the header in front of the handshake data (message type + reply route / status + channels)
+#define HS1_HEADER_LEN 2
+#define HS2_HEADER_LEN 4
+
+typedef struct
+{
+	uint64_t ns;
+	uint64_t cycles;
+} bench_time_t;
+
+typedef struct
+{
+	const char *name;
+	bench_time_t time;
+} bench_op_t;
+
+enum
+{
+	OP_HANDSHAKE,
+	OP_SIGN,
+	OP_VERIFY,
+	OP_MAKE_ACK,
+	OP_CHECK_ACK,
+	OP_REF_HMAC,
+	NUM_OF_OPS
+};
+
+static const uint8_t key[AUTH_KEY_LEN] =
+	{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+
+// Source and destination, added to the tag like in the firmware
+static const uint8_t add_data[2] = { 0, 1 };
+
+
+static bench_time_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	bench_time_t t;
+	t.ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#ifdef HAVE_CYCLES
+	t.cycles = __rdtsc();
+#else
+	t.cycles = 0;
+#endif
+	return t;
+}
+
+
+static void add_elapsed(bench_op_t *op, bench_time_t start)
+{
+	bench_time_t end = now();
+	op->time.ns += end.ns - start.ns;
+	op->time.cycles += end.cycles - start.cycles;
+}
+
+
+/*
+ * Builds a channel between master and slave (hs1, hs2) like the firmware does when connecting.
+ */
+static void connect(auth_context_t *master, auth_context_t *slave, uint64_t challenge)
+{
+	uint8_t hs1[32];
+	uint8_t hs2[64];
+	uint32_t hs1_len = sizeof(hs1);
+	uint32_t hs2_len = sizeof(hs2);
+
+	auth_master_init(master, key, challenge);
+	auth_slave_init(slave, key, ~challenge);
+
+	if (auth_master_make_handshake(master, hs1, HS1_HEADER_LEN, &hs1_len) != 0 ||
+	    auth_slave_handshake(slave, hs1, HS1_HEADER_LEN, hs1_len, hs2, HS2_HEADER_LEN, &hs2_len) != 0 ||
+	    auth_master_process_handshake(master, hs2, HS2_HEADER_LEN, hs2_len) != 0)
+	{
+		fprintf(stderr, "Handshake failed\n");
+		exit(1);
+	}
+}
+
+
+/*
+ * Compares the MAC of the backend with a known answer.
+ * The nonce is appended to the data in memory order, so it is used for the last 8 bytes of the input.
+ */
+static void check_known_answer(void)
+{
+#if defined(AUTH_MAC_AES_CMAC)
+	// RFC 4493, example 2
+	static const uint8_t kat_key[16] =
+		{ 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+	static const uint8_t kat_msg[16] =
+		{ 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a };
+	static const uint8_t kat_tag[8] = { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44 };
+#elif defined(AUTH_MAC_SIPHASH)
+	// SipHash paper, appendix A (output 0xa129ca6149be45e5)
+	static const uint8_t kat_key[16] =
+		{ 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+	static const uint8_t kat_msg[15] =
+		{ 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e };
+	static const uint8_t kat_tag[8] = { 0xe5, 0x45, 0xbe, 0x49, 0x61, 0xca, 0x29, 0xa1 };
+#else
+	// Compare with cf_hmac
+	const uint8_t *kat_key = key;
+	static const uint8_t kat_msg[19] = "Waschfreiheit test";
+	uint8_t kat_tag[CF_SHA256_HASHSZ];
+	cf_hmac_ctx hmac;
+	cf_hmac_init(&hmac, &cf_sha256, kat_key, AUTH_KEY_LEN);
+	cf_hmac_update(&hmac, kat_msg, sizeof(kat_msg));
+	cf_hmac_finish(&hmac, kat_tag);
+#endif
+
+	auth_mac_key_t mac_key;
+	uint64_t nonce;
+	uint8_t tag[AUTH_MAC_TAG_LEN];
+
+	uint32_t data_len = sizeof(kat_msg) - sizeof(nonce);
+	memcpy(&nonce, kat_msg + data_len, sizeof(nonce));
+
+	auth_mac_init(&mac_key, kat_key);
+	// Split the data to check that the parts are concatenated correctly
+	auth_mac_tag(&mac_key, kat_msg, data_len / 2, kat_msg + data_len / 2, data_len - data_len / 2, nonce, tag);
+
+	if (memcmp(tag, kat_tag, sizeof(tag)) != 0)
+	{
+		fprintf(stderr, "%s does not match the known answer!\n", auth_mac_name);
+		exit(1);
+	}
+}
+
+
+/*
+ * Sends <count> messages from the master to the slave and acks them.
+ */
+static void exchange(auth_context_t *master, auth_context_t *slave, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t msg[16] = { (uint8_t)i };
+		uint8_t ack[16];
+		uint32_t len = sizeof(msg);
+		uint32_t ack_len = sizeof(ack);
+
+		if (auth_master_sign(master, msg, 1, &len, add_data, sizeof(add_data), NULL) != 0 ||
+		    auth_slave_verify(slave, msg, &len, add_data, sizeof(add_data)) != 0 ||
+		    auth_slave_make_ack(slave, ack, ACK_HEADER_LEN, &ack_len, 0) != 0 ||
+		    auth_master_check_ack(master, ack, ACK_HEADER_LEN, ack_len, NULL) != 0)
+		{
+			fprintf(stderr, "Message exchange failed\n");
+			exit(1);
+		}
+	}
+}
+
+
+static void check(int condition, const char *text)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "Resume check failed: %s\n", text);
+		exit(1);
+	}
+}
+
+
+/*
+ * Resumes a channel like after a restart of the master and replays the resume message:
+ * In the same channel after more messages and in later channels after a reboot of the slave (random nonce).
+ */
+static void check_resume(void)
+{
+	auth_context_t master;
+	auth_context_t slave;
+
+	connect(&master, &slave, 0x0123456789abcdefULL);
+	exchange(&master, &slave, 3);
+	uint64_t ticket = auth_master_get_ticket(&master);
+	exchange(&master, &slave, 5);
+
+	// Restart of the master, the context is lost
+	uint8_t resume[32] = { 0x42, 0x17 };
+	uint32_t resume_len = sizeof(resume);
+	auth_master_init(&master, key, 0);
+	check(auth_master_make_resume(&master, ticket, resume, 2, &resume_len, add_data, sizeof(add_data), NULL) == 0,
+	      "make resume");
+
+	uint8_t msg[32];
+	uint32_t len = resume_len;
+	memcpy(msg, resume, resume_len);
+	check(auth_slave_resume(&slave, msg, &len, add_data, sizeof(add_data)) == 0 && len == 2, "resume");
+
+	// Retransmission of the resume message
+	len = resume_len;
+	memcpy(msg, resume, resume_len);
+	check(auth_slave_resume(&slave, msg, &len, add_data, sizeof(add_data)) == AUTH_OLD_NONCE, "retransmitted resume");
+
+	uint8_t ack[16];
+	uint32_t ack_len = sizeof(ack);
+	check(auth_slave_make_ack(&slave, ack, ACK_HEADER_LEN, &ack_len, 0) == 0 &&
+	      auth_master_check_ack(&master, ack, ACK_HEADER_LEN, ack_len, NULL) == 0, "resume ack");
+	exchange(&master, &slave, 5);
+
+	// Replay in the same channel
+	len = resume_len;
+	memcpy(msg, resume, resume_len);
+	check(auth_slave_resume(&slave, msg, &len, add_data, sizeof(add_data)) == AUTH_WRONG_NONCE, "replay");
+
+	// Replay after reboots of the slave, a new channel with a random nonce each time
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (uint32_t i = 0; i < 10000; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		auth_context_t new_master;
+		auth_master_init(&new_master, key, i);
+		auth_slave_init(&slave, key, state);
+
+		uint8_t hs1[32];
+		uint8_t hs2[64];
+		uint32_t hs1_len = sizeof(hs1);
+		uint32_t hs2_len = sizeof(hs2);
+		check(auth_master_make_handshake(&new_master, hs1, HS1_HEADER_LEN, &hs1_len) == 0 &&
+		      auth_slave_handshake(&slave, hs1, HS1_HEADER_LEN, hs1_len, hs2, HS2_HEADER_LEN, &hs2_len) == 0,
+		      "handshake");
+
+		len = resume_len;
+		memcpy(msg, resume, resume_len);
+		check(auth_slave_resume(&slave, msg, &len, add_data, sizeof(add_data)) != 0, "replay after reboot");
+	}
+}
+
+
+static void run(uint32_t msg_len, uint32_t iterations)
+{
+	auth_context_t master;
+	auth_context_t slave;
+
+	bench_op_t ops[NUM_OF_OPS] =
+	{
+		[OP_HANDSHAKE] = { "handshake" },
+		[OP_SIGN]      = { "sign" },
+		[OP_VERIFY]    = { "verify" },
+		[OP_MAKE_ACK]  = { "make ack" },
+		[OP_CHECK_ACK] = { "check ack" },
+		[OP_REF_HMAC]  = { "cf_hmac (ref)" },
+	};
+
+	// MAC input bytes per operation (handshake: hs2 sign + check)
+	uint32_t mac_bytes[NUM_OF_OPS] =
+	{
+		[OP_HANDSHAKE] = 2 * (HS2_HEADER_LEN + 16 + 8),
+		[OP_SIGN]      = msg_len + sizeof(add_data) + 8,
+		[OP_VERIFY]    = msg_len + sizeof(add_data) + 8,
+		[OP_MAKE_ACK]  = ACK_HEADER_LEN + 1 + 8,
+		[OP_CHECK_ACK] = ACK_HEADER_LEN + 1 + 8,
+		[OP_REF_HMAC]  = msg_len + sizeof(add_data) + 8,
+	};
+
+	uint8_t msg[64];
+	uint8_t ack[16];
+
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		// A new channel every 16 messages
+		if ((i & 0x0f) == 0)
+		{
+			bench_time_t t = now();
+			connect(&master, &slave, 0x0123456789abcdefULL + i);
+			add_elapsed(&ops[OP_HANDSHAKE], t);
+		}
+
+		memset(msg, (uint8_t)i, msg_len);
+		uint64_t nonce = master.nonce;
+
+		uint32_t len = sizeof(msg);
+		bench_time_t t = now();
+		int res = auth_master_sign(&master, msg, msg_len, &len, add_data, sizeof(add_data), NULL);
+		add_elapsed(&ops[OP_SIGN], t);
+
+		t = now();
+		res |= auth_slave_verify(&slave, msg, &len, add_data, sizeof(add_data));
+		add_elapsed(&ops[OP_VERIFY], t);
+
+		uint32_t ack_len = sizeof(ack);
+		t = now();
+		res |= auth_slave_make_ack(&slave, ack, ACK_HEADER_LEN, &ack_len, 0);
+		add_elapsed(&ops[OP_MAKE_ACK], t);
+
+		t = now();
+		res |= auth_master_check_ack(&master, ack, ACK_HEADER_LEN, ack_len, NULL);
+		add_elapsed(&ops[OP_CHECK_ACK], t);
+
+		if (res != 0)
+		{
+			fprintf(stderr, "Message exchange failed in iteration %u\n", i);
+			exit(1);
+		}
+
+		// Same work as a sign before the midstates were cached
+		cf_hmac_ctx hmac;
+		uint8_t digest[CF_SHA256_HASHSZ];
+		t = now();
+		cf_hmac_init(&hmac, &cf_sha256, key, sizeof(key));
+		cf_hmac_update(&hmac, msg, msg_len);
+		cf_hmac_update(&hmac, add_data, sizeof(add_data));
+		cf_hmac_update(&hmac, &nonce, sizeof(nonce));
+		cf_hmac_finish(&hmac, digest);
+		add_elapsed(&ops[OP_REF_HMAC], t);
+	}
+
+	for (uint32_t i = 0; i < NUM_OF_OPS; i++)
+	{
+		uint32_t count = iterations;
+		if (i == OP_HANDSHAKE)
+		{
+			count = (iterations + 15) / 16;
+		}
+
+		printf("%4u  %-14s %8.1f", msg_len, ops[i].name, (double)ops[i].time.ns / count);
+#ifdef HAVE_CYCLES
+		printf(" %12.1f %12.1f", (double)ops[i].time.cycles / count, (double)ops[i].time.cycles / count / mac_bytes[i]);
+#endif
+		printf("\n");
+	}
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = 100000;
+	if (argc > 1)
+	{
+		iterations = strtoul(argv[1], NULL, 10);
+	}
+
+	if (iterations == 0)
+	{
+		fprintf(stderr, "USAGE: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	check_known_answer();
+	check_resume();
+
+	printf("MAC: %s, context size %u bytes\n\n", auth_mac_name, (unsigned int)sizeof(auth_context_t));
+	printf("Size  Operation       ns / op");
+#ifdef HAVE_CYCLES
+	printf("  cycles / op  cycles / byte");
+#endif
+	printf("\n");
+
+	// Sizes of: authping, status update, route request
+	static const uint32_t sizes[] = { 1, 3, 40 };
+	for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		run(sizes[i], iterations);
+	}
+
+	return 0;
+}
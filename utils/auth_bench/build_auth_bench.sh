@@ -0,0 +1,17 @@
+#!/bin/sh
+# Builds the auth benchmark for every MAC backend, needs the cifra submodule.
+# Run all of them with: for b in auth_bench_*; do ./$b; done
+set -e
+
+FW=../../firmware
+CIFRA=${CIFRA:-$FW/cifra/src}
+CFLAGS="-std=gnu11 -O2 -Wall -Iinclude -I$FW/include -I$CIFRA -I$CIFRA/ext -Dtypeof=__typeof__"
+
+# The HMAC reference in the benchmark is built for every backend
+SOURCES="auth_bench.c $FW/source/auth.c $FW/source/auth_mac.c \
+	$CIFRA/hmac.c $CIFRA/sha256.c $CIFRA/blockwise.c $CIFRA/chash.c"
+
+gcc $CFLAGS -DAUTH_MAC_HMAC_SHA256 -o auth_bench_hmac_sha256 $SOURCES
+gcc $CFLAGS -DAUTH_MAC_AES_CMAC -o auth_bench_aes_cmac $SOURCES \
+	$CIFRA/aes.c $CIFRA/cmac.c $CIFRA/modes.c $CIFRA/gf128.c
+gcc $CFLAGS -DAUTH_MAC_SIPHASH -o auth_bench_siphash $SOURCES
@@ -0,0 +1,7 @@
+/*
+ * The debug output of auth.c would dominate the measurement, it is dropped in the benchmark.
+ */
+
+#pragma once
+
+#define printf(...) ((void)0)
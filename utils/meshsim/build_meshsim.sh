@@ -0,0 +1,17 @@
+#!/bin/sh
+# Builds the mesh simulator.
+# Only the network layer (meshnw.c) is built from the firmware, the node and master
+# applications are modelled in meshsim.c.
+# Set TDMA=1 to build the network layer with the time slotted MAC.
+set -e
+
+FW=../../firmware
+CFLAGS="-std=gnu11 -O2 -g -Wall -Iinclude -I$FW/include"
+
+if [ "$TDMA" = "1" ]; then
+	CFLAGS="$CFLAGS -DMESHNW_TDMA"
+fi
+
+gcc $CFLAGS -shared -fPIC -o meshnw_sensor.so $FW/source/meshnw.c
+gcc $CFLAGS -shared -fPIC -DMASTER -o meshnw_master.so $FW/source/meshnw.c
+gcc $CFLAGS -I$FW/include/sensor -rdynamic -o meshsim meshsim.c sim_kernel.c sim_radio.c $FW/source/sensor/state_estimation.c $FW/source/rtt_estimator.c -ldl -lm
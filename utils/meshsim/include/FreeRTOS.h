@@ -0,0 +1,37 @@
+/*
+ * Host replacement for the FreeRTOS kernel used by the mesh simulator.
+ * Only the parts used by the network layer are provided, they are implemented by sim_kernel.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+typedef struct sim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// The simulator allocates its own task data, the static buffers are unused.
+typedef struct
+{
+	void *unused;
+} StaticTask_t;
+
+typedef struct
+{
+	struct sim_task *owner;
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+#define configTICK_RATE_HZ 1000
+#define portMAX_DELAY      ((TickType_t)0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+#define pdTRUE             1
+#define pdFALSE            0
+#define tskIDLE_PRIORITY   0
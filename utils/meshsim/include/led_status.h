@@ -0,0 +1,16 @@
+/*
+ * The simulated nodes have no LEDs.
+ */
+
+#pragma once
+
+enum LED_STATUS_SYSTEM
+{
+	LED_STATUS_SYSTEM_RX,
+	LED_STATUS_SYSTEM_TX
+};
+
+static inline void led_status_system(enum LED_STATUS_SYSTEM status)
+{
+	(void)status;
+}
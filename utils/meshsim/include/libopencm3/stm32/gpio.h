@@ -0,0 +1,2 @@
+/* Empty on the host, sx127x_config.h only needs the defines of the RF limits. */
+#pragma once
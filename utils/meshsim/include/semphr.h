@@ -0,0 +1,12 @@
+/*
+ * Host replacement for the FreeRTOS mutex API (see sim_kernel.c).
+ * Only mutexes with an infinite timeout are supported.
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
@@ -0,0 +1,20 @@
+/*
+ * Host replacement for the FreeRTOS task API (see sim_kernel.c).
+ * Time is simulated, a tick is one ms.
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn,
+                               const char *name,
+                               uint32_t stack_depth,
+                               void *arg,
+                               UBaseType_t priority,
+                               StackType_t *stack,
+                               StaticTask_t *task_buffer);
+
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+TickType_t xTaskGetTickCount(void);
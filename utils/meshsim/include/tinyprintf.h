@@ -0,0 +1,10 @@
+/*
+ * The firmware output goes to the log of the node that is currently running (see sim_kernel.c).
+ * No format attribute here, the firmware uses %lu for uint32_t which is correct on the target only.
+ */
+
+#pragma once
+
+int sim_printf(const char *fmt, ...);
+
+#define printf sim_printf
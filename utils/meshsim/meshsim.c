@@ -0,0 +1,938 @@
+/*
+ * Mesh network simulator
+ *
+ * Runs the network layer of the firmware (meshnw.c) for many nodes on the host.
+ * This is the only firmware module that is simulated, everything above it is a model.
+ * Every node gets its own copy of meshnw_master.so / meshnw_sensor.so (the module has global state),
+ * the FreeRTOS API and the modem driver are replaced by sim_kernel.c and sim_radio.c.
+ * sim_kernel.c is used instead of a FreeRTOS port because the vendored FreeRTOS has no POSIX port
+ * and the virtual time keeps the runs deterministic and much faster than real time.
+ *
+ * sensor_node.c and the master (master_node.c, master_sensorconnection.c) are not built,
+ * they need the sensor hardware, the flash config and the serial console.
+ * Their status channel is modelled instead:
+ * The sensors send their status to the master if it changed and retransmit it
+ * with the same (round trip time based) timeouts as the firmware until the master acks it.
+ * The status changes are either random or replayed from ADC logs (debug file logger)
+ * through the real state estimation. The messages have the size of the real (signed) messages,
+ * the authentication itself is not simulated (auth.c builds on the host, see utils/auth_bench).
+ *
+ * USAGE: meshsim [options] <topology file>
+ * See meshsim_topology.py for the topology format.
+ */
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "meshnw.h"
+#include "messagetypes.h"
+#include "rtt_estimator.h"
+#include "state_estimation.h"
+#include "sim_kernel.h"
+#include "sim_radio.h"
+#include "sx127x_config.h"
+
+#define MAX_CHANNELS 4
+
+// Values of the firmware (sensor_node.c / sensor_config_defaults.h)
+#define STATUS_LOOP_DELAY_MS         100
+#define MAX_STATUS_RETRANSMISSIONS   100
+#define RT_DELAY_RANDOM               25
+#define RT_DELAY_LIN_DIV               3
+
+// The input task processes the ADC samples in blocks
+#define INPUT_LOOP_DELAY_MS          100
+
+/*
+ * Status messages and acks, the sequence number is placed where the real messages
+ * have their nonce and MAC so that the size on air is the same.
+ */
+typedef struct
+{
+	msg_type_t type;
+	uint16_t status;
+	uint32_t seq;
+	uint32_t mac;
+} __attribute__((packed)) sim_status_msg_t;
+
+typedef struct
+{
+	msg_type_t type;
+	uint8_t result_code;
+	uint32_t seq;
+	uint32_t mac;
+} __attribute__((packed)) sim_ack_msg_t;
+
+typedef struct
+{
+	bool (*init)(nodeid_t id, const sx127x_rf_config_t *config, mesh_nw_message_cb_t cb);
+	void (*enable_forwarding)(void);
+	bool (*set_route)(nodeid_t destination, nodeid_t next_hop);
+	bool (*send)(nodeid_t dst, void *data, uint8_t len);
+	uint8_t (*get_link_stats)(meshnw_link_stats_t *stats, uint8_t max);
+} meshnw_api_t;
+
+typedef struct
+{
+	FILE *log;
+	const char *filename;
+	uint8_t log_channel;
+	uint16_t sps;
+	uint64_t samples;
+	bool has_params;
+	state_estimation_params_t params;
+	state_estimation_data_t se;
+} adc_replay_t;
+
+typedef struct
+{
+	bool used;
+	bool is_master;
+	bool sensor;
+	nodeid_t id;
+	meshnw_api_t nw;
+	nodeid_t routes[MESHNW_MAX_NODEID + 1];
+
+	// Base retransmission delay in s, this is the connection timeout of the master
+	uint32_t rt_base_delay;
+
+	// Status source
+	adc_replay_t *adc[MAX_CHANNELS];
+	uint64_t next_change[MAX_CHANNELS];
+	uint64_t input_start;
+	uint16_t status;
+
+	// Time of the first change that has not been sent yet, 0 if none
+	uint64_t pending_change_time;
+
+	// Status channel, see sensor_node_message_thread()
+	bool acked;
+	uint16_t last_sent_status;
+	uint32_t rt_counter;
+	uint32_t rt_timeout;
+	uint64_t sent_at;
+	rtt_estimator_t rtt;
+	uint32_t seq;
+	uint64_t update_change_time;
+
+	// Last sequence number the master received from this node
+	uint32_t master_seq;
+
+	// Results
+	uint32_t changes;
+	uint32_t updates;
+	uint32_t delivered;
+	uint32_t retransmissions;
+	uint32_t rt_timeouts;
+	uint32_t *latencies;
+	uint32_t num_latencies;
+	uint32_t max_latencies;
+} sim_node_t;
+
+static struct
+{
+	sim_node_t nodes[MESHNW_MAX_NODEID + 1];
+	nodeid_t master;
+	sx127x_rf_config_t rf;
+
+	const char *lib_dir;
+	uint32_t channels;
+	uint32_t change_interval_s;
+	uint32_t default_rt_base;
+} sim;
+
+
+static void fail(const char *fmt, const char *arg, int line)
+{
+	fprintf(stderr, "Line %i: ", line);
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+
+/*
+ * Loads a private copy of the network layer for a node.
+ */
+static void load_network_layer(sim_node_t *node)
+{
+	char src[512];
+	snprintf(src, sizeof(src), "%s/%s", sim.lib_dir, node->is_master ? "meshnw_master.so" : "meshnw_sensor.so");
+
+	// dlopen() returns the same instance for the same file, so every node needs its own file.
+	char dst[] = "/tmp/meshsim_XXXXXX";
+	int out = mkstemp(dst);
+	FILE *in = fopen(src, "rb");
+	if (out < 0 || !in)
+	{
+		fprintf(stderr, "Can't copy %s, did you run build_meshsim.sh?\n", src);
+		exit(1);
+	}
+
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+	{
+		if (write(out, buffer, n) != (ssize_t)n)
+		{
+			fprintf(stderr, "Failed to write %s\n", dst);
+			exit(1);
+		}
+	}
+	fclose(in);
+	close(out);
+
+	void *lib = dlopen(dst, RTLD_NOW | RTLD_LOCAL);
+	unlink(dst);
+	if (!lib)
+	{
+		fprintf(stderr, "Failed to load the network layer: %s\n", dlerror());
+		exit(1);
+	}
+
+	node->nw.init = dlsym(lib, "meshnw_init");
+	node->nw.enable_forwarding = dlsym(lib, "meshnw_enable_forwarding");
+	node->nw.set_route = dlsym(lib, "meshnw_set_route");
+	node->nw.send = dlsym(lib, "meshnw_send");
+	node->nw.get_link_stats = dlsym(lib, "meshnw_get_link_stats");
+
+	if (!node->nw.init || !node->nw.enable_forwarding || !node->nw.set_route || !node->nw.send || !node->nw.get_link_stats)
+	{
+		fprintf(stderr, "Network layer is missing symbols: %s\n", dlerror());
+		exit(1);
+	}
+}
+
+
+/*
+ * Parses a list of numbers like the master does for the cfg_sensor command.
+ */
+static bool parse_list(const char *str, int32_t *out, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char *end;
+		out[i] = strtol(str, &end, 10);
+		if (end == str || (i + 1 < count && *end != ','))
+		{
+			return false;
+		}
+		str = end + 1;
+	}
+	return true;
+}
+
+
+static void parse_se_params(state_estimation_params_t *p, char **args, int line)
+{
+	int32_t in[3];
+	int32_t mx[(SE_STATECOUNT - 1) * SE_STATECOUNT];
+	int32_t wnd[SE_STATECOUNT];
+	int32_t rej[2];
+
+	if (!parse_list(args[0], in, 3) ||
+	    !parse_list(args[1], mx, sizeof(mx) / sizeof(mx[0])) ||
+	    !parse_list(args[2], wnd, SE_STATECOUNT) ||
+	    !parse_list(args[3], rej, 2))
+	{
+		fail("Invalid state estimation parameters%s", "", line);
+	}
+
+	p->input_filter.mid_value_adjustment_speed = in[0];
+	p->input_filter.lowpass_weight = in[1];
+	p->input_filter.num_samples = in[2];
+
+	for (uint32_t i = 0; i < sizeof(mx) / sizeof(mx[0]); i++)
+	{
+		p->state_filter.transition_matrix[i] = mx[i];
+	}
+
+	for (uint32_t i = 0; i < SE_STATECOUNT; i++)
+	{
+		p->state_filter.window_sizes[i] = wnd[i];
+	}
+
+	p->state_filter.reject_threshold = rej[0];
+	p->state_filter.reject_consec_count = rej[1];
+}
+
+
+/*
+ * Parameters used if an ADC log is replayed without explicit parameters (same as se_pytester.c)
+ */
+static void default_se_params(state_estimation_params_t *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->input_filter.lowpass_weight = 50;
+	p->input_filter.num_samples = 100;
+	p->input_filter.mid_value_adjustment_speed = 1000;
+	p->state_filter.reject_consec_count = 15;
+	p->state_filter.reject_threshold = 13 * 8;
+
+	for (uint32_t i = 0; i < SE_STATECOUNT; i++)
+	{
+		p->state_filter.window_sizes[i] = 200;
+	}
+
+	p->state_filter.transition_matrix[1 + 0 * (SE_STATECOUNT - 1)] = 100;
+	p->state_filter.transition_matrix[0 + 2 * (SE_STATECOUNT - 1)] = -50;
+}
+
+
+static sim_node_t *get_node(const char *str, int line)
+{
+	char *end;
+	long id = strtol(str, &end, 10);
+	if (*end || id < 0 || id > MESHNW_MAX_NODEID)
+	{
+		fail("Invalid node id %s", str, line);
+	}
+
+	sim_node_t *node = &sim.nodes[id];
+	if (!node->used)
+	{
+		node->used = true;
+		node->sensor = true;
+		node->id = id;
+		node->rt_base_delay = sim.default_rt_base;
+		node->acked = true;
+		memset(node->routes, MESHNW_INVALID_NODE, sizeof(node->routes));
+	}
+	return node;
+}
+
+
+static adc_replay_t *get_adc(sim_node_t *node, const char *channel, int line)
+{
+	long ch = strtol(channel, NULL, 10);
+	if (ch < 0 || ch >= MAX_CHANNELS)
+	{
+		fail("Invalid channel %s", channel, line);
+	}
+
+	if (!node->adc[ch])
+	{
+		node->adc[ch] = calloc(1, sizeof(adc_replay_t));
+		default_se_params(&node->adc[ch]->params);
+	}
+	return node->adc[ch];
+}
+
+
+static void load_topology(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Can't open %s\n", filename);
+		exit(1);
+	}
+
+	char buffer[1024];
+	int line = 0;
+	bool have_master = false;
+
+	while (fgets(buffer, sizeof(buffer), f))
+	{
+		line++;
+
+		char *args[16];
+		int argc = 0;
+		for (char *tok = strtok(buffer, " \t\r\n"); tok && argc < 16; tok = strtok(NULL, " \t\r\n"))
+		{
+			if (tok[0] == '#')
+			{
+				break;
+			}
+			args[argc++] = tok;
+		}
+
+		if (argc == 0)
+		{
+			continue;
+		}
+
+		if (strcmp(args[0], "master") == 0 && argc == 2)
+		{
+			sim_node_t *n = get_node(args[1], line);
+			n->is_master = true;
+			n->sensor = false;
+			sim.master = n->id;
+			have_master = true;
+		}
+		else if (strcmp(args[0], "node") == 0 && argc >= 2)
+		{
+			sim_node_t *n = get_node(args[1], line);
+			for (int i = 2; i < argc; i++)
+			{
+				if (strcmp(args[i], "nosensor") == 0)
+				{
+					n->sensor = false;
+				}
+				else if (strcmp(args[i], "rt_base") == 0 && i + 1 < argc)
+				{
+					n->rt_base_delay = strtoul(args[++i], NULL, 10);
+				}
+				else
+				{
+					fail("Unknown node option %s", args[i], line);
+				}
+			}
+		}
+		else if (strcmp(args[0], "link") == 0 && argc >= 3)
+		{
+			sim_node_t *a = get_node(args[1], line);
+			sim_node_t *b = get_node(args[2], line);
+			double loss = argc > 3 ? strtod(args[3], NULL) : 0.0;
+			int rssi = argc > 4 ? atoi(args[4]) : -100;
+			int snr = argc > 5 ? atoi(args[5]) : 5;
+			sim_radio_add_link(a->id, b->id, loss, rssi, snr);
+		}
+		else if (strcmp(args[0], "route") == 0 && argc == 4)
+		{
+			sim_node_t *n = get_node(args[1], line);
+			sim_node_t *dst = get_node(args[2], line);
+			sim_node_t *hop = get_node(args[3], line);
+			n->routes[dst->id] = hop->id;
+		}
+		else if (strcmp(args[0], "adc") == 0 && (argc == 5 || argc == 6))
+		{
+			sim_node_t *n = get_node(args[1], line);
+			adc_replay_t *adc = get_adc(n, args[2], line);
+			adc->log_channel = atoi(args[3]);
+			adc->filename = strdup(args[4]);
+			adc->sps = argc == 6 ? atoi(args[5]) : 500;
+			adc->log = fopen(adc->filename, "r");
+			if (!adc->log || adc->sps == 0)
+			{
+				fail("Can't replay %s", adc->filename, line);
+			}
+		}
+		else if (strcmp(args[0], "se_params") == 0 && argc == 7)
+		{
+			sim_node_t *n = get_node(args[1], line);
+			adc_replay_t *adc = get_adc(n, args[2], line);
+			parse_se_params(&adc->params, &args[3], line);
+			adc->has_params = true;
+		}
+		else if (strcmp(args[0], "rf") == 0 && argc == 4)
+		{
+			sim.rf.lora_spread_factor = atoi(args[1]);
+			sim.rf.lora_bandwidth = atoi(args[2]);
+			sim.rf.lora_coderate = atoi(args[3]);
+		}
+		else
+		{
+			fail("Invalid line: %s", args[0], line);
+		}
+	}
+
+	fclose(f);
+
+	if (!have_master)
+	{
+		fprintf(stderr, "The topology has no master\n");
+		exit(1);
+	}
+
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		for (uint32_t ch = 0; ch < MAX_CHANNELS; ch++)
+		{
+			if (sim.nodes[i].adc[ch] && !sim.nodes[i].adc[ch]->log)
+			{
+				fprintf(stderr, "se_params without adc log for node %u\n", i);
+				exit(1);
+			}
+		}
+	}
+}
+
+
+static uint64_t random_interval(uint32_t mean_s)
+{
+	// Exponentially distributed -> status changes are a poisson process
+	double u = sim_random_double();
+	if (u < 1e-9)
+	{
+		u = 1e-9;
+	}
+	return (uint64_t)(-(double)mean_s * 1000.0 * log(u)) + 1;
+}
+
+
+static void add_latency(sim_node_t *node, uint32_t latency)
+{
+	if (node->num_latencies == node->max_latencies)
+	{
+		node->max_latencies = node->max_latencies ? node->max_latencies * 2 : 64;
+		node->latencies = realloc(node->latencies, node->max_latencies * sizeof(uint32_t));
+	}
+	node->latencies[node->num_latencies++] = latency;
+}
+
+
+static void set_channel_status(sim_node_t *node, uint32_t ch, bool on, uint64_t time)
+{
+	uint16_t status = on ? (node->status | (1 << ch)) : (node->status & ~(1 << ch));
+	if (status == node->status)
+	{
+		return;
+	}
+
+	node->status = status;
+	node->changes++;
+	if (node->pending_change_time == 0)
+	{
+		node->pending_change_time = time;
+	}
+}
+
+
+/*
+ * Reads the next sample of a channel from an ADC log.
+ * The lines of the log have the format "<NUM> A  <CH>=<VAL>; <CH>=<VAL>;"
+ * returns false at the end of the log
+ */
+static bool read_adc_sample(adc_replay_t *adc, uint16_t *value)
+{
+	char buffer[512];
+	while (fgets(buffer, sizeof(buffer), adc->log))
+	{
+		char *p = strchr(buffer, ' ');
+		if (!p || p[1] != 'A' || p[2] != ' ')
+		{
+			continue;
+		}
+		p += 3;
+
+		unsigned int ch;
+		unsigned int val;
+		int n;
+		while (sscanf(p, " %u=%u;%n", &ch, &val, &n) == 2)
+		{
+			if (ch == adc->log_channel && val <= 0x0fff)
+			{
+				*value = val;
+				return true;
+			}
+			p += n;
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Feeds the ADC samples up to <now> into the state estimation.
+ */
+static void replay_adc(sim_node_t *node, uint32_t ch, uint64_t now)
+{
+	adc_replay_t *adc = node->adc[ch];
+	if (!adc->log)
+	{
+		return;
+	}
+
+	while (node->input_start + adc->samples * 1000 / adc->sps <= now)
+	{
+		uint64_t time = node->input_start + adc->samples * 1000 / adc->sps;
+		uint16_t value;
+		if (!read_adc_sample(adc, &value))
+		{
+			printf("Node %u: End of ADC log %s at %.1f s\n", node->id, adc->filename, time / 1000.0);
+			fclose(adc->log);
+			adc->log = NULL;
+			return;
+		}
+
+		stateest_update(&adc->se, value);
+		adc->samples++;
+		set_channel_status(node, ch, stateest_is_on(&adc->se), time);
+	}
+}
+
+
+/*
+ * Generates the status changes of a sensor node.
+ */
+static void input_task(void *arg)
+{
+	sim_node_t *node = arg;
+	node->input_start = sim_time_ms();
+
+	for (uint32_t ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		if (node->adc[ch])
+		{
+			if (stateest_init(&node->adc[ch]->se, &node->adc[ch]->params, node->adc[ch]->sps) != 0)
+			{
+				fprintf(stderr, "Invalid state estimation parameters for node %u channel %u\n", node->id, ch);
+				exit(1);
+			}
+		}
+		else if (ch < sim.channels && sim.change_interval_s)
+		{
+			node->next_change[ch] = node->input_start + random_interval(sim.change_interval_s);
+		}
+	}
+
+	TickType_t last = xTaskGetTickCount();
+	while (1)
+	{
+		vTaskDelayUntil(&last, INPUT_LOOP_DELAY_MS);
+		uint64_t now = sim_time_ms();
+
+		for (uint32_t ch = 0; ch < MAX_CHANNELS; ch++)
+		{
+			if (node->adc[ch])
+			{
+				replay_adc(node, ch, now);
+			}
+			else if (node->next_change[ch] && node->next_change[ch] <= now)
+			{
+				set_channel_status(node, ch, (node->status & (1 << ch)) == 0, node->next_change[ch]);
+				node->next_change[ch] += random_interval(sim.change_interval_s);
+			}
+		}
+	}
+}
+
+
+static void send_status(sim_node_t *node)
+{
+	sim_status_msg_t msg = { MSG_TYPE_STATUS_UPDATE, node->last_sent_status, node->seq, 0 };
+	node->nw.send(sim.master, &msg, sizeof(msg));
+}
+
+
+/*
+ * Model of the status part of sensor_node_message_thread().
+ */
+static void sensor_status_update(sim_node_t *node)
+{
+	bool send = false;
+
+	if (!node->acked)
+	{
+		if (node->rt_counter > MAX_STATUS_RETRANSMISSIONS)
+		{
+			// The firmware reboots here and is configured again by the controller
+			printf("NETWORK TIMEOUT!\n");
+			node->rt_timeouts++;
+			node->acked = true;
+			node->rt_counter = 0;
+			node->last_sent_status = ~node->status;
+			return;
+		}
+
+		if (sim_time_ms() - node->sent_at >= node->rt_timeout)
+		{
+			send = true;
+			node->retransmissions++;
+		}
+	}
+	else if (node->status != node->last_sent_status)
+	{
+		node->last_sent_status = node->status;
+		node->acked = false;
+		node->rt_counter = 0;
+		node->seq++;
+		node->updates++;
+		node->update_change_time = node->pending_change_time ? node->pending_change_time : sim_time_ms();
+		node->pending_change_time = 0;
+		send = true;
+	}
+	else
+	{
+		// Changed back before it was sent
+		node->pending_change_time = 0;
+	}
+
+	if (send)
+	{
+		send_status(node);
+		node->sent_at = sim_time_ms();
+
+		uint32_t timeout = rtt_timeout(&node->rtt, node->rt_counter / RT_DELAY_LIN_DIV);
+		node->rt_timeout = timeout + sim_random() % (timeout * RT_DELAY_RANDOM / 100 + 1);
+		node->rt_counter++;
+	}
+}
+
+
+/*
+ * Receive callback of all nodes
+ */
+static void node_rx(nodeid_t src, void *data, uint8_t len)
+{
+	sim_node_t *node = &sim.nodes[sim_current_node()];
+
+	if (node->is_master && len == sizeof(sim_status_msg_t) && ((uint8_t *)data)[0] == MSG_TYPE_STATUS_UPDATE)
+	{
+		sim_status_msg_t msg;
+		memcpy(&msg, data, sizeof(msg));
+
+		sim_node_t *sensor = &sim.nodes[src];
+		if (sensor->used && msg.seq != sensor->master_seq)
+		{
+			// New status
+			sensor->master_seq = msg.seq;
+			if (msg.seq == sensor->seq)
+			{
+				sensor->delivered++;
+				add_latency(sensor, sim_time_ms() - sensor->update_change_time);
+			}
+		}
+
+		sim_ack_msg_t ack = { MSG_TYPE_AUTH_ACK, ACK_OK, msg.seq, 0 };
+		node->nw.send(src, &ack, sizeof(ack));
+	}
+	else if (!node->is_master && len == sizeof(sim_ack_msg_t) && ((uint8_t *)data)[0] == MSG_TYPE_AUTH_ACK)
+	{
+		sim_ack_msg_t ack;
+		memcpy(&ack, data, sizeof(ack));
+
+		if (ack.seq == node->seq && !node->acked)
+		{
+			node->acked = true;
+			if (node->rt_counter <= 1)
+			{
+				rtt_update(&node->rtt, sim_time_ms() - node->sent_at);
+			}
+			else
+			{
+				rtt_keep_backoff(&node->rtt, (node->rt_counter - 1) / RT_DELAY_LIN_DIV);
+			}
+		}
+	}
+}
+
+
+static void node_task(void *arg)
+{
+	sim_node_t *node = arg;
+
+	if (!node->nw.init(node->id, &sim.rf, node_rx))
+	{
+		fprintf(stderr, "Init of node %u failed\n", node->id);
+		exit(1);
+	}
+
+	for (uint32_t dst = 0; dst <= MESHNW_MAX_NODEID; dst++)
+	{
+		if (node->routes[dst] != MESHNW_INVALID_NODE)
+		{
+			node->nw.set_route(dst, node->routes[dst]);
+		}
+	}
+	node->nw.enable_forwarding();
+
+	if (node->sensor)
+	{
+		rtt_init(&node->rtt, node->rt_base_delay * 1000);
+		sim_task_start(input_task, node, node->id, "INPUT");
+	}
+
+	TickType_t last = xTaskGetTickCount();
+	while (1)
+	{
+		vTaskDelayUntil(&last, STATUS_LOOP_DELAY_MS);
+
+		if (node->sensor)
+		{
+			sensor_status_update(node);
+		}
+	}
+}
+
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t count, uint32_t p)
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+	return sorted[(uint64_t)(count - 1) * p / 100];
+}
+
+
+static void print_results(uint64_t duration_ms, bool link_stats)
+{
+	printf("\nSimulated %.0f s\n\n", duration_ms / 1000.0);
+	printf("Node  Changes  Updates  Deliv    RT  Tmo   SRTT |  Lat avg    p50    p95    max [ms] | Airtime [s]  Duty [%%]  Busy |   RX  Coll  Lost  HDup  WrCh\n");
+
+	uint32_t *all = NULL;
+	uint32_t num_all = 0;
+	uint64_t total_airtime = 0;
+	uint32_t total_rt = 0;
+	uint32_t total_updates = 0;
+	uint32_t total_delivered = 0;
+
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		sim_node_t *n = &sim.nodes[i];
+		if (!n->used)
+		{
+			continue;
+		}
+
+		sim_radio_stats_t rs;
+		sim_radio_get_stats(n->id, &rs);
+
+		qsort(n->latencies, n->num_latencies, sizeof(uint32_t), compare_u32);
+		uint64_t sum = 0;
+		for (uint32_t l = 0; l < n->num_latencies; l++)
+		{
+			sum += n->latencies[l];
+		}
+
+		printf("%3u%c  %7u  %7u  %5u  %4u  %3u  %5lu | %8.0f  %5u  %5u  %5u      | %11.1f  %8.3f  %4u | %4u  %4u  %4u  %4u  %4u\n",
+		       n->id, n->is_master ? 'M' : ' ',
+		       n->changes, n->updates, n->delivered, n->retransmissions, n->rt_timeouts, (unsigned long)rtt_get_srtt(&n->rtt),
+		       n->num_latencies ? (double)sum / n->num_latencies : 0.0,
+		       percentile(n->latencies, n->num_latencies, 50),
+		       percentile(n->latencies, n->num_latencies, 95),
+		       percentile(n->latencies, n->num_latencies, 100),
+		       rs.airtime_us / 1e6, rs.airtime_us / (duration_ms * 10.0), rs.tx_busy,
+		       rs.rx_packets, rs.rx_collisions, rs.rx_lost, rs.rx_half_duplex, rs.rx_wrong_channel);
+
+		all = realloc(all, (num_all + n->num_latencies + 1) * sizeof(uint32_t));
+		memcpy(&all[num_all], n->latencies, n->num_latencies * sizeof(uint32_t));
+		num_all += n->num_latencies;
+		total_airtime += rs.airtime_us;
+		total_rt += n->retransmissions;
+		total_updates += n->updates;
+		total_delivered += n->delivered;
+	}
+
+	qsort(all, num_all, sizeof(uint32_t), compare_u32);
+
+	printf("\nTotal: %u updates, %u delivered, %u retransmissions, %.1f s airtime\n",
+	       total_updates, total_delivered, total_rt, total_airtime / 1e6);
+	printf("Latency (status change -> master): p50 %u ms, p95 %u ms, p99 %u ms, max %u ms\n",
+	       percentile(all, num_all, 50), percentile(all, num_all, 95),
+	       percentile(all, num_all, 99), percentile(all, num_all, 100));
+	free(all);
+
+	if (!link_stats)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		sim_node_t *n = &sim.nodes[i];
+		if (!n->used)
+		{
+			continue;
+		}
+
+		meshnw_link_stats_t stats[MESHNW_LINK_STATS_ENTRIES];
+		uint8_t count = n->nw.get_link_stats(stats, MESHNW_LINK_STATS_ENTRIES);
+
+		printf("\nLink statistics of node %u\n", n->id);
+		printf("Node     RX     TX    FWD   DROP   FAIL  RSSI  SNR/4  DELAY\n");
+		for (uint8_t s = 0; s < count; s++)
+		{
+			printf("%4u  %5u  %5u  %5u  %5u  %5u  %4i  %5i  %5u\n",
+			       stats[s].node, stats[s].rx, stats[s].tx, stats[s].fwd, stats[s].drop, stats[s].tx_fail,
+			       (int)stats[s].rssi - SX127X_CONFIG_RSSI_OFFSET, stats[s].snr, stats[s].fwd_delay);
+		}
+	}
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	        "USAGE: %s [options] <topology>\n"
+	        "  -d SECONDS   Simulated time (default 3600)\n"
+	        "  -s SEED      Seed for the random numbers (default 1)\n"
+	        "  -c SECONDS   Mean time between random status changes per channel, 0 disables them (default 600)\n"
+	        "  -n CHANNELS  Number of channels with random status changes (default 2)\n"
+	        "  -r SECONDS   Default base retransmission delay (default 10)\n"
+	        "  -L DIR       Directory of meshnw_master.so and meshnw_sensor.so (default .)\n"
+	        "  -l           Print the link statistics of all nodes\n"
+	        "  -v           Print the output of the nodes\n",
+	        name);
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	uint64_t duration_s = 3600;
+	uint64_t seed = 1;
+	bool link_stats = false;
+
+	sim.lib_dir = ".";
+	sim.channels = 2;
+	sim.change_interval_s = 600;
+	sim.default_rt_base = 10;
+
+	// Default RF settings of the sensors (sensor_config_defaults.h)
+	sim.rf.frequency = 433500000;
+	sim.rf.tx_power = 10;
+	sim.rf.lora_spread_factor = 10;
+	sim.rf.lora_coderate = 2;
+	sim.rf.lora_bandwidth = 7;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:s:c:n:r:L:lv")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd': duration_s = strtoull(optarg, NULL, 10); break;
+			case 's': seed = strtoull(optarg, NULL, 10); break;
+			case 'c': sim.change_interval_s = strtoul(optarg, NULL, 10); break;
+			case 'n': sim.channels = strtoul(optarg, NULL, 10); break;
+			case 'r': sim.default_rt_base = strtoul(optarg, NULL, 10); break;
+			case 'L': sim.lib_dir = optarg; break;
+			case 'l': link_stats = true; break;
+			case 'v': sim_set_log(stdout); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || sim.channels > MAX_CHANNELS)
+	{
+		usage(argv[0]);
+	}
+
+	sim_random_seed(seed);
+	load_topology(argv[optind]);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i <= MESHNW_MAX_NODEID; i++)
+	{
+		if (sim.nodes[i].used)
+		{
+			load_network_layer(&sim.nodes[i]);
+			sim_task_start(node_task, &sim.nodes[i], i, "NODE");
+			count++;
+		}
+	}
+
+	printf("Simulating %u nodes for %lu s\n", count, (unsigned long)duration_s);
+
+	sim_run(duration_s * 1000);
+	print_results(duration_s * 1000, link_stats);
+
+	return 0;
+}
@@ -0,0 +1,224 @@
+#!/bin/env python3
+"""
+Generates topology files for the mesh simulator (meshsim).
+
+The topology is either taken from the network section of a controller config
+or generated as a tree with a fixed number of nodes.
+
+Topology file format, one statement per line, '#' starts a comment:
+  master <ID>                              The master node
+  node <ID> [nosensor] [rt_base <S>]       A node, nosensor: only relays packets,
+                                           rt_base: base retransmission delay in s (connection timeout)
+  link <A> <B> [LOSS] [RSSI] [SNR]         Bidirectional radio link, loss probability (0 - 1),
+                                           RSSI in dBm, SNR in dB
+  route <ID> <DST> <HOP>                   Routing table entry of node ID
+  adc <ID> <CH> <LOG_CH> <FILE> [SPS]      Replays channel LOG_CH of an ADC log (debug file logger)
+                                           as sensor channel CH with SPS samples per second
+  se_params <ID> <CH> <INPUT_FILTER> <ST_MATRIX> <WND_SIZES> <REJECT_FILTER>
+                                           State estimation parameters for a replayed channel,
+                                           same format as the cfg_sensor command of the master
+  rf <SPREAD_FACTOR> <BANDWIDTH> <CODERATE>  LoRa settings (see sx127x.h)
+"""
+
+import argparse
+import math
+import os
+import sys
+
+parser = argparse.ArgumentParser(description="Generate a topology file for the mesh simulator.",
+                                 epilog="Without --conf, a tree with --tree nodes is generated.")
+
+parser.add_argument("--conf", help="Controller config file (network section is used)")
+parser.add_argument("--tree", type=int, default=50, help="Number of nodes in the generated tree")
+parser.add_argument("--fanout", type=int, default=3, help="Children per node in the generated tree")
+parser.add_argument("--hop-timeout", type=int, default=None,
+                    help="Timeout per hop in s (default: hop_timeout from the config or 3)")
+parser.add_argument("--loss", type=float, default=0.02, help="Loss probability of the links")
+parser.add_argument("--rssi", type=int, default=-105, help="RSSI of the links in dBm")
+parser.add_argument("--snr", type=int, default=3, help="SNR of the links in dB")
+parser.add_argument("--sibling-loss", type=float, default=0.2,
+                    help="Loss probability of the links between nodes with the same next hop to the master, "
+                         "these links only cause collisions (negative disables them)")
+parser.add_argument("--adc", action="append", default=[], metavar="NODE:CH:LOG_CH:FILE[:SPS]",
+                    help="Replay an ADC log on a node (node name or id)")
+
+args = parser.parse_args()
+
+
+class Node:
+    def __init__(self, node_id):
+        self.node_id = node_id
+        self.parent = None
+        self.routes = {}
+        self.sensor = True
+        self.channels = {}
+
+
+def link_line(a, b, loss, rssi, snr):
+    return "link {} {} {} {} {}".format(a, b, loss, rssi, snr)
+
+
+def route_length(nodes, node_id):
+    """
+    Same as BaseNode.route_length(), the master counts as one hop
+    """
+    length = 1
+    while nodes[node_id].parent is not None:
+        node_id = nodes[node_id].parent
+        length += 1
+    return length
+
+
+def make_tree(count, fanout):
+    nodes = {0: Node(0)}
+    queue = [0]
+    next_id = 1
+    while next_id <= count:
+        parent = queue.pop(0)
+        for _ in range(fanout):
+            if next_id > count:
+                break
+            nodes[next_id] = Node(next_id)
+            nodes[next_id].parent = parent
+            queue.append(next_id)
+            next_id += 1
+
+    # Every node needs a route to the master and to all nodes behind it
+    for n in nodes.values():
+        if n.parent is None:
+            continue
+        n.routes[0] = n.parent
+        child = n.node_id
+        hop = n.parent
+        while hop is not None:
+            nodes[hop].routes[n.node_id] = child
+            child = hop
+            hop = nodes[hop].parent
+    return nodes
+
+
+def channel_params(ch):
+    """
+    Formats the state estimation parameters like WaschNode.__make_calib_message_wasch()
+    """
+    input_filter = ','.join(str(e) for e in [
+        ch['input_filter']['mid_adjustment_speed'],
+        ch['input_filter']['lowpass_weight'],
+        ch['input_filter']['frame_size']])
+
+    mx = ch['transition_matrix']
+    size = int(math.sqrt(len(mx)))
+    transition_matrix = ','.join(str(mx[i * size + o]) for i in range(size) for o in range(size) if i != o)
+
+    window_sizes = ','.join(str(e) for e in ch['window_sizes'])
+    reject_filter = "{},{}".format(ch['reject_filter']['threshold'], ch['reject_filter']['consec_count'])
+
+    return "{} {} {} {}".format(input_filter, transition_matrix, window_sizes, reject_filter)
+
+
+def load_conf(filename):
+    import libconf
+
+    with open(filename) as cfgf:
+        config = libconf.load(cfgf, includedir=os.path.dirname(filename))
+
+    network = config['network']
+    ids = {name: int(cfg['id']) for name, cfg in network.items()}
+    nodes = {}
+
+    def resolve(name):
+        if name.startswith('#'):
+            node_id = int(name[1:])
+            if node_id not in nodes:
+                # Not managed by the controller, can only relay
+                nodes[node_id] = Node(node_id)
+                nodes[node_id].sensor = False
+            return node_id
+        return ids[name]
+
+    for name, cfg in network.items():
+        node_id = ids[name]
+        nodes.setdefault(node_id, Node(node_id))
+
+    master_id = None
+    for name, cfg in network.items():
+        node = nodes[ids[name]]
+        if cfg['type'] == "MASTER":
+            master_id = node.node_id
+            node.sensor = False
+        elif 'gateway' in cfg:
+            node.parent = ids[cfg['gateway']]
+            node.routes[0] = node.parent
+        else:
+            # Dummy node for name translation
+            node.sensor = False
+
+        for dst, hop in cfg.get('routes', ()):
+            node.routes[resolve(dst)] = resolve(hop)
+
+        for ch in cfg.get('channels', ()):
+            if ch.get('type', 'wasch') == 'wasch':
+                node.channels[int(ch['index'])] = channel_params(ch)
+
+    if master_id != 0:
+        sys.exit("The master needs to have the id 0")
+
+    return nodes, config.get('hop_timeout', 3), {name: i for name, i in ids.items()}
+
+
+if args.conf:
+    nodes, hop_timeout, names = load_conf(args.conf)
+    source = args.conf
+else:
+    nodes = make_tree(args.tree, args.fanout)
+    hop_timeout = 3
+    names = {}
+    source = "tree with {} nodes, fanout {}".format(args.tree, args.fanout)
+
+if args.hop_timeout is not None:
+    hop_timeout = args.hop_timeout
+
+print("# Generated by meshsim_topology.py from {}".format(source))
+print("master 0")
+
+for n in sorted(nodes.values(), key=lambda n: n.node_id):
+    if n.node_id == 0:
+        continue
+    options = []
+    if not n.sensor:
+        options.append("nosensor")
+    else:
+        options.append("rt_base {}".format(hop_timeout * route_length(nodes, n.node_id)))
+    print("node {} {}".format(n.node_id, ' '.join(options)))
+
+# Every next hop is in range
+links = set()
+for n in nodes.values():
+    for hop in n.routes.values():
+        if hop != n.node_id:
+            links.add((min(n.node_id, hop), max(n.node_id, hop)))
+
+for a, b in sorted(links):
+    print(link_line(a, b, args.loss, args.rssi, args.snr))
+
+# Nodes with the same next hop to the master are probably close to each other
+if args.sibling_loss >= 0:
+    for a in nodes.values():
+        for b in nodes.values():
+            if a.node_id < b.node_id and a.routes.get(0) is not None and \
+               a.routes.get(0) == b.routes.get(0) and (a.node_id, b.node_id) not in links:
+                print(link_line(a.node_id, b.node_id, args.sibling_loss, args.rssi - 10, args.snr - 5))
+
+for n in sorted(nodes.values(), key=lambda n: n.node_id):
+    for dst, hop in sorted(n.routes.items()):
+        print("route {} {} {}".format(n.node_id, dst, hop))
+
+for adc in args.adc:
+    parts = adc.split(':')
+    if len(parts) not in (4, 5):
+        sys.exit("Invalid --adc argument: " + adc)
+    node_id = names[parts[0]] if parts[0] in names else int(parts[0])
+    ch = int(parts[1])
+    print("adc {} {} {} {}".format(node_id, ch, parts[2], ' '.join(parts[3:])))
+    if ch in nodes[node_id].channels:
+        print("se_params {} {} {}".format(node_id, ch, nodes[node_id].channels[ch]))
@@ -0,0 +1,322 @@
+#include "sim_kernel.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#define TASK_STACK_SIZE (128 * 1024)
+
+// Max length of a log line, longer lines are split
+#define LOG_LINE_LENGTH 160
+
+// Log line buffer for output outside of a task
+#define LOG_NODE_NONE 256
+
+struct sim_task
+{
+	ucontext_t ctx;
+	void (*fn)(void *);
+	void *arg;
+	int node;
+	const char *name;
+
+	// The task runs at <wake> if it is not waiting for a mutex
+	uint64_t wake;
+	StaticSemaphore_t *waiting_for;
+
+	// Tasks with the same wake up time run in the order they blocked
+	uint64_t order;
+
+	struct sim_task *next;
+};
+
+static struct
+{
+	ucontext_t sched_ctx;
+	struct sim_task *tasks;
+	struct sim_task *current;
+	uint64_t now;
+	uint64_t order;
+
+	FILE *log;
+	char line[LOG_NODE_NONE + 1][LOG_LINE_LENGTH];
+	uint32_t line_len[LOG_NODE_NONE + 1];
+} kernel;
+
+
+static void task_entry(void)
+{
+	struct sim_task *t = kernel.current;
+	t->fn(t->arg);
+
+	fprintf(stderr, "Task %s of node %i returned\n", t->name, t->node);
+	exit(1);
+}
+
+
+/*
+ * Returns to the scheduler, the task continues when it is selected again.
+ */
+static void task_block(void)
+{
+	swapcontext(&kernel.current->ctx, &kernel.sched_ctx);
+}
+
+
+void sim_task_start(void (*fn)(void *), void *arg, int node, const char *name)
+{
+	struct sim_task *t = calloc(1, sizeof(*t));
+	void *stack = malloc(TASK_STACK_SIZE);
+	if (!t || !stack)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	t->fn = fn;
+	t->arg = arg;
+	t->node = node;
+	t->name = name;
+	t->wake = kernel.now;
+	t->order = kernel.order++;
+
+	getcontext(&t->ctx);
+	t->ctx.uc_stack.ss_sp = stack;
+	t->ctx.uc_stack.ss_size = TASK_STACK_SIZE;
+	t->ctx.uc_link = NULL;
+	makecontext(&t->ctx, task_entry, 0);
+
+	t->next = kernel.tasks;
+	kernel.tasks = t;
+}
+
+
+void sim_run(uint64_t end_ms)
+{
+	while (1)
+	{
+		struct sim_task *next = NULL;
+		for (struct sim_task *t = kernel.tasks; t; t = t->next)
+		{
+			if (t->waiting_for)
+			{
+				continue;
+			}
+
+			if (!next || t->wake < next->wake || (t->wake == next->wake && t->order < next->order))
+			{
+				next = t;
+			}
+		}
+
+		if (!next)
+		{
+			fprintf(stderr, "Deadlock, all tasks are waiting for a mutex\n");
+			exit(1);
+		}
+
+		if (next->wake > end_ms)
+		{
+			kernel.now = end_ms;
+			return;
+		}
+
+		if (next->wake > kernel.now)
+		{
+			kernel.now = next->wake;
+		}
+
+		kernel.current = next;
+		swapcontext(&kernel.sched_ctx, &next->ctx);
+		kernel.current = NULL;
+	}
+}
+
+
+uint64_t sim_time_ms(void)
+{
+	return kernel.now;
+}
+
+
+int sim_current_node(void)
+{
+	return kernel.current ? kernel.current->node : -1;
+}
+
+
+void sim_set_log(FILE *f)
+{
+	kernel.log = f;
+}
+
+
+int sim_printf(const char *fmt, ...)
+{
+	char buffer[512];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+
+	if (!kernel.log)
+	{
+		return n;
+	}
+
+	int node = sim_current_node();
+	int idx = node < 0 ? LOG_NODE_NONE : node;
+	char *line = kernel.line[idx];
+
+	for (const char *c = buffer; *c; c++)
+	{
+		if (*c != '\n')
+		{
+			line[kernel.line_len[idx]++] = *c;
+		}
+
+		if (*c == '\n' || kernel.line_len[idx] == LOG_LINE_LENGTH - 1)
+		{
+			line[kernel.line_len[idx]] = 0;
+			fprintf(kernel.log, "%10.3f %3i| %s\n", kernel.now / 1000.0, node, line);
+			kernel.line_len[idx] = 0;
+		}
+	}
+
+	return n;
+}
+
+
+/*
+ * -- FreeRTOS API --
+ */
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn,
+                               const char *name,
+                               uint32_t stack_depth,
+                               void *arg,
+                               UBaseType_t priority,
+                               StackType_t *stack,
+                               StaticTask_t *task_buffer)
+{
+	(void)stack_depth;
+	(void)priority;
+	(void)stack;
+	(void)task_buffer;
+
+	sim_task_start(fn, arg, sim_current_node(), name);
+
+	// The handle is not used by the firmware
+	return NULL;
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+	if (!kernel.current)
+	{
+		return;
+	}
+
+	kernel.current->wake = kernel.now + ticks;
+	kernel.current->order = kernel.order++;
+	task_block();
+}
+
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment)
+{
+	*previous_wake += increment;
+
+	TickType_t delay = *previous_wake - (TickType_t)kernel.now;
+	if (delay > increment)
+	{
+		// Already late -> don't wait but give the other tasks a chance to run
+		delay = 0;
+	}
+
+	vTaskDelay(delay);
+}
+
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)kernel.now;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+	buffer->owner = NULL;
+	return buffer;
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout)
+{
+	if (!kernel.current)
+	{
+		// The simulation is stopped, nothing else can run
+		return pdTRUE;
+	}
+
+	if (!mutex->owner)
+	{
+		mutex->owner = kernel.current;
+		return pdTRUE;
+	}
+
+	if (mutex->owner == kernel.current)
+	{
+		fprintf(stderr, "Task %s of node %i takes a mutex it already owns\n", kernel.current->name, kernel.current->node);
+		exit(1);
+	}
+
+	if (timeout != portMAX_DELAY)
+	{
+		// Only blocking without timeout is supported
+		return pdFALSE;
+	}
+
+	// Wait until the owner passes the mutex to this task
+	kernel.current->waiting_for = mutex;
+	kernel.current->order = kernel.order++;
+	task_block();
+
+	return pdTRUE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+	if (!kernel.current)
+	{
+		return pdTRUE;
+	}
+
+	struct sim_task *waiter = NULL;
+	for (struct sim_task *t = kernel.tasks; t; t = t->next)
+	{
+		if (t->waiting_for == mutex && (!waiter || t->order < waiter->order))
+		{
+			waiter = t;
+		}
+	}
+
+	mutex->owner = waiter;
+	if (waiter)
+	{
+		waiter->waiting_for = NULL;
+		waiter->wake = kernel.now;
+		waiter->order = kernel.order++;
+	}
+
+	return pdTRUE;
+}
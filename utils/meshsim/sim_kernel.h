@@ -0,0 +1,41 @@
+/*
+ * Cooperative scheduler with simulated time for the mesh simulator.
+ *
+ * Every FreeRTOS task of every node is a coroutine and only one of them runs at a time.
+ * A task runs until it blocks (delay or mutex), then the task with the earliest wake up time
+ * continues and the simulated time jumps forward to this point.
+ * There is no preemption, so a simulation is deterministic and runs as fast as the host allows.
+ *
+ * Tasks belong to a node (the node id), tasks created by a task inherit its node.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Creates a task for <node>, it starts at the current simulated time.
+ * Like FreeRTOS tasks, <fn> must never return.
+ */
+void sim_task_start(void (*fn)(void *), void *arg, int node, const char *name);
+
+/*
+ * Runs the tasks until the simulated time reaches <end_ms>.
+ */
+void sim_run(uint64_t end_ms);
+
+/*
+ * Current simulated time in ms
+ */
+uint64_t sim_time_ms(void);
+
+/*
+ * Node of the running task, -1 if no task is running
+ */
+int sim_current_node(void);
+
+/*
+ * Sets the file the output of the nodes (printf) is written to, NULL discards the output.
+ */
+void sim_set_log(FILE *f);
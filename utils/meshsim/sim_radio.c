@@ -0,0 +1,371 @@
+#include "sim_radio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sx127x.h"
+#include "sx127x_config.h"
+#include "sim_kernel.h"
+#include "tinyprintf.h"
+
+// Number of transmissions kept for the evaluation at the receivers
+#define TX_RING_SIZE 4096
+
+// Random RSSI / SNR variation for every packet
+#define RSSI_JITTER_DB 2
+
+typedef struct
+{
+	bool connected;
+	float loss;
+	int16_t rssi_dbm;
+	int16_t snr_db;
+} link_t;
+
+typedef struct
+{
+	int sender;
+	uint32_t frequency;
+	uint64_t start_us;
+	uint64_t end_us;
+	uint8_t len;
+	uint8_t data[256];
+} transmission_t;
+
+typedef struct
+{
+	const sx127x_rf_config_t *config;
+	uint32_t frequency;
+	uint64_t frequency_changed_us;
+	uint64_t tx_end_us;
+
+	// Sequence number of the next transmission to evaluate
+	uint64_t rx_next;
+
+	uint8_t last_rssi;
+	int8_t last_snr;
+
+	sim_radio_stats_t stats;
+} radio_t;
+
+static link_t links[SIM_RADIO_MAX_NODES][SIM_RADIO_MAX_NODES];
+static radio_t radios[SIM_RADIO_MAX_NODES];
+
+static transmission_t tx_ring[TX_RING_SIZE];
+static uint64_t tx_next_seq;
+
+// Longest transmission so far, used to limit the search for overlapping packets
+static uint64_t max_toa_us;
+
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+// See sx127x.c
+static const uint32_t LORA_BANDWIDTH_TABLE[] = {7800, 10400, 15600, 20800, 31200, 41700, 62500, 125000, 250000, 500000};
+#define LORA_LOW_DR_OPT_THRESHOLD_US 16000
+
+
+void sim_random_seed(uint64_t seed)
+{
+	random_state = seed ? seed : 0x2545F4914F6CDD1DULL;
+}
+
+
+uint64_t sim_random(void)
+{
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+
+double sim_random_double(void)
+{
+	return (sim_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+void sim_radio_add_link(int a, int b, double loss, int rssi_dbm, int snr_db)
+{
+	link_t l = { true, loss, rssi_dbm, snr_db };
+	links[a][b] = l;
+	links[b][a] = l;
+}
+
+
+void sim_radio_get_stats(int node, sim_radio_stats_t *stats)
+{
+	*stats = radios[node].stats;
+}
+
+
+static radio_t *current_radio(void)
+{
+	int node = sim_current_node();
+	if (node < 0 || node >= SIM_RADIO_MAX_NODES)
+	{
+		fprintf(stderr, "Modem access outside of a node task\n");
+		exit(1);
+	}
+	return &radios[node];
+}
+
+
+static uint64_t now_us(void)
+{
+	return sim_time_ms() * 1000;
+}
+
+
+/*
+ * Checks if a transmission can be heard by <node> right now.
+ */
+static bool is_receiving(int node, const radio_t *r)
+{
+	uint64_t now = now_us();
+	for (uint64_t seq = tx_next_seq; seq > 0 && tx_next_seq - seq < TX_RING_SIZE; seq--)
+	{
+		const transmission_t *t = &tx_ring[(seq - 1) % TX_RING_SIZE];
+		if (t->start_us + max_toa_us < now)
+		{
+			break;
+		}
+
+		if (t->sender != node && links[t->sender][node].connected &&
+		    t->frequency == r->frequency && t->start_us <= now && t->end_us > now)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Decides if the transmission <seq> is received by <node>.
+ */
+static bool evaluate_reception(int node, radio_t *r, uint64_t seq)
+{
+	const transmission_t *t = &tx_ring[seq % TX_RING_SIZE];
+	const link_t *l = &links[t->sender][node];
+
+	if (r->frequency != t->frequency || r->frequency_changed_us > t->start_us)
+	{
+		r->stats.rx_wrong_channel++;
+		return false;
+	}
+
+	// Look for overlapping transmissions, older ones first
+	const uint64_t oldest = tx_next_seq > TX_RING_SIZE ? tx_next_seq - TX_RING_SIZE : 0;
+	uint64_t first = seq;
+	while (first > oldest && tx_ring[(first - 1) % TX_RING_SIZE].start_us + max_toa_us >= t->start_us)
+	{
+		first--;
+	}
+
+	for (uint64_t s = first; s < tx_next_seq; s++)
+	{
+		const transmission_t *o = &tx_ring[s % TX_RING_SIZE];
+		if (o->start_us >= t->end_us)
+		{
+			break;
+		}
+
+		if (s == seq || o->end_us <= t->start_us)
+		{
+			continue;
+		}
+
+		if (o->sender == node)
+		{
+			r->stats.rx_half_duplex++;
+			return false;
+		}
+
+		const link_t *ol = &links[o->sender][node];
+		if (ol->connected && o->frequency == t->frequency && l->rssi_dbm < ol->rssi_dbm + SIM_RADIO_CAPTURE_DB)
+		{
+			r->stats.rx_collisions++;
+			return false;
+		}
+	}
+
+	if (sim_random_double() < l->loss)
+	{
+		r->stats.rx_lost++;
+		return false;
+	}
+
+	int jitter_rssi = (int)(sim_random() % (2 * RSSI_JITTER_DB + 1)) - RSSI_JITTER_DB;
+	int jitter_snr = (int)(sim_random() % (2 * RSSI_JITTER_DB + 1)) - RSSI_JITTER_DB;
+
+	int rssi = l->rssi_dbm + jitter_rssi + SX127X_CONFIG_RSSI_OFFSET;
+	r->last_rssi = rssi < 0 ? 0 : (rssi > 255 ? 255 : rssi);
+	r->last_snr = (l->snr_db + jitter_snr) * 4;
+	r->stats.rx_packets++;
+	return true;
+}
+
+
+/*
+ * -- Driver interface --
+ */
+
+bool sx127x_init(const sx127x_rf_config_t *cfg)
+{
+	radio_t *r = current_radio();
+	r->config = cfg;
+	r->frequency = cfg->frequency;
+	r->frequency_changed_us = now_us();
+	r->rx_next = tx_next_seq;
+	return true;
+}
+
+
+uint8_t sx127x_recv(uint8_t *buffer, uint8_t max)
+{
+	int node = sim_current_node();
+	radio_t *r = current_radio();
+
+	if (!r->config)
+	{
+		return 0;
+	}
+
+	if (r->rx_next + TX_RING_SIZE < tx_next_seq)
+	{
+		// Fell behind, the oldest transmissions are gone
+		r->rx_next = tx_next_seq - TX_RING_SIZE;
+	}
+
+	while (r->rx_next < tx_next_seq)
+	{
+		uint64_t seq = r->rx_next;
+		const transmission_t *t = &tx_ring[seq % TX_RING_SIZE];
+
+		if (t->sender == node || !links[t->sender][node].connected)
+		{
+			r->rx_next++;
+			continue;
+		}
+
+		if (t->end_us > now_us())
+		{
+			// Still in the air
+			break;
+		}
+
+		r->rx_next++;
+
+		if (evaluate_reception(node, r, seq))
+		{
+			memcpy(buffer, t->data, t->len < max ? t->len : max);
+			return t->len;
+		}
+	}
+
+	return 0;
+}
+
+
+bool sx127x_send(const uint8_t *data, uint8_t len)
+{
+	int node = sim_current_node();
+	radio_t *r = current_radio();
+
+	if (sx127x_is_busy())
+	{
+		printf("Send packet failed because the modem is busy\n");
+		r->stats.tx_busy++;
+		return false;
+	}
+
+	uint64_t toa = sx127x_get_time_on_air_us(len);
+	transmission_t *t = &tx_ring[tx_next_seq % TX_RING_SIZE];
+
+	t->sender = node;
+	t->frequency = r->frequency;
+	t->start_us = now_us();
+	t->end_us = t->start_us + toa;
+	t->len = len;
+	memcpy(t->data, data, len);
+	tx_next_seq++;
+
+	if (toa > max_toa_us)
+	{
+		max_toa_us = toa;
+	}
+
+	r->tx_end_us = t->end_us;
+	r->stats.tx_packets++;
+	r->stats.airtime_us += toa;
+
+	return true;
+}
+
+
+bool sx127x_set_frequency(uint32_t frequency)
+{
+	radio_t *r = current_radio();
+
+	if (frequency < SX127X_CONFIG_LORA_FREQUENCY_MIN || frequency > SX127X_CONFIG_LORA_FREQUENCY_MAX)
+	{
+		printf("Frequency %u out of range\n", frequency);
+		return false;
+	}
+
+	if (r->tx_end_us > now_us())
+	{
+		return false;
+	}
+
+	r->frequency = frequency;
+	r->frequency_changed_us = now_us();
+	return true;
+}
+
+
+bool sx127x_is_busy(void)
+{
+	int node = sim_current_node();
+	radio_t *r = current_radio();
+
+	return r->tx_end_us > now_us() || is_receiving(node, r);
+}
+
+
+uint64_t sx127x_get_random(void)
+{
+	return sim_random();
+}
+
+
+void sx127x_get_last_pkt_stats(uint8_t *rssi, int8_t *snr)
+{
+	radio_t *r = current_radio();
+	*rssi = r->last_rssi;
+	*snr = r->last_snr;
+}
+
+
+uint32_t sx127x_get_time_on_air_us(uint8_t len)
+{
+	// Same calculation as in sx127x.c
+	const sx127x_rf_config_t *cfg = current_radio()->config;
+	const uint32_t sf = cfg->lora_spread_factor;
+	const uint32_t sl_us = ((1UL << sf) * 1000000) / LORA_BANDWIDTH_TABLE[cfg->lora_bandwidth];
+	const uint32_t de = (sl_us > LORA_LOW_DR_OPT_THRESHOLD_US) ? 1 : 0;
+
+	int32_t num = 8 * (int32_t)len - 4 * (int32_t)sf + 28;
+	uint32_t den = 4 * (sf - 2 * de);
+
+	uint32_t payload_symbols = 8;
+	if (num > 0)
+	{
+		payload_symbols += ((num + den - 1) / den) * (cfg->lora_coderate + 5);
+	}
+
+	return (49 * sl_us) / 4 + payload_symbols * sl_us;
+}
@@ -0,0 +1,51 @@
+/*
+ * Simulated radio medium for the mesh simulator.
+ * This implements the sx127x driver interface (sx127x.h) for all nodes, the node is selected by the running task.
+ *
+ * Only nodes with a link can hear each other. A packet is received if
+ * - the receiver did not send itself during the transmission (half duplex),
+ * - the receiver was tuned to the frequency of the packet for the whole transmission,
+ * - it was not hit by the link loss and
+ * - no other packet on the same frequency overlapped at the receiver,
+ *   unless the packet is at least SIM_RADIO_CAPTURE_DB stronger than all overlapping packets.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_RADIO_MAX_NODES 256
+#define SIM_RADIO_CAPTURE_DB 6
+
+typedef struct
+{
+	uint32_t tx_packets;
+	uint64_t airtime_us;
+
+	// Send attempts rejected because the modem was busy
+	uint32_t tx_busy;
+
+	uint32_t rx_packets;
+	uint32_t rx_collisions;
+	uint32_t rx_lost;
+	uint32_t rx_half_duplex;
+	uint32_t rx_wrong_channel;
+} sim_radio_stats_t;
+
+/*
+ * Adds a bidirectional link between two nodes.
+ * loss       Probability that a packet is lost (0 - 1)
+ * rssi_dbm   RSSI at the receiver
+ * snr_db     SNR at the receiver
+ */
+void sim_radio_add_link(int a, int b, double loss, int rssi_dbm, int snr_db);
+
+/*
+ * Random numbers for the whole simulation
+ */
+void sim_random_seed(uint64_t seed);
+uint64_t sim_random(void);
+double sim_random_double(void);
+
+void sim_radio_get_stats(int node, sim_radio_stats_t *stats);